@@ -0,0 +1,38 @@
+#ifndef _CHE_BASE_CPU_H_
+#define _CHE_BASE_CPU_H_
+
+#include "che_base_define.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define _CHE_X86_
+#endif
+
+// Lets a single function use instructions beyond the compiler's baseline, the caller
+// has to check the matching CPU_FEATURE_ bit first. MSVC needs no annotation.
+#if defined(__GNUC__) || defined(__clang__)
+#define CHE_TARGET_ATTRIBUTE(features) __attribute__((target(features)))
+#else
+#define CHE_TARGET_ATTRIBUTE(features)
+#endif
+
+namespace chepdf {
+
+#define CPU_FEATURE_SSE2		0x00000001
+#define CPU_FEATURE_SSSE3		0x00000002
+#define CPU_FEATURE_SSE41		0x00000004
+#define CPU_FEATURE_AVX2		0x00000008
+#define CPU_FEATURE_AESNI		0x00000010
+#define CPU_FEATURE_PCLMUL		0x00000020
+#define CPU_FEATURE_SHA			0x00000040
+
+// Features of the running processor, detected with CPUID on first use. Always 0 off x86.
+uint32_t GetCPUFeatures();
+
+inline bool IsCPUFeatureSupported(uint32_t features)
+{
+	return (GetCPUFeatures() & features) == features;
+}
+
+}//namespace
+
+#endif
@@ -26,4 +26,8 @@ typedef float			FLOAT;
 typedef double			DOUBLE;
 typedef uint32_t    	ARGB;
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define _CHE_SSE2_
+#endif
+
 #endif
@@ -4,11 +4,21 @@
 #include <cstdlib>
 #include <new>
 
+//builds that do not pass the platform define, the locks and the reference count depend on it
+#if defined(__linux__) && !defined(_LINUX_)
+#define _LINUX_
+#endif
+
 #ifdef _MAC_OS_X_
 #include <malloc/malloc.h>
 #include <pthread.h>
 #endif
 
+#ifdef _LINUX_
+#include <malloc.h>
+#include <pthread.h>
+#endif
+
 #ifdef _WIN32
 #include <malloc.h>
 #include <Windows.h>
@@ -211,6 +221,8 @@ public:
     virtual size_t ReadBlock(void * buffer, size_t offset, size_t size) = 0;
     virtual bool ReadByte(size_t offset, uint8_t & byte) = 0;
     virtual void Release() = 0;
+    // All GetSize bytes when the reader holds them in memory, so they can be scanned in place.
+    virtual const uint8_t * GetData() { return nullptr; }
 };
 
 class ReferenceCount
@@ -221,7 +233,8 @@ public:
     inline operator size_t() { return referenceCount_; }
 
     void Increase();
-    void Decrease();
+    // Returns the count left, so only one of several releasing threads sees zero.
+    size_t Decrease();
 
 private:
 #ifdef _MAC_OS_X_
@@ -246,7 +259,7 @@ private:
     HANDLE	mutex_;
 #endif
 
-#ifdef _MAC_OS_X_
+#if defined(_MAC_OS_X_) || defined(_LINUX_)
     pthread_mutex_t mutex_;
 #endif
 };
@@ -276,6 +289,8 @@ public:
     void Alloc( size_t size );
     
 private:
+    bool Reserve(size_t capacity);
+    
     size_t capacity_;
     size_t increament_;
     size_t size_;
@@ -1,29 +1,35 @@
 #ifndef _CHE_BASE_STRING_
 #define _CHE_BASE_STRING_
 
+#include <functional>
+
 #include "che_base_object.h"
 
 namespace chepdf {
 
 struct ByteStringData;
 
+//characters kept in the string object itself, longer strings go to a shared ByteStringData
+#define BYTESTRING_INLINE_SIZE	23
+#define BYTESTRING_LONG_TAG		0xFF
+
 class ByteString : public BaseObject
 {
 public:
-	ByteString(Allocator * allocator) : BaseObject(allocator), data_(nullptr) {}
+	ByteString(Allocator * allocator) : BaseObject(allocator) { SetInlineLength(0); }
 
-	ByteString() : BaseObject(nullptr)
-	{
-		Clear();
-	}
+	ByteString() : BaseObject(nullptr) { SetInlineLength(0); }
 
 	ByteString(char ch, Allocator * allocator = nullptr);
 	ByteString(const char * pstr, uint32_t length = 0, Allocator * allocator = nullptr);
 	ByteString(const ByteString& str);
+	ByteString(ByteString && str);
+	~ByteString() { Clear(); }
 
 	ByteString & operator=(char ch);
 	ByteString & operator=(const char * pstr);
 	ByteString & operator=(const ByteString& str);
+	ByteString & operator=(ByteString && str);
 
 	bool operator==(char ch) const;
 	bool operator==(char const * pstr) const;
@@ -47,6 +53,16 @@ public:
 	friend bool operator!=(char ch, ByteString & str);
 	friend bool operator!=(const char * pstr, ByteString & str);
 
+	// Byte order like memcmp, a string sorts before any longer string it starts.
+	int32_t Compare(const ByteString & str) const;
+	bool operator<(const ByteString & str) const { return Compare(str) < 0; }
+	bool operator<=(const ByteString & str) const { return Compare(str) <= 0; }
+	bool operator>(const ByteString & str) const { return Compare(str) > 0; }
+	bool operator>=(const ByteString & str) const { return Compare(str) >= 0; }
+
+	// FNV-1a of the bytes, cached in the shared data of long strings.
+	uint32_t GetHash() const;
+
 	char operator[](uint32_t index) const;
 
 	uint32_t GetLength() const;
@@ -54,13 +70,40 @@ public:
 	bool SetData(uint8_t * data, uint32_t length);
 	char const * GetData() const;
 
+	// Writable access for in-place edits. Unshares the data and makes room for capacity bytes
+	// keeping the current content, ReleaseBuffer then sets the final length.
+	uint8_t * GetBuffer(uint32_t capacity);
+	void ReleaseBuffer(uint32_t length);
+
 	int32_t GetInteger() const;
 	FLOAT GetFloat() const;
 
 	void Clear();
 
 private:
-	ByteStringData * data_;
+	bool IsLong() const { return (uint8_t)inline_[BYTESTRING_INLINE_SIZE] == BYTESTRING_LONG_TAG; }
+	//the tag byte holds the unused inline room, so a full inline string ends on its own terminator
+	void SetInlineLength(uint32_t length)
+	{
+		inline_[length] = '\0';
+		inline_[BYTESTRING_INLINE_SIZE] = (char)(BYTESTRING_INLINE_SIZE - length);
+	}
+	void SetLong(ByteStringData * data)
+	{
+		inline_[BYTESTRING_INLINE_SIZE] = (char)BYTESTRING_LONG_TAG;
+		data_ = data;
+	}
+
+	ByteStringData * NewData(uint32_t capacity);
+	void ReleaseData(ByteStringData * data);
+	void Assign(const char * pstr, uint32_t length);
+	void Append(const char * pstr, uint32_t length);
+
+	union
+	{
+		ByteStringData *	data_;
+		char				inline_[BYTESTRING_INLINE_SIZE + 1];
+	};
 };
 
 bool operator==(char ch, ByteString & str);
@@ -80,18 +123,18 @@ class WideString : public BaseObject
 public:
 	WideString(Allocator * allocator) : BaseObject(allocator), data_(nullptr) {}
 
-	WideString() : BaseObject(nullptr)
-	{
-		Clear();
-	}
+	WideString() : BaseObject(nullptr), data_(nullptr) {}
 
 	WideString(wchar_t wch, Allocator * allocator = nullptr);
 	WideString(const wchar_t * pstr, uint32_t nStrSize = 0, Allocator * allocator = nullptr);
 	WideString(const WideString & str);
+	WideString(WideString && str);
+	~WideString() { Clear(); }
 
 	WideString & operator=(wchar_t wch);
 	WideString & operator=(const wchar_t * pstr);
 	WideString & operator=(const WideString & str);
+	WideString & operator=(WideString && str);
 
 	bool operator==(wchar_t wch) const;
 	bool operator==(const wchar_t * pstr) const;
@@ -122,12 +165,21 @@ public:
 	bool SetData(wchar_t * pData, uint32_t length);
 	wchar_t const *  GetData() const;
 
+	// Same contract as ByteString::GetBuffer, capacity counts characters.
+	wchar_t * GetBuffer(uint32_t capacity);
+	void ReleaseBuffer(uint32_t length);
+
 	int32_t GetInteger() const;
 	FLOAT GetFloat() const;
 
 	void Clear();
 
 private:
+	WideStringData * NewData(uint32_t capacity);
+	void ReleaseData(WideStringData * data);
+	void Assign(const wchar_t * pstr, uint32_t length);
+	void Append(const wchar_t * pstr, uint32_t length);
+
 	WideStringData * data_;
 };
 
@@ -147,6 +199,71 @@ bool operator!=(const wchar_t *  lstr, WideString & str);
 
 uint32_t StringToUINT32(const ByteString & str);
 
+// Parses a PDF number, an optional sign then digits with at most one '.', without the C locale.
+// Leading white space is skipped and parsing stops at the first byte that does not belong to the
+// number. Returns the bytes used, 0 if there is no number. bIntegerRet is set when the number has
+// no '.' and fits integerRet, otherwise integerRet holds the value truncated toward zero.
+uint32_t ParsePdfNumber(const char * data, uint32_t length, int32_t & integerRet, FLOAT & floatRet, bool & bIntegerRet);
+
+struct StringBuilderChunk;
+
+//first chunk size, later chunks double up to the maximum
+#define STRINGBUILDER_CHUNK_SIZE		256
+#define STRINGBUILDER_CHUNK_MAX_SIZE	65536
+
+// Builds long output from many small pieces. Pieces go into a chain of chunks taken from the
+// allocator, so nothing written is ever moved, and the whole chain is written out by Flush or
+// joined once by GetString.
+class StringBuilder : public BaseObject
+{
+public:
+	StringBuilder(Allocator * allocator = nullptr);
+	~StringBuilder();
+
+	StringBuilder & Append(const char * data, size_t size);
+	StringBuilder & Append(const char * str);
+	StringBuilder & Append(const ByteString & str);
+	StringBuilder & Append(char ch);
+	StringBuilder & AppendInteger(int64_t value);
+	// Fixed point with up to 5 decimals and no exponent, as a PDF real.
+	StringBuilder & AppendFloat(FLOAT value);
+
+	StringBuilder & operator<<(const char * str) { return Append(str); }
+	StringBuilder & operator<<(const ByteString & str) { return Append(str); }
+	StringBuilder & operator<<(char ch) { return Append(ch); }
+	StringBuilder & operator<<(int32_t value) { return AppendInteger(value); }
+	StringBuilder & operator<<(uint32_t value) { return AppendInteger(value); }
+	StringBuilder & operator<<(int64_t value) { return AppendInteger(value); }
+	StringBuilder & operator<<(FLOAT value) { return AppendFloat(value); }
+
+	size_t GetSize() const { return size_; }
+	ByteString GetString() const;
+
+	// Writes everything to pWrite and clears the builder, false if a write failed.
+	bool Flush(IWrite * pWrite);
+	// Keeps the first chunk for reuse.
+	void Clear();
+
+private:
+	StringBuilder(const StringBuilder &);
+	StringBuilder & operator=(const StringBuilder &);
+
+	bool NewChunk(size_t size);
+
+	StringBuilderChunk * head_;
+	StringBuilderChunk * tail_;
+	size_t size_;
+};
+
+}//namespace
+
+// Lets ByteString key std::unordered_map directly.
+namespace std {
+template <>
+struct hash<chepdf::ByteString>
+{
+	size_t operator()(const chepdf::ByteString & str) const { return str.GetHash(); }
+};
 }//namespace
 
 #endif
@@ -39,9 +39,12 @@ protected:
     uint32_t    rounds_;
 	uint8_t     init_vector_[MAX_IV_SIZE];
 	uint8_t     expanded_key_[_MAX_ROUNDS+1][4][4];
+	bool        b_aesni_;
 
 public:
 	int32_t init(Mode mode, Direction dir, const uint8_t * key, KeyLength keyLen, uint8_t * initVector = 0);
+	// Replaces the IV and keeps the key schedule, cheaper than a second init with the same key.
+	void setInitVector(const uint8_t * initVector);
 	int32_t blockEncrypt(const uint8_t * input, int32_t inputLen, uint8_t * outBuffer);
 	int32_t padEncrypt(const uint8_t * input, int32_t inputOctets, uint8_t * outBuffer);
 	int32_t blockDecrypt(const uint8_t * input, int32_t inputLen, uint8_t * outBuffer);
@@ -5,10 +5,23 @@
 
 namespace chepdf {
 
+// Init runs the key schedule once, copies of an initialised object restart the same keystream.
+// The state is kept in 32 bit cells, byte cells stall on store forwarding in the keystream loop.
 class CryptoRC4
 {
 public:
+	void Init(const uint8_t * const key, uint32_t keyLength);
+	// Continues the keystream where the last call stopped, data may be dataRet.
+	void Process(const uint8_t * data, size_t dataLength, uint8_t * dataRet);
+	// Discards keystream bytes, as if length bytes had been processed.
+	void Skip(size_t length);
+
 	static void Encrypt(const uint8_t * const key, uint32_t keyLength, uint8_t * data, uint32_t dataLength, uint8_t * dataRet);
+
+private:
+	uint32_t    state_[256];
+	uint8_t     x_;
+	uint8_t     y_;
 };
     
 }//namespace
@@ -22,6 +22,26 @@ private:
     uint8_t		in_[64];
 };
 
+#define MD5_MULTI_MAX_LANES	8
+
+// Hashes independent messages side by side: 8 lanes with AVX2, 4 with SSE2, one by one
+// otherwise. Messages can differ in length, shorter lanes sit idle while longer ones finish.
+class HashMD5Multi
+{
+public:
+    HashMD5Multi();
+
+    uint32_t GetLaneCount() const { return lanes_; }
+
+    // digests[i] = MD5(bufs[i], lens[i]). bufs[i] may point at digests[i] for iterated hashing.
+    void Hash(const uint8_t * const * bufs, const uint32_t * lens, uint32_t count, uint8_t (*digests)[16]);
+
+private:
+    void HashGroup(const uint8_t * const * bufs, const uint32_t * lens, uint32_t count, uint8_t (*digests)[16]);
+
+    uint32_t    lanes_;
+};
+
 }//namespace
 
 #endif
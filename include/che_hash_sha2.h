@@ -0,0 +1,58 @@
+#ifndef _CHE_HASH_SHA2_H_
+#define _CHE_HASH_SHA2_H_
+
+#include <cstddef>
+
+#include "che_base_define.h"
+
+namespace chepdf {
+
+class HashSHA256
+{
+public:
+    HashSHA256();
+
+    void Init();
+    void Update(const uint8_t * buf, size_t len);
+    void Final(uint8_t digest[32]);
+
+private:
+    void Transform(const uint8_t * blocks, size_t count);
+
+    uint32_t    state_[8];
+    uint64_t    length_;
+    uint8_t     in_[64];
+    bool        b_shani_;
+};
+
+class HashSHA512
+{
+public:
+    HashSHA512();
+
+    void Init();
+    void Update(const uint8_t * buf, size_t len);
+    void Final(uint8_t digest[64]);
+
+protected:
+    void Transform(const uint8_t * blocks, size_t count);
+    void Pad();
+
+    uint64_t    state_[8];
+    uint64_t    length_;
+    uint8_t     in_[128];
+};
+
+// SHA-384 is SHA-512 with its own initial state, truncated to 48 bytes.
+class HashSHA384 : public HashSHA512
+{
+public:
+    HashSHA384();
+
+    void Init();
+    void Final(uint8_t digest[48]);
+};
+
+}//namespace
+
+#endif
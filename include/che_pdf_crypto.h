@@ -2,6 +2,8 @@
 #define _CHE_PDF_CRYPTO_H_
 
 #include "che_base_string.h"
+#include "che_crypto_aes.h"
+#include "che_crypto_rc4.h"
 
 namespace chepdf {
 
@@ -22,6 +24,12 @@ namespace chepdf {
 
 #define CRYPTO_ALGORITHM_RC4	1
 #define CRYPTO_ALGORITHM_AESV2	2
+#define CRYPTO_ALGORITHM_AESV3	3
+
+#define CRYPTO_OBJKEY_CACHE_SIZE	64
+
+class PdfObjectPointer;
+class PdfStreamPointer;
 
 class PdfCrypto : public BaseObject
 {
@@ -32,34 +40,106 @@ public:
 
 	PdfCrypto(const ByteString id, uint8_t algorithm, uint8_t version, uint8_t revision,
               uint8_t key_length, bool b_meta_data, uint32_t p, Allocator * allocator = nullptr);
+
+	// Standard security handler V5 (AESV3, revision 5 or 6), the key is always 256 bits.
+	PdfCrypto(const ByteString id, uint8_t o[48], uint8_t u[48], uint8_t oe[32], uint8_t ue[32], uint8_t perms[16],
+              uint8_t revision, bool b_meta_data, uint32_t p, Allocator * allocator = nullptr);
     
-    virtual ~PdfCrypto() {}
+    virtual ~PdfCrypto();
 
 	void Init(const ByteString userPassword, const ByteString ownerPassword);
 
 	bool Authenticate(const ByteString & password);
 
+	// Tries the candidates as user and owner passwords without touching the crypto state and
+	// returns the index of the first one that opens the file, or -1. threadCount 0 uses all cores.
+	int32_t AuthenticateBatch(const ByteString * passwords, uint32_t count, uint32_t threadCount = 0) const;
+
 	bool IsPasswordOK() { return b_password_ok_; }
 
 	uint32_t Encrypt(ByteString & str, uint32_t objNum, uint32_t genNum);
 	uint32_t Encrypt(uint8_t * pData, uint32_t length, uint32_t objNum, uint32_t genNum);
-	uint32_t Encrypt(ByteString & str, uint8_t objKey[16], uint32_t objKeyLen);
-	uint32_t Encrypt(uint8_t * pData, uint32_t length, uint8_t objKey[16], uint32_t objKeyLen);
+	uint32_t Encrypt(ByteString & str, uint8_t objKey[32], uint32_t objKeyLen);
+	// AES output is IV + padded data, pData must have room for length + 32 bytes.
+	uint32_t Encrypt(uint8_t * pData, uint32_t length, uint8_t objKey[32], uint32_t objKeyLen);
 	uint32_t Decrypt(ByteString & str, uint32_t objNum, uint32_t genNum);
 	uint32_t Decrypt(uint8_t * pData, uint32_t length, uint32_t objNum, uint32_t genNum);
-	uint32_t Decrypt(ByteString & str, uint8_t objKey[16], uint32_t objKeyLen);
-	uint32_t Decrypt(uint8_t * pData, uint32_t length, uint8_t objKey[16], uint32_t objKeyLen);
+	uint32_t Decrypt(ByteString & str, uint8_t objKey[32], uint32_t objKeyLen);
+	uint32_t Decrypt(uint8_t * pData, uint32_t length, uint8_t objKey[32], uint32_t objKeyLen);
+
+	// Encrypts the strings and stream data of indirect objects in place, objNums and genNums give
+	// the key of each object. The objects must not share direct children. Memory streams that are
+	// not encrypted yet keep this crypto for GetRawData, streams under another crypto are decrypted
+	// with it first. False when any string or stream could not be encrypted, or when a stream is
+	// under a crypto whose password was not verified. threadCount 0 uses all cores.
+	bool EncryptObjects(const PdfObjectPointer * objects, const uint32_t * objNums, const uint32_t * genNums,
+	                    uint32_t count, uint32_t threadCount = 0);
+
+	size_t GetObjKeyCacheHits() const;
+	size_t GetObjKeyCacheMisses() const;
+	void ClearObjKeyCache();
 
 private:
-	void ComputeEncryptionKey(uint8_t userPad[32], uint8_t encryptionKeyRet[16]);
-	void ComputeOwnerKey(uint8_t userPad[32], uint8_t ownerPad[32], uint8_t ownerKeyRet[32], bool bAuth = false);
-	void ComputeUserKey(uint8_t encryptionKey[16], uint8_t userKeyRet[32]);
-	void CreateObjKey(uint32_t objNum, uint32_t genNum, uint8_t objkey[16], uint32_t * pObjKeyLengthRet);
-	void PadPassword(const ByteString & password, uint8_t pswd[32]);
-	void RC4(uint8_t * key, uint32_t keyLength, uint8_t * data, uint32_t dataLength, uint8_t * dataRet);
-	
-	uint32_t AESEncrypt(uint8_t * key, uint32_t keyLength, uint8_t * data, uint32_t dataLength, uint8_t * dataRet);
-	uint32_t AESDecrypt(uint8_t * key, uint32_t keyLength, uint8_t * data, uint32_t dataLength, uint8_t * dataRet);
+	friend class PdfDecryptContext;
+
+	// Object key plus the RC4 state or AES schedule built from it, ready for one direction.
+	struct ObjCipher
+	{
+		uint8_t         key[32];
+		uint32_t        key_length;
+		CryptoRC4       rc4;
+		CryptoRijndael  aes;
+	};
+
+	// Schedules are built on first use in each direction.
+	struct ObjKeyCacheEntry
+	{
+		bool            b_valid;
+		bool            b_encrypt_ready;
+		bool            b_decrypt_ready;
+		uint32_t        obj_num;
+		uint32_t        gen_num;
+		uint32_t        key_length;
+		uint8_t         key[16];
+		CryptoRC4       rc4;
+		CryptoRijndael  aes_encrypt;
+		CryptoRijndael  aes_decrypt;
+	};
+
+	void ComputeEncryptionKey(const uint8_t userPad[32], uint8_t encryptionKeyRet[16]) const;
+	void ComputeOwnerKey(const uint8_t userPad[32], const uint8_t ownerPad[32], uint8_t ownerKeyRet[32], bool bAuth = false) const;
+	void ComputeUserKey(const uint8_t encryptionKey[16], uint8_t userKeyRet[32]) const;
+	void ComputeUserKey(const uint8_t encryptionKey[16], const uint8_t idDigest[16], uint8_t userKeyRet[32]) const;
+	void ComputeUserKeyDigest(uint8_t digestRet[16]) const;
+	bool CheckUserKey(const uint8_t userKey[32]) const;
+	void CreateObjKey(uint32_t objNum, uint32_t genNum, uint8_t objkey[32], uint32_t * pObjKeyLengthRet) const;
+	// Same keys as CreateObjKey, with the MD5s of several objects computed side by side.
+	void CreateObjKeys(const uint32_t * objNums, const uint32_t * genNums, uint32_t count, uint8_t (*objKeys)[32], uint32_t * pObjKeyLengthRet) const;
+	void PadPassword(const ByteString & password, uint8_t pswd[32]) const;
+	void RC4(const uint8_t * key, uint32_t keyLength, const uint8_t * data, uint32_t dataLength, uint8_t * dataRet) const;
+
+	// Batch forms of the key computations above, the MD5s run on HashMD5Multi.
+	void ComputeEncryptionKeys(const uint8_t (*userPads)[32], uint32_t count, uint8_t (*encryptionKeysRet)[16]) const;
+	void ComputeOwnerRC4Keys(const uint8_t (*ownerPads)[32], uint32_t count, uint8_t (*keysRet)[16]) const;
+	int32_t AuthenticateChunk(const ByteString * passwords, uint32_t count) const;
+
+	void InitV5(const ByteString & userPassword, const ByteString & ownerPassword);
+	bool AuthenticateV5(const ByteString & password);
+	bool ComputeFileKeyV5(const ByteString & password, uint8_t keyRet[32]) const;
+	void ComputeHashV5(const uint8_t * password, uint32_t length, const uint8_t salt[8], const uint8_t * udata, uint8_t hashRet[32]) const;
+	void PrepareFileKeyAES();
+
+	void PrepareObjCipher(uint32_t objNum, uint32_t genNum, bool bEncrypt, ObjCipher & cipher);
+	void PrepareObjCipher(uint8_t objKey[32], uint32_t objKeyLen, bool bEncrypt, ObjCipher & cipher);
+	uint32_t EncryptData(ObjCipher & cipher, uint8_t * pData, uint32_t length);
+	uint32_t DecryptData(ObjCipher & cipher, uint8_t * pData, uint32_t length);
+	uint32_t EncryptString(ObjCipher & cipher, ByteString & str);
+	uint32_t DecryptString(ObjCipher & cipher, ByteString & str);
+	bool EncryptObject(const PdfObjectPointer & object, const ObjCipher & cipher);
+	bool EncryptStream(const PdfStreamPointer & stream, const ObjCipher & cipher);
+
+	uint32_t AESEncrypt(CryptoRijndael & aes, uint8_t * data, uint32_t dataLength, uint8_t * dataRet);
+	uint32_t AESDecrypt(CryptoRijndael & aes, uint8_t * data, uint32_t dataLength, uint8_t * dataRet);
 
 private:
     bool            b_password_ok_;
@@ -69,10 +149,52 @@ private:
 	uint8_t         revision_;
 	uint8_t         key_length_;
 	uint32_t        p_;
-	uint8_t         o_[32];
-	uint8_t         u_[32];
-	uint8_t         encryption_key_[16];
+	uint8_t         o_[48];
+	uint8_t         u_[48];
+	uint8_t         oe_[32];
+	uint8_t         ue_[32];
+	uint8_t         perms_[16];
+	uint8_t         encryption_key_[32];
     ByteString      id_;
+	// V5 uses the file key for every object, so the key schedules are built once.
+	CryptoRijndael  aes_encrypt_;
+	CryptoRijndael  aes_decrypt_;
+	// Direct mapped on the object number, guarded by obj_key_cache_lock_.
+	ObjKeyCacheEntry *  obj_key_cache_;
+	size_t              obj_key_cache_hits_;
+	size_t              obj_key_cache_misses_;
+	mutable MutexLock   obj_key_cache_lock_;
+};
+
+// Decrypts one stream fed in sequential chunks, keeping the RC4 keystream position and the
+// AES-CBC chaining between calls.
+class PdfDecryptContext : public BaseObject
+{
+public:
+	PdfDecryptContext(PdfCrypto * crypto, uint32_t objNum, uint32_t genNum, Allocator * allocator = nullptr);
+
+	// Restarts at a plain text offset and returns the offset of the encrypted data the next
+	// Update has to start from. RC4 skips keystream, AES restarts from the previous block.
+	size_t Seek(size_t offset);
+	// dataRet needs room for length + 16 bytes and must not overlap data for AES, the last
+	// decrypted block is held back until Final because it carries the padding.
+	uint32_t Update(const uint8_t * data, uint32_t length, uint8_t * dataRet);
+	// Returns the held back block without padding, dataRet needs room for 16 bytes.
+	uint32_t Final(uint8_t * dataRet);
+
+private:
+	uint32_t FlushHeld(uint8_t * dataRet, uint32_t length);
+
+	uint8_t         algorithm_;
+	CryptoRC4       rc4_;
+	CryptoRC4       rc4_start_;
+	CryptoRijndael  aes_;
+	uint8_t         block_[16];
+	uint32_t        block_length_;
+	bool            b_iv_ready_;
+	uint8_t         held_[16];
+	bool            b_held_;
+	uint32_t        discard_;
 };
     
 }//namespace
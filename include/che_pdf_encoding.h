@@ -0,0 +1,40 @@
+#ifndef _CHE_PDF_ENCODING_H_
+#define _CHE_PDF_ENCODING_H_
+
+#include "che_base_string.h"
+
+namespace chepdf {
+
+// Text string encodings (PDF 32000-2 7.9.2.2). The span converters return the number of
+// characters or bytes written and never write more than the bound given for dst; they do not
+// look for a byte order mark. wchar_t holds UTF-32 where it is 32 bits wide and UTF-16 otherwise.
+// Code units that cannot be decoded become U+FFFD.
+
+// dst holds size characters.
+uint32_t PDFDocEncodingToWide(const uint8_t * src, uint32_t size, wchar_t * dst);
+// dst holds size / 2 characters. Language escapes (U+001B ... U+001B) are dropped.
+uint32_t UTF16BEToWide(const uint8_t * src, uint32_t size, wchar_t * dst);
+// dst holds size characters.
+uint32_t UTF8ToWide(const uint8_t * src, uint32_t size, wchar_t * dst);
+
+// dst holds length * 4 bytes.
+uint32_t WideToUTF16BE(const wchar_t * src, uint32_t length, uint8_t * dst);
+// dst holds length * 4 bytes.
+uint32_t WideToUTF8(const wchar_t * src, uint32_t length, uint8_t * dst);
+// dst holds length bytes. False if some character has no PDFDocEncoding code, dst is then
+// only partly written.
+bool WideToPDFDocEncoding(const wchar_t * src, uint32_t length, uint8_t * dst);
+
+// Decodes a text string, UTF-16BE or UTF-8 when it starts with their byte order mark and
+// PDFDocEncoding otherwise.
+bool PdfStringToWideString(const ByteString & str, WideString & strRet);
+// Encodes a text string, PDFDocEncoding when every character has a code and UTF-16BE with
+// a byte order mark otherwise.
+bool WideStringToPdfString(const WideString & str, ByteString & strRet);
+
+bool UTF8ToWideString(const ByteString & str, WideString & strRet);
+bool WideStringToUTF8(const WideString & str, ByteString & strRet);
+
+}//namespace
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef _CHE_PDF_FILE_H_
+#define _CHE_PDF_FILE_H_
+
+#include "che_pdf_object.h"
+#include "che_pdf_parser.h"
+
+namespace chepdf {
+
+enum PDF_XREF_ENTRY_TYPE
+{
+    XREF_ENTRY_NONE         = 0x00,
+    XREF_ENTRY_FREE         = 0x01,
+    XREF_ENTRY_COMMON       = 0x02,
+    XREF_ENTRY_COMPRESSED   = 0x03
+};
+
+// One cross-reference entry in 12 bytes. Common entries hold a 40 bit file offset in offset_high
+// and offset, compressed entries the number of their object stream in offset and their index in
+// that stream in index.
+struct PdfXRefEntry
+{
+    uint8_t     type;
+    uint8_t     offset_high;
+    uint16_t    generate_number;
+    uint32_t    offset;
+    uint32_t    index;
+
+    size_t GetOffset() const { return (size_t)(((uint64_t)offset_high << 32) | offset); }
+    void SetOffset(uint64_t value) { offset_high = (uint8_t)(value >> 32); offset = (uint32_t)value; }
+};
+
+// Largest object number a file may use (PDF 32000-1 C.2), the index never grows past it.
+#define PDF_XREF_MAX_OBJECT_NUMBER  8388607
+
+// Entries of every object number in one array, so a lookup is a bounds check and an index.
+class PdfXRefTable : public BaseObject
+{
+public:
+    PdfXRefTable(Allocator * allocator = nullptr);
+    ~PdfXRefTable();
+
+    // Number of object numbers covered, one past the largest one added.
+    uint32_t GetCount() const { return count_; }
+
+    bool Reserve(uint32_t count);
+    // Keeps an entry already there, sections are read from the newest to the oldest.
+    bool Add(uint32_t objNum, const PdfXRefEntry & entry);
+    const PdfXRefEntry * Get(uint32_t objNum) const
+    {
+        return (objNum < count_ && entries_[objNum].type != XREF_ENTRY_NONE) ? &entries_[objNum] : nullptr;
+    }
+    void Clear();
+
+private:
+    PdfXRefTable(const PdfXRefTable &);
+    PdfXRefTable & operator=(const PdfXRefTable &);
+
+    PdfXRefEntry *  entries_;
+    uint32_t        count_;
+    uint32_t        capacity_;
+};
+
+// Shards of the object cache, each with its own lock and its share of the byte budget.
+#define PDF_OBJECT_CACHE_SHARD_COUNT        16
+#define PDF_OBJECT_CACHE_DEFAULT_BUDGET     (32 * 1024 * 1024)
+
+// Parsed objects of a file by object number. Entries are spread over shards that lock on their own,
+// so threads resolving different objects rarely wait for each other. Past its share of the budget
+// a shard drops its least recently used entries that nothing outside the cache holds, not even a
+// part of them, and that were not modified. It does so on every add and, a few entries at a time,
+// on every lookup that finds its object, so entries released later go as well. A dropped object
+// is parsed again the next time it is asked for.
+class PdfObjectCache : public BaseObject
+{
+public:
+    PdfObjectCache(size_t budget = PDF_OBJECT_CACHE_DEFAULT_BUDGET, Allocator * allocator = nullptr);
+    ~PdfObjectCache();
+
+    // Bytes the cache may hold, as PdfObject::GetMemorySize counts them. Entries still in use can
+    // take it over the budget until they are released.
+    void SetBudget(size_t budget);
+    size_t GetBudget() const { return budget_; }
+
+    bool Find(uint32_t key, uint32_t genNum, PdfObjectPointer & objectRet);
+    // Returns the object cached for key, which is object unless another thread added one first.
+    PdfObjectPointer Add(uint32_t key, uint32_t genNum, const PdfObjectPointer & object);
+    void Remove(uint32_t key);
+    // Drops every entry that can be dropped, whatever the budget.
+    void Purge();
+    void Clear();
+
+    size_t GetSize();
+    size_t GetCount();
+    size_t GetHits();
+    size_t GetMisses();
+
+private:
+    PdfObjectCache(const PdfObjectCache &);
+    PdfObjectCache & operator=(const PdfObjectCache &);
+
+    // Shards keep their entries in a list from the most to the least recently used.
+    struct Entry
+    {
+        PdfObjectPointer    object;
+        uint32_t            key;
+        uint32_t            generate_number;
+        size_t              size;
+        Entry *             prev;
+        Entry *             next;
+    };
+
+    struct Shard
+    {
+        Shard() : head(nullptr), tail(nullptr), size(0), hits(0), misses(0) {}
+
+        MutexLock                           lock;
+        std::unordered_map<uint32_t, Entry> entries;
+        Entry *                             head;
+        Entry *                             tail;
+        size_t                              size;
+        size_t                              hits;
+        size_t                              misses;
+    };
+
+    Shard & GetShard(uint32_t key) { return shards_[key % PDF_OBJECT_CACHE_SHARD_COUNT]; }
+    static void Unlink(Shard & shard, Entry * entry);
+    static void PushFront(Shard & shard, Entry * entry);
+    // Drops entries from the tail until the shard fits in budget, visiting at most maxVisits of them.
+    // Entries in use are skipped and move to the front, so the next walk does not meet them first again.
+    static void Trim(Shard & shard, size_t budget, size_t maxVisits = SIZE_MAX);
+
+    size_t  budget_;
+    Shard   shards_[PDF_OBJECT_CACHE_SHARD_COUNT];
+};
+
+// A document read through its cross-reference sections. References parsed from the file resolve
+// through GetObject, which goes straight from the object number to the offset of the object or to
+// its place in an object stream.
+class PdfFile : public BaseObject
+{
+public:
+    PdfFile(Allocator * allocator = nullptr);
+    ~PdfFile();
+
+    // Reads the sections from startxref along the /Prev chain, classic tables, cross-reference
+    // streams and hybrid files alike. The reader stays owned by the caller and must outlive the file.
+    bool Open(IRead * iread);
+    void Close();
+
+    IRead * GetIRead() const { return iread_; }
+    // Trailer of the newest section, the stream dictionary when that section is a stream.
+    PdfDictionaryPointer GetTrailer() const { return trailer_; }
+    const PdfXRefTable & GetXRefTable() const { return xref_; }
+
+    // Strings and streams of objects parsed afterwards are decrypted with crypto, all but the
+    // encryption dictionary itself.
+    void SetCrypto(PdfCrypto * crypto) { crypto_ = crypto; }
+    PdfCrypto * GetCrypto() const { return crypto_; }
+
+    // Objects are parsed the first time they are asked for and then served from the cache until
+    // it drops them. Null when the entry is missing, free or of another generation.
+    PdfObjectPointer GetObject(uint32_t objNum, uint32_t genNum = 0);
+
+    PdfObjectCache & GetObjectCache() { return cache_; }
+
+private:
+    PdfFile(const PdfFile &);
+    PdfFile & operator=(const PdfFile &);
+
+    bool FindStartXRef(PdfLexer & lexer, size_t & offsetRet);
+    // Reads the table after the xref keyword into entriesRet and the dictionary after trailer.
+    bool ParseXRefTable(PdfParser & parser, std::vector<std::pair<uint32_t, PdfXRefEntry> > & entriesRet,
+                        PdfDictionaryPointer & trailerRet);
+    // Hybrid files list objects of object streams as free in their table, bSkipFree keeps the
+    // stream from hiding the common entries of that table.
+    bool ParseXRefStream(PdfParser & parser, size_t offset, bool bSkipFree, PdfDictionaryPointer & dictionaryRet);
+    // Null when objNum is already being parsed on this thread, as when a stream /Length refers to
+    // the stream itself or an object stream keeps its /Length inside.
+    PdfObjectPointer ParseObject(const PdfXRefEntry & entry, uint32_t objNum, uint32_t genNum);
+    PdfObjectPointer ParseObjectAt(const PdfXRefEntry & entry, uint32_t objNum, uint32_t genNum);
+    PdfObjectPointer GetCompressedObject(const PdfXRefEntry & entry, uint32_t objNum);
+    // The decoded data of object stream objNum, kept in the cache as a memory stream in place of
+    // the stream as parsed.
+    PdfStreamPointer GetObjectStream(const PdfXRefEntry & entry, uint32_t objNum);
+
+    IRead *                 iread_;
+    PdfCrypto *             crypto_;
+    uint32_t                encrypt_object_number_;
+    PdfDictionaryPointer    trailer_;
+    PdfXRefTable            xref_;
+    PdfObjectCache          cache_;
+};
+
+}//namespace
+
+#endif
@@ -3,8 +3,18 @@
 
 #include "che_pdf_object.h"
 
+struct _Jbig2GlobalCtx;
+
 namespace chepdf {
 
+// Output of the bilevel decoders (CCITTFax and JBIG2Decode).
+enum PDF_BILEVEL_OUTPUT
+{
+	BILEVEL_OUTPUT_PACKED			= 0x00,	// 1 bpp, polarity as PDF specifies it (the default)
+	BILEVEL_OUTPUT_PACKED_NATIVE	= 0x01,	// 1 bpp straight from the decoder, 1 is black
+	BILEVEL_OUTPUT_GRAY8			= 0x02	// 8 bpp, 0x00 black and 0xFF white
+};
+
 class PdfFilter : public BaseObject
 {
 public:
@@ -65,28 +75,32 @@ public:
 	{
 		if (dictionary)
 		{
-			PdfObjectPointer object = dictionary->GetElement( "Predictor" );
-			if (object && object->GetType() == OBJ_TYPE_NUMBER )
+			PdfObjectPointer object = dictionary->GetElement( NAME_Predictor, OBJ_TYPE_NUMBER );
+			if (object && object->GetPdfNumber()->GetInteger() > 0)
 			{	
 				predictor_ = object->GetPdfNumber()->GetInteger();
 			}
-			object = dictionary->GetElement( "colors_" );
-			if (object && object->GetType() == OBJ_TYPE_NUMBER )
+			object = dictionary->GetElement( NAME_Colors, OBJ_TYPE_NUMBER );
+			if (object && object->GetPdfNumber()->GetInteger() > 0 && object->GetPdfNumber()->GetInteger() <= 32)
 			{
 				colors_ = object->GetPdfNumber()->GetInteger();
 			}
-			object = dictionary->GetElement( "BitsPerComponent" );
-			if (object && object->GetType() == OBJ_TYPE_NUMBER )
+			object = dictionary->GetElement( NAME_BitsPerComponent, OBJ_TYPE_NUMBER );
+			if (object)
 			{
-				bpc_ = object->GetPdfNumber()->GetInteger();
+				int32_t bpc = object->GetPdfNumber()->GetInteger();
+				if (bpc == 1 || bpc == 2 || bpc == 4 || bpc == 8 || bpc == 16)
+				{
+					bpc_ = bpc;
+				}
 			}
-			object = dictionary->GetElement( "columns_" );
-			if (object && object->GetType() == OBJ_TYPE_NUMBER )
+			object = dictionary->GetElement( NAME_Columns, OBJ_TYPE_NUMBER );
+			if (object && object->GetPdfNumber()->GetInteger() > 0 && object->GetPdfNumber()->GetInteger() <= 0xFFFFFF)
 			{
 				columns_ = object->GetPdfNumber()->GetInteger();
 			}
-			object = dictionary->GetElement( "early_change_" );
-			if (object && object->GetType() == OBJ_TYPE_NUMBER )
+			object = dictionary->GetElement( NAME_EarlyChange, OBJ_TYPE_NUMBER );
+			if (object)
 			{
 				early_change_ = object->GetPdfNumber()->GetInteger();
 			}
@@ -250,9 +264,16 @@ public:
 		{
 			return;
 		}
+		if (predictor_ == 1 || stride_ == 0)
+		{
+			buffer.Write(data, size);
+			return;
+		}
+		//a last row cut short is dropped
+		size_t row = (predictor_ >= 10) ? stride_ + 1 : stride_;
 		uint8_t * p	 = data;
 		uint8_t * ep = data + size;
-		while (p < ep)
+		while ((size_t)(ep - p) >= row)
 		{
 			if (predictor_ == 1)
 			{
@@ -381,11 +402,14 @@ public:
 	PdfFaxFilter(PdfFaxDecodeParams * params = nullptr, Allocator * allocator = nullptr);
 	~PdfFaxFilter();
 
+	void SetOutputFormat(PDF_BILEVEL_OUTPUT format) { output_format_ = format; }
+
     void Encode(uint8_t * data, size_t size, Buffer & buffer);
     void Decode(uint8_t * data, size_t size, Buffer & buffer);
 
 private:
 	PdfFaxDecodeParams * params_;
+	PDF_BILEVEL_OUTPUT	output_format_;
 };
 
 class PdfDCTDFilter : public PdfFilter
@@ -404,9 +428,73 @@ class PdfJPXFilter : public PdfFilter
 public:
     PdfJPXFilter(Allocator * allocator = nullptr);
     ~PdfJPXFilter();
+
+    // Discard the highest resolution levels, each one halves width and height.
+    void SetReduce(uint32_t reduce) { reduce_ = reduce; }
+    // Decode only the given region, in full resolution reference grid coordinates.
+    void SetDecodeArea(int32_t x0, int32_t y0, int32_t x1, int32_t y1);
+    // 0 uses every available core, 1 decodes on the calling thread only.
+    void SetThreadCount(uint32_t count) { thread_count_ = count; }
     
     void Encode(uint8_t * data, size_t size, Buffer & buffer);
     void Decode(uint8_t * data, size_t size, Buffer & buffer);
+
+private:
+    uint32_t    reduce_;
+    uint32_t    thread_count_;
+    bool        b_decode_area_;
+    int32_t     area_x0_;
+    int32_t     area_y0_;
+    int32_t     area_x1_;
+    int32_t     area_y1_;
+};
+
+class PdfJBig2GlobalsCache : public BaseObject
+{
+public:
+	PdfJBig2GlobalsCache(Allocator * allocator = nullptr);
+	~PdfJBig2GlobalsCache();
+
+	// Returns the parsed globals of stream obj_num gen_num in the document owner, usually its
+	// PdfFile, parsing data on first use. Every non-null result must be handed back with Release().
+	_Jbig2GlobalCtx * Acquire(const void * owner, uint32_t obj_num, uint32_t gen_num, uint8_t * data, size_t size);
+	void Release(const void * owner, uint32_t obj_num, uint32_t gen_num);
+
+	// Frees every context that no filter is currently using.
+	void Purge();
+	// Same for the contexts of one document, before it closes and its address can be reused.
+	void Purge(const void * owner);
+	size_t GetCount();
+
+private:
+	struct Key
+	{
+		const void *	owner;
+		uint32_t		obj_num;
+		uint32_t		gen_num;
+
+		bool operator==(const Key & key) const
+		{
+			return owner == key.owner && obj_num == key.obj_num && gen_num == key.gen_num;
+		}
+	};
+
+	struct KeyHash
+	{
+		size_t operator()(const Key & key) const
+		{
+			return std::hash<const void *>()(key.owner) ^ ((size_t)key.obj_num * 31 + key.gen_num);
+		}
+	};
+
+	struct Entry
+	{
+		_Jbig2GlobalCtx *	ctx;
+		size_t				users;
+	};
+
+	std::unordered_map<Key, Entry, KeyHash>	entries_;
+	MutexLock								lock_;
 };
 
 class PdfJBig2Filter : public PdfFilter
@@ -416,6 +504,10 @@ public:
 	~PdfJBig2Filter();
 
 	void SetGlobals(uint8_t * data, size_t size);
+	// Shares the parsed globals with every other stream using the same JBIG2Globals object of owner.
+	void SetGlobals(PdfJBig2GlobalsCache * cache, const void * owner, uint32_t obj_num, uint32_t gen_num,
+	                uint8_t * data, size_t size);
+	void SetOutputFormat(PDF_BILEVEL_OUTPUT format) { output_format_ = format; }
 
    void Encode(uint8_t * data, size_t size, Buffer & buffer);
    void Decode(uint8_t * data, size_t size, Buffer & buffer);
@@ -423,6 +515,11 @@ public:
 private:
 	uint8_t *	globals_param_;
     size_t      globals_param_size_;
+	PdfJBig2GlobalsCache *	globals_cache_;
+	const void *			globals_owner_;
+	uint32_t				globals_obj_num_;
+	uint32_t				globals_gen_num_;
+	PDF_BILEVEL_OUTPUT		output_format_;
 };
 
 }//namespace
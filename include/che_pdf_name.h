@@ -0,0 +1,94 @@
+#ifndef _CHE_PDF_NAME_H_
+#define _CHE_PDF_NAME_H_
+
+#include "che_base_string.h"
+
+namespace chepdf {
+
+// Standard names with a fixed atom, X(name) is expanded once for the enum and once for the table.
+#define PDF_NAME_LIST(X) \
+    X(Type) X(Subtype) X(Length) X(Filter) X(DecodeParms) X(F) X(FFilter) X(FDecodeParms) X(DL) \
+    X(ASCIIHexDecode) X(ASCII85Decode) X(LZWDecode) X(FlateDecode) X(RunLengthDecode) \
+    X(CCITTFaxDecode) X(JBIG2Decode) X(DCTDecode) X(JPXDecode) X(Crypt) \
+    X(Predictor) X(Colors) X(BitsPerComponent) X(Columns) X(EarlyChange) X(K) X(EndOfLine) \
+    X(EncodedByteAlign) X(Rows) X(EndOfBlock) X(BlackIs1) X(DamagedRowsBeforeError) \
+    X(JBIG2Globals) X(ColorTransform) X(SMaskInData) \
+    X(Root) X(Info) X(Size) X(Prev) X(Encrypt) X(ID) X(XRefStm) X(XRef) X(W) X(Index) \
+    X(ObjStm) X(N) X(First) X(Extends) \
+    X(Standard) X(V) X(R) X(O) X(U) X(OE) X(UE) X(P) X(Perms) X(EncryptMetadata) \
+    X(CF) X(StmF) X(StrF) X(EFF) X(CFM) X(StdCF) X(Identity) X(None) X(V2) X(AESV2) X(AESV3) \
+    X(AuthEvent) X(DocOpen) X(Recipients) \
+    X(Catalog) X(Pages) X(Page) X(Kids) X(Count) X(Parent) X(Version) X(PageLabels) X(Names) \
+    X(Dests) X(Outlines) X(Threads) X(OpenAction) X(AA) X(URI) X(AcroForm) X(Metadata) \
+    X(StructTreeRoot) X(MarkInfo) X(Lang) X(OCProperties) X(PageMode) X(PageLayout) \
+    X(ViewerPreferences) X(Legal) X(Collection) X(NeedsRendering) \
+    X(MediaBox) X(CropBox) X(BleedBox) X(TrimBox) X(ArtBox) X(BoxColorInfo) X(Rotate) X(Resources) \
+    X(Contents) X(Group) X(Thumb) X(B) X(Dur) X(Trans) X(Annots) X(PieceInfo) X(LastModified) \
+    X(StructParents) X(Tabs) X(UserUnit) X(VP) \
+    X(ExtGState) X(ColorSpace) X(Pattern) X(Shading) X(XObject) X(Font) X(ProcSet) X(Properties) \
+    X(PDF) X(Text) X(ImageB) X(ImageC) X(ImageI) \
+    X(Image) X(Form) X(PS) X(Width) X(Height) X(ImageMask) X(Mask) X(Decode) X(Interpolate) \
+    X(Alternates) X(SMask) X(Intent) X(BBox) X(Matrix) X(FormType) X(Ref) X(OPI) X(OC) X(Name) \
+    X(DeviceGray) X(DeviceRGB) X(DeviceCMYK) X(CalGray) X(CalRGB) X(Lab) X(ICCBased) X(Indexed) \
+    X(Separation) X(DeviceN) X(Alternate) X(WhitePoint) X(BlackPoint) X(Gamma) X(Range) \
+    X(PatternType) X(PaintType) X(TilingType) X(XStep) X(YStep) X(ShadingType) X(Background) \
+    X(AntiAlias) X(Function) X(FunctionType) X(Domain) X(Coords) X(Extend) X(C0) X(C1) X(Bounds) \
+    X(Encode) X(Functions) X(Order) \
+    X(Type0) X(Type1) X(MMType1) X(Type3) X(TrueType) X(CIDFontType0) X(CIDFontType2) \
+    X(BaseFont) X(FirstChar) X(LastChar) X(Widths) X(FontDescriptor) X(Encoding) X(ToUnicode) \
+    X(DescendantFonts) X(CIDSystemInfo) X(Registry) X(Ordering) X(Supplement) X(DW) X(DW2) \
+    X(W2) X(CIDToGIDMap) X(Differences) X(BaseEncoding) X(FontName) X(FontFamily) X(Flags) \
+    X(FontBBox) X(ItalicAngle) X(Ascent) X(Descent) X(Leading) X(CapHeight) X(XHeight) \
+    X(StemV) X(StemH) X(AvgWidth) X(MaxWidth) X(MissingWidth) X(FontFile) X(FontFile2) \
+    X(FontFile3) X(CharSet) X(CharProcs) X(FontMatrix) X(Length1) X(Length2) X(Length3) \
+    X(WinAnsiEncoding) X(MacRomanEncoding) X(MacExpertEncoding) X(StandardEncoding) \
+    X(Annot) X(Rect) X(NM) X(M) X(AP) X(AS) X(Border) X(C) X(Dest) X(A) X(Link) X(Widget) \
+    X(Popup) X(FT) X(Fields) X(T) X(TU) X(DA) X(DR) X(Ff) X(Opt) X(MK) X(S) X(D) X(GoTo) \
+    X(Action) X(Next) X(Title) X(Author) X(Subject) X(Keywords) X(Creator) X(Producer) \
+    X(CreationDate) X(ModDate) X(Trapped) X(XML) X(EmbeddedFile) X(EmbeddedFiles) X(Params) \
+    X(Filespec) X(UF) X(EF) X(Desc) X(Outline) X(Last) X(LW) X(LC) X(LJ) X(ML) X(CA) X(ca) \
+    X(BM) X(SA) X(TK) X(Normal) X(OP) X(op) X(OPM) X(Sig) X(ByteRange) X(Cert) X(Reason) \
+    X(Location) X(ContactInfo) X(SubFilter) X(Direct) X(Reference) X(Obj) X(Pg) X(Stm) \
+    X(Limits) X(Nums) X(St) X(Status)
+
+enum PDF_NAME_ATOM
+{
+    NAME_ATOM_NONE = 0,
+    // The empty name "/", a name like any other.
+    NAME_ATOM_EMPTY,
+#define PDF_NAME_ATOM_ENUM(name) NAME_##name,
+    PDF_NAME_LIST(PDF_NAME_ATOM_ENUM)
+#undef PDF_NAME_ATOM_ENUM
+    NAME_ATOM_PREDEFINED_COUNT
+};
+
+// Process wide table giving every name a small integer atom, so comparing two names is an
+// integer compare and every use of a name shares one ByteString. Only the names in
+// PDF_NAME_LIST stay for the life of the process. Other names are held by reference count by
+// the PdfName objects, values and dictionary keys using them, so the names of a document leave
+// the table with its objects and their atoms are reused.
+class PdfNameTable
+{
+public:
+    // Interns the name and returns its atom with a reference the caller has to Release.
+    // NAME_ATOM_NONE when the table is full, callers report that as an error rather than drop
+    // the name.
+    static uint32_t GetAtom(const ByteString & name);
+    static uint32_t GetAtom(const char * name, uint32_t length);
+    // Looks up the name without interning it or taking a reference, NAME_ATOM_NONE if nothing
+    // holds it. The atom stays valid while something holding the name is alive.
+    static uint32_t FindAtom(const ByteString & name);
+    static uint32_t FindAtom(const char * name, uint32_t length);
+
+    // No-ops for predefined atoms and NAME_ATOM_NONE.
+    static void AddRef(uint32_t atom);
+    static void Release(uint32_t atom);
+
+    static ByteString GetName(uint32_t atom);
+    // Predefined names plus the other names held right now.
+    static uint32_t GetAtomCount();
+};
+
+}//namespace
+
+#endif
@@ -7,6 +7,7 @@
 #include <unordered_map>
 
 #include "che_base_string.h"
+#include "che_pdf_name.h"
 
 namespace chepdf {
     
@@ -86,12 +87,30 @@ class PdfObject : public BaseObject
 public:
     PDF_OBJ_TYPE        GetType() const { return type_; };
     
+    // Containers are copied one level deep, the objects they hold stay shared with the original
+    // until either side takes them out with a non-const GetElement, which copies an object that is
+    // still held elsewhere first. Objects held outside the container as well, such as through a
+    // pointer taken before the clone, are copied right away.
     PdfObjectPointer	Clone();
     void                Release();
     
+    // Copies everything the object still shares with clones, so the whole tree can be changed
+    // in place, from several threads as well.
+    void                Unshare();
+    
+    // Setting marks every container holding the object as well, clearing also clears everything
+    // the object holds, so IsModified never has to look at children.
     void                SetModified(bool value);
     virtual	bool		IsModified();
     
+    // Approximate bytes held by the object and everything stored in it. A reference counts as
+    // the value it is stored in, not as the object it points to.
+    size_t              GetMemorySize() const;
+    
+    // True when something besides the one pointer or container holding it refers to the object
+    // or to an object stored in it, such as a pointer taken from GetElement or a bound scalar.
+    bool                IsHeldOutside();
+    
     PdfNullPointer        GetPdfNull() const;
     PdfBooleanPointer     GetPdfBoolean() const;
     PdfNumberPointer      GetPdfNumber() const;
@@ -104,14 +123,37 @@ public:
     
 protected:
     PdfObject( PDF_OBJ_TYPE type, Allocator * allocator = nullptr );
-    virtual ~PdfObject() {}
+    virtual ~PdfObject();
     
     bool                b_modified_;
+    bool                b_bound_;
     PDF_OBJ_TYPE        type_;
     ReferenceCount      referenceCount_;
     
+private:
+    void                AttachParent(PdfObject * parent);
+    void                DetachParent(PdfObject * parent);
+    
+    // A scalar built from an inline entry is bound to it, its changes are written back there
+    // until the entry is replaced or the object is stored in a container itself.
+    void                BindSlot(PdfObject * container, uint32_t slot);
+    void                UnbindSlot();
+    void                WriteBack();
+    
+    // Containers holding the object, not owned. An object held by more than one container keeps
+    // the others in parents_. A bound object holds a reference to its container in parent_ and
+    // keeps the atom or index of the entry in slot_.
+    PdfObject *                 parent_;
+    union {
+        std::vector<PdfObject*> *   parents_;
+        uint32_t                    slot_;
+    };
+    
     friend class Allocator;
     friend class PdfObjectPointer;
+    friend class PdfValue;
+    friend class PdfStream;
+    friend class PdfObjectCache;
 };
 
 class PdfObjectPointer
@@ -119,9 +161,11 @@ class PdfObjectPointer
 public:
     PdfObjectPointer() : object_( nullptr ) {}
     PdfObjectPointer( const PdfObjectPointer & pointer );
+    PdfObjectPointer( PdfObjectPointer && pointer ) noexcept : object_( pointer.object_ ) { pointer.object_ = nullptr; }
     virtual ~PdfObjectPointer();
     
-    PdfObjectPointer operator=( const PdfObjectPointer & pointer );
+    PdfObjectPointer & operator=( const PdfObjectPointer & pointer );
+    PdfObjectPointer & operator=( PdfObjectPointer && pointer ) noexcept;
     bool operator!() const { return object_ ? false : true; }
     operator bool() const { return object_ ? true : false; }
     PdfObject * operator->() const { return object_; }
@@ -130,6 +174,8 @@ public:
     
 protected:
     PdfObject * object_;
+    
+    friend class PdfValue;
 };
 
 class PdfNullPointer : public PdfObjectPointer
@@ -186,6 +232,92 @@ public:
     PdfStream * operator->() const { return (PdfStream*)( object_ ); }
 };
 
+#define PDF_VALUE_INLINE    0x01
+#define PDF_VALUE_INTEGER   0x02
+// The object came from Clone and may be held by another container, copying a value drops it.
+// Whether it still is comes from its reference count.
+#define PDF_VALUE_SHARED    0x04
+
+// One array or dictionary entry. Null, booleans, numbers, names and references are kept in the
+// 16 bytes of the value itself, strings, arrays, dictionaries and streams are held by reference
+// count like PdfObjectPointer.
+class PdfValue
+{
+public:
+    PdfValue() : type_(OBJ_TYPE_INVALID), flags_(0), generate_number_(0), integer_(0), object_(nullptr) {}
+    PdfValue(const PdfObjectPointer & object);
+    PdfValue(PdfObjectPointer && object) noexcept;
+    PdfValue(const PdfValue & value);
+    PdfValue(PdfValue && value) noexcept;
+    ~PdfValue();
+    
+    PdfValue & operator=(const PdfValue & value);
+    PdfValue & operator=(PdfValue && value) noexcept;
+    
+    static PdfValue Null();
+    static PdfValue Boolean(bool value);
+    static PdfValue Integer(int32_t value);
+    static PdfValue Float(FLOAT value);
+    static PdfValue Name(uint32_t atom);
+    static PdfValue Reference(uint32_t object_number, uint32_t generate_number, PdfFile * file);
+    
+    PDF_OBJ_TYPE GetType() const { return (PDF_OBJ_TYPE)type_; }
+    bool IsValid() const { return type_ != OBJ_TYPE_INVALID; }
+    bool IsInline() const { return (flags_ & PDF_VALUE_INLINE) != 0; }
+    
+    // Scalars read the same whether they are inline or held as an object.
+    bool GetBoolean() const;
+    bool IsInteger() const;
+    int32_t GetInteger() const;
+    FLOAT GetFloat() const;
+    uint32_t GetNameAtom() const;
+    uint32_t GetReferenceNumber() const;
+    uint32_t GetGenerateNumber() const;
+    PdfFile * GetFile() const;
+    
+    // Inline values are built into a new object on every call, changing that object does not
+    // change the value. The non-const GetElement of the containers bind such an object to the
+    // entry, so its changes are written back.
+    PdfObjectPointer GetObject(Allocator * allocator = nullptr) const;
+    
+    bool IsModified() const;
+    void Reset();
+    
+private:
+    // Parent links of object values, used by the containers storing the value.
+    void AttachTo(PdfObject * parent) const;
+    void DetachFrom(PdfObject * parent) const;
+    
+    // GetObject bound to the entry slot of container when the value is inline.
+    PdfObjectPointer GetBoundObject(PdfObject * container, uint32_t slot) const;
+    
+    // False when something besides the containers sharing the object holds it.
+    bool CanShare() const;
+    void Share();
+    // Replaces an object shared by Clone with a copy that only parent holds, unless no one else
+    // holds it any more.
+    void Unshare(PdfObject * parent);
+    
+    uint8_t         type_;
+    uint8_t         flags_;
+    uint16_t        generate_number_;
+    union {
+        bool        boolean_;
+        int32_t     integer_;
+        FLOAT       float_;
+        uint32_t    atom_;
+        uint32_t    object_number_;
+    };
+    union {
+        PdfObject * object_;
+        PdfFile *   file_;
+    };
+    
+    friend class PdfObject;
+    friend class PdfArray;
+    friend class PdfDictionary;
+};
+
 class PdfNull : public PdfObject
 {
 public:
@@ -287,8 +419,8 @@ public:
     FLOAT	height;
 };
 
-#ifndef M_PI
-#define M_PI 3.14159265358979323846
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
 #endif
 
 #define FMAX4(a,b,c,d) fmax(fmax(a,b), fmax(c,d))
@@ -532,6 +664,10 @@ public:
     ByteString & GetString();
     void SetString(ByteString & str);
     
+    // The string as text, decoded from PDFDocEncoding or UTF-16BE.
+    WideString GetWideString();
+    void SetWideString(const WideString & str);
+    
 private:
     PdfString(Allocator * allocator = nullptr)
     : PdfObject(OBJ_TYPE_STRING, allocator), string_(allocator ) {};
@@ -549,17 +685,23 @@ class PdfName : public PdfObject
 {
 public:
     static PdfNamePointer Create(const ByteString & str, Allocator * allocator = nullptr);
+    static PdfNamePointer Create(uint32_t atom, Allocator * allocator = nullptr);
     
     PdfNamePointer Clone();
     
-    ByteString GetString() const { return name_; }
-    void SetString(ByteString & name) { name_ = name; SetModified(true); }
+    ByteString GetString() const { return PdfNameTable::GetName(atom_); }
+    // False, leaving the name as it was, when the name table is full.
+    bool SetString(ByteString & name);
+    
+    // Interned name, equal names have equal atoms.
+    uint32_t GetAtom() const { return atom_; }
     
 private:
-    PdfName(const ByteString & str,  Allocator * allocator = nullptr)
-    : PdfObject(OBJ_TYPE_NAME, allocator), name_(str) {}
+    PdfName(uint32_t atom, Allocator * allocator = nullptr)
+    : PdfObject(OBJ_TYPE_NAME, allocator), atom_(atom) { PdfNameTable::AddRef(atom_); }
+    ~PdfName();
     
-    ByteString name_;
+    uint32_t atom_;
     
     friend class Allocator;
     friend class PdfObject;
@@ -609,7 +751,6 @@ public:
     
     PdfArrayPointer Clone();
     
-    bool IsModified();
     
     bool Append(const PdfObjectPointer & object);
     bool Replace(uint32_t index, const PdfObjectPointer & object);
@@ -640,9 +781,19 @@ public:
     PdfDictionaryPointer  ReplaceDictionary(uint32_t index);
     PdfReferencePointer   ReplaceReference(uint32_t index, PdfFile * file);
     
+    // Values are stored as given, scalars and references stay inline. GetValue leaves an object
+    // shared with a clone in place, so it is for reading.
+    bool AppendValue(const PdfValue & value);
+    bool ReplaceValue(uint32_t index, const PdfValue & value);
+    PdfValue GetValue(uint32_t index) const;
+    
     uint32_t GetSize() const { return (uint32_t)array_.size(); }
-    PdfObjectPointer GetElement(uint32_t index ) const;
+    // The const overloads are for reading, they leave an object shared with a clone in place and
+    // return inline elements as unbound copies.
+    PdfObjectPointer GetElement(uint32_t index) const;
+    PdfObjectPointer GetElement(uint32_t index);
     PdfObjectPointer GetElement(uint32_t index, PDF_OBJ_TYPE type) const;
+    PdfObjectPointer GetElement(uint32_t index, PDF_OBJ_TYPE type);
     PdfObjectPointer GetElementByType(PDF_OBJ_TYPE type);
     
     bool GetRect(PdfRect & rect) const;
@@ -650,13 +801,21 @@ public:
     
 private:
     PdfArray(Allocator * allocator = nullptr) : PdfObject(OBJ_TYPE_ARRAY, allocator) {}
+    ~PdfArray();
+    
+    FLOAT GetFloat(uint32_t index) const;
     
-    std::vector<PdfObjectPointer> array_;
+    std::vector<PdfValue> array_;
     
     friend class Allocator;
     friend class PdfObject;
 };
 
+// Entries kept inside the dictionary object, larger dictionaries move them to the heap.
+#define PDF_DICTIONARY_INLINE_SIZE      8
+// Above this many entries a hash index over the entry arrays replaces the linear search.
+#define PDF_DICTIONARY_INDEX_THRESHOLD  32
+
 class PdfDictionary : public PdfObject
 {
 public:
@@ -665,9 +824,11 @@ public:
     PdfDictionaryPointer Clone();
     void Clear();
     
-    bool IsModified();
     
     bool                    SetObject(const ByteString & key, const PdfObjectPointer & object);
+    bool                    SetObject(uint32_t atom, const PdfObjectPointer & object);
+    bool                    SetValue(const ByteString & key, const PdfValue & value);
+    bool                    SetValue(uint32_t atom, const PdfValue & value);
     PdfNullPointer          SetNull(const ByteString & key);
     PdfBooleanPointer       SetBoolean(const ByteString & key, bool value);
     PdfNumberPointer        SetInteger(const ByteString & key, int32_t value);
@@ -680,23 +841,64 @@ public:
     PdfDictionaryPointer    SetDictionary(const ByteString & key);
     PdfReferencePointer     SetReference(const ByteString & key, uint32_t object_number, uint32_t generate_number, PdfFile * file);
     
-    uint32_t GetCount() { return (uint32_t)map_.size(); }
+    uint32_t GetCount() { return count_; }
+    // The const overloads are for reading, they leave an object shared with a clone in place and
+    // return inline entries as unbound copies.
     PdfObjectPointer GetElement(const ByteString & key) const;
+    PdfObjectPointer GetElement(const ByteString & key);
+    PdfObjectPointer GetElement(const ByteString & key, PDF_OBJ_TYPE type) const;
     PdfObjectPointer GetElement(const ByteString & key, PDF_OBJ_TYPE type);
+    // Literal keys are hashed in place instead of being copied into a ByteString first.
+    PdfObjectPointer GetElement(const char * key) const;
+    PdfObjectPointer GetElement(const char * key);
+    PdfObjectPointer GetElement(const char * key, PDF_OBJ_TYPE type) const;
+    PdfObjectPointer GetElement(const char * key, PDF_OBJ_TYPE type);
+    // Keys given as atoms, such as NAME_Length or PdfNameTable::FindAtom of the parsed bytes,
+    // skip the name table lookup.
+    PdfObjectPointer GetElement(uint32_t atom) const;
+    PdfObjectPointer GetElement(uint32_t atom);
+    PdfObjectPointer GetElement(uint32_t atom, PDF_OBJ_TYPE type) const;
+    PdfObjectPointer GetElement(uint32_t atom, PDF_OBJ_TYPE type);
+    // For reading, an object shared with a clone is not copied first as GetElement does.
+    PdfValue GetValue(const ByteString & key) const;
+    PdfValue GetValue(const char * key) const;
+    PdfValue GetValue(uint32_t atom) const;
     
     bool Remove(const ByteString & key);
+    bool Remove(const char * key);
+    bool Remove(uint32_t atom);
     
     void MoveToFirst();
     
     bool GetKeyAndElement(ByteString & key, PdfObjectPointer & object);
+    bool GetKeyAndElement(uint32_t & atom, PdfObjectPointer & object);
+    bool GetKeyAndValue(uint32_t & atom, PdfValue & value);
     
     bool CheckName(const ByteString & key, const ByteString & name, bool b_required = true);
+    bool CheckName(const char * key, const char * name, bool b_required = true);
+    bool CheckName(uint32_t keyAtom, uint32_t nameAtom, bool b_required = true);
     
 private:
-    PdfDictionary(Allocator * allocator = nullptr) : PdfObject(OBJ_TYPE_DICTIONARY, allocator) {}
-    
-    std::unordered_map<std::string,PdfObjectPointer>::iterator iterator_;
-    std::unordered_map<std::string,PdfObjectPointer> map_;
+    PdfDictionary(Allocator * allocator = nullptr);
+    ~PdfDictionary();
+    
+    int32_t Find(uint32_t atom) const;
+    bool Grow();
+    void BuildIndex();
+    void ReleaseEntries();
+    
+    // Keys and values in insertion order, keys past count_ stay NAME_ATOM_NONE so the search can
+    // read whole groups of four.
+    uint32_t            count_;
+    uint32_t            capacity_;
+    uint32_t *          keys_;
+    PdfValue *          values_;
+    // Open addressing slots holding entry index + 1, only above PDF_DICTIONARY_INDEX_THRESHOLD.
+    uint32_t *          index_;
+    uint32_t            index_size_;
+    uint32_t            iterator_;
+    uint32_t            inline_keys_[PDF_DICTIONARY_INLINE_SIZE];
+    PdfValue            inline_values_[PDF_DICTIONARY_INLINE_SIZE];
     
     friend class Allocator;
     friend class PdfObject;
@@ -722,15 +924,18 @@ public:
     
     PdfStreamPointer Clone();
     
-    bool IsModified();
     
     uint32_t GetObjectNumber() const { return object_number_; }
     uint32_t GetGenerateNumber() const { return generate_number_; }
     
     void SetDictionary(const PdfDictionaryPointer & dictionary);
-    PdfDictionaryPointer GetDictionary() const { return dictionary_; }
+    // The const overload is for reading, it leaves a dictionary shared with a clone in place.
+    PdfDictionaryPointer GetDictionary() const;
+    PdfDictionaryPointer GetDictionary();
     
+    // Size of the stored data, AES encrypted streams decrypt to less than that.
     size_t GetRawSize() const { return size_; }
+    // Decrypted data from a plain text offset, returns the number of bytes written.
     size_t GetRawData(size_t offset, uint8_t * buffer, size_t buffer_size) const;
     bool SetRawData(uint8_t * data, size_t data_size, uint8_t filter = STREAM_FILTER_NULL);
     
@@ -747,9 +952,13 @@ private:
               Allocator * allocator = nullptr);
 
     ~PdfStream();
+
+    size_t ReadRawData(size_t offset, uint8_t * buffer, size_t buffer_size) const;
+    void UnshareDictionary();
     
     PdfCrypto * crypto_;
     PdfDictionaryPointer dictionary_;
+    bool b_shared_dictionary_;
     
     bool b_memory_stream;
     union {
@@ -764,6 +973,8 @@ private:
     friend class Allocator;
     friend class PdfObject;
     friend class PdfStreamAccess;
+    friend class PdfCrypto;
+    friend class PdfFile;
 };
 
 enum PDF_STREAM_DECODE_MODE
@@ -0,0 +1,144 @@
+#ifndef _CHE_PDF_PARSER_H_
+#define _CHE_PDF_PARSER_H_
+
+#include <cstring>
+
+#include "che_pdf_object.h"
+
+namespace chepdf {
+
+enum PDF_TOKEN_TYPE
+{
+    TOKEN_TYPE_END                  = 0x00,
+    TOKEN_TYPE_INTEGER              = 0x01,
+    TOKEN_TYPE_FLOAT                = 0x02,
+    TOKEN_TYPE_STRING               = 0x03,
+    TOKEN_TYPE_HEX_STRING           = 0x04,
+    TOKEN_TYPE_NAME                 = 0x05,
+    TOKEN_TYPE_ARRAY_BEGIN          = 0x06,
+    TOKEN_TYPE_ARRAY_END            = 0x07,
+    TOKEN_TYPE_DICTIONARY_BEGIN     = 0x08,
+    TOKEN_TYPE_DICTIONARY_END       = 0x09,
+    TOKEN_TYPE_KEYWORD              = 0x0A,
+    TOKEN_TYPE_INVALID              = 0x0B
+};
+
+// One token as it stands in the data. data points into the lexer window and is only valid until
+// the next call on the lexer: strings without their delimiters, names without the '/'.
+struct PdfToken
+{
+    PDF_TOKEN_TYPE  type;
+    // Strings and names holding escapes, '#' codes or line ends that have to be decoded.
+    bool            b_escaped;
+    uint32_t        length;
+    const uint8_t * data;
+    size_t          offset;
+    int32_t         integer;
+    FLOAT           number;
+
+    bool IsKeyword(const char * keyword, uint32_t size) const
+    {
+        return type == TOKEN_TYPE_KEYWORD && length == size && memcmp(data, keyword, size) == 0;
+    }
+};
+
+// Bytes read into the window at a time when the reader does not hold the data in memory, tokens
+// longer than the window grow it.
+#define PDF_LEXER_WINDOW_SIZE   8192
+
+// Splits the data of a reader into tokens (PDF 32000-1 7.2). Readers that hold their data in
+// memory are scanned in place, others through a window read in blocks.
+class PdfLexer : public BaseObject
+{
+public:
+    PdfLexer(IRead * iread, Allocator * allocator = nullptr);
+    ~PdfLexer();
+
+    IRead * GetIRead() const { return iread_; }
+    size_t GetSize() const { return size_; }
+
+    size_t GetPosition() const { return position_; }
+    void SetPosition(size_t offset) { position_ = (offset < size_) ? offset : size_; }
+
+    // Reads the token at the position and moves past it, false at the end of the data.
+    bool NextToken(PdfToken & token);
+    // Moves past white space and comments, false at the end of the data.
+    bool SkipWhiteSpace();
+
+    // Up to size bytes from offset, size is cut at the end of the data. Valid until the next call.
+    const uint8_t * GetSpan(size_t offset, size_t & size);
+    // Offset of the first occurrence of the bytes at or after the position and before limit.
+    bool Find(const char * pattern, uint32_t length, size_t limit, size_t & offsetRet);
+
+private:
+    PdfLexer(const PdfLexer &);
+    PdfLexer & operator=(const PdfLexer &);
+
+    // Makes the window hold size bytes from offset, or everything up to the end of the data.
+    bool Fill(size_t offset, size_t size);
+
+    IRead *         iread_;
+    size_t          size_;
+    size_t          position_;
+    // The whole data or the window, data_[0] is at data_offset_.
+    const uint8_t * data_;
+    size_t          data_offset_;
+    size_t          data_size_;
+    uint8_t *       window_;
+    size_t          window_capacity_;
+};
+
+// Containers nested deeper than this end the parse, so a hostile file cannot exhaust the stack.
+#define PDF_PARSER_MAX_DEPTH    256
+
+// Builds objects straight from the tokens of a lexer. Scalars and references go into their
+// containers inline, names become atoms without passing through a ByteString and strings are
+// decoded into the buffer of the string they end up in.
+class PdfParser : public BaseObject
+{
+public:
+    PdfParser(IRead * iread, PdfFile * file = nullptr, Allocator * allocator = nullptr);
+
+    PdfLexer & GetLexer() { return lexer_; }
+    PdfFile * GetFile() const { return file_; }
+
+    // Strings and streams of indirect objects parsed afterwards are decrypted with crypto.
+    void SetCrypto(PdfCrypto * crypto) { crypto_ = crypto; }
+    PdfCrypto * GetCrypto() const { return crypto_; }
+
+    // Parses the object at the lexer position, false if there is none. Scalars and references
+    // come back inline.
+    bool GetValue(PdfValue & valueRet);
+    PdfObjectPointer GetObject();
+
+    // Parses "n g obj ... endobj" at offset. Stream data stays in the reader, the stream only
+    // keeps its offset and size.
+    PdfObjectPointer GetIndirectObject(size_t offset, uint32_t & objNumRet, uint32_t & genNumRet);
+
+private:
+    bool NextToken(PdfToken & token);
+    void PushBack(const PdfToken & token);
+    bool ParseValue(PdfToken & token, PdfValue & valueRet, uint32_t depth);
+    bool ParseArray(PdfValue & valueRet, uint32_t depth);
+    bool ParseDictionary(PdfValue & valueRet, uint32_t depth);
+    PdfStringPointer ParseString(const PdfToken & token);
+    // The atom holds a reference the caller releases, NAME_ATOM_NONE when the name table is full
+    // or the name can't be decoded.
+    uint32_t ParseName(const PdfToken & token);
+    bool GetStreamSize(const PdfDictionaryPointer & dictionary, size_t offset, size_t & sizeRet);
+
+    PdfLexer        lexer_;
+    PdfFile *       file_;
+    PdfCrypto *     crypto_;
+    // Object whose strings are being parsed, b_crypt_ is false outside indirect objects.
+    bool            b_crypt_;
+    uint32_t        object_number_;
+    uint32_t        generate_number_;
+    // Integers read ahead to tell "n g R" from two numbers, in the order they were read.
+    PdfToken        pending_[2];
+    uint32_t        pending_count_;
+};
+
+}//namespace
+
+#endif
@@ -0,0 +1,88 @@
+#include "../include/che_base_cpu.h"
+
+#ifdef _CHE_X86_
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace chepdf {
+
+#ifdef _CHE_X86_
+
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuidex(info, (int)leaf, (int)subleaf);
+	regs[0] = (uint32_t)info[0];
+	regs[1] = (uint32_t)info[1];
+	regs[2] = (uint32_t)info[2];
+	regs[3] = (uint32_t)info[3];
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t xgetbv0()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t eax, edx;
+	__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+static uint32_t DetectCPUFeatures()
+{
+	uint32_t regs[4];
+	uint32_t features = 0;
+
+	cpuid(0, 0, regs);
+	uint32_t max_leaf = regs[0];
+	if (max_leaf < 1)
+	{
+		return 0;
+	}
+
+	cpuid(1, 0, regs);
+	if (regs[3] & (1u << 26)) features |= CPU_FEATURE_SSE2;
+	if (regs[2] & (1u << 9)) features |= CPU_FEATURE_SSSE3;
+	if (regs[2] & (1u << 19)) features |= CPU_FEATURE_SSE41;
+	if (regs[2] & (1u << 25)) features |= CPU_FEATURE_AESNI;
+	if (regs[2] & (1u << 1)) features |= CPU_FEATURE_PCLMUL;
+
+	//AVX state has to be enabled by the OS as well, not just present
+	bool b_avx_os = false;
+	if ((regs[2] & (1u << 27)) && (regs[2] & (1u << 28)))
+	{
+		b_avx_os = (xgetbv0() & 0x06) == 0x06;
+	}
+
+	if (max_leaf >= 7)
+	{
+		cpuid(7, 0, regs);
+		if (b_avx_os && (regs[1] & (1u << 5))) features |= CPU_FEATURE_AVX2;
+		if (regs[1] & (1u << 29)) features |= CPU_FEATURE_SHA;
+	}
+	return features;
+}
+
+#endif
+
+uint32_t GetCPUFeatures()
+{
+#ifdef _CHE_X86_
+	//a local static is initialised once, threads asking at the same time wait for it
+	static const uint32_t features = DetectCPUFeatures();
+	return features;
+#else
+	return 0;
+#endif
+}
+
+}//namespace
@@ -182,6 +182,8 @@ public:
     virtual void Release();
 
 private:
+    //a seek and the read after it must not interleave with another thread's
+    MutexLock lock_;
     FILE * pFile_;
 };
 
@@ -195,6 +197,7 @@ public:
     virtual size_t ReadBlock(void * buffer, size_t offset, size_t size);
     virtual bool ReadByte(size_t offset, uint8_t & byte);
     virtual void Release();
+    virtual const uint8_t * GetData() { return pBuf_; }
 
 private:
     uint8_t * pBuf_;
@@ -221,13 +224,15 @@ ICrtFileReadDefault::~ICrtFileReadDefault()
 
 size_t ICrtFileReadDefault::GetSize()
 {
+    size_t size = 0;
+    lock_.Lock();
     if (pFile_)
     {
         fseek(pFile_, 0, SEEK_END);
-        return ftell(pFile_);
-    } else {
-        return 0;
+        size = ftell(pFile_);
     }
+    lock_.UnLock();
+    return size;
 }
 
 size_t ICrtFileReadDefault::ReadBlock(void * buffer, size_t offset, size_t size)
@@ -236,31 +241,27 @@ size_t ICrtFileReadDefault::ReadBlock(void * buffer, size_t offset, size_t size)
     {
         return 0;
     }
+    size_t ret = 0;
+    lock_.Lock();
     if (pFile_)
     {
         fseek(pFile_, offset, SEEK_SET);
-        size_t ret = fread(buffer, 1, size, pFile_);
-        return ret;
+        ret = fread(buffer, 1, size, pFile_);
     }
-    return 0;
+    lock_.UnLock();
+    return ret;
 }
 
 bool ICrtFileReadDefault::ReadByte(size_t offset, uint8_t & byte)
 {
-    if (pFile_)
+    bool bRet = false;
+    lock_.Lock();
+    if (pFile_ && fseek(pFile_, offset, SEEK_SET) != -1)
     {
-        if (fseek(pFile_, offset, SEEK_SET) == -1)
-        {
-            return false;
-        } else {
-            size_t ret = fread(&byte, 1, 1, pFile_);
-            if (ret == 1)
-            {
-                return true;
-            }
-        }
+        bRet = (fread(&byte, 1, 1, pFile_) == 1);
     }
-    return false;
+    lock_.UnLock();
+    return bRet;
 }
 
 void ICrtFileReadDefault::Release()
@@ -296,18 +297,23 @@ ICrtFileReadMemoryCopy::~ICrtFileReadMemoryCopy()
     }
 }
 
+size_t ICrtFileReadMemoryCopy::GetSize()
+{
+    return bufSize_;
+}
+
 size_t ICrtFileReadMemoryCopy::ReadBlock(void * buffer, size_t offset, size_t size)
 {
-    if (offset + size < bufSize_)
+    if (buffer == nullptr || pBuf_ == nullptr || offset >= bufSize_)
+    {
+        return 0;
+    }
+    if (size > bufSize_ - offset)
     {
-        memcpy(buffer, pBuf_ + offset, size);
-        return size;
-    } else {
         size = bufSize_ - offset;
-        memcpy(buffer, pBuf_ + offset, size);
-        return size;
     }
-    return 0;
+    memcpy(buffer, pBuf_ + offset, size);
+    return size;
 }
 
 bool ICrtFileReadMemoryCopy::ReadByte(size_t offset, uint8_t & byte)
@@ -320,17 +326,28 @@ bool ICrtFileReadMemoryCopy::ReadByte(size_t offset, uint8_t & byte)
     return false;
 }
 
+void ICrtFileReadMemoryCopy::Release()
+{
+    if (pBuf_)
+    {
+        GetAllocator()->DeleteArray<uint8_t>(pBuf_);
+        pBuf_ = nullptr;
+    }
+    bufSize_ = 0;
+}
+
 class IMemoryRead : public IRead
 {
 public:
     IMemoryRead(const uint8_t * pBuf, size_t size, Allocator * allocator)
-        : IRead(allocator), pBuf_(nullptr), bufSize_(0) {}
+        : IRead(allocator), pBuf_(pBuf), bufSize_(pBuf ? size : 0) {}
     virtual ~IMemoryRead() {};
 
     virtual size_t GetSize() { return bufSize_; }
     virtual size_t ReadBlock(void * buffer, size_t offset, size_t size);
     virtual bool ReadByte(size_t offset, uint8_t & byte);
     virtual void Release() { pBuf_ = nullptr; bufSize_ = 0; }
+    virtual const uint8_t * GetData() { return pBuf_; }
 
 private:
     const uint8_t *	pBuf_;
@@ -408,25 +425,29 @@ void IRead::DestroyIRead(IRead * pIRead)
 }
 
 
-inline void ReferenceCount::Increase()
+void ReferenceCount::Increase()
 {
-#ifdef _WIN32
+#if defined(_WIN32)
     _InterlockedIncrement(&referenceCount_);
-#endif
-
-#ifdef _MAC_OS_X_
+#elif defined(_MAC_OS_X_)
     OSAtomicIncrement32(&referenceCount_);
+#elif defined(__GNUC__)
+    __sync_add_and_fetch(&referenceCount_, 1);
+#else
+#error "no atomic increment for this platform"
 #endif
 }
 
-inline void ReferenceCount::Decrease()
+size_t ReferenceCount::Decrease()
 {
-#ifdef _WIN32
-    _InterlockedDecrement(&referenceCount_);
-#endif
-
-#ifdef _MAC_OS_X_
-    OSAtomicDecrement32(&referenceCount_);
+#if defined(_WIN32)
+    return (size_t)_InterlockedDecrement(&referenceCount_);
+#elif defined(_MAC_OS_X_)
+    return (size_t)OSAtomicDecrement32(&referenceCount_);
+#elif defined(__GNUC__)
+    return (size_t)__sync_sub_and_fetch(&referenceCount_, 1);
+#else
+#error "no atomic decrement for this platform"
 #endif
 }
 
@@ -437,7 +458,7 @@ MutexLock::MutexLock()
     mutex_ = CreateMutex(NULL, false, NULL);
 #endif
 
-#ifdef _MAC_OS_X_
+#if defined(_MAC_OS_X_) || defined(_LINUX_)
     pthread_mutex_init(&mutex_, nullptr);
 #endif
 }
@@ -452,7 +473,7 @@ MutexLock::~MutexLock()
     }
 #endif
 
-#ifdef _MAC_OS_X_
+#if defined(_MAC_OS_X_) || defined(_LINUX_)
     pthread_mutex_destroy(&mutex_);
 #endif
 }
@@ -463,7 +484,7 @@ void MutexLock::Lock()
     WaitForSingleObject(mutex_, INFINITE);
 #endif
 
-#ifdef _MAC_OS_X_
+#if defined(_MAC_OS_X_) || defined(_LINUX_)
     pthread_mutex_lock(&mutex_);
 #endif
 }
@@ -474,7 +495,7 @@ void MutexLock::UnLock()
     ReleaseMutex(mutex_);
 #endif
 
-#ifdef _MAC_OS_X_
+#if defined(_MAC_OS_X_) || defined(_LINUX_)
     pthread_mutex_unlock(&mutex_);
 #endif
 }
@@ -534,35 +555,56 @@ const Buffer & Buffer::operator=(const Buffer & buffer)
     return *this;
 }
 
+bool Buffer::Reserve(size_t capacity)
+{
+    if (capacity <= capacity_)
+    {
+        return true;
+    }
+    //doubling keeps a run of writes linear, increament_ still sets the smallest step
+    size_t newCapacity = capacity_ + ((capacity_ > increament_) ? capacity_ : increament_);
+    if (newCapacity < capacity)
+    {
+        newCapacity = capacity;
+    }
+    uint8_t * tmp_data = GetAllocator()->NewArray<uint8_t>(newCapacity);
+    if (tmp_data == nullptr)
+    {
+        return false;
+    }
+    if (size_ > 0)
+    {
+        memcpy(tmp_data, data_, size_);
+    }
+    if (data_)
+    {
+        GetAllocator()->DeleteArray<uint8_t>(data_);
+    }
+    data_ = tmp_data;
+    capacity_ = newCapacity;
+    return true;
+}
+
 size_t Buffer::Write(const uint8_t * data, size_t offset, size_t size)
 {
     if (data == nullptr || size == 0 || offset > size_)
     {
         return 0;
     }
-    if (size + offset > capacity_)
+    //data may be inside this buffer, which Reserve can move
+    bool bInside = data_ && data >= data_ && data < data_ + size_;
+    size_t inside = bInside ? data - data_ : 0;
+    if (!Reserve(size + offset))
     {
-        size_t need = size + offset - capacity_;
-        if (need <= increament_)
-        {
-            need = 1;
-        }else{
-            need = (size_t)(need / increament_) + 1;
-        }
-        uint8_t * tmp_data = GetAllocator()->NewArray<uint8_t>(capacity_ + need * increament_);
-        memset(tmp_data, 0, capacity_ + need * increament_);
-        memcpy(tmp_data, data_, size_);
-        memcpy(tmp_data + offset, data, size);
-        GetAllocator()->DeleteArray<uint8_t>(data_);
-        data_ = tmp_data;
-        size_ = offset + size;
-        capacity_ += need * increament_;
-        return size;
-    }else{
-        memcpy(data_ + offset, data, size);
-        size_ = offset + size;
-        return size;
+        return 0;
+    }
+    if (bInside)
+    {
+        data = data_ + inside;
     }
+    memmove(data_ + offset, data, size);
+    size_ = offset + size;
+    return size;
 }
 
 void Buffer::Alloc(size_t size)
@@ -593,29 +635,7 @@ size_t Buffer::Write(const Buffer & buffer)
     {
         return 0;
     }
-    if (size_ + buffer.size_ > capacity_)
-    {
-        size_t need = size_ + buffer.size_ - capacity_;
-        if (need <= increament_)
-        {
-            need = 1;
-        }else{
-            need = (size_t)(need / increament_) + 1;
-        }
-        uint8_t * tmp_data = GetAllocator()->NewArray<uint8_t>(capacity_ + need * increament_);
-        memset(tmp_data, 0, capacity_ + need * increament_);
-        memcpy(tmp_data, data_, size_);
-        memcpy(tmp_data + size_, buffer.data_, buffer.size_);
-        GetAllocator()->DeleteArray<uint8_t>(data_);
-        data_ = tmp_data;
-        size_ += buffer.size_;
-        capacity_ += need * increament_;
-        return buffer.size_;
-    }else{
-        memcpy(data_ + size_, buffer.data_, buffer.size_);
-        size_ += buffer.size_;
-        return buffer.size_;
-    }
+    return Write(buffer.data_, size_, buffer.size_);
 }
 
 size_t Buffer::Read(uint8_t * buffer, size_t size)
@@ -1,216 +1,273 @@
 #include <cstdlib>
+#include <cmath>
 #include <cstring>
 #include <cwchar>
 #include <memory>
+#include <atomic>
 
 #include "../include/che_base_string.h"
 
 namespace chepdf
 {
 
+// Header of a long string, the characters follow it in the same allocation.
 struct ByteStringData
 {
-	ByteStringData()
-	{
-		str_ = nullptr;
-		length_ = 0;
-	}
-	char *          str_;
-	uint32_t        length_;
+	ByteStringData() : length_(0), capacity_(0), hash_(0) {}
+
+	char * GetString() { return (char *)(this + 1); }
+
 	ReferenceCount  reference_;
+	uint32_t        length_;
+	//characters that fit, not counting the terminator
+	uint32_t        capacity_;
+	//0 until computed, reset by every write in place
+	std::atomic<uint32_t> hash_;
 };
 
+static inline uint32_t bytes_hash(const char * data, uint32_t length)
+{
+	//FNV-1a
+	uint32_t hash = 2166136261u;
+	for (uint32_t i = 0; i < length; i++)
+	{
+		hash ^= (uint8_t)data[i];
+		hash *= 16777619u;
+	}
+	//0 marks a cached hash not computed yet
+	return hash ? hash : 1;
+}
+
+static inline bool bytes_equal(const char * data1, uint32_t length1, const char * data2, uint32_t length2)
+{
+	return length1 == length2 && (length1 == 0 || memcmp(data1, data2, length1) == 0);
+}
+
+ByteStringData * ByteString::NewData(uint32_t capacity)
+{
+	void * block = GetAllocator()->Alloc(sizeof(ByteStringData) + capacity + 1);
+	if (block == nullptr)
+	{
+		return nullptr;
+	}
+	ByteStringData * data = new(block) ByteStringData;
+	data->reference_.Increase();
+	data->capacity_ = (uint32_t)(GetAllocator()->GetSize(block) - sizeof(ByteStringData) - 1);
+	return data;
+}
+
+void ByteString::ReleaseData(ByteStringData * data)
+{
+	if (data->reference_.Decrease() == 0)
+	{
+		data->~ByteStringData();
+		GetAllocator()->Free(data);
+	}
+}
+
+void ByteString::Assign(char const * pstr, uint32_t length)
+{
+	if (pstr == nullptr || length == 0)
+	{
+		Clear();
+		return;
+	}
+	ByteStringData * old = IsLong() ? data_ : nullptr;
+	if (old && old->reference_ == 1 && old->capacity_ >= length)
+	{
+		memmove(old->GetString(), pstr, length);
+		old->GetString()[length] = '\0';
+		old->length_ = length;
+		old->hash_.store(0, std::memory_order_relaxed);
+		return;
+	}
+	//pstr may point into the old characters, they are released last
+	if (length <= BYTESTRING_INLINE_SIZE)
+	{
+		memmove(inline_, pstr, length);
+		SetInlineLength(length);
+	}else{
+		ByteStringData * data = NewData(length);
+		if (data == nullptr)
+		{
+			return;
+		}
+		memcpy(data->GetString(), pstr, length);
+		data->GetString()[length] = '\0';
+		data->length_ = length;
+		SetLong(data);
+	}
+	if (old)
+	{
+		ReleaseData(old);
+	}
+}
+
+void ByteString::Append(char const * pstr, uint32_t length)
+{
+	if (pstr == nullptr || length == 0)
+	{
+		return;
+	}
+	uint32_t oldLength = GetLength();
+	uint32_t newLength = oldLength + length;
+	if (!IsLong())
+	{
+		if (newLength <= BYTESTRING_INLINE_SIZE)
+		{
+			memmove(inline_ + oldLength, pstr, length);
+			SetInlineLength(newLength);
+			return;
+		}
+	}else if (data_->reference_ == 1 && data_->capacity_ >= newLength)
+	{
+		memmove(data_->GetString() + oldLength, pstr, length);
+		data_->GetString()[newLength] = '\0';
+		data_->length_ = newLength;
+		data_->hash_.store(0, std::memory_order_relaxed);
+		return;
+	}
+	//doubling keeps repeated appends linear
+	uint32_t capacity = newLength;
+	if (capacity < oldLength * 2)
+	{
+		capacity = oldLength * 2;
+	}
+	ByteStringData * data = NewData(capacity);
+	if (data == nullptr)
+	{
+		return;
+	}
+	if (oldLength > 0)
+	{
+		memcpy(data->GetString(), GetData(), oldLength);
+	}
+	memcpy(data->GetString() + oldLength, pstr, length);
+	data->GetString()[newLength] = '\0';
+	data->length_ = newLength;
+	Clear();
+	SetLong(data);
+}
+
 ByteString::ByteString(char ch, Allocator * allocator)
 	:BaseObject(allocator)
 {
-	if (ch == '\0')
+	SetInlineLength(0);
+	if (ch != '\0')
 	{
-		data_ = nullptr;
-	}
-	else{
-		data_ = GetAllocator()->New<ByteStringData>();
-		data_->length_ = 1;
-		data_->reference_.Increase();
-		data_->str_[0] = ch;
-		data_->str_ = GetAllocator()->NewArray<char>(2);
-		data_->str_[1] = '\0';
+		inline_[0] = ch;
+		SetInlineLength(1);
 	}
 }
 
 ByteString::ByteString(char const * pstr, uint32_t length /* = 0 */, Allocator * allocator /*= nullptr*/)
 	:BaseObject(allocator)
 {
+	SetInlineLength(0);
 	if (pstr == nullptr)
 	{
-		data_ = nullptr;
 		return;
 	}
 	if (length == 0)
 	{
 		length = (uint32_t)strlen(pstr);
 	}
-	if (length > 0)
-	{
-		data_ = GetAllocator()->New<ByteStringData>();
-		data_->reference_.Increase();
-		data_->length_ = length;
-		data_->str_ = GetAllocator()->NewArray<char>(length + 1);
-		memcpy(data_->str_, pstr, length);
-		data_->str_[length] = '\0';
-	}
-	else{
-		data_ = nullptr;
-	}
+	Assign(pstr, length);
 }
 
 ByteString::ByteString(const ByteString & str)
 	:BaseObject(str.GetAllocator())
 {
-	if (str.data_ == nullptr)
+	memcpy(inline_, str.inline_, sizeof(inline_));
+	if (IsLong())
 	{
-		data_ = nullptr;
-	}
-	else{
-		data_ = str.data_;
-		str.data_->reference_.Increase();
+		data_->reference_.Increase();
 	}
 }
 
+ByteString::ByteString(ByteString && str)
+	:BaseObject(str.GetAllocator())
+{
+	memcpy(inline_, str.inline_, sizeof(inline_));
+	str.SetInlineLength(0);
+}
+
 void ByteString::Clear()
 {
-	if (data_)
+	if (IsLong())
 	{
-		data_->reference_.Decrease();
-
-		if (data_->reference_ == 0 && data_->str_)
-		{
-			GetAllocator()->DeleteArray<char>(data_->str_);
-			data_->str_ = nullptr;
-			GetAllocator()->Delete<ByteStringData>(data_);
-		}
-		data_ = nullptr;
+		ReleaseData(data_);
 	}
+	SetInlineLength(0);
 }
 
 ByteString & ByteString::operator=(char ch)
 {
-	Clear();
-	if (ch == '\0')
-	{
-		return *this;
-	}
-	data_ = GetAllocator()->New<ByteStringData>();
-	data_->length_ = 1;
-	data_->reference_.Increase();
-	data_->str_ = GetAllocator()->NewArray<char>(2);
-	data_->str_[0] = ch;
-	data_->str_[1] = '\0';
+	Assign(&ch, ch == '\0' ? 0 : 1);
 	return *this;
 }
 
 ByteString & ByteString::operator=(char const * pstr)
 {
-	Clear();
-	if (pstr == nullptr)
+	Assign(pstr, pstr ? (uint32_t)strlen(pstr) : 0);
+	return *this;
+}
+
+ByteString & ByteString::operator=(const ByteString & str)
+{
+	if (this == &str)
 	{
 		return *this;
 	}
-
-	uint32_t length = (uint32_t)strlen(pstr);
-	if (length == 0)
+	if (!str.IsLong() || str.GetAllocator() != GetAllocator())
 	{
+		//the shared block is freed by the allocator of its owner
+		Assign(str.GetData(), str.GetLength());
 		return *this;
 	}
-
-	data_ = GetAllocator()->New<ByteStringData>();
-	data_->reference_.Increase();
-	data_->length_ = length;
-	data_->str_ = GetAllocator()->NewArray<char>(length + 1);
-	strcpy(data_->str_, pstr);
+	if (IsLong() && data_ == str.data_)
+	{
+		return *this;
+	}
+	str.data_->reference_.Increase();
+	Clear();
+	SetLong(str.data_);
 	return *this;
 }
 
-ByteString & ByteString::operator=(const ByteString & str)
+ByteString & ByteString::operator=(ByteString && str)
 {
 	if (this == &str)
 	{
 		return *this;
 	}
-	if (data_ == str.data_)
+	if (str.GetAllocator() != GetAllocator())
 	{
+		Assign(str.GetData(), str.GetLength());
 		return *this;
 	}
 	Clear();
-	if (str.data_)
-	{
-		data_ = str.data_;
-		str.data_->reference_.Increase();
-	}
+	memcpy(inline_, str.inline_, sizeof(inline_));
+	str.SetInlineLength(0);
 	return *this;
 }
 
 bool ByteString::operator==(char ch) const
 {
-	if (data_ == nullptr || strlen(data_->str_) == 0)
+	if (ch == '\0')
 	{
-		if (ch == '\0')
-		{
-			return true;
-		}
-		else{
-			return false;
-		}
-	}
-	else{
-		if (data_->length_ != 1)
-		{
-			return false;
-		}
-		else{
-			if (data_->str_[0] == ch)
-			{
-				return true;
-			}
-			else{
-				return false;
-			}
-		}
+		return GetLength() == 0;
 	}
+	return GetLength() == 1 && GetData()[0] == ch;
 }
 
 bool ByteString::operator==(char const * pstr) const
 {
-	if (data_ == nullptr || strlen(data_->str_) == 0)
+	if (pstr == nullptr)
 	{
-		if (pstr == nullptr || strlen(pstr) == 0)
-		{
-			return true;
-		}
-		else{
-			return false;
-		}
-	}
-	else{
-		if (pstr == nullptr)
-		{
-			if (data_->str_ == nullptr)
-			{
-				return true;
-			}
-			else{
-				return false;
-			}
-		}
-		else{
-			if (strcmp(data_->str_, pstr) == 0)
-			{
-				return true;
-			}
-			else{
-				return false;
-			}
-		}
+		return GetLength() == 0;
 	}
+	return bytes_equal(GetData(), GetLength(), pstr, (uint32_t)strlen(pstr));
 }
 
 bool ByteString::operator==(const ByteString & str) const
@@ -219,520 +276,229 @@ bool ByteString::operator==(const ByteString & str) const
 	{
 		return true;
 	}
-	else{
+	uint32_t length = GetLength();
+	if (length != str.GetLength())
+	{
+		return false;
+	}
+	if (IsLong() && str.IsLong())
+	{
 		if (data_ == str.data_)
 		{
 			return true;
 		}
-		else{
-			if (data_ == nullptr)
-			{
-				return false;
-			}
-			else{
-				if (strcmp(data_->str_, str.data_->str_) == 0)
-				{
-					return true;
-				}
-				else{
-					return false;
-				}
-			}
+		//cached hashes that differ settle it without touching the bytes
+		uint32_t hash1 = data_->hash_.load(std::memory_order_relaxed);
+		uint32_t hash2 = str.data_->hash_.load(std::memory_order_relaxed);
+		if (hash1 != 0 && hash2 != 0 && hash1 != hash2)
+		{
+			return false;
+		}
+	}
+	return length == 0 || memcmp(GetData(), str.GetData(), length) == 0;
+}
+
+int32_t ByteString::Compare(const ByteString & str) const
+{
+	uint32_t length1 = GetLength();
+	uint32_t length2 = str.GetLength();
+	uint32_t length = (length1 < length2) ? length1 : length2;
+	if (length > 0)
+	{
+		int ret = memcmp(GetData(), str.GetData(), length);
+		if (ret != 0)
+		{
+			return (ret < 0) ? -1 : 1;
 		}
 	}
+	if (length1 == length2)
+	{
+		return 0;
+	}
+	return (length1 < length2) ? -1 : 1;
+}
+
+uint32_t ByteString::GetHash() const
+{
+	if (!IsLong())
+	{
+		return bytes_hash(inline_, GetLength());
+	}
+	uint32_t hash = data_->hash_.load(std::memory_order_relaxed);
+	if (hash == 0)
+	{
+		hash = bytes_hash(data_->GetString(), data_->length_);
+		data_->hash_.store(hash, std::memory_order_relaxed);
+	}
+	return hash;
 }
 
 bool ByteString::SetData(uint8_t * pData, uint32_t length)
 {
-	if (pData == nullptr || length == 0)
+	Assign((char const *)pData, pData ? length : 0);
+	return true;
+}
+
+uint8_t * ByteString::GetBuffer(uint32_t capacity)
+{
+	uint32_t length = GetLength();
+	if (capacity < length)
 	{
-		Clear();
-		return true;
+		capacity = length;
 	}
-	if (data_ == nullptr)
+	if (capacity == 0)
 	{
-		data_ = GetAllocator()->New<ByteStringData>();
-		data_->reference_.Increase();
-		data_->length_ = length;
-		data_->str_ = GetAllocator()->NewArray<char>(length + 1);
-		memcpy(data_->str_, pData, length);
-		data_->str_[length] = '\0';
+		return nullptr;
 	}
-	else{
-		data_->reference_.Decrease();
-		if (data_->reference_ == 0)
+	if (!IsLong())
+	{
+		if (capacity <= BYTESTRING_INLINE_SIZE)
 		{
-			if (data_->str_)
-			{
-				GetAllocator()->DeleteArray<char>(data_->str_);
-			}
-			data_->reference_.Increase();
-			data_->length_ = length;
-			data_->str_ = GetAllocator()->NewArray<char>(length + 1);
-			memcpy(data_->str_, pData, length);
-			data_->str_[length] = '\0';
-		}
-		else {
-			data_ = GetAllocator()->New<ByteStringData>();
-			data_->reference_.Increase();
-			data_->length_ = length;
-			data_->str_ = GetAllocator()->NewArray<char>(length + 1);
-			memcpy(data_->str_, pData, length);
-			data_->str_[length] = '\0';
+			return (uint8_t *)inline_;
 		}
+	}else if (data_->reference_ == 1 && data_->capacity_ >= capacity)
+	{
+		data_->hash_.store(0, std::memory_order_relaxed);
+		return (uint8_t *)data_->GetString();
+	}
+
+	ByteStringData * data = NewData(capacity);
+	if (data == nullptr)
+	{
+		return nullptr;
+	}
+	if (length > 0)
+	{
+		memcpy(data->GetString(), GetData(), length);
+	}
+	data->GetString()[length] = '\0';
+	data->length_ = length;
+	Clear();
+	SetLong(data);
+	return (uint8_t *)data_->GetString();
+}
+
+void ByteString::ReleaseBuffer(uint32_t length)
+{
+	if (length == 0)
+	{
+		Clear();
+		return;
+	}
+	if (IsLong())
+	{
+		data_->length_ = length;
+		data_->GetString()[length] = '\0';
+		data_->hash_.store(0, std::memory_order_relaxed);
+	}else{
+		SetInlineLength(length);
 	}
-	return true;
 }
 
 char const * ByteString::GetData() const
 {
-	return data_ ? data_->str_ : nullptr;
+	if (IsLong())
+	{
+		return data_->GetString();
+	}
+	//empty strings have no data
+	return ((uint8_t)inline_[BYTESTRING_INLINE_SIZE] != BYTESTRING_INLINE_SIZE) ? inline_ : nullptr;
 }
 
 uint32_t ByteString::GetLength() const
 {
-	if (data_ == nullptr)
+	if (IsLong())
 	{
-		return 0;
-	}
-	else{
 		return data_->length_;
 	}
+	return BYTESTRING_INLINE_SIZE - (uint8_t)inline_[BYTESTRING_INLINE_SIZE];
 }
 
 char ByteString::operator[](uint32_t index) const
 {
-	if (data_ != nullptr)
+	if (index >= GetLength())
 	{
-		if (index >= data_->length_)
-		{
-			return 0;
-		}
-		else if (data_->str_)
-		{
-			return data_->str_[index];
-		}
-		else{
-			return 0;
-		}
-	}
-	else{
 		return 0;
 	}
+	return GetData()[index];
 }
 
 int32_t ByteString::GetInteger() const
 {
-	return atoi(GetData());
+	int32_t integer = 0;
+	FLOAT value = 0;
+	bool bInteger = false;
+	ParsePdfNumber(GetData(), GetLength(), integer, value, bInteger);
+	return integer;
 }
 
 FLOAT ByteString::GetFloat() const
 {
-	return atof(GetData());
+	int32_t integer = 0;
+	FLOAT value = 0;
+	bool bInteger = false;
+	ParsePdfNumber(GetData(), GetLength(), integer, value, bInteger);
+	return value;
 }
 
 ByteString ByteString::operator+(char ch)
 {
-	if (data_ == nullptr || data_->str_ == nullptr)
-	{
-		return ByteString(ch, GetAllocator());
-	}
-
-	uint32_t length = data_->length_ + 2;
-	char * pstr = GetAllocator()->NewArray<char>(length);
-
-	strcpy(pstr, data_->str_);
-	pstr[length - 2] = ch;
-	pstr[length - 1] = '\0';
-
-	ByteString str(pstr, length - 1, GetAllocator());
-	GetAllocator()->DeleteArray<char>(pstr);
+	ByteString str(*this);
+	str += ch;
 	return str;
 }
 
-
 ByteString ByteString::operator+(char const * pstr)
 {
-	if (pstr == nullptr)
-	{
-		return ByteString(*this);
-	}
-
-	if (data_ == nullptr || data_->str_ == nullptr)
-	{
-		return ByteString(pstr, (uint32_t)strlen(pstr), GetAllocator());
-	}
-
-	uint32_t length = data_->length_ + (uint32_t)strlen(pstr) + 1;
-	char * pTstr_ = GetAllocator()->NewArray<char>(length);
-
-	strcpy(pTstr_, data_->str_);
-	strcat(pTstr_, pstr);
-
-	ByteString str(pTstr_, (uint32_t)strlen(pTstr_), GetAllocator());
-	GetAllocator()->DeleteArray<char>(pTstr_);
+	ByteString str(*this);
+	str += pstr;
 	return str;
 }
 
 ByteString ByteString::operator+(const ByteString & str)
 {
-	if (str.data_ == nullptr)
-	{
-		return ByteString(*this);
-	}
-
-	if (data_ == nullptr || data_->str_ == nullptr)
-	{
-		return ByteString(str);
-	}
-
-	size_t length = data_->length_ + str.data_->length_ + 1;
-	char * pTestr_ = GetAllocator()->NewArray<char>(length);
-	strcpy(pTestr_, data_->str_);
-	strcat(pTestr_, str.data_->str_);
-
-	ByteString strRet(pTestr_);
-	GetAllocator()->DeleteArray<char>(pTestr_);
+	ByteString strRet(*this);
+	strRet += str;
 	return strRet;
 }
 
 ByteString & ByteString::operator+=(char ch)
 {
-	if (ch == 0)
+	if (ch != 0)
 	{
-		return *this;
+		Append(&ch, 1);
 	}
-
-	if (data_ == nullptr)
-	{
-		data_ = GetAllocator()->New<ByteStringData>();
-		data_->reference_.Increase();
-		data_->length_ = 1;
-		data_->str_ = GetAllocator()->NewArray<char>(2);
-		data_->str_[0] = ch;
-		data_->str_[1] = '\0';
-	}
-	else{
-		if (data_->str_ == nullptr)
-		{
-			data_->length_ = 1;
-			data_->reference_.Increase();
-			data_->str_ = GetAllocator()->NewArray<char>(2);
-			data_->str_[0] = ch;
-			data_->str_[1] = '\0';
-			return *this;
-		}
-		char * pTstr_ = GetAllocator()->NewArray<char>(strlen(data_->str_) + 2);
-		strcpy(pTstr_, data_->str_);
-		data_->reference_.Decrease();
-		if (data_->reference_ == 0)
-		{
-			if (data_->str_)
-			{
-				GetAllocator()->DeleteArray<char>(data_->str_);
-				data_->str_ = nullptr;
-			}
-			data_->length_ = 0;
-			data_->reference_.Increase();
-		}
-		else{
-			data_ = GetAllocator()->New<ByteStringData>();
-			data_->length_ = 0;
-			data_->reference_.Increase();
-			data_->str_ = nullptr;
-		}
-
-		uint32_t length = (uint32_t)strlen(pTstr_) + 2;
-		data_->str_ = GetAllocator()->NewArray<char>(length);
-		strcpy(data_->str_, pTstr_);
-		data_->str_[length - 2] = ch;
-		data_->str_[length - 1] = '\0';
-		data_->length_ = length - 1;
-
-		GetAllocator()->DeleteArray<char>(pTstr_);
-	}
-	return *this;
-}
+	return *this;
+}
 
 ByteString & ByteString::operator+=(char const * pstr)
 {
-	if (pstr == nullptr)
-	{
-		return *this;
-	}
-
-	if (strlen(pstr) == 0)
+	if (pstr != nullptr)
 	{
-		return *this;
-	}
-
-	if (data_ == nullptr)
-	{
-		uint32_t length = (uint32_t)strlen(pstr);
-		data_ = GetAllocator()->New<ByteStringData>();
-		data_->reference_.Increase();
-		data_->str_ = GetAllocator()->NewArray<char>(length + 1);
-		strcpy(data_->str_, pstr);
-		data_->length_ = length;
-	}
-	else{
-		if (data_->str_ == nullptr)
-		{
-			uint32_t length = (uint32_t)strlen(pstr);
-			data_->str_ = GetAllocator()->NewArray<char>(length + 1);
-			strcpy(data_->str_, pstr);
-			data_->length_ = length;
-			return *this;
-		}
-
-		char * pTstr_ = GetAllocator()->NewArray<char>(strlen(data_->str_) + 1);
-		strcpy(pTstr_, data_->str_);
-
-		data_->reference_.Decrease();
-		if (data_->reference_ == 0)
-		{
-			if (data_->str_)
-			{
-				GetAllocator()->DeleteArray<char>(data_->str_);
-				data_->str_ = nullptr;
-			}
-			data_->length_ = 0;
-			data_->reference_.Increase();
-		}
-		else{
-			data_ = GetAllocator()->New<ByteStringData>();
-			data_->length_ = 0;
-			data_->reference_.Increase();
-			data_->str_ = nullptr;
-		}
-
-		uint32_t length = (uint32_t)strlen(pTstr_) + (uint32_t)strlen(pstr);
-		data_->str_ = GetAllocator()->NewArray<char>(length + 1);
-		strcpy(data_->str_, pTstr_);
-		strcat(data_->str_, pstr);
-		data_->length_ = length;
+		Append(pstr, (uint32_t)strlen(pstr));
 	}
-
 	return *this;
 }
 
 ByteString & ByteString::operator+=(const ByteString & str)
 {
-	if (str.data_ == nullptr || str.data_->str_ == nullptr)
-	{
-		return *this;
-	}
-
-	if (this == &str)
-	{
-		char * pTstr_ = GetAllocator()->NewArray<char>(strlen(data_->str_) + 1);
-		strcpy(pTstr_, data_->str_);
-
-		data_->reference_.Decrease();
-		if (data_->reference_ == 0)
-		{
-			if (data_->str_)
-			{
-				GetAllocator()->DeleteArray<char>(data_->str_);
-				data_->str_ = nullptr;
-			}
-			data_->length_ = 0;
-			data_->reference_.Increase();
-		}
-		else{
-			data_ = GetAllocator()->New<ByteStringData>();
-			data_->length_ = 0;
-			data_->reference_.Increase();
-			data_->str_ = nullptr;
-		}
-
-		uint32_t length = (uint32_t)strlen(pTstr_) * 2 + 1;
-		data_->str_ = GetAllocator()->NewArray<char>(length);
-		strcpy(data_->str_, pTstr_);
-		strcat(data_->str_, pTstr_);
-
-		data_->length_ = length - 1;
-
-		GetAllocator()->DeleteArray<char>(pTstr_);
-		pTstr_ = nullptr;
-
-		return *this;
-	}
-	else{
-		if (data_ == str.data_)
-		{
-			char * pTstr_ = GetAllocator()->NewArray<char>(strlen(data_->str_) + 1);
-			strcpy(pTstr_, data_->str_);
-
-			data_->reference_.Decrease();
-			data_->reference_.Decrease();
-			if (data_->reference_ == 0)
-			{
-				if (data_->str_)
-				{
-					GetAllocator()->DeleteArray<char>(data_->str_);
-					data_->str_ = nullptr;
-				}
-				data_->length_ = 0;
-				data_->reference_.Increase();
-				data_->reference_.Increase();
-			}
-			else{
-				data_ = GetAllocator()->New<ByteStringData>();
-				data_->reference_.Increase();
-				data_->reference_.Increase();
-				data_->str_ = nullptr;
-				data_->length_ = 0;
-			}
-
-			uint32_t length = (uint32_t)strlen(pTstr_) * 2 + 1;
-			data_->str_ = GetAllocator()->NewArray<char>(length);
-			strcpy(data_->str_, pTstr_);
-			strcat(data_->str_, pTstr_);
-
-			data_->length_ = length - 1;
-
-			GetAllocator()->DeleteArray<char>(pTstr_);
-			pTstr_ = nullptr;
-
-			return *this;
-		}
-		else{
-			if (data_->str_ == nullptr)
-			{
-				size_t length = strlen(str.data_->str_) + 1;
-				data_->str_ = GetAllocator()->NewArray<char>(length);
-				strcpy(data_->str_, str.data_->str_);
-				return *this;
-			}
-
-			char * pTstr_ = GetAllocator()->NewArray<char>(strlen(data_->str_) + 1);
-			strcpy(pTstr_, data_->str_);
-
-			if (data_->reference_ == 1)
-			{
-				if (data_->str_)
-				{
-					GetAllocator()->DeleteArray<char>(data_->str_);
-					data_->str_ = nullptr;
-					data_->length_ = 0;
-				}
-			}
-			else{
-				data_->reference_.Decrease();
-				data_ = GetAllocator()->New<ByteStringData>();
-				data_->length_ = 0;
-				data_->reference_.Increase();
-				data_->str_ = nullptr;
-			}
-
-			uint32_t length = (uint32_t)strlen(str.data_->str_);
-			length += strlen(pTstr_) + 1;
-			data_->str_ = GetAllocator()->NewArray<char>(length);
-			strcpy(data_->str_, pTstr_);
-			strcat(data_->str_, str.data_->str_);
-
-			GetAllocator()->DeleteArray<char>(pTstr_);
-			pTstr_ = nullptr;
-
-			data_->length_ = length - 1;
-
-			return *this;
-		}
-	}
+	Append(str.GetData(), str.GetLength());
+	return *this;
 }
 
 bool ByteString::operator!=(char ch) const
 {
-	if (data_ == nullptr)
-	{
-		if (ch == 0)
-		{
-			return false;
-		}
-		else{
-			return true;
-		}
-	}
-	else{
-		if (data_->length_ != 1)
-		{
-			return true;
-		}
-		else{
-			if (data_->str_[0] == ch)
-			{
-				return false;
-			}
-			else{
-				return true;
-			}
-		}
-	}
+	return !(*this == ch);
 }
 
 bool ByteString::operator!=(char const * pstr) const
 {
-	if (data_ == nullptr)
-	{
-		if (pstr == nullptr || strlen(pstr) == 0)
-		{
-			return false;
-		}
-		else{
-			return true;
-		}
-	}
-	else{
-		if (pstr == nullptr)
-		{
-			if (data_->str_ == nullptr)
-			{
-				return false;
-			}
-			else{
-				return true;
-			}
-		}
-		else{
-			if (strcmp(data_->str_, pstr) == 0)
-			{
-				return false;
-			}
-			else{
-				return true;
-			}
-		}
-	}
+	return !(*this == pstr);
 }
 
 bool ByteString::operator!=(const ByteString & str) const
 {
-	if (this == &str)
-	{
-		return false;
-	}
-	else{
-		if (data_ == str.data_)
-		{
-			return false;
-		}
-		else{
-			if (data_ == nullptr)
-			{
-				return true;
-			}
-			else{
-				if (strcmp(data_->str_, str.data_->str_) == 0)
-				{
-					return false;
-				}
-				else{
-					return true;
-				}
-			}
-		}
-	}
+	return !(*this == str);
 }
 
 bool operator==(char ch, ByteString & str)
@@ -771,324 +537,304 @@ bool operator!=(char const * pstr, const ByteString & str)
 
 
 
+// Header of a wide string, the characters follow it in the same allocation.
 struct WideStringData
 {
-	WideStringData()
-	{
-		str_ = nullptr;
-		length_ = 0;
-	}
-	wchar_t *       str_;
-	uint32_t        length_;
+	WideStringData() : length_(0), capacity_(0) {}
+
+	wchar_t * GetString() { return (wchar_t *)(this + 1); }
+
 	ReferenceCount  reference_;
+	uint32_t        length_;
+	//characters that fit, not counting the terminator
+	uint32_t        capacity_;
 };
 
-WideString::WideString(wchar_t wch, Allocator * allocator)
-	: BaseObject(allocator)
+WideStringData * WideString::NewData(uint32_t capacity)
 {
-	if (wch == '\0')
+	void * block = GetAllocator()->Alloc(sizeof(WideStringData) + sizeof(wchar_t) * ((size_t)capacity + 1));
+	if (block == nullptr)
 	{
-		data_ = nullptr;
+		return nullptr;
 	}
-	else{
-		data_ = GetAllocator()->New<WideStringData>();
-		data_->length_ = 1;
-		data_->reference_.Increase();
-		data_->str_ = GetAllocator()->NewArray<wchar_t >(2);
-		data_->str_[0] = wch;
-		data_->str_[1] = '\0';
+	WideStringData * data = new(block) WideStringData;
+	data->reference_.Increase();
+	data->capacity_ = (uint32_t)((GetAllocator()->GetSize(block) - sizeof(WideStringData)) / sizeof(wchar_t) - 1);
+	return data;
+}
+
+void WideString::ReleaseData(WideStringData * data)
+{
+	if (data->reference_.Decrease() == 0)
+	{
+		data->~WideStringData();
+		GetAllocator()->Free(data);
 	}
 }
 
-WideString::WideString(wchar_t const * pstr, uint32_t length /* = 0 */, Allocator * allocator)
-	: BaseObject(allocator)
+void WideString::Assign(wchar_t const * pstr, uint32_t length)
 {
-	if (pstr == nullptr)
+	if (pstr == nullptr || length == 0)
 	{
-		data_ = nullptr;
+		Clear();
 		return;
 	}
-	if (length == 0)
+	if (data_ && data_->reference_ == 1 && data_->capacity_ >= length)
 	{
-		length = (uint32_t)wcslen(pstr);
+		memmove(data_->GetString(), pstr, sizeof(wchar_t) * length);
+		data_->GetString()[length] = L'\0';
+		data_->length_ = length;
+		return;
 	}
-	if (length > 0)
+	WideStringData * data = NewData(length);
+	if (data == nullptr)
 	{
-		data_ = GetAllocator()->New<WideStringData>();
-		data_->reference_.Increase();
-		data_->length_ = length;
-		data_->str_ = GetAllocator()->NewArray<wchar_t >(length + 1);
-		wcscpy(data_->str_, pstr);
-		data_->str_[length] = '\0';
+		return;
 	}
-	else{
-		data_ = nullptr;
+	memcpy(data->GetString(), pstr, sizeof(wchar_t) * length);
+	data->GetString()[length] = L'\0';
+	data->length_ = length;
+	//pstr may point into the old characters, they are released last
+	Clear();
+	data_ = data;
+}
+
+void WideString::Append(wchar_t const * pstr, uint32_t length)
+{
+	if (pstr == nullptr || length == 0)
+	{
+		return;
+	}
+	uint32_t oldLength = GetLength();
+	uint32_t newLength = oldLength + length;
+	if (data_ && data_->reference_ == 1 && data_->capacity_ >= newLength)
+	{
+		memmove(data_->GetString() + oldLength, pstr, sizeof(wchar_t) * length);
+		data_->GetString()[newLength] = L'\0';
+		data_->length_ = newLength;
+		return;
 	}
+	//doubling keeps repeated appends linear
+	uint32_t capacity = newLength;
+	if (capacity < oldLength * 2)
+	{
+		capacity = oldLength * 2;
+	}
+	WideStringData * data = NewData(capacity);
+	if (data == nullptr)
+	{
+		return;
+	}
+	if (oldLength > 0)
+	{
+		memcpy(data->GetString(), data_->GetString(), sizeof(wchar_t) * oldLength);
+	}
+	memcpy(data->GetString() + oldLength, pstr, sizeof(wchar_t) * length);
+	data->GetString()[newLength] = L'\0';
+	data->length_ = newLength;
+	Clear();
+	data_ = data;
 }
 
-WideString::WideString(const WideString & str) : BaseObject(str.GetAllocator())
+WideString::WideString(wchar_t wch, Allocator * allocator)
+	: BaseObject(allocator), data_(nullptr)
 {
-	if (str.data_ == nullptr)
+	if (wch != L'\0')
 	{
-		data_ = nullptr;
+		Assign(&wch, 1);
 	}
-	else{
-		data_ = str.data_;
-		str.data_->reference_.Increase();
+}
+
+WideString::WideString(wchar_t const * pstr, uint32_t length /* = 0 */, Allocator * allocator)
+	: BaseObject(allocator), data_(nullptr)
+{
+	if (pstr == nullptr)
+	{
+		return;
+	}
+	if (length == 0)
+	{
+		length = (uint32_t)wcslen(pstr);
 	}
+	Assign(pstr, length);
 }
 
-void WideString::Clear()
+WideString::WideString(const WideString & str)
+	: BaseObject(str.GetAllocator()), data_(str.data_)
 {
 	if (data_)
 	{
-		data_->reference_.Decrease();
-		if (data_->reference_ == 0 && data_->str_)
-		{
-			GetAllocator()->DeleteArray<wchar_t >(data_->str_);
-			data_->str_ = nullptr;
-			GetAllocator()->Delete<WideStringData>(data_);
-		}
-
-		data_ = nullptr;
+		data_->reference_.Increase();
 	}
 }
 
-WideString & WideString::operator=(wchar_t  wch)
+WideString::WideString(WideString && str)
+	: BaseObject(str.GetAllocator()), data_(str.data_)
 {
-	Clear();
+	str.data_ = nullptr;
+}
 
-	if (wch == (wchar_t)0x0000)
+void WideString::Clear()
+{
+	if (data_)
 	{
-		return *this;
+		ReleaseData(data_);
+		data_ = nullptr;
 	}
+}
 
-	data_ = GetAllocator()->New<WideStringData>();
-	data_->length_ = 1;
-	data_->reference_.Increase();
-	data_->str_ = GetAllocator()->NewArray<wchar_t >(2);
-	data_->str_[0] = wch;
-	data_->str_[1] = (wchar_t)0x0000;
-
+WideString & WideString::operator=(wchar_t wch)
+{
+	Assign(&wch, wch == L'\0' ? 0 : 1);
 	return *this;
 }
 
-WideString& WideString::operator=(wchar_t const * pstr)
+WideString & WideString::operator=(wchar_t const * pstr)
 {
-	Clear();
+	Assign(pstr, pstr ? (uint32_t)wcslen(pstr) : 0);
+	return *this;
+}
 
-	if (pstr == nullptr)
+WideString & WideString::operator=(const WideString & str)
+{
+	if (this == &str || data_ == str.data_)
 	{
 		return *this;
 	}
-
-	uint32_t length = (uint32_t)wcslen(pstr);
-	if (length == 0)
+	if (str.GetAllocator() != GetAllocator())
 	{
+		//the shared block is freed by the allocator of its owner
+		Assign(str.GetData(), str.GetLength());
 		return *this;
 	}
-
-	data_ = GetAllocator()->New<WideStringData>();
-	data_->reference_.Increase();
-	data_->length_ = length;
-	data_->str_ = GetAllocator()->NewArray<wchar_t >(length + 1);
-	wcscpy(data_->str_, pstr);
+	if (str.data_)
+	{
+		str.data_->reference_.Increase();
+	}
+	Clear();
+	data_ = str.data_;
 	return *this;
 }
 
-WideString & WideString::operator=(const WideString & str)
+WideString & WideString::operator=(WideString && str)
 {
 	if (this == &str)
 	{
 		return *this;
 	}
-
-	if (data_ == str.data_)
+	if (str.GetAllocator() != GetAllocator())
 	{
+		Assign(str.GetData(), str.GetLength());
 		return *this;
 	}
-
 	Clear();
-
-	if (str.data_)
-	{
-		data_ = str.data_;
-		str.data_->reference_.Increase();
-	}
-
+	data_ = str.data_;
+	str.data_ = nullptr;
 	return *this;
 }
 
 bool WideString::operator==(wchar_t wch) const
 {
-	if (data_ == nullptr || wcslen(data_->str_) == 0)
+	if (wch == L'\0')
 	{
-		if (wch == '\0')
-		{
-			return true;
-		}
-		else{
-			return false;
-		}
-	}
-	else{
-		if (data_->length_ != 1)
-		{
-			return false;
-		}
-		else{
-			if (data_->str_[0] == wch)
-			{
-				return true;
-			}
-			else{
-				return false;
-			}
-		}
+		return GetLength() == 0;
 	}
+	return GetLength() == 1 && data_->GetString()[0] == wch;
 }
 
-bool WideString::operator==(wchar_t const * pstr)const
+bool WideString::operator==(wchar_t const * pstr) const
 {
-	if (data_ == nullptr || wcslen(data_->str_) == 0)
+	uint32_t length = pstr ? (uint32_t)wcslen(pstr) : 0;
+	if (length != GetLength())
 	{
-		if (pstr == nullptr || wcslen(pstr) == 0)
-		{
-			return true;
-		}
-		else{
-			return false;
-		}
-	}
-	else{
-		if (pstr == nullptr)
-		{
-			if (data_->str_ == nullptr)
-			{
-				return true;
-			}
-			else{
-				return false;
-			}
-		}
-		else{
-			if (wcscmp(data_->str_, pstr) == 0)
-			{
-				return true;
-			}
-			else{
-				return false;
-			}
-		}
+		return false;
 	}
+	return length == 0 || memcmp(data_->GetString(), pstr, sizeof(wchar_t) * length) == 0;
 }
 
-bool WideString::operator==(const WideString & str)const
+bool WideString::operator==(const WideString & str) const
 {
-	if (this == &str)
+	if (this == &str || data_ == str.data_)
 	{
 		return true;
 	}
-	else{
-		if (data_ == str.data_)
-		{
-			return true;
-		}
-		else{
-			if (data_ == nullptr)
-			{
-				return false;
-			}
-			else{
-				if (wcscmp(data_->str_, str.data_->str_) == 0)
-				{
-					return true;
-				}
-				else{
-					return false;
-				}
-			}
-		}
+	uint32_t length = GetLength();
+	if (length != str.GetLength())
+	{
+		return false;
 	}
+	return length == 0 || memcmp(data_->GetString(), str.data_->GetString(), sizeof(wchar_t) * length) == 0;
 }
 
 bool WideString::SetData(wchar_t * pData, uint32_t length)
 {
-	if (pData == nullptr || length == 0)
+	Assign(pData, pData ? length : 0);
+	return true;
+}
+
+wchar_t * WideString::GetBuffer(uint32_t capacity)
+{
+	uint32_t length = GetLength();
+	if (capacity < length)
 	{
-		Clear();
-		return true;
+		capacity = length;
+	}
+	if (capacity == 0)
+	{
+		return nullptr;
+	}
+	if (data_ && data_->reference_ == 1 && data_->capacity_ >= capacity)
+	{
+		return data_->GetString();
 	}
+	WideStringData * data = NewData(capacity);
+	if (data == nullptr)
+	{
+		return nullptr;
+	}
+	if (length > 0)
+	{
+		memcpy(data->GetString(), data_->GetString(), sizeof(wchar_t) * length);
+	}
+	data->GetString()[length] = L'\0';
+	data->length_ = length;
+	Clear();
+	data_ = data;
+	return data_->GetString();
+}
+
+void WideString::ReleaseBuffer(uint32_t length)
+{
 	if (data_ == nullptr)
 	{
-		data_ = GetAllocator()->New<WideStringData>();
-		data_->reference_.Increase();
-		data_->length_ = length;
-		data_->str_ = GetAllocator()->NewArray<wchar_t >(length + 1);
-		memcpy(data_->str_, pData, length * sizeof(wchar_t));
-		data_->str_[length] = '\0';
+		return;
 	}
-	else{
-		data_->reference_.Decrease();
-		if (data_->reference_ == 0)
-		{
-			if (data_->str_)
-			{
-				GetAllocator()->DeleteArray<wchar_t >(data_->str_);
-			}
-			data_->reference_.Increase();
-			data_->length_ = length;
-			data_->str_ = GetAllocator()->NewArray<wchar_t >(length + 1);
-			memcpy(data_->str_, pData, length * sizeof(wchar_t));
-			data_->str_[length] = '\0';
-		}
-		else {
-			data_ = GetAllocator()->New<WideStringData>();
-			data_->reference_.Increase();
-			data_->length_ = length;
-			data_->str_ = GetAllocator()->NewArray<wchar_t >(length + 1);
-			memcpy(data_->str_, pData, length * sizeof(wchar_t));
-			data_->str_[length] = '\0';
-		}
+	if (length == 0)
+	{
+		Clear();
+		return;
 	}
-	return true;
+	data_->length_ = length;
+	data_->GetString()[length] = L'\0';
 }
 
 wchar_t const * WideString::GetData() const
 {
-	return (data_) ? data_->str_ : nullptr;
+	return data_ ? data_->GetString() : nullptr;
 }
 
 uint32_t WideString::GetLength() const
 {
-	if (data_ == nullptr)
-	{
-		return 0;
-	}
-	else{
-		return data_->length_;
-	}
+	return data_ ? data_->length_ : 0;
 }
 
 wchar_t WideString::operator[](uint32_t index) const
 {
-	if (data_ != nullptr)
+	if (index >= GetLength())
 	{
-		if (index >= data_->length_)
-		{
-			return 0;
-		}
-		else if (data_->str_)
-		{
-			return data_->str_[index];
-		}
-		else{
-			return 0;
-		}
-	}
-	else{
 		return 0;
 	}
+	return data_->GetString()[index];
 }
 
 int32_t WideString::GetInteger() const
@@ -1235,464 +981,557 @@ FLOAT WideString::GetFloat() const
 
 WideString WideString::operator+(wchar_t wch)
 {
-	if (data_ == nullptr || data_->str_ == nullptr)
-	{
-		return WideString(wch, GetAllocator());
-	}
-
-	size_t length = data_->length_ + 2;
-	wchar_t  * pTestr_ = GetAllocator()->NewArray<wchar_t >(length);
+	WideString str(*this);
+	str += wch;
+	return str;
+}
 
-	wcscpy(pTestr_, data_->str_);
-	pTestr_[length - 2] = wch;
-	pTestr_[length - 1] = '\0';
+WideString WideString::operator+(wchar_t const * pstr)
+{
+	WideString str(*this);
+	str += pstr;
+	return str;
+}
 
-	WideString tstr_ing(pTestr_);
-	GetAllocator()->DeleteArray<wchar_t >(pTestr_);
-	return tstr_ing;
+WideString WideString::operator+(const WideString & str)
+{
+	WideString strRet(*this);
+	strRet += str;
+	return strRet;
 }
 
-WideString WideString::operator+(wchar_t const * pstr)
+WideString & WideString::operator+=(wchar_t wch)
 {
-	if (pstr == nullptr)
+	if (wch != 0)
 	{
-		return WideString(*this);
+		Append(&wch, 1);
 	}
+	return *this;
+}
 
-	if (data_ == nullptr || data_->str_ == nullptr)
+WideString & WideString::operator+=(wchar_t const * pstr)
+{
+	if (pstr != nullptr)
 	{
-		return WideString(pstr);
+		Append(pstr, (uint32_t)wcslen(pstr));
 	}
+	return *this;
+}
 
-	uint32_t length = data_->length_ + (uint32_t)wcslen(pstr);
-	wchar_t  * pTestr_ = GetAllocator()->NewArray<wchar_t >(length + 1);
-	wcscpy(pTestr_, data_->str_);
-	wcscat(pTestr_, pstr);
-	data_->length_ = length;
+WideString & WideString::operator+=(const WideString & str)
+{
+	Append(str.GetData(), str.GetLength());
+	return *this;
+}
 
-	WideString tstr_ing(pTestr_);
-	GetAllocator()->DeleteArray<wchar_t >(pTestr_);
-	return tstr_ing;
+bool WideString::operator!=(wchar_t wch) const
+{
+	return !(*this == wch);
 }
 
-WideString WideString::operator+(const WideString & str)
+bool WideString::operator!=(wchar_t const * pstr) const
+{
+	return !(*this == pstr);
+}
+
+bool WideString::operator!=(const WideString & str) const
+{
+	return !(*this == str);
+}
+
+bool operator==(wchar_t  wch, WideString & str)
+{
+	return (str == wch);
+}
+
+bool operator==(wchar_t const * pstr, const WideString & str)
 {
-	if (str.data_ == nullptr)
+	return (str == pstr);
+}
+
+WideString operator+(wchar_t wch, const WideString & str)
+{
+	WideString testr_(wch, str.GetAllocator());
+	testr_ += str;
+	return testr_;
+}
+
+WideString operator+(wchar_t const * pstr, const WideString & str)
+{
+	WideString testr_(pstr, (uint32_t)wcslen(pstr), str.GetAllocator());
+	testr_ += str;
+	return testr_;
+}
+
+bool operator!=(wchar_t  wch, const WideString & str)
+{
+	return (str != wch);
+}
+
+bool operator!=(wchar_t const * pstr, const WideString & str)
+{
+	return (str != pstr);
+}
+
+uint32_t StringToUINT32(const ByteString & str)
+{
+	if (str.GetLength() == 0)
 	{
-		return WideString(*this);
+		return 0;
 	}
-
-	if (data_ == nullptr || data_->str_ == nullptr)
+	size_t length = 4;
+	if (str.GetLength() < length)
 	{
-		return WideString(str);
+		length = str.GetLength();
+	}
+	uint32_t valRet = 0;
+	for (size_t i = length; i > 0; --i)
+	{
+		valRet = valRet << 8;
+		valRet |= str.GetData()[i - 1];
 	}
+	return valRet;
+}
 
-	uint32_t length = data_->length_ + str.data_->length_;
-	wchar_t  * pTestr_ = GetAllocator()->NewArray<wchar_t >(length + 1);
+//digits kept in the 64 bit mantissa, later ones only move the exponent
+#define PDF_NUMBER_MAX_DIGITS	19
 
-	wcscpy(pTestr_, data_->str_);
-	wcscat(pTestr_, str.data_->str_);
-	data_->length_ = length;
+#if defined(_WIN32) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define PDF_NUMBER_SWAR
+#endif
 
-	WideString tstr_ing(pTestr_);
-	GetAllocator()->DeleteArray<wchar_t >(pTestr_);
-	return tstr_ing;
+#ifdef PDF_NUMBER_SWAR
+// Eight ASCII digits at once, the first digit is in the lowest byte.
+static inline bool swar_is_8_digits(uint64_t chunk)
+{
+	return ((chunk & 0xF0F0F0F0F0F0F0F0ull) == 0x3030303030303030ull) &&
+		(((chunk + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) == 0x3030303030303030ull);
 }
 
-WideString & WideString::operator+=(wchar_t wch)
+static inline uint32_t swar_parse_8_digits(uint64_t chunk)
 {
-	if (wch == 0)
-	{
-		return *this;
-	}
+	chunk -= 0x3030303030303030ull;
+	chunk = (chunk * 10) + (chunk >> 8);
+	chunk = (((chunk & 0x000000FF000000FFull) * (100 + (1000000ull << 32))) +
+		(((chunk >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+	return (uint32_t)chunk;
+}
+#endif
 
-	if (data_ == nullptr)
+// Adds a run of digits to the mantissa, returns the digits read.
+static inline uint32_t parse_digits(const char * data, uint32_t length, uint64_t & mantissa,
+									uint32_t & digits, int32_t & dropped)
+{
+	uint32_t i = 0;
+#ifdef PDF_NUMBER_SWAR
+	while (i + 8 <= length && digits + 8 <= PDF_NUMBER_MAX_DIGITS)
 	{
-		data_ = GetAllocator()->New<WideStringData>();
-		data_->reference_.Increase();
-		data_->length_ = 1;
-		data_->str_ = GetAllocator()->NewArray<wchar_t >(2);
-		data_->str_[0] = wch;
-		data_->str_[1] = '\0';
+		uint64_t chunk;
+		memcpy(&chunk, data + i, 8);
+		if (!swar_is_8_digits(chunk))
+		{
+			break;
+		}
+		mantissa = mantissa * 100000000ull + swar_parse_8_digits(chunk);
+		if (mantissa != 0)
+		{
+			digits += 8;
+		}
+		i += 8;
 	}
-	else{
-		if (data_->str_ == nullptr)
+#endif
+	for (; i < length; i++)
+	{
+		uint32_t digit = (uint8_t)data[i] - '0';
+		if (digit > 9)
 		{
-			data_->length_ = 1;
-			data_->reference_.Increase();
-			data_->str_ = GetAllocator()->NewArray<wchar_t >(2);
-			data_->str_[0] = wch;
-			data_->str_[1] = '\0';
-			return *this;
+			break;
 		}
-
-		wchar_t *  pTestr_ = GetAllocator()->NewArray<wchar_t >(wcslen(data_->str_) + 2);
-		wcscpy(pTestr_, data_->str_);
-
-		data_->reference_.Decrease();
-		if (data_->reference_ == 0)
+		if (digits < PDF_NUMBER_MAX_DIGITS)
 		{
-			if (data_->str_)
+			mantissa = mantissa * 10 + digit;
+			//leading zeros take no room
+			if (mantissa != 0)
 			{
-				GetAllocator()->DeleteArray<wchar_t >(data_->str_);
-				data_->str_ = nullptr;
+				digits++;
 			}
-			data_->length_ = 0;
-			data_->reference_.Increase();
-		}
-		else{
-			data_ = GetAllocator()->New<WideStringData>();
-			data_->length_ = 0;
-			data_->reference_.Increase();
-			data_->str_ = nullptr;
+		}else{
+			dropped++;
 		}
-
-		uint32_t dwBufferSize = (uint32_t)wcslen(pTestr_) + 2;
-		data_->str_ = GetAllocator()->NewArray<wchar_t >(dwBufferSize);
-		wcscpy(data_->str_, pTestr_);
-		data_->str_[dwBufferSize - 2] = wch;
-		data_->str_[dwBufferSize - 1] = '\0';
-		data_->length_ = dwBufferSize - 1;
-
-		GetAllocator()->DeleteArray<wchar_t >(pTestr_);
 	}
-	return *this;
+	return i;
 }
 
-WideString & WideString::operator+=(wchar_t const * pstr)
+uint32_t ParsePdfNumber(const char * data, uint32_t length, int32_t & integerRet, FLOAT & floatRet, bool & bIntegerRet)
 {
-	if (pstr == nullptr)
+	//10^0 to 10^22 are exact in a double
+	static const double powers[] =
 	{
-		return *this;
-	}
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
 
-	if (wcslen(pstr) == 0)
+	integerRet = 0;
+	floatRet = 0;
+	bIntegerRet = false;
+	if (data == nullptr || length == 0)
 	{
-		return *this;
+		return 0;
 	}
 
-	if (data_ == nullptr)
+	uint32_t i = 0;
+	while (i < length && (data[i] == ' ' || data[i] == '\t' || data[i] == '\r' || data[i] == '\n' ||
+		   data[i] == '\f' || data[i] == '\0'))
 	{
-		uint32_t length = (uint32_t)wcslen(pstr);
-		data_ = GetAllocator()->New<WideStringData>();
-		data_->reference_.Increase();
-		data_->str_ = GetAllocator()->NewArray<wchar_t >(length + 1);
-		wcscpy(data_->str_, pstr);
-		data_->length_ = length;
+		i++;
 	}
-	else{
-		if (data_->str_ == nullptr)
-		{
-			uint32_t length = (uint32_t)wcslen(pstr);
-			data_->str_ = GetAllocator()->NewArray<wchar_t >(length + 1);
-			wcscpy(data_->str_, pstr);
-			data_->length_ = length;
-			data_->reference_.Increase();
-			return *this;
-		}
-
-		wchar_t * pTestr_ = GetAllocator()->NewArray<wchar_t >(wcslen(data_->str_) + 1);
-		wcscpy(pTestr_, data_->str_);
-
-		data_->reference_.Decrease();
-		if (data_->reference_ == 0)
-		{
-			if (data_->str_)
-			{
-				GetAllocator()->DeleteArray<wchar_t >(data_->str_);
-				data_->str_ = nullptr;
-			}
-			data_->length_ = 0;
-			data_->reference_.Increase();
-		}
-		else{
-			data_ = GetAllocator()->New<WideStringData>();
-			data_->length_ = 0;
-			data_->reference_.Increase();
-			data_->str_ = nullptr;
-		}
-
-		uint32_t length = (uint32_t)wcslen(pTestr_) + (uint32_t)wcslen(pstr);
-		data_->str_ = GetAllocator()->NewArray<wchar_t >(length + 1);
-		wcscpy(data_->str_, pTestr_);
-		wcscat(data_->str_, pstr);
-		data_->length_ = length;
+	bool bNegative = false;
+	if (i < length && (data[i] == '+' || data[i] == '-'))
+	{
+		bNegative = (data[i] == '-');
+		i++;
 	}
 
-	return *this;
-}
-
-WideString & WideString::operator+=(const WideString & str)
-{
-	if (str.data_ == nullptr || str.data_->str_ == nullptr)
+	uint64_t mantissa = 0;
+	uint32_t digits = 0;
+	int32_t dropped = 0;
+	uint32_t count = parse_digits(data + i, length - i, mantissa, digits, dropped);
+	i += count;
+	bool bPoint = false;
+	int32_t exponent = dropped;
+	if (i < length && data[i] == '.')
 	{
-		return *this;
+		bPoint = true;
+		i++;
+		//fraction digits that fit scale the mantissa down, the others are ignored
+		int32_t fractionDropped = 0;
+		uint32_t fraction = parse_digits(data + i, length - i, mantissa, digits, fractionDropped);
+		exponent -= (int32_t)fraction - fractionDropped;
+		count += fraction;
+		i += fraction;
+	}
+	if (count == 0)
+	{
+		return 0;
 	}
 
-	if (this == &str)
+	if (!bPoint && dropped == 0 && mantissa <= (bNegative ? 0x80000000ull : 0x7FFFFFFFull))
 	{
-		wchar_t * pTestr_ = GetAllocator()->NewArray<wchar_t >(wcslen(data_->str_) + 1);
-		wcscpy(pTestr_, data_->str_);
+		integerRet = bNegative ? (int32_t)(0 - (uint32_t)mantissa) : (int32_t)mantissa;
+		floatRet = (FLOAT)integerRet;
+		bIntegerRet = true;
+		return i;
+	}
 
-		data_->reference_.Decrease();
-		if (data_->reference_ == 0)
+	double value = (double)mantissa;
+	//exact when the mantissa fits 53 bits, close enough for PDF otherwise
+	if (exponent < 0)
+	{
+		int32_t e = -exponent;
+		while (e > 22)
 		{
-			if (data_->str_)
-			{
-				GetAllocator()->DeleteArray<wchar_t >(data_->str_);
-				data_->str_ = nullptr;
-			}
-			data_->length_ = 0;
-			data_->reference_.Increase();
+			value /= powers[22];
+			e -= 22;
 		}
-		else{
-			data_ = GetAllocator()->New<WideStringData>();
-			data_->length_ = 0;
-			data_->reference_.Increase();
-			data_->str_ = nullptr;
-		}
-
-		uint32_t length = (uint32_t)wcslen(pTestr_) * 2;
-		data_->str_ = GetAllocator()->NewArray<wchar_t >(length + 1);
-		wcscpy(data_->str_, pTestr_);
-		wcscat(data_->str_, pTestr_);
-
-		data_->length_ = length;
-
-		GetAllocator()->DeleteArray<wchar_t >(pTestr_);
-		pTestr_ = nullptr;
-
-		return *this;
-	}
-	else{
-		if (data_ == str.data_)
+		value /= powers[e];
+	}else if (exponent > 0)
+	{
+		int32_t e = exponent;
+		while (e > 22)
 		{
-			wchar_t *  pTestr_ = GetAllocator()->NewArray<wchar_t >(wcslen(data_->str_) + 1);
-			wcscpy(pTestr_, data_->str_);
-
-			data_->reference_.Decrease();
-			data_->reference_.Decrease();
-			if (data_->reference_ == 0)
-			{
-				if (data_->str_)
-				{
-					GetAllocator()->DeleteArray<wchar_t >(data_->str_);
-					data_->str_ = nullptr;
-				}
-				data_->length_ = 0;
-				data_->reference_.Increase();
-				data_->reference_.Increase();
-			}
-			else{
-				data_ = GetAllocator()->New<WideStringData>();
-				data_->reference_.Increase();
-				data_->reference_.Increase();
-				data_->str_ = nullptr;
-				data_->length_ = 0;
-			}
-
-			uint32_t length = (uint32_t)wcslen(pTestr_) * 2;
-			data_->str_ = GetAllocator()->NewArray<wchar_t >(length + 1);
-			wcscpy(data_->str_, pTestr_);
-			wcscat(data_->str_, pTestr_);
-
-			data_->length_ = length;
-
-			GetAllocator()->DeleteArray<wchar_t >(pTestr_);
-			pTestr_ = nullptr;
-
-			return *this;
+			value *= powers[22];
+			e -= 22;
 		}
-		else{
-			if (data_->str_ == nullptr)
-			{
-				size_t length = wcslen(str.data_->str_);
-				data_->str_ = GetAllocator()->NewArray<wchar_t >(length + 1);
-				wcscpy(data_->str_, str.data_->str_);
-				return *this;
-			}
+		value *= powers[e];
+	}
+	if (bNegative)
+	{
+		value = -value;
+	}
+	floatRet = (FLOAT)value;
+	if (value >= 2147483647.0)
+	{
+		integerRet = 0x7FFFFFFF;
+	}else if (value <= -2147483648.0)
+	{
+		integerRet = (int32_t)0x80000000;
+	}else{
+		integerRet = (int32_t)value;
+	}
+	return i;
+}
 
-			wchar_t * pTestr_ = GetAllocator()->NewArray<wchar_t >(wcslen(data_->str_) + 1);
-			wcscpy(pTestr_, data_->str_);
+// Header of a builder chunk, the bytes follow it in the same allocation.
+struct StringBuilderChunk
+{
+	char * GetData() { return (char *)(this + 1); }
 
-			if (data_->reference_ == 1)
-			{
-				if (data_->str_)
-				{
-					GetAllocator()->DeleteArray<wchar_t >(data_->str_);
-					data_->str_ = nullptr;
-					data_->length_ = 0;
-				}
-			}
-			else{
-				data_->reference_.Decrease();
-				data_ = GetAllocator()->New<WideStringData>();
-				data_->length_ = 0;
-				data_->reference_.Increase();
-				data_->str_ = nullptr;
-			}
+	StringBuilderChunk *    next_;
+	size_t                  size_;
+	size_t                  capacity_;
+};
 
-			uint32_t length = (uint32_t)wcslen(str.data_->str_);
-			length += wcslen(pTestr_);
-			data_->str_ = GetAllocator()->NewArray<wchar_t >(length + 1);
-			wcscpy(data_->str_, pTestr_);
-			wcscat(data_->str_, str.data_->str_);
+static const char gDigitPairs[201] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
 
-			GetAllocator()->DeleteArray<wchar_t >(pTestr_);
-			pTestr_ = nullptr;
+//writes the digits backward ending at end, returns the first one
+static inline char * format_digits(uint64_t value, char * end)
+{
+	while (value >= 100)
+	{
+		uint32_t pair = (uint32_t)(value % 100) * 2;
+		value /= 100;
+		*--end = gDigitPairs[pair + 1];
+		*--end = gDigitPairs[pair];
+	}
+	if (value >= 10)
+	{
+		*--end = gDigitPairs[value * 2 + 1];
+		*--end = gDigitPairs[value * 2];
+	}
+	else
+	{
+		*--end = (char)('0' + value);
+	}
+	return end;
+}
 
-			data_->length_ = length;
+StringBuilder::StringBuilder(Allocator * allocator)
+	: BaseObject(allocator), head_(nullptr), tail_(nullptr), size_(0) {}
 
-			return *this;
-		}
+StringBuilder::~StringBuilder()
+{
+	Clear();
+	if (head_)
+	{
+		GetAllocator()->Free(head_);
+		head_ = nullptr;
+		tail_ = nullptr;
 	}
 }
 
-bool WideString::operator!=(wchar_t  wch) const
+bool StringBuilder::NewChunk(size_t size)
 {
-	if (data_ == nullptr)
+	size_t capacity = STRINGBUILDER_CHUNK_SIZE;
+	if (tail_)
 	{
-		if (wch == 0)
+		capacity = tail_->capacity_ * 2;
+		if (capacity > STRINGBUILDER_CHUNK_MAX_SIZE)
 		{
-			return false;
-		}
-		else{
-			return true;
+			capacity = STRINGBUILDER_CHUNK_MAX_SIZE;
 		}
 	}
-	else{
-		if (data_->length_ != 1)
-		{
-			return true;
-		}
-		else{
-			if (data_->str_[0] == wch)
-			{
-				return false;
-			}
-			else{
-				return true;
-			}
-		}
+	//a big piece gets a chunk of its own instead of being split
+	if (capacity < size)
+	{
+		capacity = size;
+	}
+	void * block = GetAllocator()->Alloc(sizeof(StringBuilderChunk) + capacity);
+	if (block == nullptr)
+	{
+		return false;
+	}
+	StringBuilderChunk * chunk = (StringBuilderChunk *)block;
+	chunk->next_ = nullptr;
+	chunk->size_ = 0;
+	chunk->capacity_ = GetAllocator()->GetSize(block) - sizeof(StringBuilderChunk);
+	if (tail_)
+	{
+		tail_->next_ = chunk;
 	}
+	else
+	{
+		head_ = chunk;
+	}
+	tail_ = chunk;
+	return true;
 }
 
-bool WideString::operator!=(wchar_t const * pstr) const
+StringBuilder & StringBuilder::Append(const char * data, size_t size)
 {
-	if (data_ == nullptr)
+	if (data == nullptr)
 	{
-		if (pstr == nullptr || wcslen(pstr) == 0)
-		{
-			return false;
-		}
-		else{
-			return true;
-		}
+		return *this;
 	}
-	else{
-		if (pstr == nullptr)
+	while (size > 0)
+	{
+		if (tail_ == nullptr || tail_->size_ == tail_->capacity_)
 		{
-			if (data_->str_ == nullptr)
+			if (!NewChunk(size))
 			{
-				return false;
-			}
-			else{
-				return true;
+				break;
 			}
 		}
-		else{
-			if (wcscmp(data_->str_, pstr) == 0)
-			{
-				return false;
-			}
-			else{
-				return true;
-			}
+		size_t count = tail_->capacity_ - tail_->size_;
+		if (count > size)
+		{
+			count = size;
 		}
+		memcpy(tail_->GetData() + tail_->size_, data, count);
+		tail_->size_ += count;
+		size_ += count;
+		data += count;
+		size -= count;
 	}
+	return *this;
 }
 
-bool WideString::operator!=(const WideString & str) const
+StringBuilder & StringBuilder::Append(const char * str)
 {
-	if (this == &str)
+	if (str == nullptr)
 	{
-		return false;
-	}
-	else{
-		if (data_ == str.data_)
-		{
-			return false;
-		}
-		else{
-			if (data_ == nullptr)
-			{
-				return true;
-			}
-			else{
-				if (wcscmp(data_->str_, str.data_->str_) == 0)
-				{
-					return false;
-				}
-				else{
-					return true;
-				}
-			}
-		}
+		return *this;
 	}
+	return Append(str, strlen(str));
 }
 
-bool operator==(wchar_t  wch, WideString & str)
+StringBuilder & StringBuilder::Append(const ByteString & str)
 {
-	return (str == wch);
+	return Append(str.GetData(), str.GetLength());
 }
 
-bool operator==(wchar_t const * pstr, const WideString & str)
+StringBuilder & StringBuilder::Append(char ch)
 {
-	return (str == pstr);
+	if (tail_ && tail_->size_ < tail_->capacity_)
+	{
+		tail_->GetData()[tail_->size_++] = ch;
+		size_++;
+		return *this;
+	}
+	return Append(&ch, 1);
 }
 
-WideString operator+(wchar_t wch, const WideString & str)
+StringBuilder & StringBuilder::AppendInteger(int64_t value)
 {
-	WideString testr_(wch, str.GetAllocator());
-	testr_ += str;
-	return testr_;
+	char buffer[24];
+	char * end = buffer + sizeof(buffer);
+	char * start = format_digits(value < 0 ? 0 - (uint64_t)value : (uint64_t)value, end);
+	if (value < 0)
+	{
+		*--start = '-';
+	}
+	return Append(start, end - start);
 }
 
-WideString operator+(wchar_t const * pstr, const WideString & str)
+StringBuilder & StringBuilder::AppendFloat(FLOAT value)
 {
-	WideString testr_(pstr, (uint32_t)wcslen(pstr), str.GetAllocator());
-	testr_ += str;
-	return testr_;
+	double v = value;
+	//nan and the infinities have no PDF syntax, and the scaling below never ends on inf
+	if (!std::isfinite(v))
+	{
+		return Append('0');
+	}
+	bool bNegative = v < 0;
+	if (bNegative)
+	{
+		v = -v;
+	}
+	char buffer[64];
+	char * end = buffer + sizeof(buffer);
+	char * start = end;
+	if (v < 1e13)
+	{
+		uint64_t scaled = (uint64_t)(v * 100000 + 0.5);
+		if (scaled == 0)
+		{
+			return Append('0');
+		}
+		uint32_t fraction = (uint32_t)(scaled % 100000);
+		if (fraction != 0)
+		{
+			uint32_t digits = 5;
+			while (fraction % 10 == 0)
+			{
+				fraction /= 10;
+				digits--;
+			}
+			for (uint32_t i = 0; i < digits; i++)
+			{
+				*--start = (char)('0' + fraction % 10);
+				fraction /= 10;
+			}
+			*--start = '.';
+		}
+		start = format_digits(scaled / 100000, start);
+	}
+	else
+	{
+		//past float precision, the low digits are zeros
+		uint32_t zeros = 0;
+		while (v >= 1e18)
+		{
+			v /= 10;
+			zeros++;
+		}
+		end -= zeros;
+		memset(end, '0', zeros);
+		start = format_digits((uint64_t)(v + 0.5), end);
+		end += zeros;
+	}
+	if (bNegative)
+	{
+		*--start = '-';
+	}
+	return Append(start, end - start);
 }
 
-bool operator!=(wchar_t  wch, const WideString & str)
+ByteString StringBuilder::GetString() const
 {
-	return (str != wch);
+	ByteString str(GetAllocator());
+	if (size_ == 0 || size_ > 0xFFFFFFFF)
+	{
+		return str;
+	}
+	uint8_t * buffer = str.GetBuffer((uint32_t)size_);
+	if (buffer == nullptr)
+	{
+		return str;
+	}
+	for (StringBuilderChunk * chunk = head_; chunk != nullptr; chunk = chunk->next_)
+	{
+		memcpy(buffer, chunk->GetData(), chunk->size_);
+		buffer += chunk->size_;
+	}
+	str.ReleaseBuffer((uint32_t)size_);
+	return str;
 }
 
-bool operator!=(wchar_t const * pstr, const WideString & str)
+bool StringBuilder::Flush(IWrite * pWrite)
 {
-	return (str != pstr);
+	if (pWrite == nullptr)
+	{
+		return false;
+	}
+	for (StringBuilderChunk * chunk = head_; chunk != nullptr; chunk = chunk->next_)
+	{
+		if (chunk->size_ > 0 && !pWrite->WriteBlock(chunk->GetData(), chunk->size_))
+		{
+			return false;
+		}
+	}
+	Clear();
+	return true;
 }
 
-uint32_t StringToUINT32(const ByteString & str)
+void StringBuilder::Clear()
 {
-	if (str.GetLength() == 0)
+	if (head_ == nullptr)
 	{
-		return 0;
-	}
-	size_t length = 4;
-	if (str.GetLength() < length)
-	{
-		length = str.GetLength();
+		return;
 	}
-	uint32_t valRet = 0;
-	for (size_t i = length; i > 0; --i)
+	StringBuilderChunk * chunk = head_->next_;
+	while (chunk)
 	{
-		valRet = valRet << 8;
-		valRet |= str.GetData()[i - 1];
+		StringBuilderChunk * next = chunk->next_;
+		GetAllocator()->Free(chunk);
+		chunk = next;
 	}
-	return valRet;
+	head_->next_ = nullptr;
+	head_->size_ = 0;
+	tail_ = head_;
+	size_ = 0;
 }
 
 }//end of namespce chelib
@@ -1,6 +1,13 @@
 #include <memory>
+#include <cstring>
 
 #include "../include/che_crypto_aes.h"
+#include "../include/che_base_cpu.h"
+
+#ifdef _CHE_X86_
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#endif
 
 namespace chepdf {
     
@@ -917,9 +924,189 @@ static unsigned char rcon[30] =
 	0xb3, 0x7d, 0xfa, 0xef, 0xc5, 0x91
 };
 
+#ifdef _CHE_X86_
+
+// AES-NI versions of the ECB/CBC loops. keys points at expanded_key_, which already
+// holds the equivalent inverse cipher schedule when initialised for decryption.
+
+CHE_TARGET_ATTRIBUTE("aes,sse2")
+static void aesni_encrypt_ecb(const uint8_t * keys, uint32_t rounds, const uint8_t * input, uint8_t * output, size_t blocks)
+{
+	__m128i k[_MAX_ROUNDS + 1];
+	for (uint32_t r = 0; r <= rounds; r++)
+	{
+		k[r] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + 16 * r));
+	}
+	for (; blocks >= 4; blocks -= 4)
+	{
+		__m128i b0 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input)), k[0]);
+		__m128i b1 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 16)), k[0]);
+		__m128i b2 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 32)), k[0]);
+		__m128i b3 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 48)), k[0]);
+		for (uint32_t r = 1; r < rounds; r++)
+		{
+			b0 = _mm_aesenc_si128(b0, k[r]);
+			b1 = _mm_aesenc_si128(b1, k[r]);
+			b2 = _mm_aesenc_si128(b2, k[r]);
+			b3 = _mm_aesenc_si128(b3, k[r]);
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output), _mm_aesenclast_si128(b0, k[rounds]));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output + 16), _mm_aesenclast_si128(b1, k[rounds]));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output + 32), _mm_aesenclast_si128(b2, k[rounds]));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output + 48), _mm_aesenclast_si128(b3, k[rounds]));
+		input += 64;
+		output += 64;
+	}
+	for (; blocks > 0; blocks--)
+	{
+		__m128i b = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input)), k[0]);
+		for (uint32_t r = 1; r < rounds; r++)
+		{
+			b = _mm_aesenc_si128(b, k[r]);
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output), _mm_aesenclast_si128(b, k[rounds]));
+		input += 16;
+		output += 16;
+	}
+}
+
+// CBC encryption is serial by nature, iv is updated to the last ciphertext block.
+CHE_TARGET_ATTRIBUTE("aes,sse2")
+static void aesni_encrypt_cbc(const uint8_t * keys, uint32_t rounds, uint8_t iv[16], const uint8_t * input, uint8_t * output, size_t blocks)
+{
+	__m128i k[_MAX_ROUNDS + 1];
+	for (uint32_t r = 0; r <= rounds; r++)
+	{
+		k[r] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + 16 * r));
+	}
+	__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iv));
+	for (; blocks > 0; blocks--)
+	{
+		b = _mm_xor_si128(b, _mm_loadu_si128(reinterpret_cast<const __m128i*>(input)));
+		b = _mm_xor_si128(b, k[0]);
+		for (uint32_t r = 1; r < rounds; r++)
+		{
+			b = _mm_aesenc_si128(b, k[r]);
+		}
+		b = _mm_aesenclast_si128(b, k[rounds]);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output), b);
+		input += 16;
+		output += 16;
+	}
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(iv), b);
+}
+
+CHE_TARGET_ATTRIBUTE("aes,sse2")
+static void aesni_decrypt_ecb(const uint8_t * keys, uint32_t rounds, const uint8_t * input, uint8_t * output, size_t blocks)
+{
+	__m128i k[_MAX_ROUNDS + 1];
+	for (uint32_t r = 0; r <= rounds; r++)
+	{
+		k[r] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + 16 * r));
+	}
+	for (; blocks >= 4; blocks -= 4)
+	{
+		__m128i b0 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input)), k[rounds]);
+		__m128i b1 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 16)), k[rounds]);
+		__m128i b2 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 32)), k[rounds]);
+		__m128i b3 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 48)), k[rounds]);
+		for (uint32_t r = rounds - 1; r > 0; r--)
+		{
+			b0 = _mm_aesdec_si128(b0, k[r]);
+			b1 = _mm_aesdec_si128(b1, k[r]);
+			b2 = _mm_aesdec_si128(b2, k[r]);
+			b3 = _mm_aesdec_si128(b3, k[r]);
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output), _mm_aesdeclast_si128(b0, k[0]));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output + 16), _mm_aesdeclast_si128(b1, k[0]));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output + 32), _mm_aesdeclast_si128(b2, k[0]));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output + 48), _mm_aesdeclast_si128(b3, k[0]));
+		input += 64;
+		output += 64;
+	}
+	for (; blocks > 0; blocks--)
+	{
+		__m128i b = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input)), k[rounds]);
+		for (uint32_t r = rounds - 1; r > 0; r--)
+		{
+			b = _mm_aesdec_si128(b, k[r]);
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output), _mm_aesdeclast_si128(b, k[0]));
+		input += 16;
+		output += 16;
+	}
+}
+
+// CBC decryption of four independent blocks at a time. Every input block is loaded
+// before anything is stored, so input and output may be the same buffer.
+CHE_TARGET_ATTRIBUTE("aes,sse2")
+static void aesni_decrypt_cbc(const uint8_t * keys, uint32_t rounds, uint8_t iv[16], const uint8_t * input, uint8_t * output, size_t blocks)
+{
+	__m128i k[_MAX_ROUNDS + 1];
+	for (uint32_t r = 0; r <= rounds; r++)
+	{
+		k[r] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + 16 * r));
+	}
+	__m128i prev = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iv));
+	for (; blocks >= 4; blocks -= 4)
+	{
+		__m128i c0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+		__m128i c1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 16));
+		__m128i c2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 32));
+		__m128i c3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 48));
+		__m128i b0 = _mm_xor_si128(c0, k[rounds]);
+		__m128i b1 = _mm_xor_si128(c1, k[rounds]);
+		__m128i b2 = _mm_xor_si128(c2, k[rounds]);
+		__m128i b3 = _mm_xor_si128(c3, k[rounds]);
+		for (uint32_t r = rounds - 1; r > 0; r--)
+		{
+			b0 = _mm_aesdec_si128(b0, k[r]);
+			b1 = _mm_aesdec_si128(b1, k[r]);
+			b2 = _mm_aesdec_si128(b2, k[r]);
+			b3 = _mm_aesdec_si128(b3, k[r]);
+		}
+		b0 = _mm_xor_si128(_mm_aesdeclast_si128(b0, k[0]), prev);
+		b1 = _mm_xor_si128(_mm_aesdeclast_si128(b1, k[0]), c0);
+		b2 = _mm_xor_si128(_mm_aesdeclast_si128(b2, k[0]), c1);
+		b3 = _mm_xor_si128(_mm_aesdeclast_si128(b3, k[0]), c2);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output), b0);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output + 16), b1);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output + 32), b2);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output + 48), b3);
+		prev = c3;
+		input += 64;
+		output += 64;
+	}
+	for (; blocks > 0; blocks--)
+	{
+		__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+		__m128i b = _mm_xor_si128(c, k[rounds]);
+		for (uint32_t r = rounds - 1; r > 0; r--)
+		{
+			b = _mm_aesdec_si128(b, k[r]);
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(output), _mm_xor_si128(_mm_aesdeclast_si128(b, k[0]), prev));
+		prev = c;
+		input += 16;
+		output += 16;
+	}
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(iv), prev);
+}
+
+#else
+
+// Never reached, b_aesni_ stays false off x86.
+static void aesni_encrypt_ecb(const uint8_t *, uint32_t, const uint8_t *, uint8_t *, size_t) {}
+static void aesni_encrypt_cbc(const uint8_t *, uint32_t, uint8_t *, const uint8_t *, uint8_t *, size_t) {}
+static void aesni_decrypt_ecb(const uint8_t *, uint32_t, const uint8_t *, uint8_t *, size_t) {}
+static void aesni_decrypt_cbc(const uint8_t *, uint32_t, uint8_t *, const uint8_t *, uint8_t *, size_t) {}
+
+#endif
+
 CryptoRijndael::CryptoRijndael()
 {
 	state_ = Invalid;
+	b_aesni_ = false;
 }
 
 CryptoRijndael::~CryptoRijndael()
@@ -1000,10 +1187,21 @@ int32_t CryptoRijndael::init(Mode mode, Direction dir, const unsigned char * key
 	{
 		keyEncToDec();
 	}
+	b_aesni_ = IsCPUFeatureSupported(CPU_FEATURE_AESNI);
 	state_ = Valid;
 	return RIJNDAEL_SUCCESS;
 }
 
+void CryptoRijndael::setInitVector(const uint8_t * initVector)
+{
+	if (initVector)
+	{
+		memcpy(init_vector_, initVector, MAX_IV_SIZE);
+	}else{
+		memset(init_vector_, 0, MAX_IV_SIZE);
+	}
+}
+
 int32_t CryptoRijndael::blockEncrypt(const unsigned char * input, int32_t inputLen, unsigned char * outBuffer)
 {
 	int32_t i, k, numBlocks;
@@ -1020,6 +1218,11 @@ int32_t CryptoRijndael::blockEncrypt(const unsigned char * input, int32_t inputL
 	switch (mode_)
 	{
 	case ECB:
+		if (b_aesni_)
+		{
+			aesni_encrypt_ecb(expanded_key_[0][0], rounds_, input, outBuffer, numBlocks);
+			break;
+		}
 		for (i = numBlocks; i > 0; i--)
 		{
 			encrypt(input, outBuffer);
@@ -1028,6 +1231,12 @@ int32_t CryptoRijndael::blockEncrypt(const unsigned char * input, int32_t inputL
 		}
 		break;
 	case CBC:
+		if (b_aesni_)
+		{
+			memcpy(block, init_vector_, 16);
+			aesni_encrypt_cbc(expanded_key_[0][0], rounds_, block, input, outBuffer, numBlocks);
+			break;
+		}
 		reinterpret_cast<uint32_t*>(block)[0] = reinterpret_cast<const uint32_t*>(init_vector_)[0] ^ reinterpret_cast<const uint32_t*>(input)[0];
 		reinterpret_cast<uint32_t*>(block)[1] = reinterpret_cast<const uint32_t*>(init_vector_)[1] ^ reinterpret_cast<const uint32_t*>(input)[1];
 		reinterpret_cast<uint32_t*>(block)[2] = reinterpret_cast<const uint32_t*>(init_vector_)[2] ^ reinterpret_cast<const uint32_t*>(input)[2];
@@ -1108,7 +1317,13 @@ int32_t CryptoRijndael::padEncrypt(const uint8_t * input, int32_t inputOctets, u
 	switch (mode_)
 	{
 	case ECB:
-		for (i = numBlocks; i > 0; i--)
+		if (b_aesni_)
+		{
+			aesni_encrypt_ecb(expanded_key_[0][0], rounds_, input, outBuffer, numBlocks);
+			input += 16 * numBlocks;
+			outBuffer += 16 * numBlocks;
+		}
+		else for (i = numBlocks; i > 0; i--)
 		{
 			encrypt(input, outBuffer);
 			input += 16;
@@ -1118,9 +1333,27 @@ int32_t CryptoRijndael::padEncrypt(const uint8_t * input, int32_t inputOctets, u
 		//assert(padLen > 0 && padLen <= 16);
 		memcpy(block, input, 16 - padLen);
 		memset(block + 16 - padLen, static_cast<int32_t>(padLen), padLen);
+		if (b_aesni_)
+		{
+			aesni_encrypt_ecb(expanded_key_[0][0], rounds_, block, outBuffer, 1);
+			break;
+		}
 		encrypt(block, outBuffer);
 		break;
 	case CBC:
+		if (b_aesni_)
+		{
+			uint8_t chain[16];
+			memcpy(chain, init_vector_, 16);
+			aesni_encrypt_cbc(expanded_key_[0][0], rounds_, chain, input, outBuffer, numBlocks);
+			input += 16 * numBlocks;
+			outBuffer += 16 * numBlocks;
+			padLen = 16 - (inputOctets - 16 * numBlocks);
+			memcpy(block, input, 16 - padLen);
+			memset(block + 16 - padLen, static_cast<int32_t>(padLen), padLen);
+			aesni_encrypt_cbc(expanded_key_[0][0], rounds_, chain, block, outBuffer, 1);
+			break;
+		}
 		iv = init_vector_;
 		for (i = numBlocks; i > 0; i--)
 		{
@@ -1171,6 +1404,11 @@ int32_t CryptoRijndael::blockDecrypt(const uint8_t * input, int32_t inputLen, ui
 	switch (mode_)
 	{
 	case ECB:
+		if (b_aesni_)
+		{
+			aesni_decrypt_ecb(expanded_key_[0][0], rounds_, input, outBuffer, numBlocks);
+			break;
+		}
 		for (i = numBlocks; i > 0; i--)
 		{
 			decrypt(input, outBuffer);
@@ -1179,6 +1417,12 @@ int32_t CryptoRijndael::blockDecrypt(const uint8_t * input, int32_t inputLen, ui
 		}
 		break;
 	case CBC:
+		if (b_aesni_)
+		{
+			memcpy(block, init_vector_, 16);
+			aesni_decrypt_cbc(expanded_key_[0][0], rounds_, block, input, outBuffer, numBlocks);
+			break;
+		}
 #if STRICT_ALIGN 
 		memcpy(iv,init_vector_,16);
 #else
@@ -1273,16 +1517,23 @@ int32_t CryptoRijndael::padDecrypt(const uint8_t * input, int32_t inputOctets, u
 	switch (mode_)
 	{
 	case ECB:
-		for (i = numBlocks - 1; i > 0; i--)
+		if (b_aesni_)
 		{
-			decrypt(input, outBuffer);
-			input += 16;
-			outBuffer += 16;
+			aesni_decrypt_ecb(expanded_key_[0][0], rounds_, input, outBuffer, numBlocks - 1);
+			input += 16 * (numBlocks - 1);
+			outBuffer += 16 * (numBlocks - 1);
+			aesni_decrypt_ecb(expanded_key_[0][0], rounds_, input, block, 1);
+		}else{
+			for (i = numBlocks - 1; i > 0; i--)
+			{
+				decrypt(input, outBuffer);
+				input += 16;
+				outBuffer += 16;
+			}
+			decrypt(input, block);
 		}
-
-		decrypt(input, block);
 		padLen = block[15];
-		if (padLen >= 16)return RIJNDAEL_CORRUPTED_DATA;
+		if (padLen <= 0 || padLen > 16)return RIJNDAEL_CORRUPTED_DATA;
 		for (i = 16 - padLen; i < 16; i++)
 		{
 			if (block[i] != padLen)return RIJNDAEL_CORRUPTED_DATA;
@@ -1291,25 +1542,34 @@ int32_t CryptoRijndael::padDecrypt(const uint8_t * input, int32_t inputOctets, u
 		break;
 	case CBC:
 		memcpy(iv, init_vector_, 16);
-		/* all blocks but last */
-		for (i = numBlocks - 1; i > 0; i--)
+		if (b_aesni_)
 		{
+			/* all blocks but last, then the last one into block */
+			aesni_decrypt_cbc(expanded_key_[0][0], rounds_, reinterpret_cast<uint8_t*>(iv), input, outBuffer, numBlocks - 1);
+			input += 16 * (numBlocks - 1);
+			outBuffer += 16 * (numBlocks - 1);
+			aesni_decrypt_cbc(expanded_key_[0][0], rounds_, reinterpret_cast<uint8_t*>(iv), input, block, 1);
+		}else{
+			/* all blocks but last */
+			for (i = numBlocks - 1; i > 0; i--)
+			{
+				decrypt(input, block);
+				reinterpret_cast<uint32_t*>(block)[0] ^= iv[0];
+				reinterpret_cast<uint32_t*>(block)[1] ^= iv[1];
+				reinterpret_cast<uint32_t*>(block)[2] ^= iv[2];
+				reinterpret_cast<uint32_t*>(block)[3] ^= iv[3];
+				memcpy(iv, input, 16);
+				memcpy(outBuffer, block, 16);
+				input += 16;
+				outBuffer += 16;
+			}
+			/* last block */
 			decrypt(input, block);
 			reinterpret_cast<uint32_t*>(block)[0] ^= iv[0];
 			reinterpret_cast<uint32_t*>(block)[1] ^= iv[1];
 			reinterpret_cast<uint32_t*>(block)[2] ^= iv[2];
 			reinterpret_cast<uint32_t*>(block)[3] ^= iv[3];
-			memcpy(iv, input, 16);
-			memcpy(outBuffer, block, 16);
-			input += 16;
-			outBuffer += 16;
 		}
-		/* last block */
-		decrypt(input, block);
-		reinterpret_cast<uint32_t*>(block)[0] ^= iv[0];
-		reinterpret_cast<uint32_t*>(block)[1] ^= iv[1];
-		reinterpret_cast<uint32_t*>(block)[2] ^= iv[2];
-		reinterpret_cast<uint32_t*>(block)[3] ^= iv[3];
 		padLen = block[15];
 		if (padLen <= 0 || padLen > 16)return RIJNDAEL_CORRUPTED_DATA;
 		for (i = 16 - padLen; i < 16; i++)
@@ -1351,7 +1611,7 @@ void CryptoRijndael::keySched(uint8_t key[_MAX_KEY_COLUMNS][4])
 	uint32_t r = 0;
 	int t = 0;
 	// copy values into round key array
-	for (uint32_t r = 0; (j < uKeyColumns) && (r <= rounds_);)
+	for (j = 0; (j < uKeyColumns) && (r <= rounds_);)
 	{
 		for (; (j < uKeyColumns) && (t < 4); j++, t++)
 		{
@@ -1,36 +1,97 @@
+#include <cstring>
+
 #include "../include/che_crypto_rc4.h"
 
 namespace chepdf {
 
-void CryptoRC4::Encrypt(const uint8_t * const key, uint32_t keyLength, uint8_t * data, uint32_t dataLength, uint8_t * dataRet)
+// uint8_t indices wrap by themselves, no masking needed
+static inline uint8_t rc4_next(uint32_t * s, uint8_t & x, uint8_t & y)
+{
+	x = (uint8_t)(x + 1);
+	uint32_t a = s[x];
+	y = (uint8_t)(y + a);
+	uint32_t b = s[y];
+	s[x] = b;
+	s[y] = a;
+	return (uint8_t)s[(uint8_t)(a + b)];
+}
+
+void CryptoRC4::Init(const uint8_t * const key, uint32_t keyLength)
 {
-	uint8_t rc4[256];
-	uint8_t t = 0;
-	uint32_t j = 0;
 	for (uint32_t i = 0; i < 256; ++i)
 	{
-		rc4[i] = static_cast<uint8_t>(i);
+		state_[i] = i;
+	}
+	uint8_t j = 0;
+	uint32_t k = 0;
+	for (uint32_t i = 0; i < 256; ++i)
+	{
+		uint32_t t = state_[i];
+		j = (uint8_t)(j + t + key[k]);
+		state_[i] = state_[j];
+		state_[j] = t;
+		if (++k == keyLength)
+		{
+			k = 0;
+		}
+	}
+	x_ = 0;
+	y_ = 0;
+}
+
+void CryptoRC4::Process(const uint8_t * data, size_t dataLength, uint8_t * dataRet)
+{
+	uint32_t * s = state_;
+	uint8_t x = x_;
+	uint8_t y = y_;
+	size_t m = 0;
+	for (; m + 8 <= dataLength; m += 8)
+	{
+		uint8_t ks[8];
+		ks[0] = rc4_next(s, x, y);
+		ks[1] = rc4_next(s, x, y);
+		ks[2] = rc4_next(s, x, y);
+		ks[3] = rc4_next(s, x, y);
+		ks[4] = rc4_next(s, x, y);
+		ks[5] = rc4_next(s, x, y);
+		ks[6] = rc4_next(s, x, y);
+		ks[7] = rc4_next(s, x, y);
+		uint64_t block, stream;
+		memcpy(&block, data + m, 8);
+		memcpy(&stream, ks, 8);
+		block ^= stream;
+		memcpy(dataRet + m, &block, 8);
 	}
-	for (uint32_t l = 0; l < 256; ++l)
+	for (; m < dataLength; ++m)
 	{
-		t = rc4[l];
-		j = (j + static_cast<uint32_t>(t)+static_cast<uint32_t>(key[l % keyLength])) % 256;
-		rc4[l] = rc4[j];
-		rc4[j] = t;
+		dataRet[m] = data[m] ^ rc4_next(s, x, y);
 	}
-	uint32_t a = 0;
-	uint32_t b = 0;
-	uint8_t k = 0;
-	for (uint32_t m = 0; m < dataLength; ++m)
+	x_ = x;
+	y_ = y;
+}
+
+void CryptoRC4::Skip(size_t length)
+{
+	uint32_t * s = state_;
+	uint8_t x = x_;
+	uint8_t y = y_;
+	for (size_t m = 0; m < length; ++m)
 	{
-		a = (a + 1) % 256;
-		t = rc4[a];
-		b = (b + static_cast<uint32_t>(t)) % 256;
-		rc4[a] = rc4[b];
-		rc4[b] = t;
-		k = rc4[(static_cast<uint32_t>(rc4[a]) + static_cast<uint32_t>(rc4[b])) % 256];
-		dataRet[m] = data[m] ^ k;
+		x = (uint8_t)(x + 1);
+		uint32_t a = s[x];
+		y = (uint8_t)(y + a);
+		s[x] = s[y];
+		s[y] = a;
 	}
+	x_ = x;
+	y_ = y;
+}
+
+void CryptoRC4::Encrypt(const uint8_t * const key, uint32_t keyLength, uint8_t * data, uint32_t dataLength, uint8_t * dataRet)
+{
+	CryptoRC4 rc4;
+	rc4.Init(key, keyLength);
+	rc4.Process(data, dataLength, dataRet);
 }
 
 }//namespace
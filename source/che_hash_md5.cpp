@@ -1,13 +1,19 @@
 #include "../include/che_hash_md5.h"
+#include "../include/che_base_cpu.h"
 #include <memory>
+#include <cstring>
+
+#ifdef _CHE_X86_
+#include <immintrin.h>
+#endif
 
 namespace chepdf {
 
 HashMD5::HashMD5()
 {
-	memset(buf_, 0, 4);
-	memset(bits_, 0, 2);
-	memset(in_, 0, 64);
+	memset(buf_, 0, sizeof(buf_));
+	memset(bits_, 0, sizeof(bits_));
+	memset(in_, 0, sizeof(in_));
 }
 
 
@@ -201,4 +207,262 @@ void HashMD5::Transform(uint32_t buf[4], uint32_t in[16])
 	buf[3] += d;
 }
 
+// All 64 steps with the message word index, constant and rotation of each.
+#define MD5_MULTI_ROUNDS(STEP) \
+	STEP(F1, a, b, c, d, 0, 0xd76aa478, 7);   STEP(F1, d, a, b, c, 1, 0xe8c7b756, 12); \
+	STEP(F1, c, d, a, b, 2, 0x242070db, 17);  STEP(F1, b, c, d, a, 3, 0xc1bdceee, 22); \
+	STEP(F1, a, b, c, d, 4, 0xf57c0faf, 7);   STEP(F1, d, a, b, c, 5, 0x4787c62a, 12); \
+	STEP(F1, c, d, a, b, 6, 0xa8304613, 17);  STEP(F1, b, c, d, a, 7, 0xfd469501, 22); \
+	STEP(F1, a, b, c, d, 8, 0x698098d8, 7);   STEP(F1, d, a, b, c, 9, 0x8b44f7af, 12); \
+	STEP(F1, c, d, a, b, 10, 0xffff5bb1, 17); STEP(F1, b, c, d, a, 11, 0x895cd7be, 22); \
+	STEP(F1, a, b, c, d, 12, 0x6b901122, 7);  STEP(F1, d, a, b, c, 13, 0xfd987193, 12); \
+	STEP(F1, c, d, a, b, 14, 0xa679438e, 17); STEP(F1, b, c, d, a, 15, 0x49b40821, 22); \
+	STEP(F2, a, b, c, d, 1, 0xf61e2562, 5);   STEP(F2, d, a, b, c, 6, 0xc040b340, 9); \
+	STEP(F2, c, d, a, b, 11, 0x265e5a51, 14); STEP(F2, b, c, d, a, 0, 0xe9b6c7aa, 20); \
+	STEP(F2, a, b, c, d, 5, 0xd62f105d, 5);   STEP(F2, d, a, b, c, 10, 0x02441453, 9); \
+	STEP(F2, c, d, a, b, 15, 0xd8a1e681, 14); STEP(F2, b, c, d, a, 4, 0xe7d3fbc8, 20); \
+	STEP(F2, a, b, c, d, 9, 0x21e1cde6, 5);   STEP(F2, d, a, b, c, 14, 0xc33707d6, 9); \
+	STEP(F2, c, d, a, b, 3, 0xf4d50d87, 14);  STEP(F2, b, c, d, a, 8, 0x455a14ed, 20); \
+	STEP(F2, a, b, c, d, 13, 0xa9e3e905, 5);  STEP(F2, d, a, b, c, 2, 0xfcefa3f8, 9); \
+	STEP(F2, c, d, a, b, 7, 0x676f02d9, 14);  STEP(F2, b, c, d, a, 12, 0x8d2a4c8a, 20); \
+	STEP(F3, a, b, c, d, 5, 0xfffa3942, 4);   STEP(F3, d, a, b, c, 8, 0x8771f681, 11); \
+	STEP(F3, c, d, a, b, 11, 0x6d9d6122, 16); STEP(F3, b, c, d, a, 14, 0xfde5380c, 23); \
+	STEP(F3, a, b, c, d, 1, 0xa4beea44, 4);   STEP(F3, d, a, b, c, 4, 0x4bdecfa9, 11); \
+	STEP(F3, c, d, a, b, 7, 0xf6bb4b60, 16);  STEP(F3, b, c, d, a, 10, 0xbebfbc70, 23); \
+	STEP(F3, a, b, c, d, 13, 0x289b7ec6, 4);  STEP(F3, d, a, b, c, 0, 0xeaa127fa, 11); \
+	STEP(F3, c, d, a, b, 3, 0xd4ef3085, 16);  STEP(F3, b, c, d, a, 6, 0x04881d05, 23); \
+	STEP(F3, a, b, c, d, 9, 0xd9d4d039, 4);   STEP(F3, d, a, b, c, 12, 0xe6db99e5, 11); \
+	STEP(F3, c, d, a, b, 15, 0x1fa27cf8, 16); STEP(F3, b, c, d, a, 2, 0xc4ac5665, 23); \
+	STEP(F4, a, b, c, d, 0, 0xf4292244, 6);   STEP(F4, d, a, b, c, 7, 0x432aff97, 10); \
+	STEP(F4, c, d, a, b, 14, 0xab9423a7, 15); STEP(F4, b, c, d, a, 5, 0xfc93a039, 21); \
+	STEP(F4, a, b, c, d, 12, 0x655b59c3, 6);  STEP(F4, d, a, b, c, 3, 0x8f0ccc92, 10); \
+	STEP(F4, c, d, a, b, 10, 0xffeff47d, 15); STEP(F4, b, c, d, a, 1, 0x85845dd1, 21); \
+	STEP(F4, a, b, c, d, 8, 0x6fa87e4f, 6);   STEP(F4, d, a, b, c, 15, 0xfe2ce6e0, 10); \
+	STEP(F4, c, d, a, b, 6, 0xa3014314, 15);  STEP(F4, b, c, d, a, 13, 0x4e0811a1, 21); \
+	STEP(F4, a, b, c, d, 4, 0xf7537e82, 6);   STEP(F4, d, a, b, c, 11, 0xbd3af235, 10); \
+	STEP(F4, c, d, a, b, 2, 0x2ad7d2bb, 15);  STEP(F4, b, c, d, a, 9, 0xeb86d391, 21);
+
+// state and w are lane interleaved: state[word][lane], w[word][lane].
+typedef void (*md5_multi_compress)(uint32_t state[4][MD5_MULTI_MAX_LANES], const uint32_t w[16][MD5_MULTI_MAX_LANES]);
+
+#ifdef _CHE_X86_
+
+#define VF1(x, y, z) _mm_xor_si128(z, _mm_and_si128(x, _mm_xor_si128(y, z)))
+#define VF2(x, y, z) VF1(z, x, y)
+#define VF3(x, y, z) _mm_xor_si128(_mm_xor_si128(x, y), z)
+#define VF4(x, y, z) _mm_xor_si128(y, _mm_or_si128(x, _mm_xor_si128(z, ones)))
+#define VSTEP(f, w, x, y, z, k, t, s) \
+	w = _mm_add_epi32(w, _mm_add_epi32(V##f(x, y, z), _mm_add_epi32(m[k], _mm_set1_epi32((int)t)))); \
+	w = _mm_add_epi32(_mm_or_si128(_mm_slli_epi32(w, s), _mm_srli_epi32(w, 32 - s)), x)
+
+CHE_TARGET_ATTRIBUTE("sse2")
+static void md5_compress_sse2(uint32_t state[4][MD5_MULTI_MAX_LANES], const uint32_t w[16][MD5_MULTI_MAX_LANES])
+{
+	const __m128i ones = _mm_set1_epi32(-1);
+	__m128i m[16];
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		m[i] = _mm_loadu_si128((const __m128i *)w[i]);
+	}
+	__m128i a0 = _mm_loadu_si128((const __m128i *)state[0]);
+	__m128i b0 = _mm_loadu_si128((const __m128i *)state[1]);
+	__m128i c0 = _mm_loadu_si128((const __m128i *)state[2]);
+	__m128i d0 = _mm_loadu_si128((const __m128i *)state[3]);
+	__m128i a = a0, b = b0, c = c0, d = d0;
+
+	MD5_MULTI_ROUNDS(VSTEP)
+
+	_mm_storeu_si128((__m128i *)state[0], _mm_add_epi32(a, a0));
+	_mm_storeu_si128((__m128i *)state[1], _mm_add_epi32(b, b0));
+	_mm_storeu_si128((__m128i *)state[2], _mm_add_epi32(c, c0));
+	_mm_storeu_si128((__m128i *)state[3], _mm_add_epi32(d, d0));
+}
+
+#undef VF1
+#undef VF2
+#undef VF3
+#undef VF4
+#undef VSTEP
+
+#define VF1(x, y, z) _mm256_xor_si256(z, _mm256_and_si256(x, _mm256_xor_si256(y, z)))
+#define VF2(x, y, z) VF1(z, x, y)
+#define VF3(x, y, z) _mm256_xor_si256(_mm256_xor_si256(x, y), z)
+#define VF4(x, y, z) _mm256_xor_si256(y, _mm256_or_si256(x, _mm256_xor_si256(z, ones)))
+#define VSTEP(f, w, x, y, z, k, t, s) \
+	w = _mm256_add_epi32(w, _mm256_add_epi32(V##f(x, y, z), _mm256_add_epi32(m[k], _mm256_set1_epi32((int)t)))); \
+	w = _mm256_add_epi32(_mm256_or_si256(_mm256_slli_epi32(w, s), _mm256_srli_epi32(w, 32 - s)), x)
+
+CHE_TARGET_ATTRIBUTE("avx2")
+static void md5_compress_avx2(uint32_t state[4][MD5_MULTI_MAX_LANES], const uint32_t w[16][MD5_MULTI_MAX_LANES])
+{
+	const __m256i ones = _mm256_set1_epi32(-1);
+	__m256i m[16];
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		m[i] = _mm256_loadu_si256((const __m256i *)w[i]);
+	}
+	__m256i a0 = _mm256_loadu_si256((const __m256i *)state[0]);
+	__m256i b0 = _mm256_loadu_si256((const __m256i *)state[1]);
+	__m256i c0 = _mm256_loadu_si256((const __m256i *)state[2]);
+	__m256i d0 = _mm256_loadu_si256((const __m256i *)state[3]);
+	__m256i a = a0, b = b0, c = c0, d = d0;
+
+	MD5_MULTI_ROUNDS(VSTEP)
+
+	_mm256_storeu_si256((__m256i *)state[0], _mm256_add_epi32(a, a0));
+	_mm256_storeu_si256((__m256i *)state[1], _mm256_add_epi32(b, b0));
+	_mm256_storeu_si256((__m256i *)state[2], _mm256_add_epi32(c, c0));
+	_mm256_storeu_si256((__m256i *)state[3], _mm256_add_epi32(d, d0));
+}
+
+#undef VF1
+#undef VF2
+#undef VF3
+#undef VF4
+#undef VSTEP
+
+#endif
+
+HashMD5Multi::HashMD5Multi() : lanes_(1)
+{
+#ifdef _CHE_X86_
+	if (IsCPUFeatureSupported(CPU_FEATURE_AVX2))
+	{
+		lanes_ = 8;
+	}
+	else if (IsCPUFeatureSupported(CPU_FEATURE_SSE2))
+	{
+		lanes_ = 4;
+	}
+#endif
+}
+
+void HashMD5Multi::Hash(const uint8_t * const * bufs, const uint32_t * lens, uint32_t count, uint8_t (*digests)[16])
+{
+	uint32_t i = 0;
+	if (lanes_ > 1)
+	{
+		//a last group of one is cheaper on the scalar path
+		for (; i + 1 < count; i += lanes_)
+		{
+			uint32_t n = (count - i < lanes_) ? count - i : lanes_;
+			HashGroup(bufs + i, lens + i, n, digests + i);
+		}
+	}
+	HashMD5 md5;
+	for (; i < count; i++)
+	{
+		md5.Init();
+		md5.Update(bufs[i], lens[i]);
+		md5.Final(digests[i]);
+	}
+}
+
+void HashMD5Multi::HashGroup(const uint8_t * const * bufs, const uint32_t * lens, uint32_t count, uint8_t (*digests)[16])
+{
+#ifdef _CHE_X86_
+	md5_multi_compress compress = (lanes_ == 8) ? md5_compress_avx2 : md5_compress_sse2;
+	uint32_t state[4][MD5_MULTI_MAX_LANES];
+	uint32_t saved[4][MD5_MULTI_MAX_LANES];
+	uint32_t w[16][MD5_MULTI_MAX_LANES];
+	uint32_t full_blocks[MD5_MULTI_MAX_LANES];
+	uint32_t blocks[MD5_MULTI_MAX_LANES];
+	uint32_t max_blocks = 0;
+
+	memset(w, 0, sizeof(w));
+	for (uint32_t lane = 0; lane < MD5_MULTI_MAX_LANES; lane++)
+	{
+		state[0][lane] = 0x67452301;
+		state[1][lane] = 0xefcdab89;
+		state[2][lane] = 0x98badcfe;
+		state[3][lane] = 0x10325476;
+		blocks[lane] = 0;
+		full_blocks[lane] = 0;
+		if (lane < count)
+		{
+			full_blocks[lane] = lens[lane] / 64;
+			blocks[lane] = full_blocks[lane] + ((lens[lane] % 64 < 56) ? 1 : 2);
+			if (blocks[lane] > max_blocks)
+			{
+				max_blocks = blocks[lane];
+			}
+		}
+	}
+
+	for (uint32_t block = 0; block < max_blocks; block++)
+	{
+		bool b_idle = false;
+		for (uint32_t lane = 0; lane < count; lane++)
+		{
+			uint32_t words[16];
+			if (block < full_blocks[lane])
+			{
+				memcpy(words, bufs[lane] + block * 64, 64);
+			}
+			else if (block < blocks[lane])
+			{
+				//padding and bit length, spread over one or two blocks
+				uint32_t len = lens[lane];
+				uint32_t rest = len % 64;
+				memset(words, 0, 64);
+				if (block == full_blocks[lane])
+				{
+					if (rest > 0)
+					{
+						memcpy(words, bufs[lane] + len - rest, rest);
+					}
+					((uint8_t *)words)[rest] = 0x80;
+				}
+				if (block + 1 == blocks[lane])
+				{
+					words[14] = len << 3;
+					words[15] = len >> 29;
+				}
+			}else{
+				b_idle = true;
+				continue;
+			}
+			for (uint32_t k = 0; k < 16; k++)
+			{
+				w[k][lane] = words[k];
+			}
+		}
+		if (b_idle)
+		{
+			memcpy(saved, state, sizeof(state));
+		}
+		compress(state, w);
+		if (b_idle)
+		{
+			for (uint32_t lane = 0; lane < count; lane++)
+			{
+				if (block >= blocks[lane])
+				{
+					for (uint32_t k = 0; k < 4; k++)
+					{
+						state[k][lane] = saved[k][lane];
+					}
+				}
+			}
+		}
+	}
+
+	for (uint32_t lane = 0; lane < count; lane++)
+	{
+		for (uint32_t k = 0; k < 4; k++)
+		{
+			memcpy(digests[lane] + k * 4, &state[k][lane], 4);
+		}
+	}
+#else
+	HashMD5 md5;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		md5.Init();
+		md5.Update(bufs[i], lens[i]);
+		md5.Final(digests[i]);
+	}
+#endif
+}
+
 }//namespace
@@ -0,0 +1,383 @@
+#include "../include/che_hash_sha2.h"
+#include "../include/che_base_cpu.h"
+#include <cstring>
+
+#ifdef _CHE_X86_
+#include <immintrin.h>
+#endif
+
+namespace chepdf {
+
+static const uint32_t K256[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint64_t K512[80] =
+{
+	0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+	0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+	0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+	0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+	0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+	0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+	0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+	0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+	0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+	0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+	0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+	0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+	0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+	0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+	0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+	0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+	0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+	0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+	0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+	0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+static inline uint32_t load_be32(const uint8_t * p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline uint64_t load_be64(const uint8_t * p)
+{
+	return ((uint64_t)load_be32(p) << 32) | load_be32(p + 4);
+}
+
+static inline void store_be32(uint8_t * p, uint32_t v)
+{
+	p[0] = (uint8_t)(v >> 24);
+	p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >> 8);
+	p[3] = (uint8_t)v;
+}
+
+static inline void store_be64(uint8_t * p, uint64_t v)
+{
+	store_be32(p, (uint32_t)(v >> 32));
+	store_be32(p + 4, (uint32_t)v);
+}
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+static void sha256_transform(uint32_t state[8], const uint8_t * blocks, size_t count)
+{
+	uint32_t w[64];
+	while (count--)
+	{
+		for (uint32_t t = 0; t < 16; t++)
+		{
+			w[t] = load_be32(blocks + 4 * t);
+		}
+		for (uint32_t t = 16; t < 64; t++)
+		{
+			uint32_t s0 = ROTR32(w[t - 15], 7) ^ ROTR32(w[t - 15], 18) ^ (w[t - 15] >> 3);
+			uint32_t s1 = ROTR32(w[t - 2], 17) ^ ROTR32(w[t - 2], 19) ^ (w[t - 2] >> 10);
+			w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+		}
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+		uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+		for (uint32_t t = 0; t < 64; t++)
+		{
+			uint32_t t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) + K256[t] + w[t];
+			uint32_t t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+		state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+		state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+		blocks += 64;
+	}
+}
+
+#ifdef _CHE_X86_
+
+// SHA extensions keep the state as ABEF/CDGH pairs and run two rounds per instruction.
+CHE_TARGET_ATTRIBUTE("sha,sse4.1,ssse3")
+static void sha256_transform_shani(uint32_t state[8], const uint8_t * blocks, size_t count)
+{
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+	__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0xB1);
+	__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4)), 0x1B);
+	__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+	while (count--)
+	{
+		__m128i abef = state0;
+		__m128i cdgh = state1;
+		__m128i w[4];
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			if (i < 4)
+			{
+				w[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks + 16 * i)), mask);
+			}else{
+				__m128i w7 = _mm_alignr_epi8(w[(i - 1) & 3], w[(i - 2) & 3], 4);
+				w[i & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w[i & 3], w[(i - 3) & 3]), w7), w[(i - 1) & 3]);
+			}
+			__m128i msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128(reinterpret_cast<const __m128i*>(K256 + 4 * i)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+		}
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+		blocks += 64;
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1B);
+	state1 = _mm_shuffle_epi32(state1, 0xB1);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_blend_epi16(tmp, state1, 0xF0));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), _mm_alignr_epi8(state1, tmp, 8));
+}
+
+#endif
+
+static void sha512_transform(uint64_t state[8], const uint8_t * blocks, size_t count)
+{
+	uint64_t w[80];
+	while (count--)
+	{
+		for (uint32_t t = 0; t < 16; t++)
+		{
+			w[t] = load_be64(blocks + 8 * t);
+		}
+		for (uint32_t t = 16; t < 80; t++)
+		{
+			uint64_t s0 = ROTR64(w[t - 15], 1) ^ ROTR64(w[t - 15], 8) ^ (w[t - 15] >> 7);
+			uint64_t s1 = ROTR64(w[t - 2], 19) ^ ROTR64(w[t - 2], 61) ^ (w[t - 2] >> 6);
+			w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+		}
+		uint64_t a = state[0], b = state[1], c = state[2], d = state[3];
+		uint64_t e = state[4], f = state[5], g = state[6], h = state[7];
+		for (uint32_t t = 0; t < 80; t++)
+		{
+			uint64_t t1 = h + (ROTR64(e, 14) ^ ROTR64(e, 18) ^ ROTR64(e, 41)) + ((e & f) ^ (~e & g)) + K512[t] + w[t];
+			uint64_t t2 = (ROTR64(a, 28) ^ ROTR64(a, 34) ^ ROTR64(a, 39)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+		state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+		state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+		blocks += 128;
+	}
+}
+
+
+HashSHA256::HashSHA256()
+{
+	b_shani_ = IsCPUFeatureSupported(CPU_FEATURE_SHA | CPU_FEATURE_SSE41);
+	Init();
+}
+
+void HashSHA256::Init()
+{
+	state_[0] = 0x6a09e667;
+	state_[1] = 0xbb67ae85;
+	state_[2] = 0x3c6ef372;
+	state_[3] = 0xa54ff53a;
+	state_[4] = 0x510e527f;
+	state_[5] = 0x9b05688c;
+	state_[6] = 0x1f83d9ab;
+	state_[7] = 0x5be0cd19;
+	length_ = 0;
+}
+
+void HashSHA256::Transform(const uint8_t * blocks, size_t count)
+{
+#ifdef _CHE_X86_
+	if (b_shani_)
+	{
+		sha256_transform_shani(state_, blocks, count);
+		return;
+	}
+#endif
+	sha256_transform(state_, blocks, count);
+}
+
+void HashSHA256::Update(const uint8_t * buf, size_t len)
+{
+	size_t used = (size_t)(length_ & 0x3F);
+	length_ += len;
+
+	/* Handle any leading odd-sized chunks */
+	if (used)
+	{
+		size_t t = 64 - used;
+		if (len < t)
+		{
+			memcpy(in_ + used, buf, len);
+			return;
+		}
+		memcpy(in_ + used, buf, t);
+		Transform(in_, 1);
+		buf += t;
+		len -= t;
+	}
+
+	/* Whole blocks straight from the caller's buffer */
+	if (len >= 64)
+	{
+		Transform(buf, len / 64);
+		buf += len & ~(size_t)0x3F;
+		len &= 0x3F;
+	}
+	memcpy(in_, buf, len);
+}
+
+void HashSHA256::Final(uint8_t digest[32])
+{
+	size_t used = (size_t)(length_ & 0x3F);
+	uint64_t bits = length_ << 3;
+
+	in_[used++] = 0x80;
+	if (used > 56)
+	{
+		memset(in_ + used, 0, 64 - used);
+		Transform(in_, 1);
+		used = 0;
+	}
+	memset(in_ + used, 0, 56 - used);
+	store_be64(in_ + 56, bits);
+	Transform(in_, 1);
+
+	for (uint32_t i = 0; i < 8; i++)
+	{
+		store_be32(digest + 4 * i, state_[i]);
+	}
+	Init();
+}
+
+
+HashSHA512::HashSHA512()
+{
+	Init();
+}
+
+void HashSHA512::Init()
+{
+	state_[0] = 0x6a09e667f3bcc908ULL;
+	state_[1] = 0xbb67ae8584caa73bULL;
+	state_[2] = 0x3c6ef372fe94f82bULL;
+	state_[3] = 0xa54ff53a5f1d36f1ULL;
+	state_[4] = 0x510e527fade682d1ULL;
+	state_[5] = 0x9b05688c2b3e6c1fULL;
+	state_[6] = 0x1f83d9abfb41bd6bULL;
+	state_[7] = 0x5be0cd19137e2179ULL;
+	length_ = 0;
+}
+
+void HashSHA512::Transform(const uint8_t * blocks, size_t count)
+{
+	sha512_transform(state_, blocks, count);
+}
+
+void HashSHA512::Update(const uint8_t * buf, size_t len)
+{
+	size_t used = (size_t)(length_ & 0x7F);
+	length_ += len;
+
+	if (used)
+	{
+		size_t t = 128 - used;
+		if (len < t)
+		{
+			memcpy(in_ + used, buf, len);
+			return;
+		}
+		memcpy(in_ + used, buf, t);
+		Transform(in_, 1);
+		buf += t;
+		len -= t;
+	}
+	if (len >= 128)
+	{
+		Transform(buf, len / 128);
+		buf += len & ~(size_t)0x7F;
+		len &= 0x7F;
+	}
+	memcpy(in_, buf, len);
+}
+
+void HashSHA512::Pad()
+{
+	size_t used = (size_t)(length_ & 0x7F);
+	uint64_t bits = length_ << 3;
+
+	in_[used++] = 0x80;
+	if (used > 112)
+	{
+		memset(in_ + used, 0, 128 - used);
+		Transform(in_, 1);
+		used = 0;
+	}
+	/* the high 64 bits of the 128 bit length are always 0 here */
+	memset(in_ + used, 0, 120 - used);
+	store_be64(in_ + 120, bits);
+	Transform(in_, 1);
+}
+
+void HashSHA512::Final(uint8_t digest[64])
+{
+	Pad();
+	for (uint32_t i = 0; i < 8; i++)
+	{
+		store_be64(digest + 8 * i, state_[i]);
+	}
+	Init();
+}
+
+
+HashSHA384::HashSHA384()
+{
+	Init();
+}
+
+void HashSHA384::Init()
+{
+	state_[0] = 0xcbbb9d5dc1059ed8ULL;
+	state_[1] = 0x629a292a367cd507ULL;
+	state_[2] = 0x9159015a3070dd17ULL;
+	state_[3] = 0x152fecd8f70e5939ULL;
+	state_[4] = 0x67332667ffc00b31ULL;
+	state_[5] = 0x8eb44a8768581511ULL;
+	state_[6] = 0xdb0c2e0d64f98fa7ULL;
+	state_[7] = 0x47b5481dbefa4fa4ULL;
+	length_ = 0;
+}
+
+void HashSHA384::Final(uint8_t digest[48])
+{
+	Pad();
+	for (uint32_t i = 0; i < 6; i++)
+	{
+		store_be64(digest + 8 * i, state_[i]);
+	}
+	Init();
+}
+
+}//namespace
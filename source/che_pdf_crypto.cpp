@@ -1,14 +1,72 @@
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#include <cerrno>
+#include <thread>
+#include <atomic>
+#include <vector>
 
 #include "../include/che_pdf_crypto.h"
 #include "../include/che_hash_md5.h"
+#include "../include/che_hash_sha2.h"
 #include "../include/che_crypto_rc4.h"
 #include "../include/che_crypto_aes.h"
+#include "../include/che_pdf_object.h"
+
+//after the headers above, which settle the platform defines
+#ifdef _WIN32
+#include <windows.h>
+#include <bcrypt.h>
+#pragma comment(lib, "bcrypt.lib")
+#endif
+
+#ifdef _LINUX_
+#include <sys/random.h>
+#endif
 
 namespace chepdf {
     
+//ivs, file keys and salts, only the system generator is unpredictable enough for them
+static bool random_bytes(uint8_t * data, size_t length)
+{
+#if defined(_WIN32)
+	return BCryptGenRandom(NULL, data, (ULONG)length, BCRYPT_USE_SYSTEM_PREFERRED_RNG) == 0;
+#elif defined(_MAC_OS_X_)
+	arc4random_buf(data, length);
+	return true;
+#else
+	size_t done = 0;
+#if defined(_LINUX_)
+	while (done < length)
+	{
+		ssize_t ret = getrandom(data + done, length - done, 0);
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+		done += (size_t)ret;
+	}
+	if (done == length)
+	{
+		return true;
+	}
+#endif
+	//kernels without getrandom and other unix systems
+	FILE * file = fopen("/dev/urandom", "rb");
+	if (file == nullptr)
+	{
+		return false;
+	}
+	done += fread(data + done, 1, length - done, file);
+	fclose(file);
+	return done == length;
+#endif
+}
+
 static uint8_t padding[] = "\x28\xBF\x4E\x5E\x4E\x75\x8A\x41\x64\x00\x4E\x56\xFF\xFA\x01\x08\x2E\x2E\x00\xB6\xD0\x68\x3E\x80\x2F\x0C\xA9\xFE\x64\x53\x69\x7A";
 
 PdfCrypto::PdfCrypto(const ByteString id, uint8_t O[32], uint8_t U[32], uint8_t algorithm,
@@ -16,6 +74,11 @@ PdfCrypto::PdfCrypto(const ByteString id, uint8_t O[32], uint8_t U[32], uint8_t
 	Allocator * allocator) : BaseObject(allocator), id_(allocator)
 {
 	id_ = id;
+	memset(o_, 0, sizeof(o_));
+	memset(u_, 0, sizeof(u_));
+	memset(oe_, 0, sizeof(oe_));
+	memset(ue_, 0, sizeof(ue_));
+	memset(perms_, 0, sizeof(perms_));
 	for (uint32_t i = 0; i < 32; i++)
 	{
 		o_[i] = O[i];
@@ -28,12 +91,19 @@ PdfCrypto::PdfCrypto(const ByteString id, uint8_t O[32], uint8_t U[32], uint8_t
 	b_meta_data_ = bMetaData;
 	p_ = P;
 	b_password_ok_ = false;
+	obj_key_cache_ = GetAllocator()->NewArray<ObjKeyCacheEntry>(CRYPTO_OBJKEY_CACHE_SIZE);
+	ClearObjKeyCache();
 }
 
 PdfCrypto::PdfCrypto(const ByteString id, uint8_t algorithm, uint8_t version, uint8_t revision, uint8_t keyLength,
 	bool bMetaData, uint32_t P, Allocator * allocator) : BaseObject(allocator), id_(allocator)
 {
 	id_ = id;
+	memset(o_, 0, sizeof(o_));
+	memset(u_, 0, sizeof(u_));
+	memset(oe_, 0, sizeof(oe_));
+	memset(ue_, 0, sizeof(ue_));
+	memset(perms_, 0, sizeof(perms_));
 	algorithm_ = algorithm;
 	version_ = version;
 	revision_ = revision;
@@ -41,10 +111,43 @@ PdfCrypto::PdfCrypto(const ByteString id, uint8_t algorithm, uint8_t version, ui
 	b_meta_data_ = bMetaData;
 	p_ = P;
 	b_password_ok_ = false;
+	obj_key_cache_ = GetAllocator()->NewArray<ObjKeyCacheEntry>(CRYPTO_OBJKEY_CACHE_SIZE);
+	ClearObjKeyCache();
+}
+
+PdfCrypto::PdfCrypto(const ByteString id, uint8_t O[48], uint8_t U[48], uint8_t OE[32], uint8_t UE[32], uint8_t Perms[16],
+	uint8_t revision, bool bMetaData, uint32_t P, Allocator * allocator) : BaseObject(allocator), id_(allocator)
+{
+	id_ = id;
+	memcpy(o_, O, 48);
+	memcpy(u_, U, 48);
+	memcpy(oe_, OE, 32);
+	memcpy(ue_, UE, 32);
+	memcpy(perms_, Perms, 16);
+	algorithm_ = CRYPTO_ALGORITHM_AESV3;
+	version_ = 5;
+	revision_ = revision;
+	//256 bits does not fit, V5 never looks at key_length_
+	key_length_ = 0;
+	b_meta_data_ = bMetaData;
+	p_ = P;
+	b_password_ok_ = false;
+	obj_key_cache_ = GetAllocator()->NewArray<ObjKeyCacheEntry>(CRYPTO_OBJKEY_CACHE_SIZE);
+	ClearObjKeyCache();
+}
+
+PdfCrypto::~PdfCrypto()
+{
+	GetAllocator()->DeleteArray<ObjKeyCacheEntry>(obj_key_cache_);
 }
 
 void PdfCrypto::Init(const ByteString userPassword, const ByteString ownerPassword)
 {
+	if (revision_ >= 5)
+	{
+		InitV5(userPassword, ownerPassword);
+		return;
+	}
 	uint8_t userPad[32];
 	uint8_t ownerPad[32];
 	uint8_t encryptionKey[16];
@@ -59,10 +162,12 @@ void PdfCrypto::Init(const ByteString userPassword, const ByteString ownerPasswo
 	}
 	ComputeEncryptionKey(userPad, encryptionKey);
 	ComputeUserKey(encryptionKey, u_);
+	memcpy(encryption_key_, encryptionKey, 16);
 	b_password_ok_ = true;
+	ClearObjKeyCache();
 }
 
-void PdfCrypto::PadPassword(const ByteString & password, unsigned char pswd[32])
+void PdfCrypto::PadPassword(const ByteString & password, unsigned char pswd[32]) const
 {
 	size_t m = password.GetLength();
 
@@ -79,7 +184,7 @@ void PdfCrypto::PadPassword(const ByteString & password, unsigned char pswd[32])
 	}
 }
 
-void PdfCrypto::ComputeOwnerKey(uint8_t userPad[32], uint8_t ownerPad[32], uint8_t ownerKeyRet[32], bool bAuth)
+void PdfCrypto::ComputeOwnerKey(const uint8_t userPad[32], const uint8_t ownerPad[32], uint8_t ownerKeyRet[32], bool bAuth) const
 {
 	uint8_t mkey[16];
 	uint8_t digest[16];
@@ -121,8 +226,15 @@ void PdfCrypto::ComputeOwnerKey(uint8_t userPad[32], uint8_t ownerPad[32], uint8
 	}
 }
 
-void PdfCrypto::CreateObjKey(uint32_t objNum, uint32_t genNum, uint8_t objkey[16], uint32_t* pObjKeyLengthRet)
+void PdfCrypto::CreateObjKey(uint32_t objNum, uint32_t genNum, uint8_t objkey[32], uint32_t* pObjKeyLengthRet) const
 {
+	if (algorithm_ == CRYPTO_ALGORITHM_AESV3)
+	{
+		//no per object key derivation in V5
+		memcpy(objkey, encryption_key_, 32);
+		*pObjKeyLengthRet = 32;
+		return;
+	}
 	uint32_t keyLengthInByte = key_length_ / 8;
 	uint32_t objKeyLength = keyLengthInByte + 5;
 	uint8_t	tmpkey[16 + 5 + 4];
@@ -154,8 +266,69 @@ void PdfCrypto::CreateObjKey(uint32_t objNum, uint32_t genNum, uint8_t objkey[16
 	*pObjKeyLengthRet = (keyLengthInByte < 11) ? keyLengthInByte + 5 : 16;
 }
 
+void PdfCrypto::CreateObjKeys(const uint32_t * objNums, const uint32_t * genNums, uint32_t count, uint8_t (*objKeys)[32], uint32_t * pObjKeyLengthRet) const
+{
+	if (algorithm_ == CRYPTO_ALGORITHM_AESV3)
+	{
+		for (uint32_t i = 0; i < count; i++)
+		{
+			memcpy(objKeys[i], encryption_key_, 32);
+		}
+		*pObjKeyLengthRet = 32;
+		return;
+	}
+	uint32_t keyLengthInByte = key_length_ / 8;
+	uint32_t tmpKeyLength = keyLengthInByte + 5;
+	if (algorithm_ == CRYPTO_ALGORITHM_AESV2)
+	{
+		tmpKeyLength += 4;
+	}
+
+	const uint32_t batch = 64;
+	uint8_t tmpkeys[batch][16 + 5 + 4];
+	uint8_t digests[batch][16];
+	const uint8_t * bufs[batch];
+	uint32_t lens[batch];
+	HashMD5Multi md5;
+	for (uint32_t start = 0; start < count; start += batch)
+	{
+		uint32_t n = (count - start < batch) ? count - start : batch;
+		for (uint32_t i = 0; i < n; i++)
+		{
+			uint8_t * tmpkey = tmpkeys[i];
+			uint32_t objNum = objNums[start + i];
+			uint32_t genNum = genNums[start + i];
+			memcpy(tmpkey, encryption_key_, keyLengthInByte);
+			tmpkey[keyLengthInByte + 0] = (uint8_t)(0xff & objNum);
+			tmpkey[keyLengthInByte + 1] = (uint8_t)(0xff & (objNum >> 8));
+			tmpkey[keyLengthInByte + 2] = (uint8_t)(0xff & (objNum >> 16));
+			tmpkey[keyLengthInByte + 3] = (uint8_t)(0xff & genNum);
+			tmpkey[keyLengthInByte + 4] = (uint8_t)(0xff & (genNum >> 8));
+			if (algorithm_ == CRYPTO_ALGORITHM_AESV2)
+			{
+				tmpkey[keyLengthInByte + 5] = 0x73;
+				tmpkey[keyLengthInByte + 6] = 0x41;
+				tmpkey[keyLengthInByte + 7] = 0x6c;
+				tmpkey[keyLengthInByte + 8] = 0x54;
+			}
+			bufs[i] = tmpkey;
+			lens[i] = tmpKeyLength;
+		}
+		md5.Hash(bufs, lens, n, digests);
+		for (uint32_t i = 0; i < n; i++)
+		{
+			memcpy(objKeys[start + i], digests[i], 16);
+		}
+	}
+	*pObjKeyLengthRet = (keyLengthInByte < 11) ? keyLengthInByte + 5 : 16;
+}
+
 bool PdfCrypto::Authenticate(const ByteString & password)
 {
+	if (revision_ >= 5)
+	{
+		return AuthenticateV5(password);
+	}
 	bool bRet = true;
 	uint8_t padpswd[32];
 	uint8_t userKey[32];
@@ -165,23 +338,14 @@ bool PdfCrypto::Authenticate(const ByteString & password)
 	ComputeEncryptionKey(padpswd, encrypt);
 	ComputeUserKey(encrypt, userKey);
 
-	uint32_t kmax = (revision_ == 2) ? 32 : 16;
-	for (uint32_t k = 0; bRet && k < kmax; k++)
-	{
-		bRet = bRet && (userKey[k] == u_[k]);
-	}
+	bRet = CheckUserKey(userKey);
 	if (!bRet)
 	{
-		bRet = true;
 		unsigned char userpswd[32];
 		ComputeOwnerKey(o_, padpswd, userpswd, true);
 		ComputeEncryptionKey(userpswd, encrypt);
 		ComputeUserKey(encrypt, userKey);
-		kmax = 32;
-		for (uint32_t k = 0; bRet && k < kmax; k++)
-		{
-			bRet = bRet && (userKey[k] == u_[k]);
-		}
+		bRet = CheckUserKey(userKey);
 	}
 	if (bRet == true)
 	{
@@ -190,11 +354,246 @@ bool PdfCrypto::Authenticate(const ByteString & password)
 		{
 			encryption_key_[i] = encrypt[i];
 		}
+		ClearObjKeyCache();
 	}
 	return bRet;
 }
 
-void PdfCrypto::ComputeEncryptionKey(uint8_t userPad[32], uint8_t encryptionKeyRet[16])
+int32_t PdfCrypto::AuthenticateBatch(const ByteString * passwords, uint32_t count, uint32_t threadCount) const
+{
+	if (passwords == nullptr || count == 0)
+	{
+		return -1;
+	}
+	//chunks are handed out in order, so the first match found in a chunk ends the
+	//search for every chunk after it
+	const uint32_t chunkSize = (revision_ >= 5) ? 4 : 64;
+	const uint32_t chunkCount = (count + chunkSize - 1) / chunkSize;
+	if (threadCount == 0)
+	{
+		threadCount = std::thread::hardware_concurrency();
+	}
+	if (threadCount == 0)
+	{
+		threadCount = 1;
+	}
+	if (threadCount > chunkCount)
+	{
+		threadCount = chunkCount;
+	}
+
+	std::atomic<uint32_t> nextChunk(0);
+	std::atomic<uint32_t> found(0xFFFFFFFF);
+	auto worker = [&]()
+	{
+		for (;;)
+		{
+			uint32_t chunk = nextChunk.fetch_add(1);
+			uint32_t start = chunk * chunkSize;
+			if (chunk >= chunkCount || start >= found.load())
+			{
+				return;
+			}
+			uint32_t n = (count - start < chunkSize) ? count - start : chunkSize;
+			int32_t index = AuthenticateChunk(passwords + start, n);
+			if (index >= 0)
+			{
+				uint32_t match = start + (uint32_t)index;
+				uint32_t current = found.load();
+				while (match < current && !found.compare_exchange_weak(current, match))
+				{
+				}
+				return;
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (uint32_t i = 1; i < threadCount; i++)
+	{
+		threads.push_back(std::thread(worker));
+	}
+	worker();
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+	uint32_t index = found.load();
+	return (index == 0xFFFFFFFF) ? -1 : (int32_t)index;
+}
+
+int32_t PdfCrypto::AuthenticateChunk(const ByteString * passwords, uint32_t count) const
+{
+	if (revision_ >= 5)
+	{
+		uint8_t key[32];
+		for (uint32_t i = 0; i < count; i++)
+		{
+			if (ComputeFileKeyV5(passwords[i], key))
+			{
+				return (int32_t)i;
+			}
+		}
+		return -1;
+	}
+
+	const uint32_t maxCount = 64;
+	if (count > maxCount)
+	{
+		count = maxCount;
+	}
+	uint8_t pads[maxCount][32];
+	uint8_t keys[maxCount][16];
+	uint8_t userKey[32];
+	uint8_t idDigest[16];
+	if (revision_ >= 3)
+	{
+		ComputeUserKeyDigest(idDigest);
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		PadPassword(passwords[i], pads[i]);
+	}
+
+	//as user passwords
+	int32_t match = -1;
+	ComputeEncryptionKeys(pads, count, keys);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		ComputeUserKey(keys[i], idDigest, userKey);
+		if (CheckUserKey(userKey))
+		{
+			match = (int32_t)i;
+			break;
+		}
+	}
+
+	//as owner passwords, only the candidates before a user match can still win
+	uint32_t ownerCount = (match >= 0) ? (uint32_t)match : count;
+	if (ownerCount == 0)
+	{
+		return match;
+	}
+	uint32_t keyLengthInByte = (revision_ >= 3) ? key_length_ / 8 : 5;
+	uint8_t mkey[16];
+	ComputeOwnerRC4Keys(pads, ownerCount, keys);
+	for (uint32_t i = 0; i < ownerCount; i++)
+	{
+		//the user password padded, recovered from O
+		memcpy(pads[i], o_, 32);
+		if (revision_ >= 3)
+		{
+			for (uint32_t j = 0; j < 20; j++)
+			{
+				for (uint32_t k = 0; k < keyLengthInByte; k++)
+				{
+					mkey[k] = (uint8_t)(keys[i][k] ^ (19 - j));
+				}
+				RC4(mkey, keyLengthInByte, pads[i], 32, pads[i]);
+			}
+		}else{
+			RC4(keys[i], keyLengthInByte, pads[i], 32, pads[i]);
+		}
+	}
+	ComputeEncryptionKeys(pads, ownerCount, keys);
+	for (uint32_t i = 0; i < ownerCount; i++)
+	{
+		ComputeUserKey(keys[i], idDigest, userKey);
+		if (CheckUserKey(userKey))
+		{
+			return (int32_t)i;
+		}
+	}
+	return match;
+}
+
+void PdfCrypto::ComputeEncryptionKeys(const uint8_t (*userPads)[32], uint32_t count, uint8_t (*encryptionKeysRet)[16]) const
+{
+	if (count == 0)
+	{
+		return;
+	}
+	//the same message as ComputeEncryptionKey: pad, O, P, ID and the metadata marker
+	uint32_t idLength = id_.GetLength();
+	uint32_t length = 32 + 32 + 4 + idLength;
+	if (b_meta_data_ == false && revision_ >= 4)
+	{
+		length += 4;
+	}
+	uint8_t * messages = GetAllocator()->NewArray<uint8_t>(length * count);
+	const uint8_t ** bufs = GetAllocator()->NewArray<const uint8_t *>(count);
+	uint32_t * lens = GetAllocator()->NewArray<uint32_t>(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint8_t * message = messages + i * length;
+		memcpy(message, userPads[i], 32);
+		memcpy(message + 32, o_, 32);
+		message[64] = (uint8_t)(p_ & 0xff);
+		message[65] = (uint8_t)((p_ >> 8) & 0xff);
+		message[66] = (uint8_t)((p_ >> 16) & 0xff);
+		message[67] = (uint8_t)((p_ >> 24) & 0xff);
+		if (idLength > 0)
+		{
+			memcpy(message + 68, id_.GetData(), idLength);
+		}
+		if (length > 68 + idLength)
+		{
+			memset(message + 68 + idLength, 0xFF, 4);
+		}
+		bufs[i] = message;
+		lens[i] = length;
+	}
+
+	HashMD5Multi md5;
+	md5.Hash(bufs, lens, count, encryptionKeysRet);
+	if (revision_ >= 3)
+	{
+		uint32_t keyLengthInByte = key_length_ / 8;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			bufs[i] = encryptionKeysRet[i];
+			lens[i] = keyLengthInByte;
+		}
+		for (uint32_t k = 0; k < 50; k++)
+		{
+			md5.Hash(bufs, lens, count, encryptionKeysRet);
+		}
+	}
+	GetAllocator()->DeleteArray<uint32_t>(lens);
+	GetAllocator()->DeleteArray<const uint8_t *>(bufs);
+	GetAllocator()->DeleteArray<uint8_t>(messages);
+}
+
+void PdfCrypto::ComputeOwnerRC4Keys(const uint8_t (*ownerPads)[32], uint32_t count, uint8_t (*keysRet)[16]) const
+{
+	const uint8_t ** bufs = GetAllocator()->NewArray<const uint8_t *>(count);
+	uint32_t * lens = GetAllocator()->NewArray<uint32_t>(count);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		bufs[i] = ownerPads[i];
+		lens[i] = 32;
+	}
+	HashMD5Multi md5;
+	md5.Hash(bufs, lens, count, keysRet);
+	if ((revision_ == 3) || (revision_ == 4))
+	{
+		uint32_t keyLengthInByte = key_length_ / 8;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			bufs[i] = keysRet[i];
+			lens[i] = keyLengthInByte;
+		}
+		for (uint32_t k = 0; k < 50; k++)
+		{
+			md5.Hash(bufs, lens, count, keysRet);
+		}
+	}
+	GetAllocator()->DeleteArray<uint32_t>(lens);
+	GetAllocator()->DeleteArray<const uint8_t *>(bufs);
+}
+
+void PdfCrypto::ComputeEncryptionKey(const uint8_t userPad[32], uint8_t encryptionKeyRet[16]) const
 {
 	uint32_t keyLengthInByte = key_length_ / 8;
 
@@ -211,16 +610,9 @@ void PdfCrypto::ComputeEncryptionKey(uint8_t userPad[32], uint8_t encryptionKeyR
 
 	md5.Update(ext, 4);
 
-	uint8_t * docId = nullptr;
 	if (id_.GetLength() > 0)
 	{
-		docId = GetAllocator()->NewArray<uint8_t>(id_.GetLength());
-		uint32_t j;
-		for (j = 0; j < id_.GetLength(); j++)
-		{
-			docId[j] = static_cast<unsigned char>(id_[j]);
-		}
-		md5.Update(docId, (uint32_t)id_.GetLength());
+		md5.Update((const uint8_t *)id_.GetData(), id_.GetLength());
 	}
 
 	if (b_meta_data_ == false && revision_ >= 4)
@@ -245,33 +637,39 @@ void PdfCrypto::ComputeEncryptionKey(uint8_t userPad[32], uint8_t encryptionKeyR
 	}
 }
 
-void PdfCrypto::ComputeUserKey(uint8_t encryptionKey[16], uint8_t userKeyRet[32])
+void PdfCrypto::ComputeUserKeyDigest(uint8_t digestRet[16]) const
 {
-	uint32_t keyLengthInByte = key_length_ / 8;
+	HashMD5 md5;
+	md5.Init();
+	md5.Update(padding, 32);
+	if (id_.GetLength() > 0)
+	{
+		md5.Update((const uint8_t *)id_.GetData(), id_.GetLength());
+	}
+	md5.Final(digestRet);
+}
 
+void PdfCrypto::ComputeUserKey(const uint8_t encryptionKey[16], uint8_t userKeyRet[32]) const
+{
+	uint8_t idDigest[16];
 	if (revision_ >= 3)
 	{
-		HashMD5 md5;
-		md5.Init();
-		md5.Update(padding, 32);
+		ComputeUserKeyDigest(idDigest);
+	}
+	ComputeUserKey(encryptionKey, idDigest, userKeyRet);
+}
 
-		if (id_.GetLength() > 0)
-		{
-			uint8_t * docId = GetAllocator()->NewArray<uint8_t>(id_.GetLength());
-			for (uint32_t j = 0; j < id_.GetLength(); j++)
-			{
-				docId[j] = static_cast<unsigned char>(id_[j]);
-			}
-			md5.Update(docId, (uint32_t)id_.GetLength());
-			GetAllocator()->DeleteArray<uint8_t>(docId);
-		}
+void PdfCrypto::ComputeUserKey(const uint8_t encryptionKey[16], const uint8_t idDigest[16], uint8_t userKeyRet[32]) const
+{
+	uint32_t keyLengthInByte = key_length_ / 8;
 
+	if (revision_ >= 3)
+	{
 		uint8_t digest[16];
-		md5.Final(digest);
 		uint32_t k;
 		for (k = 0; k < 16; k++)
 		{
-			userKeyRet[k] = digest[k];
+			userKeyRet[k] = idDigest[k];
 		}
 		for (k = 16; k < 32; k++)
 		{
@@ -292,152 +690,503 @@ void PdfCrypto::ComputeUserKey(uint8_t encryptionKey[16], uint8_t userKeyRet[32]
 	}
 }
 
-uint32_t PdfCrypto::Encrypt(ByteString & str, uint32_t objNum, uint32_t genNum)
+bool PdfCrypto::CheckUserKey(const uint8_t userKey[32]) const
 {
-	uint8_t objKey[16];
-	uint32_t objKeyLength = 0;
-	CreateObjKey(objNum, genNum, objKey, &objKeyLength);
-	return Encrypt(str, objKey, objKeyLength);
+	//from revision 3 on only the first 16 bytes of U are defined
+	uint32_t kmax = (revision_ == 2) ? 32 : 16;
+	return memcmp(userKey, u_, kmax) == 0;
 }
 
-uint32_t PdfCrypto::Encrypt(uint8_t * pData, uint32_t length, uint32_t objNum, uint32_t genNum)
+uint32_t PdfCrypto::Encrypt(ByteString & str, uint32_t objNum, uint32_t genNum)
 {
-	uint8_t objKey[16];
-	uint32_t objKeyLength = 0;
-	CreateObjKey(objNum, genNum, objKey, &objKeyLength);
-	return Encrypt(pData, length, objKey, objKeyLength);
+	ObjCipher cipher;
+	PrepareObjCipher(objNum, genNum, true, cipher);
+	return EncryptString(cipher, str);
 }
 
-uint32_t PdfCrypto::Encrypt(ByteString & str, uint8_t objKey[16], uint32_t objKeyLen)
+uint32_t PdfCrypto::Encrypt(uint8_t * pData, uint32_t length, uint32_t objNum, uint32_t genNum)
 {
-	uint32_t length = str.GetLength();
-	uint8_t * pData = GetAllocator()->NewArray<uint8_t>(length + 16);
-	for (uint32_t i = 0; i < length; i++)
+	if (pData == nullptr || length == 0)
 	{
-		pData[i] = (uint8_t)(str[i]);
+		return 0;
 	}
-	if (algorithm_ == CRYPTO_ALGORITHM_RC4)
+	ObjCipher cipher;
+	PrepareObjCipher(objNum, genNum, true, cipher);
+	return EncryptData(cipher, pData, length);
+}
+
+uint32_t PdfCrypto::Encrypt(ByteString & str, uint8_t objKey[32], uint32_t objKeyLen)
+{
+	ObjCipher cipher;
+	PrepareObjCipher(objKey, objKeyLen, true, cipher);
+	return EncryptString(cipher, str);
+}
+
+uint32_t PdfCrypto::Encrypt(uint8_t * pData, uint32_t length, uint8_t objKey[32], uint32_t objKeyLen)
+{
+	if (pData == nullptr || length == 0)
 	{
-		RC4(objKey, objKeyLen, pData, length, pData);
-		str.SetData(pData, length);
+		return 0;
 	}
-	else if (algorithm_ == CRYPTO_ALGORITHM_AESV2)
+	ObjCipher cipher;
+	PrepareObjCipher(objKey, objKeyLen, true, cipher);
+	return EncryptData(cipher, pData, length);
+}
+
+uint32_t PdfCrypto::Decrypt(ByteString & str, uint32_t objNum, uint32_t genNum)
+{
+	ObjCipher cipher;
+	PrepareObjCipher(objNum, genNum, false, cipher);
+	return DecryptString(cipher, str);
+}
+
+uint32_t PdfCrypto::Decrypt(uint8_t * pData, uint32_t length, uint32_t objNum, uint32_t genNum)
+{
+	if (pData == nullptr || length == 0)
 	{
-		AESEncrypt(objKey, objKeyLen, pData, length, pData);
-		str.SetData(pData, length + 16);
+		return 0;
 	}
-	GetAllocator()->DeleteArray<uint8_t>(pData);
-	return str.GetLength();
+	ObjCipher cipher;
+	PrepareObjCipher(objNum, genNum, false, cipher);
+	return DecryptData(cipher, pData, length);
 }
 
-uint32_t PdfCrypto::Encrypt(uint8_t * pData, uint32_t length, uint8_t objKey[16], uint32_t objKeyLen)
+uint32_t PdfCrypto::Decrypt(ByteString & str, uint8_t objKey[32], uint32_t objKeyLen)
+{
+	ObjCipher cipher;
+	PrepareObjCipher(objKey, objKeyLen, false, cipher);
+	return DecryptString(cipher, str);
+}
+
+uint32_t PdfCrypto::Decrypt(uint8_t * pData, uint32_t length, uint8_t objKey[32], uint32_t objKeyLen)
 {
 	if (pData == nullptr || length == 0)
 	{
 		return 0;
 	}
-	if (algorithm_ == CRYPTO_ALGORITHM_RC4)
+	ObjCipher cipher;
+	PrepareObjCipher(objKey, objKeyLen, false, cipher);
+	return DecryptData(cipher, pData, length);
+}
+
+bool PdfCrypto::EncryptObjects(const PdfObjectPointer * objects, const uint32_t * objNums, const uint32_t * genNums,
+                               uint32_t count, uint32_t threadCount)
+{
+	if (objects == nullptr || objNums == nullptr || genNums == nullptr || count == 0)
 	{
-		RC4(objKey, objKeyLen, pData, length, pData);
+		return false;
 	}
-	else if (algorithm_ == CRYPTO_ALGORITHM_AESV2)
+	//the object keys of a chunk are derived together on the multi-buffer MD5
+	const uint32_t chunkSize = 64;
+	const uint32_t chunkCount = (count + chunkSize - 1) / chunkSize;
+	if (threadCount == 0)
 	{
-		length = AESEncrypt(objKey, objKeyLen, pData, length, pData);
+		threadCount = std::thread::hardware_concurrency();
 	}
-	return length;
+	if (threadCount == 0)
+	{
+		threadCount = 1;
+	}
+	if (threadCount > chunkCount)
+	{
+		threadCount = chunkCount;
+	}
+
+	//objects shared with clones are copied here, the workers change them in place
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (objects[i])
+		{
+			objects[i]->Unshare();
+		}
+	}
+
+	std::atomic<uint32_t> nextChunk(0);
+	std::atomic<bool> bFailed(false);
+	auto worker = [&]()
+	{
+		uint8_t objKeys[chunkSize][32];
+		uint32_t objKeyLength = 0;
+		ObjCipher cipher;
+		for (;;)
+		{
+			uint32_t chunk = nextChunk.fetch_add(1);
+			if (chunk >= chunkCount)
+			{
+				return;
+			}
+			uint32_t start = chunk * chunkSize;
+			uint32_t n = (count - start < chunkSize) ? count - start : chunkSize;
+			CreateObjKeys(objNums + start, genNums + start, n, objKeys, &objKeyLength);
+			for (uint32_t i = 0; i < n; i++)
+			{
+				if (objects[start + i])
+				{
+					PrepareObjCipher(objKeys[i], objKeyLength, true, cipher);
+					if (!EncryptObject(objects[start + i], cipher))
+					{
+						bFailed = true;
+					}
+				}
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (uint32_t i = 1; i < threadCount; i++)
+	{
+		threads.push_back(std::thread(worker));
+	}
+	worker();
+	for (size_t i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+	return !bFailed;
 }
 
-uint32_t PdfCrypto::Decrypt(ByteString & str, uint32_t objNum, uint32_t genNum)
+bool PdfCrypto::EncryptObject(const PdfObjectPointer & object, const ObjCipher & cipher)
 {
-	uint8_t objKey[16];
-	uint32_t objKeyLength = 0;
-	CreateObjKey(objNum, genNum, objKey, &objKeyLength);
-	return Decrypt(str, objKey, objKeyLength);
+	if (!object)
+	{
+		return true;
+	}
+	bool bRet = true;
+	switch (object->GetType())
+	{
+	case OBJ_TYPE_STRING:
+		{
+			//every string starts over with the key schedule
+			ObjCipher stringCipher = cipher;
+			ByteString & str = object->GetPdfString()->GetString();
+			bool bEmpty = (str.GetLength() == 0);
+			//only RC4 turns an empty string into an empty one, AES always writes an IV
+			if (EncryptString(stringCipher, str) == 0 && (!bEmpty || algorithm_ != CRYPTO_ALGORITHM_RC4))
+			{
+				bRet = false;
+			}
+			break;
+		}
+	case OBJ_TYPE_ARRAY:
+		{
+			PdfArrayPointer array = object->GetPdfArray();
+			//inline values hold no strings, only the objects are walked
+			for (uint32_t i = 0; i < array->GetSize(); i++)
+			{
+				PdfValue value = array->GetValue(i);
+				if (!value.IsInline() && !EncryptObject(value.GetObject(), cipher))
+				{
+					bRet = false;
+				}
+			}
+			break;
+		}
+	case OBJ_TYPE_DICTIONARY:
+		{
+			PdfDictionaryPointer dictionary = object->GetPdfDictionary();
+			uint32_t key = NAME_ATOM_NONE;
+			PdfValue value;
+			dictionary->MoveToFirst();
+			while (dictionary->GetKeyAndValue(key, value))
+			{
+				if (!value.IsInline() && !EncryptObject(value.GetObject(), cipher))
+				{
+					bRet = false;
+				}
+			}
+			break;
+		}
+	case OBJ_TYPE_STREAM:
+		bRet = EncryptStream(object->GetPdfStream(), cipher);
+		break;
+	default:
+		break;
+	}
+	return bRet;
 }
 
-uint32_t PdfCrypto::Decrypt(uint8_t * pData, uint32_t length, uint32_t objNum, uint32_t genNum)
+bool PdfCrypto::EncryptStream(const PdfStreamPointer & stream, const ObjCipher & cipher)
 {
-	uint8_t objKey[16];
-	uint32_t objKeyLength = 0;
-	CreateObjKey(objNum, genNum, objKey, &objKeyLength);
-	return Decrypt(pData, length, objKey, objKeyLength);
+	bool bRet = true;
+	if (stream->dictionary_)
+	{
+		bRet = EncryptObject(stream->dictionary_, cipher);
+	}
+	if (stream->crypto_ == this || stream->size_ == 0)
+	{
+		//the data is under this key already
+		return bRet;
+	}
+
+	//the data is encrypted aside and swapped in only once that worked, a failure leaves the
+	//stream as it was, AES data grows by the IV and the padding
+	Allocator * allocator = stream->GetAllocator();
+	uint32_t length = (uint32_t)stream->size_;
+	uint8_t * pData = allocator->NewArray<uint8_t>((size_t)length + 32);
+	if (pData == nullptr)
+	{
+		return false;
+	}
+	if (stream->crypto_ != nullptr)
+	{
+		//data under another key is decrypted first, it must not stay under the old one
+		if (!stream->crypto_->IsPasswordOK())
+		{
+			allocator->DeleteArray<uint8_t>(pData);
+			return false;
+		}
+		length = (uint32_t)stream->GetRawData(0, pData, stream->size_);
+	}else if (stream->ReadRawData(0, pData, length) != length)
+	{
+		allocator->DeleteArray<uint8_t>(pData);
+		return false;
+	}
+
+	ObjCipher streamCipher = cipher;
+	size_t size = EncryptData(streamCipher, pData, length);
+	if (size == 0 && algorithm_ != CRYPTO_ALGORITHM_RC4)
+	{
+		allocator->DeleteArray<uint8_t>(pData);
+		return false;
+	}
+	if (stream->b_memory_stream && stream->data_)
+	{
+		allocator->DeleteArray<uint8_t>(stream->data_);
+	}
+	stream->b_memory_stream = true;
+	stream->data_ = pData;
+	stream->size_ = size;
+	stream->crypto_ = this;
+	if (stream->dictionary_)
+	{
+		stream->dictionary_->SetObject(NAME_Length, PdfNumber::Create((int32_t)stream->size_, allocator));
+	}
+	stream->SetModified(true);
+	return bRet;
 }
 
-uint32_t PdfCrypto::Decrypt(ByteString & str, uint8_t objKey[16], uint32_t objKeyLen)
+void PdfCrypto::ClearObjKeyCache()
 {
-	uint32_t length = str.GetLength();
-	uint8_t * pData = GetAllocator()->NewArray<uint8_t>(length);
-	for (uint32_t i = 0; i < length; i++)
+	obj_key_cache_lock_.Lock();
+	for (uint32_t i = 0; i < CRYPTO_OBJKEY_CACHE_SIZE; i++)
 	{
-		pData[i] = (uint8_t)(str[i]);
+		obj_key_cache_[i].b_valid = false;
 	}
+	obj_key_cache_hits_ = 0;
+	obj_key_cache_misses_ = 0;
+	obj_key_cache_lock_.UnLock();
+}
+
+size_t PdfCrypto::GetObjKeyCacheHits() const
+{
+	obj_key_cache_lock_.Lock();
+	size_t hits = obj_key_cache_hits_;
+	obj_key_cache_lock_.UnLock();
+	return hits;
+}
+
+size_t PdfCrypto::GetObjKeyCacheMisses() const
+{
+	obj_key_cache_lock_.Lock();
+	size_t misses = obj_key_cache_misses_;
+	obj_key_cache_lock_.UnLock();
+	return misses;
+}
+
+void PdfCrypto::PrepareObjCipher(uint32_t objNum, uint32_t genNum, bool bEncrypt, ObjCipher & cipher)
+{
+	if (algorithm_ == CRYPTO_ALGORITHM_AESV3)
+	{
+		//the file key schedules are already there, nothing worth caching
+		PrepareObjCipher(encryption_key_, 32, bEncrypt, cipher);
+		return;
+	}
+
+	//consecutive object numbers land in different slots, the odd multiplier moves every
+	//generation bit into the low bits the slot is taken from
+	ObjKeyCacheEntry & entry = obj_key_cache_[(objNum ^ (genNum * 0x9E3779B9)) % CRYPTO_OBJKEY_CACHE_SIZE];
+
+	obj_key_cache_lock_.Lock();
+	if (entry.b_valid && entry.obj_num == objNum && entry.gen_num == genNum)
+	{
+		obj_key_cache_hits_++;
+		memcpy(cipher.key, entry.key, entry.key_length);
+		cipher.key_length = entry.key_length;
+		if (algorithm_ == CRYPTO_ALGORITHM_RC4)
+		{
+			cipher.rc4 = entry.rc4;
+		}
+		else if (algorithm_ == CRYPTO_ALGORITHM_AESV2)
+		{
+			bool & bReady = bEncrypt ? entry.b_encrypt_ready : entry.b_decrypt_ready;
+			CryptoRijndael & aes = bEncrypt ? entry.aes_encrypt : entry.aes_decrypt;
+			if (!bReady)
+			{
+				aes.init(CryptoRijndael::CBC, bEncrypt ? CryptoRijndael::Encrypt : CryptoRijndael::Decrypt,
+				         entry.key, CryptoRijndael::Key16Bytes);
+				bReady = true;
+			}
+			cipher.aes = aes;
+		}
+		obj_key_cache_lock_.UnLock();
+		return;
+	}
+	obj_key_cache_misses_++;
+	obj_key_cache_lock_.UnLock();
+
+	uint8_t objKey[32];
+	uint32_t objKeyLength = 0;
+	CreateObjKey(objNum, genNum, objKey, &objKeyLength);
+	PrepareObjCipher(objKey, objKeyLength, bEncrypt, cipher);
+
+	obj_key_cache_lock_.Lock();
+	entry.b_valid = true;
+	entry.obj_num = objNum;
+	entry.gen_num = genNum;
+	entry.key_length = objKeyLength;
+	memcpy(entry.key, objKey, objKeyLength);
+	entry.b_encrypt_ready = false;
+	entry.b_decrypt_ready = false;
 	if (algorithm_ == CRYPTO_ALGORITHM_RC4)
 	{
-		RC4(objKey, objKeyLen, pData, length, pData);
-		str.SetData(pData, length);
+		entry.rc4 = cipher.rc4;
 	}
 	else if (algorithm_ == CRYPTO_ALGORITHM_AESV2)
 	{
-		length = AESDecrypt(objKey, objKeyLen, pData, length, pData);
-		if (length > 0)
+		if (bEncrypt)
 		{
-			str.SetData(pData, length);
+			entry.aes_encrypt = cipher.aes;
+			entry.b_encrypt_ready = true;
+		}else{
+			entry.aes_decrypt = cipher.aes;
+			entry.b_decrypt_ready = true;
 		}
 	}
-	GetAllocator()->DeleteArray<uint8_t>(pData);
+	obj_key_cache_lock_.UnLock();
+}
+
+void PdfCrypto::PrepareObjCipher(uint8_t objKey[32], uint32_t objKeyLen, bool bEncrypt, ObjCipher & cipher)
+{
+	memcpy(cipher.key, objKey, objKeyLen);
+	cipher.key_length = objKeyLen;
+	if (algorithm_ == CRYPTO_ALGORITHM_RC4)
+	{
+		cipher.rc4.Init(objKey, objKeyLen);
+	}
+	else if (algorithm_ == CRYPTO_ALGORITHM_AESV3)
+	{
+		cipher.aes = bEncrypt ? aes_encrypt_ : aes_decrypt_;
+	}
+	else if (algorithm_ == CRYPTO_ALGORITHM_AESV2)
+	{
+		cipher.aes.init(CryptoRijndael::CBC, bEncrypt ? CryptoRijndael::Encrypt : CryptoRijndael::Decrypt,
+		                objKey, CryptoRijndael::Key16Bytes);
+	}
+}
+
+uint32_t PdfCrypto::EncryptData(ObjCipher & cipher, uint8_t * pData, uint32_t length)
+{
+	if (algorithm_ == CRYPTO_ALGORITHM_RC4)
+	{
+		//the state is a copy taken right after the key schedule
+		cipher.rc4.Process(pData, length, pData);
+	}
+	else if (algorithm_ == CRYPTO_ALGORITHM_AESV2 || algorithm_ == CRYPTO_ALGORITHM_AESV3)
+	{
+		length = AESEncrypt(cipher.aes, pData, length, pData);
+	}
 	return length;
 }
 
-uint32_t PdfCrypto::Decrypt(uint8_t * pData, uint32_t length, uint8_t objKey[16], uint32_t objKeyLen)
+uint32_t PdfCrypto::DecryptData(ObjCipher & cipher, uint8_t * pData, uint32_t length)
 {
-	if (pData == nullptr || length == 0)
+	if (algorithm_ == CRYPTO_ALGORITHM_RC4)
+	{
+		//the state is a copy taken right after the key schedule
+		cipher.rc4.Process(pData, length, pData);
+	}
+	else if (algorithm_ == CRYPTO_ALGORITHM_AESV2 || algorithm_ == CRYPTO_ALGORITHM_AESV3)
+	{
+		length = AESDecrypt(cipher.aes, pData, length, pData);
+	}
+	return length;
+}
+
+uint32_t PdfCrypto::EncryptString(ObjCipher & cipher, ByteString & str)
+{
+	//encrypted in the string's own buffer, AES needs room for the IV and the padding
+	uint32_t length = str.GetLength();
+	uint32_t room = (algorithm_ == CRYPTO_ALGORITHM_RC4) ? length : length + 32;
+	uint8_t * pData = str.GetBuffer(room);
+	if (pData == nullptr)
+	{
+		return 0;
+	}
+	length = EncryptData(cipher, pData, length);
+	str.ReleaseBuffer(length);
+	return length;
+}
+
+uint32_t PdfCrypto::DecryptString(ObjCipher & cipher, ByteString & str)
+{
+	uint32_t length = str.GetLength();
+	if (length == 0)
 	{
 		return 0;
 	}
 	if (algorithm_ == CRYPTO_ALGORITHM_RC4)
 	{
-		RC4(objKey, objKeyLen, pData, length, pData);
+		length = DecryptData(cipher, str.GetBuffer(length), length);
+		str.ReleaseBuffer(length);
+		return length;
 	}
-	else if (algorithm_ == CRYPTO_ALGORITHM_AESV2)
+	//a bad padding is only found after the output is written, keep str intact until then
+	uint8_t * pData = GetAllocator()->NewArray<uint8_t>(length);
+	memcpy(pData, str.GetData(), length);
+	length = DecryptData(cipher, pData, length);
+	if (length > 0)
 	{
-		length = AESDecrypt(objKey, objKeyLen, pData, length, pData);
+		str.SetData(pData, length);
 	}
+	GetAllocator()->DeleteArray<uint8_t>(pData);
 	return length;
 }
 
-void PdfCrypto::RC4(uint8_t * key, uint32_t keyLength, uint8_t * data, uint32_t dataLength, uint8_t * dataRet)
+void PdfCrypto::RC4(const uint8_t * key, uint32_t keyLength, const uint8_t * data, uint32_t dataLength, uint8_t * dataRet) const
 {
-	CryptoRC4::Encrypt(key, keyLength, data, dataLength, dataRet);
+	CryptoRC4 rc4;
+	rc4.Init(key, keyLength);
+	rc4.Process(data, dataLength, dataRet);
 }
 
-uint32_t PdfCrypto::AESEncrypt(uint8_t * key, uint32_t keyLength, uint8_t * data, uint32_t dataLength, uint8_t * dataRet)
+uint32_t PdfCrypto::AESEncrypt(CryptoRijndael & aes, uint8_t * data, uint32_t dataLength, uint8_t * dataRet)
 {
-	CryptoRijndael aes;
-	for (uint32_t i = 0; i < 16; i++)
+	//output is a random IV followed by the padded cipher text, data may be dataRet
+	uint8_t iv[16];
+	if (!random_bytes(iv, 16))
 	{
-		dataRet[i] = key[i];
+		return 0;
 	}
-	aes.init(CryptoRijndael::CBC, CryptoRijndael::Encrypt, key, CryptoRijndael::Key16Bytes, dataRet);
-	int32_t len = aes.padEncrypt(data, (uint32_t)dataLength, &dataRet[16]);
+	memmove(dataRet + 16, data, dataLength);
+	memcpy(dataRet, iv, 16);
+
+	aes.setInitVector(iv);
+	int32_t len = aes.padEncrypt(dataRet + 16, (int32_t)dataLength, dataRet + 16);
 	if (len < 0)
 	{
 		return 0;
 	}
-	else{
-		return len;
-	}
+	return len + 16;
 }
 
-uint32_t PdfCrypto::AESDecrypt(uint8_t * key, uint32_t keyLength, uint8_t * data, uint32_t dataLength, uint8_t * dataRet)
+uint32_t PdfCrypto::AESDecrypt(CryptoRijndael & aes, uint8_t * data, uint32_t dataLength, uint8_t * dataRet)
 {
-	CryptoRijndael aes;
-	uint8_t vector[16];
-	for (uint32_t i = 0; i < 16; i++)
+	if (dataLength < 32)
 	{
-		vector[i] = data[i];
+		return 0;
 	}
-	aes.init(CryptoRijndael::CBC, CryptoRijndael::Decrypt, key, CryptoRijndael::Key16Bytes, vector);
-	int32_t len = aes.padDecrypt(&data[16], (uint32_t)(dataLength - 16), dataRet);
+	aes.setInitVector(data);
+	int32_t len = aes.padDecrypt(&data[16], (int32_t)(dataLength - 16), dataRet);
 	if (len < 0)
 	{
 		return 0;
@@ -446,5 +1195,347 @@ uint32_t PdfCrypto::AESDecrypt(uint8_t * key, uint32_t keyLength, uint8_t * data
 		return len;
 	}
 }
+
+void PdfCrypto::PrepareFileKeyAES()
+{
+	aes_encrypt_.init(CryptoRijndael::CBC, CryptoRijndael::Encrypt, encryption_key_, CryptoRijndael::Key32Bytes);
+	aes_decrypt_.init(CryptoRijndael::CBC, CryptoRijndael::Decrypt, encryption_key_, CryptoRijndael::Key32Bytes);
+}
+
+// Algorithm 2.A/2.B of ISO 32000-2. Revision 5 is the plain SHA-256, revision 6 iterates
+// AES-128 and SHA-256/384/512 over 64 copies of password, hash and user data.
+void PdfCrypto::ComputeHashV5(const uint8_t * password, uint32_t length, const uint8_t salt[8], const uint8_t * udata, uint8_t hashRet[32]) const
+{
+	uint8_t k[64];
+	uint32_t kLength = 32;
+	uint32_t udataLength = udata ? 48 : 0;
+
+	HashSHA256 sha256;
+	sha256.Update(password, length);
+	sha256.Update(salt, 8);
+	if (udata)
+	{
+		sha256.Update(udata, 48);
+	}
+	sha256.Final(k);
+
+	if (revision_ >= 6)
+	{
+		HashSHA384 sha384;
+		HashSHA512 sha512;
+		uint32_t capacity = 64 * (127 + 64 + 48);
+		uint8_t * k1 = GetAllocator()->NewArray<uint8_t>(capacity);
+		uint8_t * e = GetAllocator()->NewArray<uint8_t>(capacity);
+		for (uint32_t round = 0; ; )
+		{
+			uint32_t seqLength = length + kLength + udataLength;
+			memcpy(k1, password, length);
+			memcpy(k1 + length, k, kLength);
+			if (udata)
+			{
+				memcpy(k1 + length + kLength, udata, 48);
+			}
+			for (uint32_t i = 1; i < 64; i++)
+			{
+				memcpy(k1 + i * seqLength, k1, seqLength);
+			}
+
+			CryptoRijndael aes;
+			aes.init(CryptoRijndael::CBC, CryptoRijndael::Encrypt, k, CryptoRijndael::Key16Bytes, k + 16);
+			aes.blockEncrypt(k1, (int32_t)(seqLength * 64 * 8), e);
+
+			//256 = 1 (mod 3), so the big endian 128 bit number mod 3 is its byte sum mod 3
+			uint32_t sum = 0;
+			for (uint32_t i = 0; i < 16; i++)
+			{
+				sum += e[i];
+			}
+			switch (sum % 3)
+			{
+			case 0:
+				sha256.Update(e, seqLength * 64);
+				sha256.Final(k);
+				kLength = 32;
+				break;
+			case 1:
+				sha384.Update(e, seqLength * 64);
+				sha384.Final(k);
+				kLength = 48;
+				break;
+			default:
+				sha512.Update(e, seqLength * 64);
+				sha512.Final(k);
+				kLength = 64;
+				break;
+			}
+			round++;
+			if (round >= 64 && (uint32_t)e[seqLength * 64 - 1] + 32 <= round)
+			{
+				break;
+			}
+		}
+		GetAllocator()->DeleteArray<uint8_t>(k1);
+		GetAllocator()->DeleteArray<uint8_t>(e);
+	}
+	memcpy(hashRet, k, 32);
+}
+
+bool PdfCrypto::ComputeFileKeyV5(const ByteString & password, uint8_t keyRet[32]) const
+{
+	uint8_t pswd[127];
+	uint32_t length = password.GetLength();
+	if (length > 127)
+	{
+		length = 127;
+	}
+	memcpy(pswd, password.GetData(), length);
+
+	uint8_t hash[32];
+	const uint8_t * wrapped = nullptr;
+	ComputeHashV5(pswd, length, u_ + 32, nullptr, hash);
+	if (memcmp(hash, u_, 32) == 0)
+	{
+		ComputeHashV5(pswd, length, u_ + 40, nullptr, hash);
+		wrapped = ue_;
+	}else{
+		ComputeHashV5(pswd, length, o_ + 32, u_, hash);
+		if (memcmp(hash, o_, 32) != 0)
+		{
+			return false;
+		}
+		ComputeHashV5(pswd, length, o_ + 40, u_, hash);
+		wrapped = oe_;
+	}
+
+	//UE/OE are the file key encrypted with AES-256-CBC, zero IV and no padding
+	CryptoRijndael aes;
+	aes.init(CryptoRijndael::CBC, CryptoRijndael::Decrypt, hash, CryptoRijndael::Key32Bytes);
+	aes.blockDecrypt(wrapped, 256, keyRet);
+	return true;
+}
+
+bool PdfCrypto::AuthenticateV5(const ByteString & password)
+{
+	if (!ComputeFileKeyV5(password, encryption_key_))
+	{
+		return false;
+	}
+	PrepareFileKeyAES();
+	b_password_ok_ = true;
+	return true;
+}
+
+void PdfCrypto::InitV5(const ByteString & userPassword, const ByteString & ownerPassword)
+{
+	uint8_t user[127];
+	uint8_t owner[127];
+	uint32_t userLength = userPassword.GetLength() > 127 ? 127 : userPassword.GetLength();
+	uint32_t ownerLength = ownerPassword.GetLength() > 127 ? 127 : ownerPassword.GetLength();
+	memcpy(user, userPassword.GetData(), userLength);
+	if (ownerLength == 0)
+	{
+		memcpy(owner, user, userLength);
+		ownerLength = userLength;
+	}else{
+		memcpy(owner, ownerPassword.GetData(), ownerLength);
+	}
+
+	uint8_t hash[32];
+	uint8_t perms[16];
+	CryptoRijndael aes;
+	//without fresh key material the handler stays unusable rather than writing weak keys
+	if (!random_bytes(encryption_key_, 32) || !random_bytes(u_ + 32, 16) ||
+	    !random_bytes(o_ + 32, 16) || !random_bytes(perms + 12, 4))
+	{
+		b_password_ok_ = false;
+		return;
+	}
+
+	//U = hash || validation salt || key salt, UE = file key wrapped with the key salt hash
+	ComputeHashV5(user, userLength, u_ + 32, nullptr, u_);
+	ComputeHashV5(user, userLength, u_ + 40, nullptr, hash);
+	aes.init(CryptoRijndael::CBC, CryptoRijndael::Encrypt, hash, CryptoRijndael::Key32Bytes);
+	aes.blockEncrypt(encryption_key_, 256, ue_);
+
+	//the owner entries hash in all 48 bytes of U
+	ComputeHashV5(owner, ownerLength, o_ + 32, u_, o_);
+	ComputeHashV5(owner, ownerLength, o_ + 40, u_, hash);
+	aes.init(CryptoRijndael::CBC, CryptoRijndael::Encrypt, hash, CryptoRijndael::Key32Bytes);
+	aes.blockEncrypt(encryption_key_, 256, oe_);
+
+	perms[0] = (uint8_t)(p_ & 0xff);
+	perms[1] = (uint8_t)((p_ >> 8) & 0xff);
+	perms[2] = (uint8_t)((p_ >> 16) & 0xff);
+	perms[3] = (uint8_t)((p_ >> 24) & 0xff);
+	perms[4] = perms[5] = perms[6] = perms[7] = 0xFF;
+	perms[8] = b_meta_data_ ? 'T' : 'F';
+	perms[9] = 'a';
+	perms[10] = 'd';
+	perms[11] = 'b';
+	aes.init(CryptoRijndael::ECB, CryptoRijndael::Encrypt, encryption_key_, CryptoRijndael::Key32Bytes);
+	aes.blockEncrypt(perms, 128, perms_);
+
+	PrepareFileKeyAES();
+	b_password_ok_ = true;
+}
     
+PdfDecryptContext::PdfDecryptContext(PdfCrypto * crypto, uint32_t objNum, uint32_t genNum, Allocator * allocator)
+	: BaseObject(allocator), algorithm_(0), block_length_(0), b_iv_ready_(false), b_held_(false), discard_(0)
+{
+	if (crypto == nullptr || !crypto->IsPasswordOK())
+	{
+		return;
+	}
+	PdfCrypto::ObjCipher cipher;
+	crypto->PrepareObjCipher(objNum, genNum, false, cipher);
+	algorithm_ = crypto->algorithm_;
+	if (algorithm_ == CRYPTO_ALGORITHM_RC4)
+	{
+		rc4_start_ = cipher.rc4;
+		rc4_ = cipher.rc4;
+	}
+	else if (algorithm_ == CRYPTO_ALGORITHM_AESV2 || algorithm_ == CRYPTO_ALGORITHM_AESV3)
+	{
+		aes_ = cipher.aes;
+	}
+}
+
+size_t PdfDecryptContext::Seek(size_t offset)
+{
+	if (algorithm_ == CRYPTO_ALGORITHM_RC4)
+	{
+		rc4_ = rc4_start_;
+		rc4_.Skip(offset);
+		return offset;
+	}
+	else if (algorithm_ == CRYPTO_ALGORITHM_AESV2 || algorithm_ == CRYPTO_ALGORITHM_AESV3)
+	{
+		//plain block n is encrypted at 16 + 16 * n, the block before it serves as its IV
+		block_length_ = 0;
+		b_iv_ready_ = false;
+		b_held_ = false;
+		discard_ = (uint32_t)(offset % 16);
+		return offset - discard_;
+	}
+	return offset;
+}
+
+uint32_t PdfDecryptContext::FlushHeld(uint8_t * dataRet, uint32_t length)
+{
+	if (!b_held_)
+	{
+		return 0;
+	}
+	b_held_ = false;
+	if (discard_ >= length)
+	{
+		discard_ = 0;
+		return 0;
+	}
+	uint32_t count = length - discard_;
+	memcpy(dataRet, held_ + discard_, count);
+	discard_ = 0;
+	return count;
+}
+
+uint32_t PdfDecryptContext::Update(const uint8_t * data, uint32_t length, uint8_t * dataRet)
+{
+	if (data == nullptr || length == 0 || dataRet == nullptr)
+	{
+		return 0;
+	}
+	if (algorithm_ == CRYPTO_ALGORITHM_RC4)
+	{
+		rc4_.Process(data, length, dataRet);
+		return length;
+	}
+	if (algorithm_ != CRYPTO_ALGORITHM_AESV2 && algorithm_ != CRYPTO_ALGORITHM_AESV3)
+	{
+		memmove(dataRet, data, length);
+		return length;
+	}
+
+	uint32_t count = 0;
+	while (length > 0)
+	{
+		if (block_length_ > 0 || length < 16 || !b_iv_ready_)
+		{
+			uint32_t n = 16 - block_length_;
+			if (n > length)
+			{
+				n = length;
+			}
+			memcpy(block_ + block_length_, data, n);
+			block_length_ += n;
+			data += n;
+			length -= n;
+			if (block_length_ < 16)
+			{
+				break;
+			}
+			block_length_ = 0;
+			if (!b_iv_ready_)
+			{
+				aes_.setInitVector(block_);
+				b_iv_ready_ = true;
+				continue;
+			}
+			count += FlushHeld(dataRet + count, 16);
+			aes_.blockDecrypt(block_, 128, held_);
+			aes_.setInitVector(block_);
+			b_held_ = true;
+			continue;
+		}
+
+		//whole blocks straight from the input, the last one becomes the held block
+		uint32_t n = length & ~15u;
+		if (n > 0x100000)
+		{
+			n = 0x100000;
+		}
+		uint8_t iv[16];
+		memcpy(iv, data + n - 16, 16);
+		count += FlushHeld(dataRet + count, 16);
+		aes_.blockDecrypt(data, (int32_t)(n * 8), dataRet + count);
+		aes_.setInitVector(iv);
+		memcpy(held_, dataRet + count + n - 16, 16);
+		b_held_ = true;
+		if (discard_ > 0 && n > 16)
+		{
+			//only the first block after a Seek can be partial
+			memmove(dataRet + count, dataRet + count + discard_, n - 16 - discard_);
+			count += n - 16 - discard_;
+			discard_ = 0;
+		}else{
+			count += n - 16;
+		}
+		data += n;
+		length -= n;
+	}
+	return count;
+}
+
+uint32_t PdfDecryptContext::Final(uint8_t * dataRet)
+{
+	if (dataRet == nullptr || !b_held_)
+	{
+		return 0;
+	}
+	uint32_t length = 16;
+	uint8_t pad = held_[15];
+	if (pad > 0 && pad <= 16)
+	{
+		uint32_t i = 16 - pad;
+		while (i < 16 && held_[i] == pad)
+		{
+			i++;
+		}
+		if (i == 16)
+		{
+			length = 16 - pad;
+		}
+	}
+	return FlushHeld(dataRet, length);
+}
+
 }//namespace
@@ -0,0 +1,532 @@
+#include <cwchar>
+
+#include "../include/che_pdf_encoding.h"
+
+#ifdef _CHE_SSE2_
+#include <emmintrin.h>
+#endif
+
+#if WCHAR_MAX > 0xFFFF
+#define PDF_WCHAR_UTF32
+#endif
+
+namespace chepdf {
+
+#define UNICODE_REPLACEMENT		0xFFFD
+
+//PDFDocEncoding codes that differ from Latin-1, 0x7F, 0x9F and 0xAD are undefined
+static const uint16_t gPDFDocHigh[0x29] =
+{
+	/*0x18*/ 0x02D8, 0x02C7, 0x02C6, 0x02D9, 0x02DD, 0x02DB, 0x02DA, 0x02DC,
+	/*0x80*/ 0x2022, 0x2020, 0x2021, 0x2026, 0x2014, 0x2013, 0x0192, 0x2044,
+	/*0x88*/ 0x2039, 0x203A, 0x2212, 0x2030, 0x201E, 0x201C, 0x201D, 0x2018,
+	/*0x90*/ 0x2019, 0x201A, 0x2122, 0xFB01, 0xFB02, 0x0141, 0x0152, 0x0160,
+	/*0x98*/ 0x0178, 0x017D, 0x0131, 0x0142, 0x0153, 0x0161, 0x017E, UNICODE_REPLACEMENT,
+	/*0xA0*/ 0x20AC
+};
+
+static inline uint32_t pdfdoc_to_unicode(uint8_t code)
+{
+	if (code >= 0x18 && code <= 0x1F)
+	{
+		return gPDFDocHigh[code - 0x18];
+	}
+	if (code == 0x7F || code == 0xAD)
+	{
+		return UNICODE_REPLACEMENT;
+	}
+	if (code >= 0x80 && code <= 0xA0)
+	{
+		return gPDFDocHigh[code - 0x80 + 8];
+	}
+	return code;
+}
+
+static inline bool unicode_to_pdfdoc(uint32_t code, uint8_t & codeRet)
+{
+	if (code < 0x18 || (code >= 0x20 && code < 0x7F) || (code >= 0xA1 && code <= 0xFF && code != 0xAD))
+	{
+		codeRet = (uint8_t)code;
+		return true;
+	}
+	for (uint32_t i = 0; i < 0x29; i++)
+	{
+		if (gPDFDocHigh[i] == code && code != UNICODE_REPLACEMENT)
+		{
+			codeRet = (uint8_t)((i < 8) ? 0x18 + i : 0x80 + i - 8);
+			return true;
+		}
+	}
+	return false;
+}
+
+//writes one code point, a surrogate pair where wchar_t is 16 bits
+static inline uint32_t put_wide(wchar_t * dst, uint32_t code)
+{
+#ifndef PDF_WCHAR_UTF32
+	if (code > 0xFFFF)
+	{
+		code -= 0x10000;
+		dst[0] = (wchar_t)(0xD800 + (code >> 10));
+		dst[1] = (wchar_t)(0xDC00 + (code & 0x3FF));
+		return 2;
+	}
+#endif
+	dst[0] = (wchar_t)code;
+	return 1;
+}
+
+//reads one code point, joining surrogate pairs where wchar_t is 16 bits
+static inline uint32_t get_wide(const wchar_t * src, uint32_t length, uint32_t & index)
+{
+	uint32_t code = (uint32_t)src[index++];
+#ifdef PDF_WCHAR_UTF32
+	(void)length;
+#else
+	code &= 0xFFFF;
+	if (code >= 0xD800 && code < 0xDC00 && index < length)
+	{
+		uint32_t low = (uint32_t)src[index] & 0xFFFF;
+		if (low >= 0xDC00 && low < 0xE000)
+		{
+			index++;
+			return 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+		}
+	}
+#endif
+	if ((code >= 0xD800 && code < 0xE000) || code > 0x10FFFF)
+	{
+		return UNICODE_REPLACEMENT;
+	}
+	return code;
+}
+
+#ifdef _CHE_SSE2_
+//stores 16 characters given as two vectors of 16 bit code units
+static inline void store_wide16(wchar_t * dst, __m128i lo, __m128i hi)
+{
+#ifdef PDF_WCHAR_UTF32
+	const __m128i zero = _mm_setzero_si128();
+	_mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(lo, zero));
+	_mm_storeu_si128((__m128i *)(dst + 4), _mm_unpackhi_epi16(lo, zero));
+	_mm_storeu_si128((__m128i *)(dst + 8), _mm_unpacklo_epi16(hi, zero));
+	_mm_storeu_si128((__m128i *)(dst + 12), _mm_unpackhi_epi16(hi, zero));
+#else
+	_mm_storeu_si128((__m128i *)dst, lo);
+	_mm_storeu_si128((__m128i *)(dst + 8), hi);
+#endif
+}
+
+//stores 8 characters given as one vector of 16 bit code units
+static inline void store_wide8(wchar_t * dst, __m128i units)
+{
+#ifdef PDF_WCHAR_UTF32
+	const __m128i zero = _mm_setzero_si128();
+	_mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(units, zero));
+	_mm_storeu_si128((__m128i *)(dst + 4), _mm_unpackhi_epi16(units, zero));
+#else
+	_mm_storeu_si128((__m128i *)dst, units);
+#endif
+}
+#endif
+
+uint32_t PDFDocEncodingToWide(const uint8_t * src, uint32_t size, wchar_t * dst)
+{
+	uint32_t i = 0;
+#ifdef _CHE_SSE2_
+	//blocks without 0x18-0x1F, 0x7F-0xA0 and 0xAD widen as they are
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i maskHigh = _mm_set1_epi8((char)0xF8);
+	const __m128i accents = _mm_set1_epi8(0x18);
+	const __m128i rangeStart = _mm_set1_epi8(0x7F);
+	const __m128i rangeSize = _mm_set1_epi8(0x21);
+	const __m128i softHyphen = _mm_set1_epi8((char)0xAD);
+	for (; i + 16 <= size; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i special = _mm_cmpeq_epi8(_mm_and_si128(v, maskHigh), accents);
+		__m128i t = _mm_sub_epi8(v, rangeStart);
+		special = _mm_or_si128(special, _mm_cmpeq_epi8(_mm_max_epu8(t, rangeSize), rangeSize));
+		special = _mm_or_si128(special, _mm_cmpeq_epi8(v, softHyphen));
+		if (_mm_movemask_epi8(special) != 0)
+		{
+			for (uint32_t j = 0; j < 16; j++)
+			{
+				dst[i + j] = (wchar_t)pdfdoc_to_unicode(src[i + j]);
+			}
+			continue;
+		}
+		store_wide16(dst + i, _mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero));
+	}
+#endif
+	for (; i < size; i++)
+	{
+		dst[i] = (wchar_t)pdfdoc_to_unicode(src[i]);
+	}
+	return size;
+}
+
+uint32_t UTF16BEToWide(const uint8_t * src, uint32_t size, wchar_t * dst)
+{
+	uint32_t count = size / 2;
+	uint32_t i = 0;
+	uint32_t n = 0;
+#ifdef _CHE_SSE2_
+	//blocks without surrogates or escapes only need their bytes swapped
+	const __m128i surrogateMask = _mm_set1_epi16((short)0xF800);
+	const __m128i surrogate = _mm_set1_epi16((short)0xD800);
+	const __m128i escape = _mm_set1_epi16(0x001B);
+#endif
+	while (i < count)
+	{
+#ifdef _CHE_SSE2_
+		while (i + 8 <= count)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i *)(src + i * 2));
+			v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+			__m128i special = _mm_or_si128(_mm_cmpeq_epi16(_mm_and_si128(v, surrogateMask), surrogate),
+			                               _mm_cmpeq_epi16(v, escape));
+			if (_mm_movemask_epi8(special) != 0)
+			{
+				break;
+			}
+			store_wide8(dst + n, v);
+			i += 8;
+			n += 8;
+		}
+		if (i >= count)
+		{
+			break;
+		}
+#endif
+		uint32_t unit = ((uint32_t)src[i * 2] << 8) | src[i * 2 + 1];
+		i++;
+		if (unit == 0x001B)
+		{
+			//language and country codes up to the closing escape
+			while (i < count && !(src[i * 2] == 0 && src[i * 2 + 1] == 0x1B))
+			{
+				i++;
+			}
+			i++;
+			continue;
+		}
+		if (unit >= 0xD800 && unit < 0xE000)
+		{
+			uint32_t low = (i < count) ? (((uint32_t)src[i * 2] << 8) | src[i * 2 + 1]) : 0;
+			if (unit < 0xDC00 && low >= 0xDC00 && low < 0xE000)
+			{
+				i++;
+				n += put_wide(dst + n, 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00));
+			}
+			else
+			{
+				dst[n++] = (wchar_t)UNICODE_REPLACEMENT;
+			}
+			continue;
+		}
+		dst[n++] = (wchar_t)unit;
+	}
+	return n;
+}
+
+uint32_t UTF8ToWide(const uint8_t * src, uint32_t size, wchar_t * dst)
+{
+	uint32_t i = 0;
+	uint32_t n = 0;
+#ifdef _CHE_SSE2_
+	const __m128i zero = _mm_setzero_si128();
+#endif
+	while (i < size)
+	{
+#ifdef _CHE_SSE2_
+		//ASCII blocks widen as they are
+		while (i + 16 <= size)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+			if (_mm_movemask_epi8(v) != 0)
+			{
+				break;
+			}
+			store_wide16(dst + n, _mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero));
+			i += 16;
+			n += 16;
+		}
+		if (i >= size)
+		{
+			break;
+		}
+#endif
+		uint32_t lead = src[i];
+		if (lead < 0x80)
+		{
+			dst[n++] = (wchar_t)lead;
+			i++;
+			continue;
+		}
+		uint32_t extra = 0;
+		uint32_t code = 0;
+		uint32_t minimum = 0;
+		if (lead >= 0xC2 && lead < 0xE0)
+		{
+			extra = 1;
+			code = lead & 0x1F;
+			minimum = 0x80;
+		}
+		else if (lead >= 0xE0 && lead < 0xF0)
+		{
+			extra = 2;
+			code = lead & 0x0F;
+			minimum = 0x800;
+		}
+		else if (lead >= 0xF0 && lead < 0xF5)
+		{
+			extra = 3;
+			code = lead & 0x07;
+			minimum = 0x10000;
+		}
+		uint32_t j = 1;
+		if (extra != 0 && i + extra < size)
+		{
+			for (; j <= extra; j++)
+			{
+				if ((src[i + j] & 0xC0) != 0x80)
+				{
+					break;
+				}
+				code = (code << 6) | (src[i + j] & 0x3F);
+			}
+		}
+		if (extra == 0 || j <= extra || code < minimum || code > 0x10FFFF || (code >= 0xD800 && code < 0xE000))
+		{
+			//one replacement per byte that starts no valid sequence
+			dst[n++] = (wchar_t)UNICODE_REPLACEMENT;
+			i++;
+			continue;
+		}
+		i += extra + 1;
+		n += put_wide(dst + n, code);
+	}
+	return n;
+}
+
+uint32_t WideToUTF16BE(const wchar_t * src, uint32_t length, uint8_t * dst)
+{
+	uint32_t i = 0;
+	uint32_t n = 0;
+	while (i < length)
+	{
+		uint32_t code = get_wide(src, length, i);
+		if (code > 0xFFFF)
+		{
+			code -= 0x10000;
+			uint32_t high = 0xD800 + (code >> 10);
+			uint32_t low = 0xDC00 + (code & 0x3FF);
+			dst[n++] = (uint8_t)(high >> 8);
+			dst[n++] = (uint8_t)high;
+			dst[n++] = (uint8_t)(low >> 8);
+			dst[n++] = (uint8_t)low;
+			continue;
+		}
+		dst[n++] = (uint8_t)(code >> 8);
+		dst[n++] = (uint8_t)code;
+	}
+	return n;
+}
+
+uint32_t WideToUTF8(const wchar_t * src, uint32_t length, uint8_t * dst)
+{
+	uint32_t i = 0;
+	uint32_t n = 0;
+	while (i < length)
+	{
+		uint32_t code = get_wide(src, length, i);
+		if (code < 0x80)
+		{
+			dst[n++] = (uint8_t)code;
+		}
+		else if (code < 0x800)
+		{
+			dst[n++] = (uint8_t)(0xC0 | (code >> 6));
+			dst[n++] = (uint8_t)(0x80 | (code & 0x3F));
+		}
+		else if (code < 0x10000)
+		{
+			dst[n++] = (uint8_t)(0xE0 | (code >> 12));
+			dst[n++] = (uint8_t)(0x80 | ((code >> 6) & 0x3F));
+			dst[n++] = (uint8_t)(0x80 | (code & 0x3F));
+		}
+		else
+		{
+			dst[n++] = (uint8_t)(0xF0 | (code >> 18));
+			dst[n++] = (uint8_t)(0x80 | ((code >> 12) & 0x3F));
+			dst[n++] = (uint8_t)(0x80 | ((code >> 6) & 0x3F));
+			dst[n++] = (uint8_t)(0x80 | (code & 0x3F));
+		}
+	}
+	return n;
+}
+
+bool WideToPDFDocEncoding(const wchar_t * src, uint32_t length, uint8_t * dst)
+{
+	uint32_t i = 0;
+#ifdef _CHE_SSE2_
+	//blocks of printable ASCII narrow as they are, negative lanes fail the lower bound
+#ifdef PDF_WCHAR_UTF32
+	const __m128i lower = _mm_set1_epi32(0x1F);
+	const __m128i upper = _mm_set1_epi32(0x7F);
+	for (; i + 16 <= length; i += 16)
+	{
+		__m128i v0 = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i v1 = _mm_loadu_si128((const __m128i *)(src + i + 4));
+		__m128i v2 = _mm_loadu_si128((const __m128i *)(src + i + 8));
+		__m128i v3 = _mm_loadu_si128((const __m128i *)(src + i + 12));
+		__m128i ok = _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi32(v0, lower), _mm_cmplt_epi32(v0, upper)),
+		                           _mm_and_si128(_mm_cmpgt_epi32(v1, lower), _mm_cmplt_epi32(v1, upper)));
+		ok = _mm_and_si128(ok, _mm_and_si128(_mm_cmpgt_epi32(v2, lower), _mm_cmplt_epi32(v2, upper)));
+		ok = _mm_and_si128(ok, _mm_and_si128(_mm_cmpgt_epi32(v3, lower), _mm_cmplt_epi32(v3, upper)));
+		if (_mm_movemask_epi8(ok) != 0xFFFF)
+		{
+			break;
+		}
+		__m128i lo = _mm_packs_epi32(v0, v1);
+		__m128i hi = _mm_packs_epi32(v2, v3);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+#else
+	const __m128i lower = _mm_set1_epi16(0x1F);
+	const __m128i upper = _mm_set1_epi16(0x7F);
+	for (; i + 16 <= length; i += 16)
+	{
+		__m128i v0 = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i v1 = _mm_loadu_si128((const __m128i *)(src + i + 8));
+		__m128i ok = _mm_and_si128(_mm_and_si128(_mm_cmpgt_epi16(v0, lower), _mm_cmplt_epi16(v0, upper)),
+		                           _mm_and_si128(_mm_cmpgt_epi16(v1, lower), _mm_cmplt_epi16(v1, upper)));
+		if (_mm_movemask_epi8(ok) != 0xFFFF)
+		{
+			break;
+		}
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(v0, v1));
+	}
+#endif
+#endif
+	for (; i < length; i++)
+	{
+		if (!unicode_to_pdfdoc((uint32_t)src[i], dst[i]))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool PdfStringToWideString(const ByteString & str, WideString & strRet)
+{
+	const uint8_t * data = (const uint8_t *)str.GetData();
+	uint32_t size = str.GetLength();
+	strRet.Clear();
+	if (size >= 2 && data[0] == 0xFE && data[1] == 0xFF)
+	{
+		if (size < 4)
+		{
+			return true;
+		}
+		wchar_t * buffer = strRet.GetBuffer((size - 2) / 2);
+		if (buffer == nullptr)
+		{
+			return false;
+		}
+		strRet.ReleaseBuffer(UTF16BEToWide(data + 2, size - 2, buffer));
+		return true;
+	}
+	if (size >= 3 && data[0] == 0xEF && data[1] == 0xBB && data[2] == 0xBF)
+	{
+		if (size == 3)
+		{
+			return true;
+		}
+		wchar_t * buffer = strRet.GetBuffer(size - 3);
+		if (buffer == nullptr)
+		{
+			return false;
+		}
+		strRet.ReleaseBuffer(UTF8ToWide(data + 3, size - 3, buffer));
+		return true;
+	}
+	if (size == 0)
+	{
+		return true;
+	}
+	wchar_t * buffer = strRet.GetBuffer(size);
+	if (buffer == nullptr)
+	{
+		return false;
+	}
+	strRet.ReleaseBuffer(PDFDocEncodingToWide(data, size, buffer));
+	return true;
+}
+
+bool WideStringToPdfString(const WideString & str, ByteString & strRet)
+{
+	uint32_t length = str.GetLength();
+	strRet.Clear();
+	if (length == 0)
+	{
+		return true;
+	}
+	uint8_t * buffer = strRet.GetBuffer(length);
+	if (buffer == nullptr)
+	{
+		return false;
+	}
+	if (WideToPDFDocEncoding(str.GetData(), length, buffer))
+	{
+		strRet.ReleaseBuffer(length);
+		return true;
+	}
+	buffer = strRet.GetBuffer(length * 4 + 2);
+	if (buffer == nullptr)
+	{
+		return false;
+	}
+	buffer[0] = 0xFE;
+	buffer[1] = 0xFF;
+	strRet.ReleaseBuffer(WideToUTF16BE(str.GetData(), length, buffer + 2) + 2);
+	return true;
+}
+
+bool UTF8ToWideString(const ByteString & str, WideString & strRet)
+{
+	uint32_t size = str.GetLength();
+	strRet.Clear();
+	if (size == 0)
+	{
+		return true;
+	}
+	wchar_t * buffer = strRet.GetBuffer(size);
+	if (buffer == nullptr)
+	{
+		return false;
+	}
+	strRet.ReleaseBuffer(UTF8ToWide((const uint8_t *)str.GetData(), size, buffer));
+	return true;
+}
+
+bool WideStringToUTF8(const WideString & str, ByteString & strRet)
+{
+	uint32_t length = str.GetLength();
+	strRet.Clear();
+	if (length == 0)
+	{
+		return true;
+	}
+	uint8_t * buffer = strRet.GetBuffer(length * 4);
+	if (buffer == nullptr)
+	{
+		return false;
+	}
+	strRet.ReleaseBuffer(WideToUTF8(str.GetData(), length, buffer));
+	return true;
+}
+
+}//namespace
@@ -0,0 +1,959 @@
+#include "../include/che_pdf_file.h"
+
+#include <vector>
+
+namespace chepdf {
+
+//bytes at the end of the data searched for startxref, writers may append junk after %%EOF
+#define PDF_STARTXREF_SEARCH_SIZE   4096
+//sections followed along /Prev before the chain is taken as broken
+#define PDF_XREF_MAX_SECTIONS       4096
+//decoded object streams are cached next to the objects, under their number with the top bit set
+#define PDF_OBJECT_STREAM_KEY       0x80000000
+//entries a lookup walks from the tail, so objects released since the last add leave the cache too
+#define PDF_OBJECT_CACHE_FIND_TRIM  8
+
+//objects being parsed on this thread, the innermost first. A /Length or object stream that leads
+//back to one of them would parse it again without end
+struct PdfParsingObject
+{
+	const PdfFile *             file;
+	uint32_t                    objNum;
+	const PdfParsingObject *    outer;
+};
+
+static thread_local const PdfParsingObject * gParsingObjects = nullptr;
+
+//offsets written as plain digits, past the 31 bits of a token integer as well
+static bool token_offset(const PdfToken & token, uint64_t & valueRet)
+{
+	if (token.type != TOKEN_TYPE_INTEGER && token.type != TOKEN_TYPE_FLOAT)
+	{
+		return false;
+	}
+	if (token.length == 0 || token.length > 19)
+	{
+		return false;
+	}
+	uint64_t value = 0;
+	for (uint32_t i = 0; i < token.length; ++i)
+	{
+		if (token.data[i] < '0' || token.data[i] > '9')
+		{
+			return false;
+		}
+		value = value * 10 + (token.data[i] - '0');
+	}
+	valueRet = value;
+	return true;
+}
+
+static bool value_offset(const PdfValue & value, uint64_t & valueRet)
+{
+	if (value.GetType() != OBJ_TYPE_NUMBER)
+	{
+		return false;
+	}
+	if (value.IsInteger())
+	{
+		if (value.GetInteger() < 0)
+		{
+			return false;
+		}
+		valueRet = (uint64_t)value.GetInteger();
+		return true;
+	}
+	if (value.GetFloat() < 0)
+	{
+		return false;
+	}
+	valueRet = (uint64_t)value.GetFloat();
+	return true;
+}
+
+//"oooooooooo ggggg n" plus a two byte line end, the layout PDF 32000-1 7.5.4 requires
+static inline bool is_xref_line(const uint8_t * p)
+{
+	for (uint32_t i = 0; i < 10; ++i)
+	{
+		if ((uint8_t)(p[i] - '0') > 9)
+		{
+			return false;
+		}
+	}
+	for (uint32_t i = 11; i < 16; ++i)
+	{
+		if ((uint8_t)(p[i] - '0') > 9)
+		{
+			return false;
+		}
+	}
+	return p[10] == ' ' && p[16] == ' ' && (p[17] == 'n' || p[17] == 'f') &&
+	       (p[18] == ' ' || p[18] == 0x0D || p[18] == 0x0A) &&
+	       (p[19] == ' ' || p[19] == 0x0D || p[19] == 0x0A);
+}
+
+PdfXRefTable::PdfXRefTable(Allocator * allocator/*= nullptr*/)
+	: BaseObject(allocator), entries_(nullptr), count_(0), capacity_(0) {}
+
+PdfXRefTable::~PdfXRefTable()
+{
+	Clear();
+}
+
+bool PdfXRefTable::Reserve(uint32_t count)
+{
+	if (count <= capacity_)
+	{
+		return true;
+	}
+	if (count > PDF_XREF_MAX_OBJECT_NUMBER + 1)
+	{
+		return false;
+	}
+	PdfXRefEntry * entries = (PdfXRefEntry *)GetAllocator()->Alloc(sizeof(PdfXRefEntry) * count);
+	if (entries == nullptr)
+	{
+		return false;
+	}
+	if (count_ > 0)
+	{
+		memcpy(entries, entries_, sizeof(PdfXRefEntry) * count_);
+	}
+	memset(entries + count_, 0, sizeof(PdfXRefEntry) * (count - count_));
+	if (entries_)
+	{
+		GetAllocator()->Free(entries_);
+	}
+	entries_ = entries;
+	capacity_ = count;
+	return true;
+}
+
+bool PdfXRefTable::Add(uint32_t objNum, const PdfXRefEntry & entry)
+{
+	if (objNum > PDF_XREF_MAX_OBJECT_NUMBER || entry.type == XREF_ENTRY_NONE)
+	{
+		return false;
+	}
+	if (objNum >= capacity_)
+	{
+		uint32_t capacity = (capacity_ < 1024) ? 1024 : capacity_;
+		while (capacity <= objNum)
+		{
+			capacity *= 2;
+		}
+		if (capacity > PDF_XREF_MAX_OBJECT_NUMBER + 1)
+		{
+			capacity = PDF_XREF_MAX_OBJECT_NUMBER + 1;
+		}
+		if (!Reserve(capacity))
+		{
+			return false;
+		}
+	}
+	if (objNum >= count_)
+	{
+		//slots between the old and the new count were zeroed by Reserve
+		count_ = objNum + 1;
+	}else if (entries_[objNum].type != XREF_ENTRY_NONE)
+	{
+		return false;
+	}
+	entries_[objNum] = entry;
+	return true;
+}
+
+void PdfXRefTable::Clear()
+{
+	if (entries_)
+	{
+		GetAllocator()->Free(entries_);
+		entries_ = nullptr;
+	}
+	count_ = 0;
+	capacity_ = 0;
+}
+
+PdfObjectCache::PdfObjectCache(size_t budget/*= PDF_OBJECT_CACHE_DEFAULT_BUDGET*/, Allocator * allocator/*= nullptr*/)
+	: BaseObject(allocator), budget_(budget) {}
+
+PdfObjectCache::~PdfObjectCache()
+{
+	Clear();
+}
+
+void PdfObjectCache::Unlink(Shard & shard, Entry * entry)
+{
+	if (entry->prev)
+	{
+		entry->prev->next = entry->next;
+	}else{
+		shard.head = entry->next;
+	}
+	if (entry->next)
+	{
+		entry->next->prev = entry->prev;
+	}else{
+		shard.tail = entry->prev;
+	}
+	entry->prev = nullptr;
+	entry->next = nullptr;
+}
+
+void PdfObjectCache::PushFront(Shard & shard, Entry * entry)
+{
+	entry->prev = nullptr;
+	entry->next = shard.head;
+	if (shard.head)
+	{
+		shard.head->prev = entry;
+	}else{
+		shard.tail = entry;
+	}
+	shard.head = entry;
+}
+
+void PdfObjectCache::Trim(Shard & shard, size_t budget, size_t maxVisits/*= SIZE_MAX*/)
+{
+	Entry * entry = shard.tail;
+	size_t count = shard.entries.size();
+	if (count > maxVisits)
+	{
+		count = maxVisits;
+	}
+	for (size_t visited = 0; visited < count && entry != nullptr && shard.size > budget; ++visited)
+	{
+		Entry * prev = entry->prev;
+		PdfObject * object = entry->object.operator->();
+		//only the cache holds it or any part of it and nothing was changed, so it can be parsed
+		//again as it was
+		if (!object->IsHeldOutside() && !object->IsModified())
+		{
+			shard.size -= entry->size;
+			Unlink(shard, entry);
+			shard.entries.erase(entry->key);
+		}else{
+			Unlink(shard, entry);
+			PushFront(shard, entry);
+		}
+		entry = prev;
+	}
+}
+
+void PdfObjectCache::SetBudget(size_t budget)
+{
+	budget_ = budget;
+	for (uint32_t i = 0; i < PDF_OBJECT_CACHE_SHARD_COUNT; ++i)
+	{
+		shards_[i].lock.Lock();
+		Trim(shards_[i], budget_ / PDF_OBJECT_CACHE_SHARD_COUNT);
+		shards_[i].lock.UnLock();
+	}
+}
+
+bool PdfObjectCache::Find(uint32_t key, uint32_t genNum, PdfObjectPointer & objectRet)
+{
+	Shard & shard = GetShard(key);
+	shard.lock.Lock();
+	std::unordered_map<uint32_t, Entry>::iterator it = shard.entries.find(key);
+	if (it == shard.entries.end() || it->second.generate_number != genNum)
+	{
+		shard.misses++;
+		shard.lock.UnLock();
+		return false;
+	}
+	Entry * entry = &it->second;
+	if (entry != shard.head)
+	{
+		Unlink(shard, entry);
+		PushFront(shard, entry);
+	}
+	//the pointer is taken under the lock, so Trim never sees an object a caller is about to hold
+	objectRet = entry->object;
+	shard.hits++;
+	Trim(shard, budget_ / PDF_OBJECT_CACHE_SHARD_COUNT, PDF_OBJECT_CACHE_FIND_TRIM);
+	shard.lock.UnLock();
+	return true;
+}
+
+PdfObjectPointer PdfObjectCache::Add(uint32_t key, uint32_t genNum, const PdfObjectPointer & object)
+{
+	if (!object)
+	{
+		return object;
+	}
+	size_t size = object->GetMemorySize() + sizeof(Entry);
+	Shard & shard = GetShard(key);
+	shard.lock.Lock();
+	std::unordered_map<uint32_t, Entry>::iterator it = shard.entries.find(key);
+	if (it != shard.entries.end())
+	{
+		if (it->second.generate_number == genNum)
+		{
+			PdfObjectPointer cached = it->second.object;
+			shard.lock.UnLock();
+			return cached;
+		}
+		shard.size -= it->second.size;
+		Unlink(shard, &it->second);
+		shard.entries.erase(it);
+	}
+	Entry & entry = shard.entries[key];
+	entry.object = object;
+	entry.key = key;
+	entry.generate_number = genNum;
+	entry.size = size;
+	PushFront(shard, &entry);
+	shard.size += size;
+	Trim(shard, budget_ / PDF_OBJECT_CACHE_SHARD_COUNT);
+	shard.lock.UnLock();
+	return object;
+}
+
+void PdfObjectCache::Remove(uint32_t key)
+{
+	Shard & shard = GetShard(key);
+	shard.lock.Lock();
+	std::unordered_map<uint32_t, Entry>::iterator it = shard.entries.find(key);
+	if (it != shard.entries.end())
+	{
+		shard.size -= it->second.size;
+		Unlink(shard, &it->second);
+		shard.entries.erase(it);
+	}
+	shard.lock.UnLock();
+}
+
+void PdfObjectCache::Purge()
+{
+	for (uint32_t i = 0; i < PDF_OBJECT_CACHE_SHARD_COUNT; ++i)
+	{
+		shards_[i].lock.Lock();
+		Trim(shards_[i], 0);
+		shards_[i].lock.UnLock();
+	}
+}
+
+void PdfObjectCache::Clear()
+{
+	for (uint32_t i = 0; i < PDF_OBJECT_CACHE_SHARD_COUNT; ++i)
+	{
+		shards_[i].lock.Lock();
+		shards_[i].entries.clear();
+		shards_[i].head = nullptr;
+		shards_[i].tail = nullptr;
+		shards_[i].size = 0;
+		shards_[i].lock.UnLock();
+	}
+}
+
+size_t PdfObjectCache::GetSize()
+{
+	size_t size = 0;
+	for (uint32_t i = 0; i < PDF_OBJECT_CACHE_SHARD_COUNT; ++i)
+	{
+		shards_[i].lock.Lock();
+		size += shards_[i].size;
+		shards_[i].lock.UnLock();
+	}
+	return size;
+}
+
+size_t PdfObjectCache::GetCount()
+{
+	size_t count = 0;
+	for (uint32_t i = 0; i < PDF_OBJECT_CACHE_SHARD_COUNT; ++i)
+	{
+		shards_[i].lock.Lock();
+		count += shards_[i].entries.size();
+		shards_[i].lock.UnLock();
+	}
+	return count;
+}
+
+size_t PdfObjectCache::GetHits()
+{
+	size_t hits = 0;
+	for (uint32_t i = 0; i < PDF_OBJECT_CACHE_SHARD_COUNT; ++i)
+	{
+		shards_[i].lock.Lock();
+		hits += shards_[i].hits;
+		shards_[i].lock.UnLock();
+	}
+	return hits;
+}
+
+size_t PdfObjectCache::GetMisses()
+{
+	size_t misses = 0;
+	for (uint32_t i = 0; i < PDF_OBJECT_CACHE_SHARD_COUNT; ++i)
+	{
+		shards_[i].lock.Lock();
+		misses += shards_[i].misses;
+		shards_[i].lock.UnLock();
+	}
+	return misses;
+}
+
+PdfFile::PdfFile(Allocator * allocator/*= nullptr*/)
+	: BaseObject(allocator), iread_(nullptr), crypto_(nullptr), encrypt_object_number_(0), xref_(GetAllocator()),
+	cache_(PDF_OBJECT_CACHE_DEFAULT_BUDGET, GetAllocator()) {}
+
+PdfFile::~PdfFile()
+{
+	Close();
+}
+
+void PdfFile::Close()
+{
+	cache_.Clear();
+	trailer_.Reset();
+	xref_.Clear();
+	iread_ = nullptr;
+	crypto_ = nullptr;
+	encrypt_object_number_ = 0;
+}
+
+bool PdfFile::FindStartXRef(PdfLexer & lexer, size_t & offsetRet)
+{
+	size_t size = lexer.GetSize();
+	size_t found = 0;
+	bool bFound = false;
+	lexer.SetPosition((size > PDF_STARTXREF_SEARCH_SIZE) ? size - PDF_STARTXREF_SEARCH_SIZE : 0);
+	//the last one counts
+	while (lexer.Find("startxref", 9, size, found))
+	{
+		bFound = true;
+		offsetRet = found;
+		lexer.SetPosition(found + 9);
+	}
+	if (!bFound)
+	{
+		return false;
+	}
+	PdfToken token;
+	uint64_t offset = 0;
+	if (!lexer.NextToken(token) || !token_offset(token, offset) || offset >= size)
+	{
+		return false;
+	}
+	offsetRet = (size_t)offset;
+	return true;
+}
+
+bool PdfFile::Open(IRead * iread)
+{
+	Close();
+	if (iread == nullptr)
+	{
+		return false;
+	}
+	iread_ = iread;
+
+	PdfParser parser(iread, this, GetAllocator());
+	PdfLexer & lexer = parser.GetLexer();
+	size_t offset = 0;
+	if (!FindStartXRef(lexer, offset))
+	{
+		Close();
+		return false;
+	}
+
+	std::vector<size_t> visited;
+	std::vector<std::pair<uint32_t, PdfXRefEntry> > section;
+	while (visited.size() < PDF_XREF_MAX_SECTIONS)
+	{
+		bool bVisited = false;
+		for (size_t i = 0; i < visited.size(); ++i)
+		{
+			if (visited[i] == offset)
+			{
+				bVisited = true;
+				break;
+			}
+		}
+		if (bVisited)
+		{
+			break;
+		}
+		visited.push_back(offset);
+
+		PdfToken token;
+		PdfDictionaryPointer trailer;
+		lexer.SetPosition(offset);
+		if (!lexer.NextToken(token))
+		{
+			break;
+		}
+		if (token.IsKeyword("xref", 4))
+		{
+			section.clear();
+			lexer.SetPosition(token.offset + 4);
+			if (!ParseXRefTable(parser, section, trailer))
+			{
+				break;
+			}
+			//entries in the stream of a hybrid file come before those of its table
+			uint64_t streamOffset = 0;
+			if (value_offset(trailer->GetValue(NAME_XRefStm), streamOffset) && streamOffset < lexer.GetSize())
+			{
+				PdfDictionaryPointer dictionary;
+				ParseXRefStream(parser, (size_t)streamOffset, true, dictionary);
+			}
+			for (size_t i = 0; i < section.size(); ++i)
+			{
+				xref_.Add(section[i].first, section[i].second);
+			}
+		}else if (!ParseXRefStream(parser, offset, false, trailer))
+		{
+			break;
+		}
+
+		if (!trailer_)
+		{
+			trailer_ = trailer;
+			uint64_t size = 0;
+			if (value_offset(trailer->GetValue(NAME_Size), size) && size <= lexer.GetSize() &&
+			    size <= PDF_XREF_MAX_OBJECT_NUMBER + 1)
+			{
+				xref_.Reserve((uint32_t)size);
+			}
+		}
+		uint64_t prev = 0;
+		if (!value_offset(trailer->GetValue(NAME_Prev), prev) || prev >= lexer.GetSize())
+		{
+			break;
+		}
+		offset = (size_t)prev;
+	}
+	if (!trailer_)
+	{
+		Close();
+		return false;
+	}
+	PdfValue encrypt = trailer_->GetValue(NAME_Encrypt);
+	if (encrypt.GetType() == OBJ_TYPE_REFERENCE)
+	{
+		encrypt_object_number_ = encrypt.GetReferenceNumber();
+	}
+	return true;
+}
+
+bool PdfFile::ParseXRefTable(PdfParser & parser, std::vector<std::pair<uint32_t, PdfXRefEntry> > & entriesRet,
+                             PdfDictionaryPointer & trailerRet)
+{
+	PdfLexer & lexer = parser.GetLexer();
+	PdfToken token;
+	while (true)
+	{
+		if (!lexer.NextToken(token))
+		{
+			return false;
+		}
+		if (token.IsKeyword("trailer", 7))
+		{
+			break;
+		}
+		if (token.type != TOKEN_TYPE_INTEGER || token.integer < 0)
+		{
+			return false;
+		}
+		uint32_t start = (uint32_t)token.integer;
+		if (!lexer.NextToken(token) || token.type != TOKEN_TYPE_INTEGER || token.integer < 0)
+		{
+			return false;
+		}
+		uint32_t count = (uint32_t)token.integer;
+		uint32_t index = 0;
+		while (index < count)
+		{
+			if (!lexer.SkipWhiteSpace())
+			{
+				return false;
+			}
+			//whole lines straight from the data, a window at a time
+			size_t position = lexer.GetPosition();
+			size_t span = (size_t)(count - index) * 20;
+			if (span > PDF_LEXER_WINDOW_SIZE / 20 * 20)
+			{
+				span = PDF_LEXER_WINDOW_SIZE / 20 * 20;
+			}
+			const uint8_t * p = lexer.GetSpan(position, span);
+			size_t done = 0;
+			while (index < count && span - done >= 20 && is_xref_line(p + done))
+			{
+				const uint8_t * line = p + done;
+				uint64_t offset = 0;
+				uint32_t genNum = 0;
+				for (uint32_t i = 0; i < 10; ++i)
+				{
+					offset = offset * 10 + (line[i] - '0');
+				}
+				for (uint32_t i = 11; i < 16; ++i)
+				{
+					genNum = genNum * 10 + (line[i] - '0');
+				}
+				PdfXRefEntry entry;
+				entry.type = (line[17] == 'n') ? XREF_ENTRY_COMMON : XREF_ENTRY_FREE;
+				entry.generate_number = (uint16_t)((genNum > 0xFFFF) ? 0xFFFF : genNum);
+				entry.SetOffset((line[17] == 'n') ? offset : 0);
+				entry.index = 0;
+				if ((uint64_t)start + index <= PDF_XREF_MAX_OBJECT_NUMBER)
+				{
+					entriesRet.push_back(std::make_pair(start + index, entry));
+				}
+				++index;
+				done += 20;
+			}
+			if (done > 0)
+			{
+				lexer.SetPosition(position + done);
+				continue;
+			}
+			//lines of writers that got the layout wrong, one token at a time
+			uint64_t offset = 0;
+			if (!lexer.NextToken(token) || !token_offset(token, offset))
+			{
+				return false;
+			}
+			if (!lexer.NextToken(token) || token.type != TOKEN_TYPE_INTEGER || token.integer < 0)
+			{
+				return false;
+			}
+			uint32_t genNum = (uint32_t)token.integer;
+			if (!lexer.NextToken(token) || (!token.IsKeyword("n", 1) && !token.IsKeyword("f", 1)))
+			{
+				return false;
+			}
+			PdfXRefEntry entry;
+			entry.type = (token.data[0] == 'n') ? XREF_ENTRY_COMMON : XREF_ENTRY_FREE;
+			entry.generate_number = (uint16_t)((genNum > 0xFFFF) ? 0xFFFF : genNum);
+			entry.SetOffset((token.data[0] == 'n') ? offset : 0);
+			entry.index = 0;
+			if ((uint64_t)start + index <= PDF_XREF_MAX_OBJECT_NUMBER)
+			{
+				entriesRet.push_back(std::make_pair(start + index, entry));
+			}
+			++index;
+		}
+	}
+	PdfValue value;
+	if (!parser.GetValue(value) || value.GetType() != OBJ_TYPE_DICTIONARY)
+	{
+		return false;
+	}
+	trailerRet = value.GetObject(GetAllocator())->GetPdfDictionary();
+	return true;
+}
+
+bool PdfFile::ParseXRefStream(PdfParser & parser, size_t offset, bool bSkipFree, PdfDictionaryPointer & dictionaryRet)
+{
+	uint32_t objNum = 0;
+	uint32_t genNum = 0;
+	PdfObjectPointer object = parser.GetIndirectObject(offset, objNum, genNum);
+	if (!object || object->GetType() != OBJ_TYPE_STREAM)
+	{
+		return false;
+	}
+	PdfStreamPointer stream = object->GetPdfStream();
+	PdfDictionaryPointer dictionary = stream->GetDictionary();
+	if (!dictionary || !dictionary->CheckName(NAME_Type, NAME_XRef))
+	{
+		return false;
+	}
+
+	uint32_t width[3] = { 0, 0, 0 };
+	PdfObjectPointer w = dictionary->GetElement(NAME_W, OBJ_TYPE_ARRAY);
+	if (!w || w->GetPdfArray()->GetSize() < 3)
+	{
+		return false;
+	}
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		PdfValue value = w->GetPdfArray()->GetValue(i);
+		if (value.GetType() != OBJ_TYPE_NUMBER || value.GetInteger() < 0 || value.GetInteger() > 8)
+		{
+			return false;
+		}
+		width[i] = (uint32_t)value.GetInteger();
+	}
+	uint32_t entrySize = width[0] + width[1] + width[2];
+	if (entrySize == 0)
+	{
+		return false;
+	}
+
+	//pairs of first object number and count, [0 Size] when missing
+	std::vector<uint32_t> ranges;
+	PdfObjectPointer index = dictionary->GetElement(NAME_Index, OBJ_TYPE_ARRAY);
+	if (index)
+	{
+		PdfArrayPointer array = index->GetPdfArray();
+		for (uint32_t i = 0; i + 1 < array->GetSize(); i += 2)
+		{
+			PdfValue start = array->GetValue(i);
+			PdfValue count = array->GetValue(i + 1);
+			if (start.GetType() != OBJ_TYPE_NUMBER || count.GetType() != OBJ_TYPE_NUMBER ||
+			    start.GetInteger() < 0 || count.GetInteger() < 0)
+			{
+				return false;
+			}
+			ranges.push_back((uint32_t)start.GetInteger());
+			ranges.push_back((uint32_t)count.GetInteger());
+		}
+	}else{
+		PdfValue size = dictionary->GetValue(NAME_Size);
+		if (size.GetType() != OBJ_TYPE_NUMBER || size.GetInteger() < 0)
+		{
+			return false;
+		}
+		ranges.push_back(0);
+		ranges.push_back((uint32_t)size.GetInteger());
+	}
+
+	PdfStreamAccess access(GetAllocator());
+	if (!access.Attach(stream))
+	{
+		return false;
+	}
+	const uint8_t * p = access.GetData();
+	const uint8_t * end = p + access.GetSize();
+	for (size_t range = 0; range < ranges.size(); range += 2)
+	{
+		uint32_t start = ranges[range];
+		uint32_t count = ranges[range + 1];
+		for (uint32_t i = 0; i < count && (size_t)(end - p) >= entrySize; ++i)
+		{
+			uint64_t field[3] = { 1, 0, 0 };
+			for (uint32_t f = 0; f < 3; ++f)
+			{
+				if (width[f] == 0)
+				{
+					continue;
+				}
+				uint64_t value = 0;
+				for (uint32_t b = 0; b < width[f]; ++b)
+				{
+					value = (value << 8) | *p++;
+				}
+				field[f] = value;
+			}
+			if ((uint64_t)start + i > PDF_XREF_MAX_OBJECT_NUMBER)
+			{
+				continue;
+			}
+			PdfXRefEntry entry;
+			entry.offset_high = 0;
+			entry.index = 0;
+			switch (field[0])
+			{
+			case 0:
+				if (bSkipFree)
+				{
+					continue;
+				}
+				entry.type = XREF_ENTRY_FREE;
+				entry.generate_number = (uint16_t)((field[2] > 0xFFFF) ? 0xFFFF : field[2]);
+				entry.offset = 0;
+				break;
+			case 1:
+				entry.type = XREF_ENTRY_COMMON;
+				entry.generate_number = (uint16_t)((field[2] > 0xFFFF) ? 0xFFFF : field[2]);
+				entry.SetOffset(field[1]);
+				break;
+			case 2:
+				if (field[1] > PDF_XREF_MAX_OBJECT_NUMBER || field[2] > 0xFFFFFFFF)
+				{
+					continue;
+				}
+				entry.type = XREF_ENTRY_COMPRESSED;
+				entry.generate_number = 0;
+				entry.offset = (uint32_t)field[1];
+				entry.index = (uint32_t)field[2];
+				break;
+			default:
+				//other types are references to the null object
+				continue;
+			}
+			xref_.Add(start + i, entry);
+		}
+	}
+	dictionaryRet = dictionary;
+	return true;
+}
+
+PdfObjectPointer PdfFile::GetObject(uint32_t objNum, uint32_t genNum/*= 0*/)
+{
+	if (iread_ == nullptr)
+	{
+		return PdfObjectPointer();
+	}
+	const PdfXRefEntry * entry = xref_.Get(objNum);
+	if (entry == nullptr)
+	{
+		return PdfObjectPointer();
+	}
+	//objects in object streams always have generation 0
+	if ((entry->type != XREF_ENTRY_COMMON && entry->type != XREF_ENTRY_COMPRESSED) ||
+	    entry->generate_number != genNum)
+	{
+		return PdfObjectPointer();
+	}
+	PdfObjectPointer object;
+	if (cache_.Find(objNum, genNum, object))
+	{
+		return object;
+	}
+	object = ParseObject(*entry, objNum, genNum);
+	if (!object)
+	{
+		return object;
+	}
+	//as parsed, so the cache may drop it once it is no longer held
+	object->SetModified(false);
+	return cache_.Add(objNum, genNum, object);
+}
+
+PdfObjectPointer PdfFile::ParseObject(const PdfXRefEntry & entry, uint32_t objNum, uint32_t genNum)
+{
+	for (const PdfParsingObject * parsing = gParsingObjects; parsing != nullptr; parsing = parsing->outer)
+	{
+		if (parsing->file == this && parsing->objNum == objNum)
+		{
+			return PdfObjectPointer();
+		}
+	}
+	PdfParsingObject parsing = { this, objNum, gParsingObjects };
+	gParsingObjects = &parsing;
+	PdfObjectPointer object = ParseObjectAt(entry, objNum, genNum);
+	gParsingObjects = parsing.outer;
+	return object;
+}
+
+PdfObjectPointer PdfFile::ParseObjectAt(const PdfXRefEntry & entry, uint32_t objNum, uint32_t genNum)
+{
+	if (entry.type == XREF_ENTRY_COMPRESSED)
+	{
+		return GetCompressedObject(entry, objNum);
+	}
+	PdfParser parser(iread_, this, GetAllocator());
+	if (crypto_ && objNum != encrypt_object_number_)
+	{
+		parser.SetCrypto(crypto_);
+	}
+	uint32_t objNumRet = 0;
+	uint32_t genNumRet = 0;
+	PdfObjectPointer object = parser.GetIndirectObject(entry.GetOffset(), objNumRet, genNumRet);
+	if (!object || objNumRet != objNum || genNumRet != genNum)
+	{
+		return PdfObjectPointer();
+	}
+	return object;
+}
+
+PdfStreamPointer PdfFile::GetObjectStream(const PdfXRefEntry & entry, uint32_t objNum)
+{
+	uint32_t genNum = entry.generate_number;
+	PdfObjectPointer object;
+	if (cache_.Find(objNum | PDF_OBJECT_STREAM_KEY, genNum, object))
+	{
+		return object->GetPdfStream();
+	}
+	//only the decoded copy is cached, the raw stream goes once it is decoded
+	object = ParseObject(entry, objNum, genNum);
+	if (!object || object->GetType() != OBJ_TYPE_STREAM)
+	{
+		return PdfStreamPointer();
+	}
+	PdfStreamPointer stream = object->GetPdfStream();
+	PdfDictionaryPointer dictionary = stream->GetDictionary();
+	if (!dictionary)
+	{
+		return PdfStreamPointer();
+	}
+	PdfValue n = dictionary->GetValue(NAME_N);
+	PdfValue first = dictionary->GetValue(NAME_First);
+	if (n.GetType() != OBJ_TYPE_NUMBER || first.GetType() != OBJ_TYPE_NUMBER ||
+	    n.GetInteger() < 0 || first.GetInteger() < 0)
+	{
+		return PdfStreamPointer();
+	}
+	PdfStreamAccess access(GetAllocator());
+	if (!access.Attach(stream) || (size_t)first.GetInteger() > access.GetSize())
+	{
+		return PdfStreamPointer();
+	}
+	//a dictionary of its own, the memory stream sets /Length in it
+	PdfStreamPointer decoded = PdfStream::Create(access.GetData(), access.GetSize(), PdfDictionaryPointer(),
+	                                             objNum, genNum, nullptr, GetAllocator());
+	decoded->GetDictionary()->SetValue(NAME_N, n);
+	decoded->GetDictionary()->SetValue(NAME_First, first);
+	decoded->SetModified(false);
+	object = cache_.Add(objNum | PDF_OBJECT_STREAM_KEY, genNum, decoded);
+	return object->GetPdfStream();
+}
+
+PdfObjectPointer PdfFile::GetCompressedObject(const PdfXRefEntry & entry, uint32_t objNum)
+{
+	//object streams are never compressed themselves, which also ends any loop
+	const PdfXRefEntry * streamEntry = xref_.Get(entry.offset);
+	if (streamEntry == nullptr || streamEntry->type != XREF_ENTRY_COMMON)
+	{
+		return PdfObjectPointer();
+	}
+	PdfStreamPointer stream = GetObjectStream(*streamEntry, entry.offset);
+	if (!stream)
+	{
+		return PdfObjectPointer();
+	}
+	size_t size = stream->size_;
+	size_t first = (size_t)stream->GetDictionary()->GetValue(NAME_First).GetInteger();
+	uint32_t count = (uint32_t)stream->GetDictionary()->GetValue(NAME_N).GetInteger();
+
+	PdfObjectPointer result;
+	IRead * iread = IRead::CreateMemoryIRead(stream->data_, size, GetAllocator());
+	if (iread == nullptr)
+	{
+		return result;
+	}
+	{
+		PdfParser parser(iread, this, GetAllocator());
+		PdfLexer & lexer = parser.GetLexer();
+		PdfToken token;
+		uint64_t offset = 0;
+		bool bFound = false;
+		//the pair at the index of the entry, or else the first pair naming the object
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			if (!lexer.NextToken(token) || token.type != TOKEN_TYPE_INTEGER || token.integer < 0)
+			{
+				break;
+			}
+			uint32_t number = (uint32_t)token.integer;
+			uint64_t value = 0;
+			if (!lexer.NextToken(token) || !token_offset(token, value))
+			{
+				break;
+			}
+			if (number == objNum && (i == entry.index || !bFound))
+			{
+				offset = value;
+				bFound = true;
+				if (i >= entry.index)
+				{
+					break;
+				}
+			}
+		}
+		if (bFound && offset < size - first)
+		{
+			lexer.SetPosition(first + (size_t)offset);
+			result = parser.GetObject();
+		}
+	}
+	IRead::DestroyIRead(iread);
+	return result;
+}
+
+}//namespace
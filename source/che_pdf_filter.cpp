@@ -1,4 +1,5 @@
 #include <setjmp.h>
+#include <thread>
 
 #include "../include/che_pdf_filter.h"
 
@@ -7,6 +8,10 @@
 #include "jbig2.h"
 #include "openjpeg.h"
 
+#ifdef _CHE_SSE2_
+#include <emmintrin.h>
+#endif
+
 namespace chepdf {
 
 void PdfHexFilter::Encode(uint8_t * data, size_t size, Buffer & buffer)
@@ -577,37 +582,37 @@ PdfFaxDecodeParams::PdfFaxDecodeParams( PdfDictionaryPointer dictionary )
 	if ( dictionary )
 	{
 		PdfObjectPointer object;
-		object = dictionary->GetElement( "K", OBJ_TYPE_NUMBER );
+		object = dictionary->GetElement( NAME_K, OBJ_TYPE_NUMBER );
 		if ( object )
 		{
 			k = object->GetPdfNumber()->GetInteger();
 		}
-		object = dictionary->GetElement( "EndOfLine", OBJ_TYPE_BOOLEAN );
+		object = dictionary->GetElement( NAME_EndOfLine, OBJ_TYPE_BOOLEAN );
 		if ( object )
 		{
 			eol = object->GetPdfBoolean()->GetValue();
 		}
-		object = dictionary->GetElement( "EncodedByteAlign", OBJ_TYPE_BOOLEAN );
+		object = dictionary->GetElement( NAME_EncodedByteAlign, OBJ_TYPE_BOOLEAN );
 		if ( object )
 		{
 			eba = object->GetPdfBoolean()->GetValue();
 		}
-		object = dictionary->GetElement( "EndOfBlock", OBJ_TYPE_BOOLEAN );
+		object = dictionary->GetElement( NAME_EndOfBlock, OBJ_TYPE_BOOLEAN );
 		if ( object )
 		{
 			eob = object->GetPdfBoolean()->GetValue();
 		}
-		object = dictionary->GetElement( "BlackIs1", OBJ_TYPE_BOOLEAN );
+		object = dictionary->GetElement( NAME_BlackIs1, OBJ_TYPE_BOOLEAN );
 		if ( object )
 		{
 			bi1 = object->GetPdfBoolean()->GetValue();
 		}
-		object = dictionary->GetElement( "Columns", OBJ_TYPE_NUMBER );
+		object = dictionary->GetElement( NAME_Columns, OBJ_TYPE_NUMBER );
 		if ( object )
 		{
 			columns = object->GetPdfNumber()->GetInteger();
 		}
-		object = dictionary->GetElement( "Rows", OBJ_TYPE_NUMBER );
+		object = dictionary->GetElement( NAME_Rows, OBJ_TYPE_NUMBER );
 		if ( object )
 		{
 			rows = object->GetPdfNumber()->GetInteger();
@@ -1087,8 +1092,54 @@ static void dec2d(/*fz_context *ctx, */fz_faxd *fax)
 }
 
 
+//copy a packed 1 bpp row, optionally flipping polarity on the way
+static void bilevel_copy_row( const uint8_t * src, uint8_t * dst, size_t bytes, bool invert )
+{
+	if ( !invert )
+	{
+		memcpy( dst, src, bytes );
+		return;
+	}
+	size_t i = 0;
+#ifdef _CHE_SSE2_
+	const __m128i ones = _mm_set1_epi8( (char)0xFF );
+	for ( ; i + 16 <= bytes; i += 16 )
+	{
+		__m128i v = _mm_loadu_si128( (const __m128i *)(src + i) );
+		_mm_storeu_si128( (__m128i *)(dst + i), _mm_xor_si128( v, ones ) );
+	}
+#endif
+	for ( ; i < bytes; ++i )
+	{
+		dst[i] = src[i] ^ 0xFF;
+	}
+}
+
+//expand a packed 1 bpp row, msb first, to one byte per pixel: 0x00 black, 0xFF white
+static void bilevel_expand_row( const uint8_t * src, uint8_t * dst, uint32_t width, bool set_is_black )
+{
+	uint32_t x = 0;
+#ifdef _CHE_SSE2_
+	const __m128i mask = _mm_setr_epi8( (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+										(char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01 );
+	const __m128i flip = set_is_black ? _mm_setzero_si128() : _mm_set1_epi8( (char)0xFF );
+	for ( ; x + 16 <= width; x += 16 )
+	{
+		//byte 0 in the low eight lanes, byte 1 in the high eight
+		__m128i v = _mm_unpacklo_epi64( _mm_set1_epi8( (char)src[x >> 3] ), _mm_set1_epi8( (char)src[(x >> 3) + 1] ) );
+		__m128i clear = _mm_cmpeq_epi8( _mm_and_si128( v, mask ), _mm_setzero_si128() );
+		_mm_storeu_si128( (__m128i *)(dst + x), _mm_xor_si128( clear, flip ) );
+	}
+#endif
+	uint8_t set_value = set_is_black ? 0x00 : 0xFF;
+	for ( ; x < width; ++x )
+	{
+		dst[x] = ( ( src[x >> 3] >> ( 7 - ( x & 7 ) ) ) & 1 ) ? set_value : (uint8_t)~set_value;
+	}
+}
+
 PdfFaxFilter::PdfFaxFilter( PdfFaxDecodeParams * params, Allocator * allocator /*= nullptr*/ )
-    : PdfFilter(allocator), params_(params)
+    : PdfFilter(allocator), params_(params), output_format_(BILEVEL_OUTPUT_PACKED)
 {
 }
 
@@ -1103,13 +1154,12 @@ void PdfFaxFilter::Encode( uint8_t * data, size_t size, Buffer & buffer )
 
 void PdfFaxFilter::Decode( uint8_t * data, size_t size, Buffer & buffer )
 {
-	if ( data == nullptr || size == 0 )
+	if ( data == nullptr || size == 0 || params_ == nullptr )
 	{
 		return;
 	}
 
 	fz_faxd faxs;
-	if ( params_ )
 	{
 		faxs.ref = nullptr;
 		faxs.dst = nullptr;
@@ -1150,23 +1200,15 @@ void PdfFaxFilter::Decode( uint8_t * data, size_t size, Buffer & buffer )
 
 	unsigned char * tmp = nullptr;
 
-	if (fax->stage == STATE_DONE)
+	//the decoder works with 1 as black, the polarity change happens while each row is written out
+	bool b_invert = ( output_format_ == BILEVEL_OUTPUT_PACKED && !fax->black_is_1 );
+	size_t row_size = ( output_format_ == BILEVEL_OUTPUT_GRAY8 ) ? (size_t)fax->columns : (size_t)fax->stride;
+	uint8_t * row = nullptr;
+	if ( b_invert || output_format_ == BILEVEL_OUTPUT_GRAY8 )
 	{
-		if ( !fax->black_is_1 )
-		{
-			uint8_t * pByte = buffer.GetData();
-			for ( size_t i = 0; i < buffer.GetSize(); ++i )
-			{
-				*pByte = *pByte ^ 0xFF;
-				++pByte;
-			}
-		}
-		return;
+		row = GetAllocator()->NewArray<uint8_t>( row_size );
 	}
 
-	if (fax->stage == STATE_EOL)
-		goto eol;
-
 loop:
 
 	if (fill_bits(fax))
@@ -1239,7 +1281,18 @@ loop:
 eol:
 	fax->stage = STATE_EOL;
 
-	buffer.Write( fax->rp, fax->wp - fax->rp );
+	if ( output_format_ == BILEVEL_OUTPUT_GRAY8 )
+	{
+		bilevel_expand_row( fax->rp, row, fax->columns, true );
+		buffer.Write( row, row_size );
+	}
+	else if ( b_invert )
+	{
+		bilevel_copy_row( fax->rp, row, fax->wp - fax->rp, true );
+		buffer.Write( row, fax->wp - fax->rp );
+	}else{
+		buffer.Write( fax->rp, fax->wp - fax->rp );
+	}
 	tmp = fax->ref;
 	fax->ref = fax->dst;
 	fax->dst = tmp;
@@ -1287,15 +1340,12 @@ rtc:
 	fax->stage = STATE_DONE;
 	/*return p - buf;*/
 
-	if ( !fax->black_is_1 )
+	if ( row )
 	{
-		uint8_t * pByte = buffer.GetData();
-		for ( size_t i = 0; i < buffer.GetSize(); ++i )
-		{
-			*pByte = *pByte ^ 0xFF;
-			++pByte;
-		}
+		GetAllocator()->DeleteArray<uint8_t>( row );
 	}
+	GetAllocator()->DeleteArray<uint8_t>( fax->ref );
+	GetAllocator()->DeleteArray<uint8_t>( fax->dst );
 }
 
 
@@ -1343,6 +1393,9 @@ static void skip_input_data(j_decompress_ptr cinfo, long num_bytes)
 	}
 }
 
+void PdfDCTDFilter::Encode( uint8_t * data, size_t size, Buffer & buffer )
+{
+}
 
 void PdfDCTDFilter::Decode( uint8_t * data, size_t size, Buffer &buffer )
 {
@@ -1393,25 +1446,61 @@ void PdfDCTDFilter::Decode( uint8_t * data, size_t size, Buffer &buffer )
 
 
 
-/*static void fz_opj_error_callback(const char *msg, void *client_data)
+struct JPXMemoryStream
 {
-	//fz_context *ctx = (fz_context *)client_data;
-	//fz_warn(ctx, "openjpeg error: %s", msg);
+	const uint8_t * data;
+	size_t size;
+	size_t pos;
+};
+
+static OPJ_SIZE_T jpx_stream_read(void * buffer, OPJ_SIZE_T size, void * user_data)
+{
+	JPXMemoryStream * stream = (JPXMemoryStream *)user_data;
+	if (stream->pos >= stream->size)
+	{
+		return (OPJ_SIZE_T)-1;
+	}
+	if (size > stream->size - stream->pos)
+	{
+		size = stream->size - stream->pos;
+	}
+	memcpy(buffer, stream->data + stream->pos, size);
+	stream->pos += size;
+	return size;
 }
 
-static void fz_opj_warning_callback(const char *msg, void *client_data)
+static OPJ_OFF_T jpx_stream_skip(OPJ_OFF_T skip, void * user_data)
 {
-	//fz_context *ctx = (fz_context *)client_data;
-	//fz_warn(ctx, "openjpeg warning: %s", msg);
+	JPXMemoryStream * stream = (JPXMemoryStream *)user_data;
+	if (skip < 0)
+	{
+		if ((size_t)(-skip) > stream->pos)
+		{
+			skip = -(OPJ_OFF_T)stream->pos;
+		}
+	}
+	else if ((size_t)skip > stream->size - stream->pos)
+	{
+		skip = (OPJ_OFF_T)(stream->size - stream->pos);
+	}
+	stream->pos += skip;
+	return skip;
 }
 
-static void fz_opj_info_callback(const char *msg, void *client_data)
+static OPJ_BOOL jpx_stream_seek(OPJ_OFF_T offset, void * user_data)
 {
-	//fz_warn("openjpeg info: %s", msg);
-}*/
+	JPXMemoryStream * stream = (JPXMemoryStream *)user_data;
+	if (offset < 0 || (size_t)offset > stream->size)
+	{
+		return OPJ_FALSE;
+	}
+	stream->pos = (size_t)offset;
+	return OPJ_TRUE;
+}
 
 PdfJPXFilter::PdfJPXFilter( Allocator * allocator /*= nullptr*/ )
-    : PdfFilter(allocator)
+    : PdfFilter(allocator), reduce_(0), thread_count_(0), b_decode_area_(false),
+    area_x0_(0), area_y0_(0), area_x1_(0), area_y1_(0)
 {
 }
 
@@ -1419,6 +1508,20 @@ PdfJPXFilter::~PdfJPXFilter()
 {
 }
 
+void PdfJPXFilter::SetDecodeArea(int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+{
+	if (x1 <= x0 || y1 <= y0)
+	{
+		b_decode_area_ = false;
+		return;
+	}
+	b_decode_area_ = true;
+	area_x0_ = x0;
+	area_y0_ = y0;
+	area_x1_ = x1;
+	area_y1_ = y1;
+}
+
 void	PdfJPXFilter::Encode( uint8_t * data, size_t size, Buffer & buffer )
 {
 }
@@ -1430,15 +1533,15 @@ void	PdfJPXFilter::Decode( uint8_t * data, size_t size, Buffer & buffer )
         return;
     }
     
-    //todo, add some error handle please!
 	opj_dparameters_t   params;
-    opj_codec_t *       info = nullptr;
+    opj_codec_t *       codec = nullptr;
     opj_stream_t *      input_stream = nullptr;
 	opj_image_t *       jpx = nullptr;
     OPJ_CODEC_FORMAT format;
+	JPXMemoryStream memory_stream;
 
 	int a, n, w, h, depth, sgnd;
-	int x, y, k, v;
+	int k;
     
 	/* Check for SOC marker -- if found we have a bare J2K stream */
 	if ( data[0] == 0xFF && data[1] == 0x4F )
@@ -1448,11 +1551,6 @@ void	PdfJPXFilter::Decode( uint8_t * data, size_t size, Buffer & buffer )
 		format = OPJ_CODEC_JP2;
     }
     
-	//memset(&evtmgr, 0, sizeof(evtmgr));
-	//evtmgr.error_handler = fz_opj_error_callback;
-	//evtmgr.warning_handler = fz_opj_warning_callback;
-	//evtmgr.info_handler = fz_opj_info_callback;
-    
 	opj_set_default_decoder_parameters( &params );
 	
     //if (indexed) ???
@@ -1460,44 +1558,105 @@ void	PdfJPXFilter::Decode( uint8_t * data, size_t size, Buffer & buffer )
         params.flags |= OPJ_DPARAMETERS_IGNORE_PCLR_CMAP_CDEF_FLAG;
     }
     
-	info = opj_create_decompress( format );
-    
-	//opj_set_event_mgr( (opj_common_ptr)info, &evtmgr, nullptr );
-	opj_setup_decoder(info, &params );
-    
-    input_stream = opj_stream_default_create(true);
-    opj_stream_set_user_data(input_stream, data, nullptr);
+	codec = opj_create_decompress( format );
+	if ( !codec )
+	{
+		return;
+	}
+	if ( !opj_setup_decoder(codec, &params ) )
+	{
+		opj_destroy_codec(codec);
+		return;
+	}
+
+#if OPJ_VERSION_MAJOR > 2 || (OPJ_VERSION_MAJOR == 2 && OPJ_VERSION_MINOR >= 2)
+	{
+		uint32_t threads = thread_count_;
+		if (threads == 0)
+		{
+			threads = std::thread::hardware_concurrency();
+		}
+		if (threads > 1)
+		{
+			opj_codec_set_threads(codec, (int)threads);
+		}
+	}
+#endif
+
+	//read straight out of the caller's buffer, openjpeg copies into its own chunk buffer
+	memory_stream.data = data;
+	memory_stream.size = size;
+	memory_stream.pos = 0;
+
+    input_stream = opj_stream_create(size < OPJ_J2K_STREAM_CHUNK_SIZE ? size : OPJ_J2K_STREAM_CHUNK_SIZE, OPJ_TRUE);
+	if ( !input_stream )
+	{
+		opj_destroy_codec(codec);
+		return;
+	}
+	opj_stream_set_read_function(input_stream, jpx_stream_read);
+	opj_stream_set_skip_function(input_stream, jpx_stream_skip);
+	opj_stream_set_seek_function(input_stream, jpx_stream_seek);
+    opj_stream_set_user_data(input_stream, &memory_stream, nullptr);
     opj_stream_set_user_data_length(input_stream, size);
-    
-	//cio = opj_cio_open( (opj_common_ptr)info, data, (uint32_t)size );
-    
-    opj_decode(info, input_stream, jpx);
-    
+
+	bool b_ok = opj_read_header(input_stream, codec, &jpx) ? true : false;
+	if ( b_ok && reduce_ > 0 )
+	{
+		//a factor past the coarsest resolution makes the whole decode fail, so clamp it
+		uint32_t reduce = reduce_;
+		opj_codestream_info_v2_t * info = opj_get_cstr_info(codec);
+		if (info)
+		{
+			if (info->m_default_tile_info.tccp_info)
+			{
+				for (uint32_t i = 0; i < info->nbcomps; ++i)
+				{
+					uint32_t levels = info->m_default_tile_info.tccp_info[i].numresolutions;
+					if (levels > 0 && reduce > levels - 1)
+					{
+						reduce = levels - 1;
+					}
+				}
+			}
+			opj_destroy_cstr_info(&info);
+		}
+		if (reduce > 0)
+		{
+			b_ok = opj_set_decoded_resolution_factor(codec, reduce) ? true : false;
+		}
+	}
+	if ( b_ok && b_decode_area_ )
+	{
+		b_ok = opj_set_decode_area(codec, jpx, area_x0_, area_y0_, area_x1_, area_y1_) ? true : false;
+	}
+	if ( b_ok )
+	{
+		b_ok = opj_decode(codec, input_stream, jpx) && opj_end_decompress(codec, input_stream);
+	}
+
     opj_stream_destroy(input_stream);
-	opj_destroy_codec(info);
+	opj_destroy_codec(codec);
     
 	if ( !jpx )
     {
-        //decode error!!!
         return;
     }
+	if ( !b_ok || jpx->numcomps == 0 )
+	{
+		opj_image_destroy(jpx);
+		return;
+	}
     
-	for (k = 1; k < jpx->numcomps; k++)
+	for (k = 1; k < (int)jpx->numcomps; k++)
 	{
-		if (jpx->comps[k].w != jpx->comps[0].w)
-		{
-			opj_image_destroy(jpx);
-			//fz_throw(ctx, "image components have different width");
-		}
-		if (jpx->comps[k].h != jpx->comps[0].h)
+		if (jpx->comps[k].w != jpx->comps[0].w ||
+			jpx->comps[k].h != jpx->comps[0].h ||
+			jpx->comps[k].prec != jpx->comps[0].prec)
 		{
+			//image components have different size or precision
 			opj_image_destroy(jpx);
-			//fz_throw(ctx, "image components have different height");
-		}
-		if (jpx->comps[k].prec != jpx->comps[0].prec)
-		{
-			opj_image_destroy(jpx);
-			//fz_throw(ctx, "image components have different precision");
+			return;
 		}
 	}
     
@@ -1512,35 +1671,146 @@ void	PdfJPXFilter::Decode( uint8_t * data, size_t size, Buffer & buffer )
 	else if (n == 2) { n = 1; a = 1; }
 	else if (n > 4) { n = 4; a = 1; }
 	else { a = 0; }
+
+	int channels = n + a;
+	int offset = sgnd ? (1 << (depth - 1)) : 0;
+	int shift = depth > 8 ? depth - 8 : 0;
     
-    buffer.Alloc( n * w * h );
+    buffer.Alloc( (size_t)channels * w * h );
 	uint8_t * pByte = buffer.GetData();
-    
-	for (y = 0; y < h; y++)
+
+	//interleave one component at a time, every inner loop is a linear walk
+	for (k = 0; k < channels; k++)
 	{
-		for (x = 0; x < w; x++)
+		const OPJ_INT32 * src = jpx->comps[k].data;
+		uint8_t * dst = pByte + k;
+		size_t count = (size_t)w * h;
+		if (!src)
 		{
-			for (k = 0; k < n + a; k++)
+			continue;
+		}
+		if (offset == 0 && shift == 0)
+		{
+			for (size_t i = 0; i < count; ++i)
 			{
-				v = jpx->comps[k].data[y * w + x];
-				if (sgnd)
-					v = v + (1 << (depth - 1));
-				if (depth > 8)
-					v = v >> (depth - 8);
-				*pByte++ = v;
-				//buffer.Write( (uint8_t *)&v, 1 );
+				*dst = (uint8_t)src[i];
+				dst += channels;
+			}
+		}else{
+			for (size_t i = 0; i < count; ++i)
+			{
+				*dst = (uint8_t)((src[i] + offset) >> shift);
+				dst += channels;
 			}
-// 			if (!a)
-//                 v = 255;
-//                 buffer.Write( (uint8_t *)&v, 1 );
 		}
 	}
  
 	opj_image_destroy( jpx );
 }
 
+PdfJBig2GlobalsCache::PdfJBig2GlobalsCache( Allocator * allocator /*= nullptr*/ )
+	: BaseObject(allocator)
+{
+}
+
+PdfJBig2GlobalsCache::~PdfJBig2GlobalsCache()
+{
+	for (auto it = entries_.begin(); it != entries_.end(); ++it)
+	{
+		jbig2_global_ctx_free( it->second.ctx );
+	}
+	entries_.clear();
+}
+
+Jbig2GlobalCtx * PdfJBig2GlobalsCache::Acquire( const void * owner, uint32_t obj_num, uint32_t gen_num, uint8_t * data, size_t size )
+{
+	Jbig2GlobalCtx * gctx = nullptr;
+	Key key = { owner, obj_num, gen_num };
+	lock_.Lock();
+	auto it = entries_.find( key );
+	if ( it != entries_.end() )
+	{
+		it->second.users++;
+		gctx = it->second.ctx;
+	}
+	else if ( data && size > 0 )
+	{
+		//parse under the lock so two pages never build the same dictionary twice
+		Jbig2Ctx * ctx = jbig2_ctx_new( nullptr, JBIG2_OPTIONS_EMBEDDED, nullptr, nullptr, nullptr );
+		if ( ctx )
+		{
+			jbig2_data_in( ctx, data, size );
+			gctx = jbig2_make_global_ctx( ctx );
+			if ( gctx )
+			{
+				Entry entry;
+				entry.ctx = gctx;
+				entry.users = 1;
+				entries_[key] = entry;
+			}
+		}
+	}
+	lock_.UnLock();
+	return gctx;
+}
+
+void PdfJBig2GlobalsCache::Release( const void * owner, uint32_t obj_num, uint32_t gen_num )
+{
+	Key key = { owner, obj_num, gen_num };
+	lock_.Lock();
+	auto it = entries_.find( key );
+	if ( it != entries_.end() && it->second.users > 0 )
+	{
+		//keep the context around, the next page will most likely need it again
+		it->second.users--;
+	}
+	lock_.UnLock();
+}
+
+void PdfJBig2GlobalsCache::Purge()
+{
+	lock_.Lock();
+	for (auto it = entries_.begin(); it != entries_.end(); )
+	{
+		if ( it->second.users == 0 )
+		{
+			jbig2_global_ctx_free( it->second.ctx );
+			it = entries_.erase( it );
+		}else{
+			++it;
+		}
+	}
+	lock_.UnLock();
+}
+
+void PdfJBig2GlobalsCache::Purge( const void * owner )
+{
+	lock_.Lock();
+	for (auto it = entries_.begin(); it != entries_.end(); )
+	{
+		if ( it->first.owner == owner && it->second.users == 0 )
+		{
+			jbig2_global_ctx_free( it->second.ctx );
+			it = entries_.erase( it );
+		}else{
+			++it;
+		}
+	}
+	lock_.UnLock();
+}
+
+size_t PdfJBig2GlobalsCache::GetCount()
+{
+	lock_.Lock();
+	size_t count = entries_.size();
+	lock_.UnLock();
+	return count;
+}
+
 PdfJBig2Filter::PdfJBig2Filter( Allocator * allocator /*= nullptr*/)
-	: PdfFilter(allocator), globals_param_(nullptr), globals_param_size_(0)
+	: PdfFilter(allocator), globals_param_(nullptr), globals_param_size_(0),
+	globals_cache_(nullptr), globals_owner_(nullptr), globals_obj_num_(0), globals_gen_num_(0),
+	output_format_(BILEVEL_OUTPUT_PACKED)
 {
 }
 
@@ -1552,6 +1822,21 @@ void PdfJBig2Filter::SetGlobals( uint8_t * data, size_t size )
 {
 	globals_param_ = data;
 	globals_param_size_ = size;
+	globals_cache_ = nullptr;
+	globals_owner_ = nullptr;
+	globals_obj_num_ = 0;
+	globals_gen_num_ = 0;
+}
+
+void PdfJBig2Filter::SetGlobals( PdfJBig2GlobalsCache * cache, const void * owner, uint32_t obj_num, uint32_t gen_num,
+                                 uint8_t * data, size_t size )
+{
+	globals_param_ = data;
+	globals_param_size_ = size;
+	globals_cache_ = cache;
+	globals_owner_ = owner;
+	globals_obj_num_ = obj_num;
+	globals_gen_num_ = gen_num;
 }
 
 void PdfJBig2Filter::Encode( uint8_t * data, size_t size, Buffer & buffer )
@@ -1565,51 +1850,66 @@ void PdfJBig2Filter::Decode( uint8_t * data, size_t size, Buffer & buffer )
 		return;
 	}
 
-	Jbig2Ctx *ctx = jbig2_ctx_new( nullptr, JBIG2_OPTIONS_EMBEDDED, nullptr, nullptr, nullptr );
 	Jbig2GlobalCtx *gctx = nullptr;
+	bool b_shared = false;
 	Jbig2Image *page = nullptr;
 
-	if ( globals_param_ )
+	if ( globals_cache_ )
 	{
-		jbig2_data_in( ctx, globals_param_, globals_param_size_ );
-		gctx = jbig2_make_global_ctx( ctx );
-		ctx = jbig2_ctx_new( nullptr, JBIG2_OPTIONS_EMBEDDED, gctx, nullptr, nullptr );
+		gctx = globals_cache_->Acquire( globals_owner_, globals_obj_num_, globals_gen_num_, globals_param_, globals_param_size_ );
+		b_shared = ( gctx != nullptr );
 	}
-    
-	if ( !page )
+	else if ( globals_param_ )
+	{
+		Jbig2Ctx * globals_ctx = jbig2_ctx_new( nullptr, JBIG2_OPTIONS_EMBEDDED, nullptr, nullptr, nullptr );
+		if ( globals_ctx )
+		{
+			jbig2_data_in( globals_ctx, globals_param_, globals_param_size_ );
+			gctx = jbig2_make_global_ctx( globals_ctx );
+		}
+	}
+
+	Jbig2Ctx *ctx = jbig2_ctx_new( nullptr, JBIG2_OPTIONS_EMBEDDED, gctx, nullptr, nullptr );
+	if ( ctx )
 	{
         jbig2_data_in( ctx, data, size );
 		jbig2_complete_page( ctx );
 		page = jbig2_page_out( ctx );
-        //if page = nullptr error happened!
 	}
     
-    uint8_t * p = page->data;
-	uint8_t * s = page->data;
-	int32_t w = page->height * page->stride;
-	int32_t x = 0;
- 	while (x < w)
- 	{
- 		*p++ = ~ s[x++];
-		//*p++ = s[x++] ^ 0xff;
- 	}
-    
-    buffer.Clear();
-    buffer.Write( page->data, page->height * page->stride );
-
+	if ( page )
+	{
+		//jbig2dec hands out 1 as black, PDF wants 0 as black unless asked otherwise
+		buffer.Clear();
+		if ( output_format_ == BILEVEL_OUTPUT_GRAY8 )
+		{
+			buffer.Alloc( (size_t)page->width * page->height );
+			uint8_t * dst = buffer.GetData();
+			for ( uint32_t y = 0; y < page->height; ++y )
+			{
+				bilevel_expand_row( page->data + (size_t)y * page->stride, dst, page->width, true );
+				dst += page->width;
+			}
+		}else{
+			size_t total = (size_t)page->height * page->stride;
+			buffer.Alloc( total );
+			bilevel_copy_row( page->data, buffer.GetData(), total, output_format_ == BILEVEL_OUTPUT_PACKED );
+		}
 
-    if ( page )
-    {
 		jbig2_release_page( ctx, page );
     }
-	if ( gctx )
-	{
-		jbig2_global_ctx_free( gctx );
-	}
 	if ( ctx )
 	{
 		jbig2_ctx_free( ctx );
 	}
+	if ( b_shared )
+	{
+		globals_cache_->Release( globals_owner_, globals_obj_num_, globals_gen_num_ );
+	}
+	else if ( gctx )
+	{
+		jbig2_global_ctx_free( gctx );
+	}
 }
 
 }//namespace
@@ -0,0 +1,358 @@
+#include <cstring>
+#include <atomic>
+#include <vector>
+
+#include "../include/che_pdf_name.h"
+
+namespace chepdf {
+
+#define PDF_NAME_PAGE_SIZE			1024
+#define PDF_NAME_PAGE_COUNT			4096
+//power of two, keeps the predefined names under a quarter full
+#define PDF_NAME_PREDEFINED_SLOTS	2048
+
+static const char * gPredefinedNames[NAME_ATOM_PREDEFINED_COUNT] =
+{
+	"",
+	"",
+#define PDF_NAME_ATOM_STRING(name) #name,
+	PDF_NAME_LIST(PDF_NAME_ATOM_STRING)
+#undef PDF_NAME_ATOM_STRING
+};
+
+static inline uint32_t name_hash(const char * name, uint32_t length)
+{
+	//FNV-1a
+	uint32_t hash = 2166136261u;
+	for (uint32_t i = 0; i < length; i++)
+	{
+		hash ^= (uint8_t)name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static inline bool name_equal(const ByteString & str, const char * name, uint32_t length)
+{
+	return str.GetLength() == length && memcmp(str.GetData(), name, length) == 0;
+}
+
+// Atoms index fixed size pages of names that never move, so GetName needs no lock. The
+// predefined names have their own read only hash table and live as long as the process, other
+// names are found under lock_ and their atom goes back to free_atoms_ with the last reference.
+class PdfNameTableImpl
+{
+public:
+	PdfNameTableImpl();
+
+	uint32_t Find(const char * name, uint32_t length, bool bIntern);
+	ByteString GetName(uint32_t atom) const;
+	uint32_t GetCount() const { return NAME_ATOM_PREDEFINED_COUNT + dynamic_count_.load(std::memory_order_relaxed); }
+
+	void AddRef(uint32_t atom);
+	void Release(uint32_t atom);
+
+private:
+	uint32_t FindDynamic(const char * name, uint32_t length, uint32_t hash) const;
+	uint32_t Intern(const char * name, uint32_t length, uint32_t hash);
+	void Erase(uint32_t atom);
+	bool Grow();
+
+	const ByteString & At(uint32_t atom) const
+	{
+		return pages_[atom / PDF_NAME_PAGE_SIZE][atom % PDF_NAME_PAGE_SIZE];
+	}
+
+	std::atomic<uint32_t> & RefCount(uint32_t atom)
+	{
+		return ref_pages_[atom / PDF_NAME_PAGE_SIZE][atom % PDF_NAME_PAGE_SIZE];
+	}
+
+	uint16_t                predefined_slots_[PDF_NAME_PREDEFINED_SLOTS];
+	ByteString *            pages_[PDF_NAME_PAGE_COUNT];
+	std::atomic<uint32_t> * ref_pages_[PDF_NAME_PAGE_COUNT];
+	//atoms handed out so far, freed ones below it are reused first
+	std::atomic<uint32_t>   count_;
+	std::atomic<uint32_t>   dynamic_count_;
+	std::vector<uint32_t>   free_atoms_;
+	uint32_t *              dynamic_slots_;
+	uint32_t                dynamic_slot_count_;
+	MutexLock               lock_;
+};
+
+PdfNameTableImpl::PdfNameTableImpl()
+	: count_(NAME_ATOM_PREDEFINED_COUNT), dynamic_count_(0), dynamic_slots_(nullptr), dynamic_slot_count_(0)
+{
+	memset(predefined_slots_, 0, sizeof(predefined_slots_));
+	memset(pages_, 0, sizeof(pages_));
+	memset(ref_pages_, 0, sizeof(ref_pages_));
+	pages_[0] = Allocator::GetDefaultAllocator()->NewArray<ByteString>(PDF_NAME_PAGE_SIZE);
+	ref_pages_[0] = Allocator::GetDefaultAllocator()->NewArray<std::atomic<uint32_t> >(PDF_NAME_PAGE_SIZE);
+	//the empty name is never looked up by hash
+	for (uint32_t atom = NAME_ATOM_EMPTY + 1; atom < NAME_ATOM_PREDEFINED_COUNT; atom++)
+	{
+		uint32_t length = (uint32_t)strlen(gPredefinedNames[atom]);
+		pages_[0][atom] = ByteString(gPredefinedNames[atom], length);
+		uint32_t slot = name_hash(gPredefinedNames[atom], length) & (PDF_NAME_PREDEFINED_SLOTS - 1);
+		while (predefined_slots_[slot] != 0)
+		{
+			slot = (slot + 1) & (PDF_NAME_PREDEFINED_SLOTS - 1);
+		}
+		predefined_slots_[slot] = (uint16_t)atom;
+	}
+}
+
+uint32_t PdfNameTableImpl::Find(const char * name, uint32_t length, bool bIntern)
+{
+	uint32_t hash = name_hash(name, length);
+	uint32_t slot = hash & (PDF_NAME_PREDEFINED_SLOTS - 1);
+	while (predefined_slots_[slot] != 0)
+	{
+		if (name_equal(pages_[0][predefined_slots_[slot]], name, length))
+		{
+			return predefined_slots_[slot];
+		}
+		slot = (slot + 1) & (PDF_NAME_PREDEFINED_SLOTS - 1);
+	}
+	if (!bIntern && dynamic_count_.load(std::memory_order_relaxed) == 0)
+	{
+		return NAME_ATOM_NONE;
+	}
+
+	lock_.Lock();
+	uint32_t atom = FindDynamic(name, length, hash);
+	if (bIntern)
+	{
+		if (atom != NAME_ATOM_NONE)
+		{
+			//taken under lock_, so Release can't drop the name in between
+			RefCount(atom).fetch_add(1, std::memory_order_relaxed);
+		}else{
+			atom = Intern(name, length, hash);
+		}
+	}
+	lock_.UnLock();
+	return atom;
+}
+
+uint32_t PdfNameTableImpl::Intern(const char * name, uint32_t length, uint32_t hash)
+{
+	uint32_t count = count_.load(std::memory_order_relaxed);
+	if (free_atoms_.empty() && count >= PDF_NAME_PAGE_SIZE * PDF_NAME_PAGE_COUNT)
+	{
+		return NAME_ATOM_NONE;
+	}
+	if ((dynamic_count_.load(std::memory_order_relaxed) + 1) * 2 > dynamic_slot_count_ && !Grow())
+	{
+		return NAME_ATOM_NONE;
+	}
+	uint32_t atom = count;
+	if (!free_atoms_.empty())
+	{
+		atom = free_atoms_.back();
+	}else{
+		uint32_t page = count / PDF_NAME_PAGE_SIZE;
+		if (pages_[page] == nullptr)
+		{
+			pages_[page] = Allocator::GetDefaultAllocator()->NewArray<ByteString>(PDF_NAME_PAGE_SIZE);
+			ref_pages_[page] = Allocator::GetDefaultAllocator()->NewArray<std::atomic<uint32_t> >(PDF_NAME_PAGE_SIZE);
+			if (pages_[page] == nullptr || ref_pages_[page] == nullptr)
+			{
+				return NAME_ATOM_NONE;
+			}
+		}
+	}
+	pages_[atom / PDF_NAME_PAGE_SIZE][atom % PDF_NAME_PAGE_SIZE] = ByteString(name, length);
+	RefCount(atom).store(1, std::memory_order_relaxed);
+	uint32_t slot = hash & (dynamic_slot_count_ - 1);
+	while (dynamic_slots_[slot] != NAME_ATOM_NONE)
+	{
+		slot = (slot + 1) & (dynamic_slot_count_ - 1);
+	}
+	dynamic_slots_[slot] = atom;
+	if (atom == count)
+	{
+		//the name is in place before the atom can be seen
+		count_.store(count + 1, std::memory_order_release);
+	}else{
+		free_atoms_.pop_back();
+	}
+	dynamic_count_.fetch_add(1, std::memory_order_relaxed);
+	return atom;
+}
+
+void PdfNameTableImpl::AddRef(uint32_t atom)
+{
+	if (atom >= NAME_ATOM_PREDEFINED_COUNT && atom < count_.load(std::memory_order_acquire))
+	{
+		RefCount(atom).fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void PdfNameTableImpl::Release(uint32_t atom)
+{
+	if (atom < NAME_ATOM_PREDEFINED_COUNT || atom >= count_.load(std::memory_order_acquire))
+	{
+		return;
+	}
+	if (RefCount(atom).fetch_sub(1, std::memory_order_acq_rel) != 1)
+	{
+		return;
+	}
+	lock_.Lock();
+	//Find may have handed the name out again, or another Release dropped it already
+	if (RefCount(atom).load(std::memory_order_relaxed) == 0 && At(atom).GetLength() != 0)
+	{
+		Erase(atom);
+	}
+	lock_.UnLock();
+}
+
+void PdfNameTableImpl::Erase(uint32_t atom)
+{
+	const ByteString & str = At(atom);
+	uint32_t mask = dynamic_slot_count_ - 1;
+	uint32_t slot = name_hash(str.GetData(), str.GetLength()) & mask;
+	while (dynamic_slots_[slot] != atom)
+	{
+		slot = (slot + 1) & mask;
+	}
+	//names probed past the freed slot move back, so no probe sequence has a hole
+	uint32_t next = slot;
+	for (;;)
+	{
+		next = (next + 1) & mask;
+		if (dynamic_slots_[next] == NAME_ATOM_NONE)
+		{
+			break;
+		}
+		const ByteString & other = At(dynamic_slots_[next]);
+		uint32_t home = name_hash(other.GetData(), other.GetLength()) & mask;
+		bool bStays = (slot <= next) ? (slot < home && home <= next) : (slot < home || home <= next);
+		if (!bStays)
+		{
+			dynamic_slots_[slot] = dynamic_slots_[next];
+			slot = next;
+		}
+	}
+	dynamic_slots_[slot] = NAME_ATOM_NONE;
+	pages_[atom / PDF_NAME_PAGE_SIZE][atom % PDF_NAME_PAGE_SIZE] = ByteString();
+	free_atoms_.push_back(atom);
+	dynamic_count_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+uint32_t PdfNameTableImpl::FindDynamic(const char * name, uint32_t length, uint32_t hash) const
+{
+	if (dynamic_slot_count_ == 0)
+	{
+		return NAME_ATOM_NONE;
+	}
+	uint32_t slot = hash & (dynamic_slot_count_ - 1);
+	while (dynamic_slots_[slot] != NAME_ATOM_NONE)
+	{
+		if (name_equal(At(dynamic_slots_[slot]), name, length))
+		{
+			return dynamic_slots_[slot];
+		}
+		slot = (slot + 1) & (dynamic_slot_count_ - 1);
+	}
+	return NAME_ATOM_NONE;
+}
+
+bool PdfNameTableImpl::Grow()
+{
+	uint32_t slotCount = (dynamic_slot_count_ == 0) ? 256 : dynamic_slot_count_ * 2;
+	uint32_t * slots = Allocator::GetDefaultAllocator()->NewArray<uint32_t>(slotCount);
+	if (slots == nullptr)
+	{
+		return false;
+	}
+	memset(slots, 0, sizeof(uint32_t) * slotCount);
+	uint32_t count = count_.load(std::memory_order_relaxed);
+	for (uint32_t atom = NAME_ATOM_PREDEFINED_COUNT; atom < count; atom++)
+	{
+		const ByteString & str = At(atom);
+		if (str.GetLength() == 0)
+		{
+			continue;
+		}
+		uint32_t slot = name_hash(str.GetData(), str.GetLength()) & (slotCount - 1);
+		while (slots[slot] != NAME_ATOM_NONE)
+		{
+			slot = (slot + 1) & (slotCount - 1);
+		}
+		slots[slot] = atom;
+	}
+	if (dynamic_slots_)
+	{
+		Allocator::GetDefaultAllocator()->DeleteArray<uint32_t>(dynamic_slots_);
+	}
+	dynamic_slots_ = slots;
+	dynamic_slot_count_ = slotCount;
+	return true;
+}
+
+ByteString PdfNameTableImpl::GetName(uint32_t atom) const
+{
+	if (atom == NAME_ATOM_NONE || atom >= count_.load(std::memory_order_acquire))
+	{
+		return ByteString();
+	}
+	return At(atom);
+}
+
+static PdfNameTableImpl & GetNameTableImpl()
+{
+	static PdfNameTableImpl table;
+	return table;
+}
+
+uint32_t PdfNameTable::GetAtom(const ByteString & name)
+{
+	return GetAtom(name.GetData(), name.GetLength());
+}
+
+uint32_t PdfNameTable::GetAtom(const char * name, uint32_t length)
+{
+	if (name == nullptr || length == 0)
+	{
+		return NAME_ATOM_EMPTY;
+	}
+	return GetNameTableImpl().Find(name, length, true);
+}
+
+uint32_t PdfNameTable::FindAtom(const ByteString & name)
+{
+	return FindAtom(name.GetData(), name.GetLength());
+}
+
+uint32_t PdfNameTable::FindAtom(const char * name, uint32_t length)
+{
+	if (name == nullptr || length == 0)
+	{
+		return NAME_ATOM_EMPTY;
+	}
+	return GetNameTableImpl().Find(name, length, false);
+}
+
+void PdfNameTable::AddRef(uint32_t atom)
+{
+	GetNameTableImpl().AddRef(atom);
+}
+
+void PdfNameTable::Release(uint32_t atom)
+{
+	GetNameTableImpl().Release(atom);
+}
+
+ByteString PdfNameTable::GetName(uint32_t atom)
+{
+	return GetNameTableImpl().GetName(atom);
+}
+
+uint32_t PdfNameTable::GetAtomCount()
+{
+	return GetNameTableImpl().GetCount();
+}
+
+}//namespace
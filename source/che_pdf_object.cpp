@@ -2,16 +2,31 @@
 
 #include "../include/che_pdf_object.h"
 #include "../include/che_pdf_crypto.h"
-//#include "../include/che_pdf_filter.h"
-//#include "../include/che_pdf_parser.h"
-//#include "../include/che_pdf_file.h"
+#include "../include/che_pdf_encoding.h"
+#include "../include/che_pdf_filter.h"
+#include "../include/che_pdf_file.h"
+
+#ifdef _CHE_SSE2_
+#include <emmintrin.h>
+#endif
 
 namespace chepdf {
     
 using namespace std;
 
 PdfObject::PdfObject(PDF_OBJ_TYPE type, Allocator * allocator/*= nullptr*/)
-	: BaseObject(allocator), b_modified_(false), type_(type) {}
+	: BaseObject(allocator), b_modified_(false), b_bound_(false), type_(type), parent_(nullptr), parents_(nullptr) {}
+
+PdfObject::~PdfObject()
+{
+	if (b_bound_)
+	{
+		UnbindSlot();
+	}else if (parents_)
+	{
+		GetAllocator()->Delete<std::vector<PdfObject*> >(parents_);
+	}
+}
 
 PdfObjectPointer PdfObject::Clone()
 {
@@ -92,7 +107,191 @@ void PdfObject::Release()
 
 void PdfObject::SetModified(bool value)
 {
-	b_modified_ = value;
+	if (value)
+	{
+		b_modified_ = true;
+		if (b_bound_)
+		{
+			WriteBack();
+			return;
+		}
+		//the containers of a modified object are already modified, so the walk stops there
+		if (parent_ && !parent_->b_modified_)
+		{
+			parent_->SetModified(true);
+		}
+		if (parents_)
+		{
+			for (size_t i = 0; i < parents_->size(); i++)
+			{
+				if (!(*parents_)[i]->b_modified_)
+				{
+					(*parents_)[i]->SetModified(true);
+				}
+			}
+		}
+		return;
+	}
+	if (!b_modified_)
+	{
+		return;
+	}
+	b_modified_ = false;
+	switch (type_)
+	{
+	case OBJ_TYPE_ARRAY:
+		{
+			PdfArray * array = (PdfArray*)this;
+			for (size_t i = 0; i < array->array_.size(); i++)
+			{
+				if (!array->array_[i].IsInline() && array->array_[i].object_)
+				{
+					array->array_[i].object_->SetModified(false);
+				}
+			}
+			break;
+		}
+	case OBJ_TYPE_DICTIONARY:
+		{
+			PdfDictionary * dictionary = (PdfDictionary*)this;
+			for (uint32_t i = 0; i < dictionary->count_; i++)
+			{
+				if (!dictionary->values_[i].IsInline() && dictionary->values_[i].object_)
+				{
+					dictionary->values_[i].object_->SetModified(false);
+				}
+			}
+			break;
+		}
+	case OBJ_TYPE_STREAM:
+		{
+			PdfStream * stream = (PdfStream*)this;
+			if (stream->dictionary_)
+			{
+				stream->dictionary_->SetModified(false);
+			}
+			break;
+		}
+	default:
+		break;
+	}
+}
+
+void PdfObject::AttachParent(PdfObject * parent)
+{
+	//stored as an object, it no longer stands for the entry it was built from
+	if (b_bound_)
+	{
+		UnbindSlot();
+	}
+	if (parent_ == nullptr)
+	{
+		parent_ = parent;
+		return;
+	}
+	if (parents_ == nullptr)
+	{
+		parents_ = GetAllocator()->New<std::vector<PdfObject*> >();
+	}
+	parents_->push_back(parent);
+}
+
+void PdfObject::DetachParent(PdfObject * parent)
+{
+	if (parent_ == parent)
+	{
+		parent_ = nullptr;
+		if (parents_ && !parents_->empty())
+		{
+			parent_ = parents_->back();
+			parents_->pop_back();
+		}
+		return;
+	}
+	if (parents_)
+	{
+		for (size_t i = 0; i < parents_->size(); i++)
+		{
+			if ((*parents_)[i] == parent)
+			{
+				(*parents_)[i] = parents_->back();
+				parents_->pop_back();
+				return;
+			}
+		}
+	}
+}
+
+void PdfObject::BindSlot(PdfObject * container, uint32_t slot)
+{
+	container->referenceCount_.Increase();
+	parent_ = container;
+	slot_ = slot;
+	b_bound_ = true;
+}
+
+void PdfObject::UnbindSlot()
+{
+	PdfObject * container = parent_;
+	b_bound_ = false;
+	parent_ = nullptr;
+	parents_ = nullptr;
+	if (container->referenceCount_.Decrease() == 0)
+	{
+		container->Release();
+	}
+}
+
+void PdfObject::WriteBack()
+{
+	PdfValue value;
+	switch (type_)
+	{
+	case OBJ_TYPE_NULL:
+		value = PdfValue::Null();
+		break;
+	case OBJ_TYPE_BOOLEAN:
+		value = PdfValue::Boolean(((PdfBoolean*)this)->value_);
+		break;
+	case OBJ_TYPE_NUMBER:
+		{
+			PdfNumber * number = (PdfNumber*)this;
+			value = number->b_integer_ ? PdfValue::Integer(number->interger_) : PdfValue::Float(number->float_);
+			break;
+		}
+	case OBJ_TYPE_NAME:
+		value = PdfValue::Name(((PdfName*)this)->atom_);
+		break;
+	case OBJ_TYPE_REFERENCE:
+		{
+			PdfReference * reference = (PdfReference*)this;
+			value = PdfValue::Reference(reference->object_number_, reference->generate_number_, reference->file_);
+			break;
+		}
+	default:
+		break;
+	}
+
+	//the entry may have been replaced or removed since the object was built from it
+	if (parent_->type_ == OBJ_TYPE_DICTIONARY)
+	{
+		PdfDictionary * dictionary = (PdfDictionary*)parent_;
+		int32_t index = dictionary->Find(slot_);
+		if (index >= 0 && dictionary->values_[index].IsInline() && dictionary->values_[index].type_ == type_)
+		{
+			dictionary->SetValue(slot_, value);
+			return;
+		}
+	}else if (parent_->type_ == OBJ_TYPE_ARRAY)
+	{
+		PdfArray * array = (PdfArray*)parent_;
+		if (slot_ < array->GetSize() && array->array_[slot_].IsInline() && array->array_[slot_].type_ == type_)
+		{
+			array->ReplaceValue(slot_, value);
+			return;
+		}
+	}
+	UnbindSlot();
 }
 
 bool PdfObject::IsModified()
@@ -100,6 +299,174 @@ bool PdfObject::IsModified()
 	return b_modified_;
 }
 
+size_t PdfObject::GetMemorySize() const
+{
+	size_t size = 0;
+	switch (type_)
+	{
+	case OBJ_TYPE_NULL:
+		return sizeof(PdfNull);
+	case OBJ_TYPE_BOOLEAN:
+		return sizeof(PdfBoolean);
+	case OBJ_TYPE_NUMBER:
+		return sizeof(PdfNumber);
+	case OBJ_TYPE_NAME:
+		return sizeof(PdfName);
+	case OBJ_TYPE_REFERENCE:
+		return sizeof(PdfReference);
+	case OBJ_TYPE_STRING:
+		{
+			uint32_t length = ((PdfString*)this)->string_.GetLength();
+			return sizeof(PdfString) + ((length > BYTESTRING_INLINE_SIZE) ? length + 1 : 0);
+		}
+	case OBJ_TYPE_ARRAY:
+		{
+			PdfArray * array = (PdfArray*)this;
+			size = sizeof(PdfArray) + array->array_.capacity() * sizeof(PdfValue);
+			for (size_t i = 0; i < array->array_.size(); i++)
+			{
+				const PdfValue & value = array->array_[i];
+				if (!value.IsInline() && value.object_)
+				{
+					size += value.object_->GetMemorySize();
+				}
+			}
+			return size;
+		}
+	case OBJ_TYPE_DICTIONARY:
+		{
+			PdfDictionary * dictionary = (PdfDictionary*)this;
+			size = sizeof(PdfDictionary) + dictionary->index_size_ * sizeof(uint32_t);
+			if (dictionary->keys_ != dictionary->inline_keys_)
+			{
+				size += dictionary->capacity_ * (sizeof(uint32_t) + sizeof(PdfValue));
+			}
+			for (uint32_t i = 0; i < dictionary->count_; i++)
+			{
+				const PdfValue & value = dictionary->values_[i];
+				if (!value.IsInline() && value.object_)
+				{
+					size += value.object_->GetMemorySize();
+				}
+			}
+			return size;
+		}
+	case OBJ_TYPE_STREAM:
+		{
+			PdfStream * stream = (PdfStream*)this;
+			size = sizeof(PdfStream);
+			//data left in the reader is not held by the stream
+			if (stream->b_memory_stream && stream->data_)
+			{
+				size += stream->size_;
+			}
+			if (stream->dictionary_)
+			{
+				size += stream->dictionary_->GetMemorySize();
+			}
+			return size;
+		}
+	default:
+		break;
+	}
+	return sizeof(PdfObject);
+}
+
+bool PdfObject::IsHeldOutside()
+{
+	if ((size_t)referenceCount_ > 1)
+	{
+		return true;
+	}
+	switch (type_)
+	{
+	case OBJ_TYPE_ARRAY:
+		{
+			PdfArray * array = (PdfArray*)this;
+			for (size_t i = 0; i < array->array_.size(); i++)
+			{
+				const PdfValue & value = array->array_[i];
+				if (!value.IsInline() && value.object_ && value.object_->IsHeldOutside())
+				{
+					return true;
+				}
+			}
+			break;
+		}
+	case OBJ_TYPE_DICTIONARY:
+		{
+			PdfDictionary * dictionary = (PdfDictionary*)this;
+			for (uint32_t i = 0; i < dictionary->count_; i++)
+			{
+				const PdfValue & value = dictionary->values_[i];
+				if (!value.IsInline() && value.object_ && value.object_->IsHeldOutside())
+				{
+					return true;
+				}
+			}
+			break;
+		}
+	case OBJ_TYPE_STREAM:
+		{
+			PdfStream * stream = (PdfStream*)this;
+			return stream->dictionary_ && stream->dictionary_->IsHeldOutside();
+		}
+	default:
+		break;
+	}
+	return false;
+}
+
+void PdfObject::Unshare()
+{
+	switch (type_)
+	{
+	case OBJ_TYPE_ARRAY:
+		{
+			PdfArray * array = (PdfArray*)this;
+			for (size_t i = 0; i < array->array_.size(); i++)
+			{
+				PdfValue & value = array->array_[i];
+				value.Unshare(this);
+				if (!value.IsInline() && value.object_)
+				{
+					value.object_->Unshare();
+				}
+			}
+			break;
+		}
+	case OBJ_TYPE_DICTIONARY:
+		{
+			PdfDictionary * dictionary = (PdfDictionary*)this;
+			for (uint32_t i = 0; i < dictionary->count_; i++)
+			{
+				PdfValue & value = dictionary->values_[i];
+				value.Unshare(this);
+				if (!value.IsInline() && value.object_)
+				{
+					value.object_->Unshare();
+				}
+			}
+			break;
+		}
+	case OBJ_TYPE_STREAM:
+		{
+			PdfStream * stream = (PdfStream*)this;
+			if (stream->b_shared_dictionary_)
+			{
+				stream->UnshareDictionary();
+			}
+			if (stream->dictionary_)
+			{
+				stream->dictionary_->Unshare();
+			}
+			break;
+		}
+	default:
+		break;
+	}
+}
+
 PdfNullPointer PdfObject::GetPdfNull() const
 {
 	PdfNullPointer pointer;
@@ -191,23 +558,11 @@ PdfStreamPointer PdfObject::GetPdfStream() const
 }
 
 PdfObjectPointer::PdfObjectPointer(const PdfObjectPointer & pointer)
-	: object_(nullptr)
+	: object_(pointer.object_)
 {
-	if (object_ != pointer.object_ && pointer.object_ != nullptr)
+	if (object_)
 	{
-		if (object_)
-		{
-			object_->referenceCount_.Decrease();
-			if (pointer->referenceCount_ == 0)
-			{
-				object_->Release();
-			}
-		}
-		object_ = pointer.object_;
-		if (object_)
-		{
-			object_->referenceCount_.Decrease();
-		}
+		object_->referenceCount_.Increase();
 	}
 }
 
@@ -215,15 +570,14 @@ PdfObjectPointer::~PdfObjectPointer()
 {
 	if (object_)
 	{
-		object_->referenceCount_.Decrease();
-		if (object_->referenceCount_ == 0)
+		if (object_->referenceCount_.Decrease() == 0)
 		{
 			object_->Release();
 		}
 	}
 }
 
-PdfObjectPointer PdfObjectPointer::operator=(const PdfObjectPointer & pointer)
+PdfObjectPointer & PdfObjectPointer::operator=(const PdfObjectPointer & pointer)
 {
 	if (object_)
 	{
@@ -231,8 +585,7 @@ PdfObjectPointer PdfObjectPointer::operator=(const PdfObjectPointer & pointer)
 		{
 			return *this;
 		}
-		object_->referenceCount_.Decrease();
-		if (object_->referenceCount_ == 0)
+		if (object_->referenceCount_.Decrease() == 0)
 		{
 			object_->Release();
 			object_ = nullptr;
@@ -246,14 +599,24 @@ PdfObjectPointer PdfObjectPointer::operator=(const PdfObjectPointer & pointer)
 	return *this;
 }
 
+PdfObjectPointer & PdfObjectPointer::operator=(PdfObjectPointer && pointer) noexcept
+{
+	if (this != &pointer)
+	{
+		Reset();
+		object_ = pointer.object_;
+		pointer.object_ = nullptr;
+	}
+	return *this;
+}
+
 void PdfObjectPointer::Reset(PdfObject * object/*= nullptr*/)
 {
 	if (object_ != object)
 	{
 		if (object_)
 		{
-			object_->referenceCount_.Decrease();
-			if (object_->referenceCount_ == 0)
+			if (object_->referenceCount_.Decrease() == 0)
 			{
 				object_->Release();
 			}
@@ -359,6 +722,19 @@ void PdfString::SetString(ByteString & str)
 	SetModified(true);
 }
 
+WideString PdfString::GetWideString()
+{
+	WideString str(GetAllocator());
+	PdfStringToWideString(string_, str);
+	return str;
+}
+
+void PdfString::SetWideString(const WideString & str)
+{
+	WideStringToPdfString(str, string_);
+	SetModified(true);
+}
+
 PdfStringPointer PdfString::Clone()
 {
 	PdfStringPointer pointer;
@@ -373,14 +749,50 @@ PdfNamePointer PdfName::Create(const ByteString & str, Allocator * allocator/*=
 	{
         allocator = Allocator::GetDefaultAllocator();
 	}
-	pointer.Reset(allocator->New<PdfName>(str, allocator));
+	uint32_t atom = PdfNameTable::GetAtom(str);
+	if (atom == NAME_ATOM_NONE)
+	{
+		return pointer;
+	}
+	pointer.Reset(allocator->New<PdfName>(atom, allocator));
+	PdfNameTable::Release(atom);
+	return pointer;
+}
+
+PdfNamePointer PdfName::Create(uint32_t atom, Allocator * allocator/*= nullptr*/)
+{
+	PdfNamePointer pointer;
+	if (allocator == nullptr)
+	{
+        allocator = Allocator::GetDefaultAllocator();
+	}
+	pointer.Reset(allocator->New<PdfName>(atom, allocator));
 	return pointer;
 }
 
+PdfName::~PdfName()
+{
+	PdfNameTable::Release(atom_);
+}
+
+bool PdfName::SetString(ByteString & name)
+{
+	uint32_t atom = PdfNameTable::GetAtom(name);
+	if (atom == NAME_ATOM_NONE)
+	{
+		return false;
+	}
+	//takes over the reference of GetAtom
+	PdfNameTable::Release(atom_);
+	atom_ = atom;
+	SetModified(true);
+	return true;
+}
+
 PdfNamePointer PdfName::Clone()
 {
 	PdfNamePointer pointer;
-	pointer.Reset( GetAllocator()->New<PdfName>(name_, GetAllocator()));
+	pointer.Reset( GetAllocator()->New<PdfName>(atom_, GetAllocator()));
 	return pointer;
 }
 
@@ -408,12 +820,7 @@ PdfObjectPointer PdfReference::GetPdfObject()
 	{
 		return PdfObjectPointer();
 	}
-    //todo
-	/*PDF_RefInfo refInfo;
-	refInfo.object_number = object_number_;
-	refInfo.generate_number = generate_number_;
-	return file_->GetObject(refInfo);*/
-    return PdfObjectPointer();
+	return file_->GetObject(object_number_, generate_number_);
 }
 
 PdfObjectPointer PdfReference::GetPdfObject(PDF_OBJ_TYPE type)
@@ -423,10 +830,7 @@ PdfObjectPointer PdfReference::GetPdfObject(PDF_OBJ_TYPE type)
 	{
 		return PdfObjectPointer();
 	}
-    /*PDF_RefInfo refInfo;
-    refInfo.object_number = object_number_;
-    refInfo.generate_number = generate_number_;
-	pointer = file_->GetObject(refInfo);*/
+	pointer = file_->GetObject(object_number_, generate_number_);
 	if (!pointer)
 	{
 		return pointer;
@@ -436,7 +840,8 @@ PdfObjectPointer PdfReference::GetPdfObject(PDF_OBJ_TYPE type)
 		return pointer;
 	}
 
-	while (true)
+	//references of a hostile file may go round in a circle
+	for (uint32_t hop = 0; hop < 64; ++hop)
 	{
 		if (pointer->GetType() == OBJ_TYPE_REFERENCE)
 		{
@@ -488,7 +893,369 @@ PdfObjectPointer PdfReference::GetPdfObject(PDF_OBJ_TYPE type)
 			return PdfObjectPointer();
 		}
 	}
-	return PdfObjectPointer();
+	return PdfObjectPointer();
+}
+
+PdfValue::PdfValue(const PdfObjectPointer & object)
+	: type_(OBJ_TYPE_INVALID), flags_(0), generate_number_(0), integer_(0), object_(object.operator->())
+{
+	if (object_)
+	{
+		type_ = (uint8_t)object_->GetType();
+		object_->referenceCount_.Increase();
+	}
+}
+
+PdfValue::PdfValue(PdfObjectPointer && object) noexcept
+	: type_(OBJ_TYPE_INVALID), flags_(0), generate_number_(0), integer_(0), object_(object.object_)
+{
+	//takes over the reference of object
+	object.object_ = nullptr;
+	if (object_)
+	{
+		type_ = (uint8_t)object_->GetType();
+	}
+}
+
+PdfValue::PdfValue(const PdfValue & value)
+	: type_(value.type_), flags_(value.flags_ & ~PDF_VALUE_SHARED), generate_number_(value.generate_number_),
+	integer_(value.integer_), object_(value.object_)
+{
+	if (!IsInline() && object_)
+	{
+		object_->referenceCount_.Increase();
+	}else if (type_ == OBJ_TYPE_NAME)
+	{
+		PdfNameTable::AddRef(atom_);
+	}
+}
+
+PdfValue::PdfValue(PdfValue && value) noexcept
+	: type_(value.type_), flags_(value.flags_), generate_number_(value.generate_number_),
+	integer_(value.integer_), object_(value.object_)
+{
+	value.type_ = OBJ_TYPE_INVALID;
+	value.flags_ = 0;
+	value.object_ = nullptr;
+}
+
+PdfValue::~PdfValue()
+{
+	Reset();
+}
+
+PdfValue & PdfValue::operator=(const PdfValue & value)
+{
+	if (this == &value)
+	{
+		return *this;
+	}
+	if (!value.IsInline() && value.object_)
+	{
+		value.object_->referenceCount_.Increase();
+	}else if (value.type_ == OBJ_TYPE_NAME)
+	{
+		PdfNameTable::AddRef(value.atom_);
+	}
+	Reset();
+	type_ = value.type_;
+	flags_ = value.flags_ & ~PDF_VALUE_SHARED;
+	generate_number_ = value.generate_number_;
+	integer_ = value.integer_;
+	object_ = value.object_;
+	return *this;
+}
+
+PdfValue & PdfValue::operator=(PdfValue && value) noexcept
+{
+	if (this != &value)
+	{
+		Reset();
+		type_ = value.type_;
+		flags_ = value.flags_;
+		generate_number_ = value.generate_number_;
+		integer_ = value.integer_;
+		object_ = value.object_;
+		value.type_ = OBJ_TYPE_INVALID;
+		value.flags_ = 0;
+		value.object_ = nullptr;
+	}
+	return *this;
+}
+
+void PdfValue::Reset()
+{
+	if (!IsInline() && object_)
+	{
+		if (object_->referenceCount_.Decrease() == 0)
+		{
+			object_->Release();
+		}
+	}else if (type_ == OBJ_TYPE_NAME)
+	{
+		PdfNameTable::Release(atom_);
+	}
+	type_ = OBJ_TYPE_INVALID;
+	flags_ = 0;
+	generate_number_ = 0;
+	integer_ = 0;
+	object_ = nullptr;
+}
+
+PdfValue PdfValue::Null()
+{
+	PdfValue value;
+	value.type_ = OBJ_TYPE_NULL;
+	value.flags_ = PDF_VALUE_INLINE;
+	return value;
+}
+
+PdfValue PdfValue::Boolean(bool b)
+{
+	PdfValue value;
+	value.type_ = OBJ_TYPE_BOOLEAN;
+	value.flags_ = PDF_VALUE_INLINE;
+	value.boolean_ = b;
+	return value;
+}
+
+PdfValue PdfValue::Integer(int32_t integer)
+{
+	PdfValue value;
+	value.type_ = OBJ_TYPE_NUMBER;
+	value.flags_ = PDF_VALUE_INLINE | PDF_VALUE_INTEGER;
+	value.integer_ = integer;
+	return value;
+}
+
+PdfValue PdfValue::Float(FLOAT f)
+{
+	PdfValue value;
+	value.type_ = OBJ_TYPE_NUMBER;
+	value.flags_ = PDF_VALUE_INLINE;
+	value.float_ = f;
+	return value;
+}
+
+PdfValue PdfValue::Name(uint32_t atom)
+{
+	PdfValue value;
+	if (atom != NAME_ATOM_NONE)
+	{
+		value.type_ = OBJ_TYPE_NAME;
+		value.flags_ = PDF_VALUE_INLINE;
+		value.atom_ = atom;
+		PdfNameTable::AddRef(atom);
+	}
+	return value;
+}
+
+PdfValue PdfValue::Reference(uint32_t object_number, uint32_t generate_number, PdfFile * file)
+{
+	if (generate_number > 0xFFFF)
+	{
+		//out of range for the inline form, keep it as an object
+		return PdfValue(PdfReference::Create(object_number, generate_number, file));
+	}
+	PdfValue value;
+	value.type_ = OBJ_TYPE_REFERENCE;
+	value.flags_ = PDF_VALUE_INLINE;
+	value.generate_number_ = (uint16_t)generate_number;
+	value.object_number_ = object_number;
+	value.file_ = file;
+	return value;
+}
+
+bool PdfValue::GetBoolean() const
+{
+	if (type_ != OBJ_TYPE_BOOLEAN)
+	{
+		return false;
+	}
+	return IsInline() ? boolean_ : static_cast<PdfBoolean*>(object_)->GetValue();
+}
+
+bool PdfValue::IsInteger() const
+{
+	if (type_ != OBJ_TYPE_NUMBER)
+	{
+		return false;
+	}
+	return IsInline() ? (flags_ & PDF_VALUE_INTEGER) != 0 : static_cast<PdfNumber*>(object_)->IsInteger();
+}
+
+int32_t PdfValue::GetInteger() const
+{
+	if (type_ != OBJ_TYPE_NUMBER)
+	{
+		return 0;
+	}
+	if (IsInline())
+	{
+		return (flags_ & PDF_VALUE_INTEGER) ? integer_ : (int32_t)float_;
+	}
+	return static_cast<PdfNumber*>(object_)->GetInteger();
+}
+
+FLOAT PdfValue::GetFloat() const
+{
+	if (type_ != OBJ_TYPE_NUMBER)
+	{
+		return 0;
+	}
+	if (IsInline())
+	{
+		return (flags_ & PDF_VALUE_INTEGER) ? (FLOAT)integer_ : float_;
+	}
+	return static_cast<PdfNumber*>(object_)->GetFloat();
+}
+
+uint32_t PdfValue::GetNameAtom() const
+{
+	if (type_ != OBJ_TYPE_NAME)
+	{
+		return NAME_ATOM_NONE;
+	}
+	return IsInline() ? atom_ : static_cast<PdfName*>(object_)->GetAtom();
+}
+
+uint32_t PdfValue::GetReferenceNumber() const
+{
+	if (type_ != OBJ_TYPE_REFERENCE)
+	{
+		return 0;
+	}
+	return IsInline() ? object_number_ : static_cast<PdfReference*>(object_)->GetReferenceNumber();
+}
+
+uint32_t PdfValue::GetGenerateNumber() const
+{
+	if (type_ != OBJ_TYPE_REFERENCE)
+	{
+		return 0;
+	}
+	return IsInline() ? generate_number_ : static_cast<PdfReference*>(object_)->GetGenerateNumber();
+}
+
+PdfFile * PdfValue::GetFile() const
+{
+	if (type_ != OBJ_TYPE_REFERENCE)
+	{
+		return nullptr;
+	}
+	return IsInline() ? file_ : static_cast<PdfReference*>(object_)->GetFile();
+}
+
+PdfObjectPointer PdfValue::GetObject(Allocator * allocator/*= nullptr*/) const
+{
+	PdfObjectPointer pointer;
+	if (!IsInline())
+	{
+		pointer.Reset(object_);
+		return pointer;
+	}
+	switch (type_)
+	{
+	case OBJ_TYPE_NULL:
+		pointer = PdfNull::Create(allocator);
+		break;
+	case OBJ_TYPE_BOOLEAN:
+		pointer = PdfBoolean::Create(boolean_, allocator);
+		break;
+	case OBJ_TYPE_NUMBER:
+		if (flags_ & PDF_VALUE_INTEGER)
+		{
+			pointer = PdfNumber::Create(integer_, allocator);
+		}else{
+			pointer = PdfNumber::Create(float_, allocator);
+		}
+		break;
+	case OBJ_TYPE_NAME:
+		pointer = PdfName::Create(atom_, allocator);
+		break;
+	case OBJ_TYPE_REFERENCE:
+		pointer = PdfReference::Create(object_number_, generate_number_, file_, allocator);
+		break;
+	default:
+		break;
+	}
+	return pointer;
+}
+
+PdfObjectPointer PdfValue::GetBoundObject(PdfObject * container, uint32_t slot) const
+{
+	PdfObjectPointer pointer = GetObject(container->GetAllocator());
+	if (IsInline() && pointer)
+	{
+		pointer->BindSlot(container, slot);
+	}
+	return pointer;
+}
+
+void PdfValue::AttachTo(PdfObject * parent) const
+{
+	if (!IsInline() && object_)
+	{
+		object_->AttachParent(parent);
+	}
+}
+
+void PdfValue::DetachFrom(PdfObject * parent) const
+{
+	if (!IsInline() && object_)
+	{
+		object_->DetachParent(parent);
+	}
+}
+
+bool PdfValue::CanShare() const
+{
+	if (IsInline() || object_ == nullptr || (flags_ & PDF_VALUE_SHARED))
+	{
+		return true;
+	}
+	return (size_t)object_->referenceCount_ <= 1;
+}
+
+void PdfValue::Share()
+{
+	if (!IsInline() && object_)
+	{
+		flags_ |= PDF_VALUE_SHARED;
+	}
+}
+
+void PdfValue::Unshare(PdfObject * parent)
+{
+	if ((flags_ & PDF_VALUE_SHARED) == 0)
+	{
+		return;
+	}
+	flags_ &= ~PDF_VALUE_SHARED;
+	//the other holders let go of it already
+	if (object_ == nullptr || (size_t)object_->referenceCount_ <= 1)
+	{
+		return;
+	}
+	PdfObjectPointer copy = object_->Clone();
+	if (!copy)
+	{
+		return;
+	}
+	copy->b_modified_ = object_->b_modified_;
+	DetachFrom(parent);
+	*this = PdfValue(std::move(copy));
+	AttachTo(parent);
+}
+
+bool PdfValue::IsModified() const
+{
+	//inline values are only changed through their container, which marks itself
+	if (IsInline() || object_ == nullptr)
+	{
+		return false;
+	}
+	return object_->b_modified_;
 }
 
 PdfArrayPointer PdfArray::Create(Allocator * allocator /*= nullptr*/)
@@ -502,28 +1269,25 @@ PdfArrayPointer PdfArray::Create(Allocator * allocator /*= nullptr*/)
 	return pointer;
 }
 
-PdfObjectPointer PdfArray::GetElement(uint32_t index) const
+PdfArray::~PdfArray()
 {
-	if (index < GetSize())
+	for (size_t i = 0; i < array_.size(); i++)
 	{
-		return array_[index];
+		array_[i].DetachFrom(this);
 	}
-	return PdfObjectPointer();
 }
 
-PdfObjectPointer PdfArray::GetElement(uint32_t index, PDF_OBJ_TYPE type) const
+//the element itself, or what a reference in its place points to, when it has the type asked for
+static PdfObjectPointer element_of_type(const PdfObjectPointer & pointer, PDF_OBJ_TYPE type)
 {
-	PdfObjectPointer pointer = GetElement(index);
 	if (!pointer)
 	{
 		return pointer;
 	}
-
 	if (pointer->GetType() == type || type == OBJ_TYPE_INVALID)
 	{
 		return pointer;
 	}
-
 	if (pointer->GetType() == OBJ_TYPE_REFERENCE)
 	{
 		return pointer->GetPdfReference()->GetPdfObject(type);
@@ -531,6 +1295,70 @@ PdfObjectPointer PdfArray::GetElement(uint32_t index, PDF_OBJ_TYPE type) const
 	return PdfObjectPointer();
 }
 
+PdfObjectPointer PdfArray::GetElement(uint32_t index) const
+{
+	if (index < GetSize())
+	{
+		return array_[index].GetObject(GetAllocator());
+	}
+	return PdfObjectPointer();
+}
+
+PdfObjectPointer PdfArray::GetElement(uint32_t index)
+{
+	if (index < GetSize())
+	{
+		//the caller may change the object, so it can't stay shared with a clone
+		array_[index].Unshare(this);
+		return array_[index].GetBoundObject(this, index);
+	}
+	return PdfObjectPointer();
+}
+
+PdfValue PdfArray::GetValue(uint32_t index) const
+{
+	if (index < GetSize())
+	{
+		return array_[index];
+	}
+	return PdfValue();
+}
+
+bool PdfArray::AppendValue(const PdfValue & value)
+{
+	if (!value.IsValid())
+	{
+		return false;
+	}
+	array_.push_back(value);
+	value.AttachTo(this);
+	SetModified(true);
+	return true;
+}
+
+bool PdfArray::ReplaceValue(uint32_t index, const PdfValue & value)
+{
+	if (index >= array_.size() || !value.IsValid())
+	{
+		return false;
+	}
+	array_[index].DetachFrom(this);
+	array_[index] = value;
+	value.AttachTo(this);
+	SetModified(true);
+	return true;
+}
+
+PdfObjectPointer PdfArray::GetElement(uint32_t index, PDF_OBJ_TYPE type) const
+{
+	return element_of_type(GetElement(index), type);
+}
+
+PdfObjectPointer PdfArray::GetElement(uint32_t index, PDF_OBJ_TYPE type)
+{
+	return element_of_type(GetElement(index), type);
+}
+
 PdfObjectPointer PdfArray::GetElementByType(PDF_OBJ_TYPE type)
 {
 	PdfObjectPointer pointer;
@@ -550,8 +1378,7 @@ bool PdfArray::Append(const PdfObjectPointer & pointer)
 {
 	if (pointer)
 	{
-		array_.push_back(pointer);
-		SetModified(true);
+		AppendValue(pointer);
 		return true;
 	}
 	return false;
@@ -560,88 +1387,77 @@ bool PdfArray::Append(const PdfObjectPointer & pointer)
 PdfNullPointer PdfArray::AppendNull()
 {
     PdfNullPointer pointer = PdfNull::Create(GetAllocator());
-    array_.push_back(pointer);
-    SetModified(true);
+    AppendValue(pointer);
     return pointer;
 }
 
 PdfBooleanPointer PdfArray::AppendBoolean(bool value/*= false*/)
 {
     PdfBooleanPointer pointer = PdfBoolean::Create(value, GetAllocator());
-    array_.push_back(pointer);
-    SetModified(true);
+    AppendValue(pointer);
     return pointer;
 }
 
 PdfNumberPointer PdfArray::AppendNumber()
 {
     PdfNumberPointer pointer = PdfNumber::Create(0, GetAllocator());
-    array_.push_back(pointer);
-    SetModified(true);
+    AppendValue(pointer);
     return pointer;
 }
 
 PdfNumberPointer PdfArray::AppendNumber(int32_t value)
 {
     PdfNumberPointer pointer = PdfNumber::Create(value, GetAllocator());
-    array_.push_back(pointer);
-    SetModified(true);
+    AppendValue(pointer);
     return pointer;
 }
 
 PdfNumberPointer PdfArray::AppendNumber(FLOAT value)
 {
     PdfNumberPointer pointer = PdfNumber::Create(value, GetAllocator());
-    array_.push_back(pointer);
-    SetModified(true);
+    AppendValue(pointer);
     return pointer;
 }
 
 PdfNamePointer PdfArray::AppendName()
 {
     PdfNamePointer pointer = PdfName::Create(ByteString(GetAllocator()), GetAllocator());
-    array_.push_back(pointer);
-    SetModified(true);
+    AppendValue(pointer);
     return pointer;
 }
 
 PdfNamePointer PdfArray::AppendName(ByteString & str)
 {
     PdfNamePointer pointer = PdfName::Create(str, GetAllocator());
-    array_.push_back(pointer);
-    SetModified(true);
+    AppendValue(pointer);
     return pointer;
 }
 
 PdfStringPointer PdfArray::AppendString()
 {
     PdfStringPointer pointer = PdfString::Create(ByteString(GetAllocator()), GetAllocator());
-    array_.push_back(pointer);
-    SetModified(true);
+    AppendValue(pointer);
     return pointer;
 }
 
 PdfStringPointer PdfArray::AppendString(ByteString & str)
 {
     PdfStringPointer pointer = PdfString::Create(str, GetAllocator());
-    array_.push_back(pointer);
-    SetModified(true);
+    AppendValue(pointer);
     return pointer;
 }
 
 PdfArrayPointer PdfArray::AppendArray()
 {
     PdfArrayPointer pointer = PdfArray::Create();
-    array_.push_back(pointer);
-    SetModified(true);
+    AppendValue(pointer);
     return pointer;
 }
 
 PdfDictionaryPointer PdfArray::AppendDictionary()
 {
     PdfDictionaryPointer pointer = PdfDictionary::Create(GetAllocator());
-    array_.push_back(pointer);
-    SetModified(true);
+    AppendValue(pointer);
     return pointer;
 }
 
@@ -651,8 +1467,7 @@ PdfReferencePointer PdfArray::AppendReference(PDF_RefInfo info, PdfFile * file)
     if (file)
     {
         pointer = PdfReference::Create(info.object_number, info.generate_number, file);
-        array_.push_back(pointer);
-        SetModified(true);
+        AppendValue(pointer);
     }
     return pointer;
 }
@@ -663,8 +1478,7 @@ PdfReferencePointer PdfArray::AppendReference(uint32_t object_number, uint32_t g
     if (file)
     {
         pointer = PdfReference::Create(object_number, generate_number, file);
-        array_.push_back(pointer);
-        SetModified(true);
+        AppendValue(pointer);
     }
     return pointer;
 }
@@ -673,8 +1487,7 @@ PdfReferencePointer PdfArray::AppendReference(PdfReferencePointer & pointer)
 {
     if (pointer)
     {
-        array_.push_back(pointer);
-        SetModified(true);
+        AppendValue(pointer);
     }
     return pointer;
 }
@@ -685,31 +1498,28 @@ PdfReferencePointer PdfArray::AppendReference(PdfFile * file)
     if (file)
     {
         pointer = PdfReference::Create(0, 0, file);
-        array_.push_back(pointer);
-        SetModified(true);
+        AppendValue(pointer);
     }
     return pointer;
 }
 
 bool PdfArray::Replace(uint32_t index, const PdfObjectPointer & pointer)
 {
-    if (index > array_.size() || !pointer)
+    if (index >= array_.size() || !pointer)
     {
         return false;
     }
-    array_[index] = pointer;
-    SetModified(true);
+    ReplaceValue(index, pointer);
     return true;
 }
 
 PdfNullPointer PdfArray::ReplaceNull(uint32_t index)
 {
     PdfNullPointer pointer;
-    if (index <= array_.size())
+    if (index < array_.size())
     {
         pointer = PdfNull::Create(GetAllocator());
-        array_[index] = pointer;
-        SetModified(true);
+        ReplaceValue(index, pointer);
     }
     return pointer;
 }
@@ -717,11 +1527,10 @@ PdfNullPointer PdfArray::ReplaceNull(uint32_t index)
 PdfBooleanPointer PdfArray::ReplaceBoolean(uint32_t index)
 {
     PdfBooleanPointer pointer;
-    if (index <= array_.size())
+    if (index < array_.size())
     {
         pointer = PdfBoolean::Create(false, GetAllocator());
-        array_[index] = pointer;
-        SetModified(true);
+        ReplaceValue(index, pointer);
     }
     return pointer;
 }
@@ -729,11 +1538,10 @@ PdfBooleanPointer PdfArray::ReplaceBoolean(uint32_t index)
 PdfNumberPointer PdfArray::ReplaceNumber(uint32_t index)
 {
     PdfNumberPointer pointer;
-    if (index <= array_.size())
+    if (index < array_.size())
     {
         pointer = PdfNumber::Create(0, GetAllocator());
-        array_[index] = pointer;
-        SetModified(true);
+        ReplaceValue(index, pointer);
     }
     return pointer;
 }
@@ -741,11 +1549,10 @@ PdfNumberPointer PdfArray::ReplaceNumber(uint32_t index)
 PdfNamePointer PdfArray::ReplaceName(uint32_t index)
 {
     PdfNamePointer pointer;
-    if (index <= array_.size())
+    if (index < array_.size())
     {
         pointer = PdfName::Create(ByteString(GetAllocator()), GetAllocator());
-        array_[index] = pointer;
-        SetModified(true);
+        ReplaceValue(index, pointer);
     }
     return pointer;
 }
@@ -753,11 +1560,10 @@ PdfNamePointer PdfArray::ReplaceName(uint32_t index)
 PdfStringPointer PdfArray::ReplaceString(uint32_t index)
 {
     PdfStringPointer pointer;
-    if (index <= array_.size())
+    if (index < array_.size())
     {
         pointer = PdfString::Create(ByteString(GetAllocator()), GetAllocator());
-        array_[index] = pointer;
-        SetModified(true);
+        ReplaceValue(index, pointer);
     }
     return pointer;
 }
@@ -765,11 +1571,10 @@ PdfStringPointer PdfArray::ReplaceString(uint32_t index)
 PdfArrayPointer PdfArray::ReplaceArray(uint32_t index)
 {
     PdfArrayPointer pointer;
-    if (index <= array_.size())
+    if (index < array_.size())
     {
         pointer = PdfArray::Create(GetAllocator());
-        array_[index] = pointer;
-        SetModified(true);
+        ReplaceValue(index, pointer);
     }
     return pointer;
 }
@@ -778,11 +1583,10 @@ PdfArrayPointer PdfArray::ReplaceArray(uint32_t index)
 PdfDictionaryPointer PdfArray::ReplaceDictionary(uint32_t index)
 {
     PdfDictionaryPointer pointer;
-    if (index <= array_.size())
+    if (index < array_.size())
     {
         pointer = PdfDictionary::Create(GetAllocator());
-        array_[index] = pointer;
-        SetModified(true);
+        ReplaceValue(index, pointer);
     }
     return pointer;
 }
@@ -791,17 +1595,20 @@ PdfDictionaryPointer PdfArray::ReplaceDictionary(uint32_t index)
 PdfReferencePointer PdfArray::ReplaceReference(uint32_t index, PdfFile * file)
 {
     PdfReferencePointer pointer;
-    if (index <= array_.size() && file)
+    if (index < array_.size() && file)
     {
         pointer = PdfReference::Create(0, 0, file, GetAllocator());
-        array_[index] = pointer;
-        SetModified(true);
+        ReplaceValue(index, pointer);
     }
     return pointer;
 }
 
 void PdfArray::Clear()
 {
+	for (size_t i = 0; i < array_.size(); i++)
+	{
+		array_[i].DetachFrom(this);
+	}
     array_.clear();
     SetModified(true);
 }
@@ -812,68 +1619,52 @@ PdfArrayPointer PdfArray::Clone()
 	pointer.Reset(GetAllocator()->New<PdfArray>(GetAllocator()));
 	if (pointer)
 	{
+		pointer->array_.reserve(array_.size());
 		for (uint32_t index = 0; index < GetSize(); ++index)
 		{
-			PdfObjectPointer tmp_pointer = GetElement(index);
-			if (tmp_pointer)
+			if (!array_[index].CanShare())
+			{
+				//held outside the array too, a pointer taken earlier keeps writing to this side only
+				pointer->AppendValue(array_[index].object_->Clone());
+				continue;
+			}
+			//both sides hold the object until one of them takes it out with GetElement
+			array_[index].Share();
+			if (pointer->AppendValue(array_[index]))
 			{
-				tmp_pointer = tmp_pointer->Clone();
-                pointer->Append(tmp_pointer);
+				pointer->array_.back().Share();
 			}
 		}
 	}
 	return pointer;
 }
 
-bool PdfArray::IsModified()
+FLOAT PdfArray::GetFloat(uint32_t index) const
 {
-	if (b_modified_)
+	const PdfValue & value = array_[index];
+	if (value.GetType() == OBJ_TYPE_NUMBER)
 	{
-		return true;
+		return value.GetFloat();
 	}
-    uint32_t count = (uint32_t)array_.size();
-	for (uint32_t index = 0; index < count; ++index)
+	if (value.GetType() == OBJ_TYPE_REFERENCE)
 	{
-		if (array_[index]->IsModified())
+		PdfObjectPointer object = GetElement(index, OBJ_TYPE_NUMBER);
+		if (object)
 		{
-			b_modified_ = true;
-			return true;
+			return object->GetPdfNumber()->GetFloat();
 		}
 	}
-	return false;
+	return 0;
 }
 
 bool PdfArray::GetRect(PdfRect & rect) const
 {
 	if (GetSize() >= 4)
 	{
-        PdfObjectPointer object;
-        PdfNumberPointer number;
-		FLOAT llx = 0, lly = 0, rux = 0, ruy = 0;
-		object = GetElement(0, OBJ_TYPE_NUMBER);
-		if (object)
-		{
-			number = object->GetPdfNumber();
-			llx = number->GetFloat();
-		}
-		object = GetElement(1, OBJ_TYPE_NUMBER);
-		if (object)
-		{
-			number = object->GetPdfNumber();
-			lly = number->GetFloat();
-		}
-		object = GetElement(2, OBJ_TYPE_NUMBER);
-		if (object)
-		{
-			number = object->GetPdfNumber();
-			rux = number->GetFloat();
-		}
-		object = GetElement(3, OBJ_TYPE_NUMBER);
-		if (object)
-		{
-            number = object->GetPdfNumber();
-			ruy = number->GetFloat();
-		}
+		FLOAT llx = GetFloat(0);
+		FLOAT lly = GetFloat(1);
+		FLOAT rux = GetFloat(2);
+		FLOAT ruy = GetFloat(3);
 		rect.left = llx;
 		rect.bottom = lly;
 		rect.width = rux - llx;
@@ -887,56 +1678,34 @@ bool PdfArray::GetMatrix(PdfMatrix & matrix) const
 {
 	if (GetSize() >= 6)
 	{
-		FLOAT a = 0, b = 0, c = 0, d = 0, e = 0, f = 0;
-		PdfObjectPointer object;
-		PdfNumberPointer number;
-		object = GetElement(0, OBJ_TYPE_NUMBER);
-		if (object)
-		{
-			number = object->GetPdfNumber();
-			a = number->GetFloat();
-		}
-		object = GetElement(1, OBJ_TYPE_NUMBER);
-		if (object)
-		{
-			number = object->GetPdfNumber();
-			b = number->GetFloat();
-		}
-		object = GetElement(2, OBJ_TYPE_NUMBER);
-		if (object)
-		{
-			number = object->GetPdfNumber();
-			c = number->GetFloat();
-		}
-		object = GetElement(3, OBJ_TYPE_NUMBER);
-		if (object)
-		{
-			number = object->GetPdfNumber();
-			d = number->GetFloat();
-		}
-		object = GetElement(4, OBJ_TYPE_NUMBER);
-		if (object)
-		{
-			number = object->GetPdfNumber();
-			e = number->GetFloat();
-		}
-		object = GetElement(5, OBJ_TYPE_NUMBER);
-		if (object)
-		{
-			number = object->GetPdfNumber();
-			f = number->GetFloat();
-		}
-		matrix.a = a;
-		matrix.b = b;
-		matrix.c = c;
-		matrix.d = d;
-		matrix.e = e;
-		matrix.f = f;
+		matrix.a = GetFloat(0);
+		matrix.b = GetFloat(1);
+		matrix.c = GetFloat(2);
+		matrix.d = GetFloat(3);
+		matrix.e = GetFloat(4);
+		matrix.f = GetFloat(5);
 		return true;
 	}
 	return false;
 }
 
+PdfDictionary::PdfDictionary(Allocator * allocator/*= nullptr*/)
+	: PdfObject(OBJ_TYPE_DICTIONARY, allocator), count_(0), capacity_(PDF_DICTIONARY_INLINE_SIZE),
+	keys_(inline_keys_), values_(inline_values_), index_(nullptr), index_size_(0), iterator_(0)
+{
+	memset(inline_keys_, 0, sizeof(inline_keys_));
+}
+
+PdfDictionary::~PdfDictionary()
+{
+	for (uint32_t i = 0; i < count_; i++)
+	{
+		values_[i].DetachFrom(this);
+		PdfNameTable::Release(keys_[i]);
+	}
+	ReleaseEntries();
+}
+
 PdfDictionaryPointer PdfDictionary::Create(Allocator * allocator/*= nullptr*/)
 {
 	PdfDictionaryPointer pointer;
@@ -950,173 +1719,273 @@ PdfDictionaryPointer PdfDictionary::Create(Allocator * allocator/*= nullptr*/)
 
 PdfObjectPointer PdfDictionary::GetElement(const ByteString & key)const
 {
-    std::unordered_map<string,PdfObjectPointer>::const_iterator it = map_.find(std::string(key.GetData()));
-	if (it != map_.end())
+	//a name that was never interned can't be a key
+	return GetElement(PdfNameTable::FindAtom(key));
+}
+
+PdfObjectPointer PdfDictionary::GetElement(const ByteString & key)
+{
+	return GetElement(PdfNameTable::FindAtom(key));
+}
+
+PdfObjectPointer PdfDictionary::GetElement(const char * key)const
+{
+	if (key == nullptr)
 	{
-		return it->second;
+		return PdfObjectPointer();
 	}
-	return PdfObjectPointer();
+	return GetElement(PdfNameTable::FindAtom(key, (uint32_t)strlen(key)));
 }
 
-PdfObjectPointer PdfDictionary::GetElement(const ByteString & key, PDF_OBJ_TYPE type)
+PdfObjectPointer PdfDictionary::GetElement(const char * key)
 {
-	PdfObjectPointer pointer = GetElement( key );
-	if (!pointer)
+	if (key == nullptr)
 	{
-		return pointer;
+		return PdfObjectPointer();
 	}
-	PDF_OBJ_TYPE current_type = pointer->GetType();
-	if (current_type == type || type == OBJ_TYPE_INVALID)
+	return GetElement(PdfNameTable::FindAtom(key, (uint32_t)strlen(key)));
+}
+
+PdfObjectPointer PdfDictionary::GetElement(const char * key, PDF_OBJ_TYPE type) const
+{
+	if (key == nullptr)
 	{
-		return pointer;
+		return PdfObjectPointer();
 	}
-	if (pointer->GetType() == OBJ_TYPE_REFERENCE)
+	return GetElement(PdfNameTable::FindAtom(key, (uint32_t)strlen(key)), type);
+}
+
+PdfObjectPointer PdfDictionary::GetElement(const char * key, PDF_OBJ_TYPE type)
+{
+	if (key == nullptr)
 	{
-		pointer = pointer->GetPdfReference()->GetPdfObject(type);
-		return pointer;
+		return PdfObjectPointer();
+	}
+	return GetElement(PdfNameTable::FindAtom(key, (uint32_t)strlen(key)), type);
+}
+
+PdfObjectPointer PdfDictionary::GetElement(uint32_t atom)const
+{
+	int32_t index = Find(atom);
+	if (index >= 0)
+	{
+		return values_[index].GetObject(GetAllocator());
+	}
+	return PdfObjectPointer();
+}
+
+PdfObjectPointer PdfDictionary::GetElement(uint32_t atom)
+{
+	int32_t index = Find(atom);
+	if (index >= 0)
+	{
+		//the caller may change the object, so it can't stay shared with a clone
+		values_[index].Unshare(this);
+		return values_[index].GetBoundObject(this, atom);
 	}
 	return PdfObjectPointer();
 }
 
+PdfValue PdfDictionary::GetValue(const ByteString & key) const
+{
+	return GetValue(PdfNameTable::FindAtom(key));
+}
+
+PdfValue PdfDictionary::GetValue(const char * key) const
+{
+	if (key == nullptr)
+	{
+		return PdfValue();
+	}
+	return GetValue(PdfNameTable::FindAtom(key, (uint32_t)strlen(key)));
+}
+
+PdfValue PdfDictionary::GetValue(uint32_t atom) const
+{
+	int32_t index = Find(atom);
+	if (index >= 0)
+	{
+		return values_[index];
+	}
+	return PdfValue();
+}
+
+PdfObjectPointer PdfDictionary::GetElement(const ByteString & key, PDF_OBJ_TYPE type) const
+{
+	return GetElement(PdfNameTable::FindAtom(key), type);
+}
+
+PdfObjectPointer PdfDictionary::GetElement(const ByteString & key, PDF_OBJ_TYPE type)
+{
+	return GetElement(PdfNameTable::FindAtom(key), type);
+}
+
+PdfObjectPointer PdfDictionary::GetElement(uint32_t atom, PDF_OBJ_TYPE type) const
+{
+	return element_of_type(GetElement(atom), type);
+}
+
+PdfObjectPointer PdfDictionary::GetElement(uint32_t atom, PDF_OBJ_TYPE type)
+{
+	return element_of_type(GetElement(atom), type);
+}
+
 bool PdfDictionary::SetObject(const ByteString & key, const PdfObjectPointer & pointer)
 {
-	if (key.GetLength() > 0 && pointer)
+	if (!pointer)
+	{
+		return false;
+	}
+	return SetValue(key, PdfValue(pointer));
+}
+
+bool PdfDictionary::SetObject(uint32_t atom, const PdfObjectPointer & pointer)
+{
+	if (!pointer)
+	{
+		return false;
+	}
+	return SetValue(atom, PdfValue(pointer));
+}
+
+bool PdfDictionary::SetValue(const ByteString & key, const PdfValue & value)
+{
+	uint32_t atom = PdfNameTable::GetAtom(key);
+	bool bRet = SetValue(atom, value);
+	PdfNameTable::Release(atom);
+	return bRet;
+}
+
+bool PdfDictionary::SetValue(uint32_t atom, const PdfValue & value)
+{
+	if (atom == NAME_ATOM_NONE || !value.IsValid())
+	{
+		return false;
+	}
+	int32_t index = Find(atom);
+	if (index >= 0)
 	{
-		map_[string(key.GetData())] = pointer;
+		values_[index].DetachFrom(this);
+		values_[index] = value;
+		value.AttachTo(this);
 		SetModified(true);
-        return true;
+		return true;
 	}
-    return false;
+	if (count_ == capacity_ && !Grow())
+	{
+		return false;
+	}
+	keys_[count_] = atom;
+	PdfNameTable::AddRef(atom);
+	values_[count_] = value;
+	value.AttachTo(this);
+	count_++;
+	if (index_ || count_ > PDF_DICTIONARY_INDEX_THRESHOLD)
+	{
+		BuildIndex();
+	}
+	SetModified(true);
+	return true;
 }
 
 PdfNullPointer PdfDictionary::SetNull(const ByteString & key)
 {
-    PdfNullPointer pointer;
-	if (key.GetLength() > 0)
+	PdfNullPointer pointer = PdfNull::Create(GetAllocator());
+	if (!SetObject(key, pointer))
 	{
- 		pointer = PdfNull::Create(GetAllocator());
-		map_[string(key.GetData())] = pointer;
-		SetModified(true);
+		pointer.Reset();
 	}
-    return pointer;
+	return pointer;
 }
 
 PdfBooleanPointer PdfDictionary::SetBoolean(const ByteString & key, bool value)
 {
-    PdfBooleanPointer pointer;
-	if (key.GetLength() > 0)
+	PdfBooleanPointer pointer = PdfBoolean::Create(value, GetAllocator());
+	if (!SetObject(key, pointer))
 	{
- 		pointer = PdfBoolean::Create(value, GetAllocator());
-		map_[string(key.GetData())] = pointer;
-		SetModified(true);
+		pointer.Reset();
 	}
-    return pointer;
+	return pointer;
 }
 
 PdfNumberPointer PdfDictionary::SetInteger(const ByteString & key, int32_t value)
 {
-    PdfNumberPointer pointer;
-	if (key.GetLength() > 0)
+	PdfNumberPointer pointer = PdfNumber::Create(value, GetAllocator());
+	if (!SetObject(key, pointer))
 	{
-		pointer = PdfNumber::Create(value, GetAllocator());
-		map_[string(key.GetData())] = pointer;
-		SetModified(true);
+		pointer.Reset();
 	}
-    return pointer;
+	return pointer;
 }
 
 PdfNumberPointer PdfDictionary::SetFloatNumber(const ByteString & key, FLOAT value)
 {
-    PdfNumberPointer pointer;
-	if (key.GetLength() > 0)
+	PdfNumberPointer pointer = PdfNumber::Create(value, GetAllocator());
+	if (!SetObject(key, pointer))
 	{
-		pointer = PdfNumber::Create(value, GetAllocator());
-		map_[string(key.GetData())] = pointer;
-		SetModified(true);
+		pointer.Reset();
 	}
-    return pointer;
+	return pointer;
 }
 
 PdfStringPointer PdfDictionary::SetString(const ByteString & key, const ByteString & str )
 {
-    PdfStringPointer pointer;
-	if ( key.GetLength() > 0 )
+	PdfStringPointer pointer = PdfString::Create( str, GetAllocator() );
+	if (!SetObject(key, pointer))
 	{
- 		pointer = PdfString::Create( str, GetAllocator() );
-		map_[string(key.GetData())] = pointer;
-		SetModified(true);
+		pointer.Reset();
 	}
-    return pointer;
+	return pointer;
 }
 
 PdfNamePointer	PdfDictionary::SetName(const ByteString & key, const ByteString & name)
 {
-    PdfNamePointer pointer;
-	if (key.GetLength() > 0)
+	PdfNamePointer pointer = PdfName::Create(name, GetAllocator());
+	if (!SetObject(key, pointer))
 	{
-		pointer = PdfName::Create(name, GetAllocator());
-		map_[string(key.GetData())] = pointer;
-		SetModified(true);
+		pointer.Reset();
 	}
-    return pointer;
+	return pointer;
 }
 
 bool PdfDictionary::SetArray(const ByteString & key, const PdfArrayPointer & pointer)
 {
-	if (key.GetLength() > 0 && pointer)
-	{
-		map_[string(key.GetData())] = pointer;
-		SetModified(true);
-        return true;
-	}
-    return false;
+	return SetObject(key, pointer);
 }
 
 PdfArrayPointer PdfDictionary::SetArray(const ByteString & key)
 {
-    PdfArrayPointer pointer;
-    if (key.GetLength() > 0)
-    {
-        pointer = PdfArray::Create(GetAllocator());
-        map_[string(key.GetData())] = pointer;
-        SetModified(true);
-    }
-    return pointer;
+	PdfArrayPointer pointer = PdfArray::Create(GetAllocator());
+	if (!SetObject(key, pointer))
+	{
+		pointer.Reset();
+	}
+	return pointer;
 }
 
 bool PdfDictionary::SetDictionary(const ByteString & key, const PdfDictionaryPointer & pointer)
 {
-	if (key.GetLength() > 0 && pointer)
-	{
-		map_[string(key.GetData())] = pointer;
-		SetModified(true);
-        return true;
-	}
-    return false;
+	return SetObject(key, pointer);
 }
 
 PdfDictionaryPointer PdfDictionary::SetDictionary(const ByteString & key)
 {
-    PdfDictionaryPointer pointer;
-    if (key.GetLength() > 0)
-    {
-        pointer = PdfDictionary::Create(GetAllocator());
-        map_[string(key.GetData())] = pointer;
-        SetModified(true);
-    }
-    return pointer;
+	PdfDictionaryPointer pointer = PdfDictionary::Create(GetAllocator());
+	if (!SetObject(key, pointer))
+	{
+		pointer.Reset();
+	}
+	return pointer;
 }
 
 PdfReferencePointer PdfDictionary::SetReference(const ByteString & key, uint32_t object_number, uint32_t generate_number, PdfFile * file)
 {
-    PdfReferencePointer pointer;
-	if (key.GetLength() > 0)
+	PdfReferencePointer pointer = PdfReference::Create(object_number, generate_number, file, GetAllocator());
+	if (!SetObject(key, pointer))
 	{
-        pointer = PdfReference::Create(object_number, generate_number, file, GetAllocator());
-		map_[string(key.GetData())] = pointer;
-		SetModified(true);
+		pointer.Reset();
 	}
-    return pointer;
+	return pointer;
 }
 
 PdfDictionaryPointer PdfDictionary::Clone()
@@ -1125,10 +1994,20 @@ PdfDictionaryPointer PdfDictionary::Clone()
 	pointer.Reset(GetAllocator()->New<PdfDictionary>(GetAllocator()));
 	if (pointer)
 	{
-		unordered_map<string,PdfObjectPointer>::iterator it;
-		for (it = map_.begin(); it != map_.end(); ++it)
+		for (uint32_t i = 0; i < count_; i++)
 		{
-			pointer->SetObject(it->first.c_str(), it->second);
+			if (!values_[i].CanShare())
+			{
+				//held outside the dictionary too, a pointer taken earlier keeps writing to this side only
+				pointer->SetValue(keys_[i], values_[i].object_->Clone());
+				continue;
+			}
+			//both sides hold the object until one of them takes it out with GetElement
+			values_[i].Share();
+			if (pointer->SetValue(keys_[i], values_[i]))
+			{
+				pointer->values_[pointer->count_ - 1].Share();
+			}
 		}
 	}
 	return pointer;
@@ -1136,36 +2015,42 @@ PdfDictionaryPointer PdfDictionary::Clone()
 
 void PdfDictionary::Clear()
 {
-    map_.clear();
-    iterator_ = map_.end();
+	for (uint32_t i = 0; i < count_; i++)
+	{
+		values_[i].DetachFrom(this);
+		PdfNameTable::Release(keys_[i]);
+	}
+	ReleaseEntries();
+	memset(inline_keys_, 0, sizeof(inline_keys_));
+	keys_ = inline_keys_;
+	values_ = inline_values_;
+	capacity_ = PDF_DICTIONARY_INLINE_SIZE;
+	iterator_ = 0;
     SetModified(true);
 }
 
-bool PdfDictionary::IsModified()
+bool PdfDictionary::CheckName(const ByteString & key, const ByteString & name, bool b_required/*= true*/)
+{
+	return CheckName(PdfNameTable::FindAtom(key), PdfNameTable::FindAtom(name), b_required);
+}
+
+bool PdfDictionary::CheckName(const char * key, const char * name, bool b_required/*= true*/)
 {
-	if (b_modified_)
-	{
-		return true;
-	}
-	unordered_map<string,PdfObjectPointer>::iterator it;
-	for (it = map_.begin(); it != map_.end(); ++it)
+	if (key == nullptr || name == nullptr)
 	{
-		if (it->second->IsModified())
-		{
-			b_modified_ = true;
-			return true;
-		}
+		return false;
 	}
-	return false;
+	return CheckName(PdfNameTable::FindAtom(key, (uint32_t)strlen(key)),
+	                 PdfNameTable::FindAtom(name, (uint32_t)strlen(name)), b_required);
 }
 
-bool PdfDictionary::CheckName(const ByteString & key, const ByteString & name, bool b_required/*= true*/)
+bool PdfDictionary::CheckName(uint32_t keyAtom, uint32_t nameAtom, bool b_required/*= true*/)
 {
-	PdfObjectPointer object = GetElement(key, OBJ_TYPE_NAME);
+	PdfObjectPointer object = GetElement(keyAtom, OBJ_TYPE_NAME);
 	if (object)
 	{
 		PdfNamePointer nameObject = object->GetPdfName();
-		if (nameObject->GetString() == name)
+		if (nameObject->GetAtom() == nameAtom)
 		{
 			return true;
 		}
@@ -1179,36 +2064,240 @@ bool PdfDictionary::CheckName(const ByteString & key, const ByteString & name, b
 
 void PdfDictionary::MoveToFirst()
 {
-    iterator_ = map_.begin();
+    iterator_ = 0;
 }
 
 bool PdfDictionary::GetKeyAndElement(ByteString & key, PdfObjectPointer & object)
 {
-    if (iterator_ != map_.end())
+    if (iterator_ < count_)
     {
-        key = iterator_->first.data();
-        object = iterator_->second;
+        key = PdfNameTable::GetName(keys_[iterator_]);
+        values_[iterator_].Unshare(this);
+        object = values_[iterator_].GetBoundObject(this, keys_[iterator_]);
 		++iterator_;
         return true;
     }
     return false;
 }
 
-bool PdfDictionary::Remove(const ByteString & key)
+bool PdfDictionary::GetKeyAndValue(uint32_t & atom, PdfValue & value)
+{
+    if (iterator_ < count_)
+    {
+        atom = keys_[iterator_];
+        value = values_[iterator_];
+		++iterator_;
+        return true;
+    }
+	return false;
+}
+
+bool PdfDictionary::GetKeyAndElement(uint32_t & atom, PdfObjectPointer & object)
 {
-    unordered_map<string,PdfObjectPointer>::iterator it = map_.find(key.GetData());
-    if (it != map_.end() )
+    if (iterator_ < count_)
     {
-        if (iterator_ == it)
-        {
-            ++iterator_;
-        }
-        map_.erase(it);
+        atom = keys_[iterator_];
+        values_[iterator_].Unshare(this);
+        object = values_[iterator_].GetBoundObject(this, keys_[iterator_]);
+		++iterator_;
         return true;
     }
     return false;
 }
 
+bool PdfDictionary::Remove(const ByteString & key)
+{
+	return Remove(PdfNameTable::FindAtom(key));
+}
+
+bool PdfDictionary::Remove(const char * key)
+{
+	if (key == nullptr)
+	{
+		return false;
+	}
+	return Remove(PdfNameTable::FindAtom(key, (uint32_t)strlen(key)));
+}
+
+bool PdfDictionary::Remove(uint32_t atom)
+{
+	int32_t index = Find(atom);
+	if (index < 0)
+	{
+		return false;
+	}
+	values_[index].DetachFrom(this);
+	PdfNameTable::Release(keys_[index]);
+	//shifted down to keep the insertion order
+	for (uint32_t i = (uint32_t)index; i + 1 < count_; i++)
+	{
+		keys_[i] = keys_[i + 1];
+		values_[i] = std::move(values_[i + 1]);
+	}
+	count_--;
+	keys_[count_] = NAME_ATOM_NONE;
+	values_[count_].Reset();
+	if ((uint32_t)index < iterator_)
+	{
+		iterator_--;
+	}
+	if (index_)
+	{
+		//positions moved, the index is rebuilt from scratch
+		GetAllocator()->DeleteArray<uint32_t>(index_);
+		index_ = nullptr;
+		index_size_ = 0;
+		if (count_ > PDF_DICTIONARY_INDEX_THRESHOLD)
+		{
+			BuildIndex();
+		}
+	}
+	SetModified(true);
+	return true;
+}
+
+int32_t PdfDictionary::Find(uint32_t atom) const
+{
+	if (atom == NAME_ATOM_NONE)
+	{
+		return -1;
+	}
+	if (index_)
+	{
+		uint32_t mask = index_size_ - 1;
+		uint32_t hash = atom * 2654435761u;
+		uint32_t slot = (hash ^ (hash >> 16)) & mask;
+		while (index_[slot] != 0)
+		{
+			if (keys_[index_[slot] - 1] == atom)
+			{
+				return (int32_t)(index_[slot] - 1);
+			}
+			slot = (slot + 1) & mask;
+		}
+		return -1;
+	}
+#ifdef _CHE_SSE2_
+	//capacity is a multiple of four and unused keys are zero
+	__m128i needle = _mm_set1_epi32((int)atom);
+	for (uint32_t i = 0; i < count_; i += 4)
+	{
+		__m128i keys = _mm_loadu_si128((const __m128i *)(keys_ + i));
+		int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(keys, needle)));
+		if (mask)
+		{
+			return (int32_t)(i + ((mask & 1) ? 0 : (mask & 2) ? 1 : (mask & 4) ? 2 : 3));
+		}
+	}
+#else
+	for (uint32_t i = 0; i < count_; i++)
+	{
+		if (keys_[i] == atom)
+		{
+			return (int32_t)i;
+		}
+	}
+#endif
+	return -1;
+}
+
+bool PdfDictionary::Grow()
+{
+	uint32_t capacity = capacity_ * 2;
+	uint32_t * keys = GetAllocator()->NewArray<uint32_t>(capacity);
+	PdfValue * values = GetAllocator()->NewArray<PdfValue>(capacity);
+	if (keys == nullptr || values == nullptr)
+	{
+		if (keys)
+		{
+			GetAllocator()->DeleteArray<uint32_t>(keys);
+		}
+		if (values)
+		{
+			GetAllocator()->DeleteArray<PdfValue>(values);
+		}
+		return false;
+	}
+	memset(keys, 0, sizeof(uint32_t) * capacity);
+	memcpy(keys, keys_, sizeof(uint32_t) * count_);
+	for (uint32_t i = 0; i < count_; i++)
+	{
+		values[i] = std::move(values_[i]);
+	}
+	//the index refers to entry positions, which don't change
+	uint32_t count = count_;
+	uint32_t * index = index_;
+	index_ = nullptr;
+	ReleaseEntries();
+	count_ = count;
+	index_ = index;
+	keys_ = keys;
+	values_ = values;
+	capacity_ = capacity;
+	return true;
+}
+
+void PdfDictionary::BuildIndex()
+{
+	//twice the entry count keeps the probes short
+	uint32_t size = 64;
+	while (size < count_ * 2)
+	{
+		size *= 2;
+	}
+	if (index_ && index_size_ == size && count_ > 0)
+	{
+		//only the entry just appended is missing
+		uint32_t hash = keys_[count_ - 1] * 2654435761u;
+		uint32_t slot = (hash ^ (hash >> 16)) & (size - 1);
+		while (index_[slot] != 0)
+		{
+			slot = (slot + 1) & (size - 1);
+		}
+		index_[slot] = count_;
+		return;
+	}
+	if (index_)
+	{
+		GetAllocator()->DeleteArray<uint32_t>(index_);
+	}
+	index_ = GetAllocator()->NewArray<uint32_t>(size);
+	index_size_ = size;
+	memset(index_, 0, sizeof(uint32_t) * size);
+	for (uint32_t i = 0; i < count_; i++)
+	{
+		uint32_t hash = keys_[i] * 2654435761u;
+		uint32_t slot = (hash ^ (hash >> 16)) & (size - 1);
+		while (index_[slot] != 0)
+		{
+			slot = (slot + 1) & (size - 1);
+		}
+		index_[slot] = i + 1;
+	}
+}
+
+void PdfDictionary::ReleaseEntries()
+{
+	if (keys_ != inline_keys_)
+	{
+		GetAllocator()->DeleteArray<uint32_t>(keys_);
+		GetAllocator()->DeleteArray<PdfValue>(values_);
+	}else{
+		for (uint32_t i = 0; i < count_; i++)
+		{
+			inline_values_[i].Reset();
+		}
+	}
+	if (index_)
+	{
+		GetAllocator()->DeleteArray<uint32_t>(index_);
+		index_ = nullptr;
+		index_size_ = 0;
+	}
+	count_ = 0;
+}
+
+
 PdfStreamPointer PdfStream::Create(uint32_t object_number, uint32_t generate_number, PdfCrypto * crypto/*= nullptr*/, Allocator * allocator/*= nullptr*/)
 {
 	PdfStreamPointer pointer;
@@ -1246,7 +2335,7 @@ PdfStreamPointer PdfStream::Create(IRead* iread, size_t offset, size_t size, con
 
 PdfStream::PdfStream(uint8_t * data, size_t size, const PdfDictionaryPointer & dictionary,
                      uint32_t object_number, uint32_t generate_number, PdfCrypto * crypto, Allocator * allocator)
-    : PdfObject(OBJ_TYPE_STREAM, allocator), crypto_(crypto), b_memory_stream(true),
+    : PdfObject(OBJ_TYPE_STREAM, allocator), crypto_(crypto), b_shared_dictionary_(false), b_memory_stream(true),
     data_(nullptr), size_(size), file_offset_(0), object_number_(object_number), generate_number_(generate_number)
 {
 	if (data != nullptr && size != 0)
@@ -1260,12 +2349,13 @@ PdfStream::PdfStream(uint8_t * data, size_t size, const PdfDictionaryPointer & d
 	}else{
 		dictionary_ = PdfDictionary::Create(GetAllocator());
 	}
+	dictionary_->AttachParent(this);
 	dictionary_->SetInteger("Length", (int32_t)size);
 }
 
 PdfStream::PdfStream(IRead* iread, size_t offset, size_t size, const PdfDictionaryPointer & dictionary,
                      uint32_t object_number, uint32_t genarate_number, PdfCrypto * crypto, Allocator * allocator)
-    : PdfObject(OBJ_TYPE_STREAM, allocator), crypto_(crypto), b_memory_stream(false), iread_(nullptr), size_(size),
+    : PdfObject(OBJ_TYPE_STREAM, allocator), crypto_(crypto), b_shared_dictionary_(false), b_memory_stream(false), iread_(iread), size_(size),
     file_offset_(offset), object_number_(object_number), generate_number_(genarate_number)
 {
 	if (dictionary)
@@ -1274,18 +2364,24 @@ PdfStream::PdfStream(IRead* iread, size_t offset, size_t size, const PdfDictiona
 	}else{
 		dictionary_ = PdfDictionary::Create(GetAllocator());
 	}
+	dictionary_->AttachParent(this);
 	dictionary_->SetInteger("Length", (uint32_t)size);
 }
 
 PdfStream::PdfStream(uint32_t object_number, uint32_t generate_number, PdfCrypto * crypto, Allocator * allocator)
-    : PdfObject(OBJ_TYPE_STREAM, allocator), crypto_(crypto), b_memory_stream(true), data_(nullptr), size_(0),
+    : PdfObject(OBJ_TYPE_STREAM, allocator), crypto_(crypto), b_shared_dictionary_(false), b_memory_stream(true), data_(nullptr), size_(0),
     file_offset_(0), object_number_(object_number), generate_number_(generate_number)
 {
 	dictionary_ = PdfDictionary::Create(GetAllocator());
+	dictionary_->AttachParent(this);
 }
 
 PdfStream::~PdfStream()
 {
+	if (dictionary_)
+	{
+		dictionary_->DetachParent(this);
+	}
  	if (b_memory_stream == true && data_)
  	{
 		GetAllocator()->DeleteArray<uint8_t>(data_);
@@ -1294,36 +2390,85 @@ PdfStream::~PdfStream()
 
 PdfStreamPointer PdfStream::Clone()
 {
-	PdfStreamPointer stream;
-	PdfDictionaryPointer dictionary;
-	if (dictionary_)
+	PdfStreamPointer stream = PdfStream::Create(object_number_, generate_number_, crypto_, GetAllocator());
+	if (!stream)
 	{
-		dictionary = dictionary_->Clone();
+		return stream;
 	}
+	//file data is shared through the reader, memory data is copied
+	stream->b_memory_stream = b_memory_stream;
 	if (b_memory_stream)
 	{
-		uint8_t * data = GetAllocator()->NewArray<uint8_t>(size_);
-		stream = PdfStream::Create(data, size_, dictionary, object_number_, generate_number_, crypto_, GetAllocator());
-	}else
+		if (data_ && size_ > 0)
+		{
+			stream->data_ = GetAllocator()->NewArray<uint8_t>(size_);
+			memcpy(stream->data_, data_, size_);
+		}
+	}else{
+		stream->iread_ = iread_;
+		stream->file_offset_ = file_offset_;
+	}
+	stream->size_ = size_;
+	if (dictionary_)
 	{
-		stream = PdfStream::Create(iread_, file_offset_, size_, dictionary, object_number_, generate_number_, crypto_, GetAllocator());
+		if (!b_shared_dictionary_ && (size_t)dictionary_->referenceCount_ > 1)
+		{
+			//held outside the stream too, a pointer taken earlier keeps writing to this side only
+			stream->SetDictionary(dictionary_->Clone());
+		}else{
+			stream->SetDictionary(dictionary_);
+			stream->b_shared_dictionary_ = true;
+			b_shared_dictionary_ = true;
+		}
 	}
 	return stream;
 }
 
-bool PdfStream::IsModified()
+PdfDictionaryPointer PdfStream::GetDictionary() const
+{
+	return dictionary_;
+}
+
+PdfDictionaryPointer PdfStream::GetDictionary()
 {
-	if (b_modified_ || dictionary_->IsModified())
+	if (b_shared_dictionary_)
 	{
-		b_modified_ = true;
-		return true;
+		//the caller may change the dictionary, so it can't stay shared with a clone
+		UnshareDictionary();
 	}
-	return false;
+	return dictionary_;
+}
+
+void PdfStream::UnshareDictionary()
+{
+	b_shared_dictionary_ = false;
+	if (!dictionary_ || (size_t)dictionary_->referenceCount_ <= 1)
+	{
+		return;
+	}
+	PdfDictionaryPointer dictionary = dictionary_->Clone();
+	if (!dictionary)
+	{
+		return;
+	}
+	dictionary->b_modified_ = dictionary_->b_modified_;
+	dictionary_->DetachParent(this);
+	dictionary_ = dictionary;
+	dictionary_->AttachParent(this);
 }
 
 void PdfStream::SetDictionary(const PdfDictionaryPointer & dictionary)
 {
+	if (dictionary_)
+	{
+		dictionary_->DetachParent(this);
+	}
 	dictionary_ = dictionary;
+	b_shared_dictionary_ = false;
+	if (dictionary_)
+	{
+		dictionary_->AttachParent(this);
+	}
 	SetModified(true);
 }
 
@@ -1348,15 +2493,21 @@ bool PdfStream::SetRawData(uint8_t * data, size_t size, uint8_t filter/* = STREA
 	if (!dictionary_)
 	{
 		dictionary_ = PdfDictionary::Create(GetAllocator());
+		dictionary_->AttachParent(this);
+	}
+	if (b_shared_dictionary_)
+	{
+		UnshareDictionary();
 	}
 	switch (filter)
 	{
 	case STREAM_FILTER_NULL:
 		{
-			data_ = GetAllocator()->NewArray<uint8_t>(size);
+			//room for the AES IV and padding, so the data is encrypted in place below
+			data_ = GetAllocator()->NewArray<uint8_t>(crypto_ ? size + 32 : size);
 			memcpy(data_, data, size);
 			size_ = size;
-            dictionary_->Remove("Filter");
+            dictionary_->Remove(NAME_Filter);
 			break;
 		}
 	case STREAM_FILTER_HEX:
@@ -1433,42 +2584,87 @@ bool PdfStream::SetRawData(uint8_t * data, size_t size, uint8_t filter/* = STREA
 		break;
 	}
 	
-	dictionary_->SetInteger("Length", (uint32_t)size_);
-	if (crypto_ && crypto_->IsPasswordOK())
+	if (crypto_ && crypto_->IsPasswordOK() && data_)
 	{
-		crypto_->Decrypt(data_, (uint32_t)size_, GetObjectNumber(), GetGenerateNumber());
+		//kept encrypted like the data read from the file, GetRawData decrypts it again
+		if (GetAllocator()->GetSize(data_) < size_ + 32)
+		{
+			uint8_t * buffer = GetAllocator()->NewArray<uint8_t>(size_ + 32);
+			memcpy(buffer, data_, size_);
+			GetAllocator()->DeleteArray<uint8_t>(data_);
+			data_ = buffer;
+		}
+		size_ = crypto_->Encrypt(data_, (uint32_t)size_, GetObjectNumber(), GetGenerateNumber());
 	}
+	dictionary_->SetObject(NAME_Length, PdfNumber::Create((int32_t)size_, GetAllocator()));
 	SetModified(true);
 	return true;
 }
 
+size_t PdfStream::ReadRawData(size_t offset, uint8_t * buffer, size_t buffer_size) const
+{
+	if (offset >= size_)
+	{
+		return 0;
+	}
+	if (buffer_size > size_ - offset)
+	{
+		buffer_size = size_ - offset;
+	}
+	if (b_memory_stream)
+	{
+		if (data_ == nullptr)
+		{
+			return 0;
+		}
+		memcpy(buffer, data_ + offset, buffer_size);
+		return buffer_size;
+	}
+	if (iread_ == nullptr)
+	{
+		return 0;
+	}
+	return iread_->ReadBlock(buffer, offset + file_offset_, buffer_size);
+}
+
 size_t PdfStream::GetRawData(size_t offset, uint8_t * buffer, size_t buffer_size) const
 {
 	if (buffer == nullptr || buffer_size == 0 || offset >= size_)
  	{
  		return 0;
  	}
-    size_t size_return = 0;
-	if (b_memory_stream == false)
+	if (crypto_ == nullptr || !crypto_->IsPasswordOK())
+	{
+		return ReadRawData(offset, buffer, buffer_size);
+	}
+
+	//offset is in plain text, the context maps it back into the encrypted data
+	PdfDecryptContext context(crypto_, object_number_, generate_number_, GetAllocator());
+	size_t source_offset = context.Seek(offset);
+	size_t size_return = 0;
+	uint8_t source[4096];
+	uint8_t plain[4096 + 16];
+	bool b_final = false;
+	while (size_return < buffer_size && !b_final)
 	{
-		size_return = iread_->ReadBlock(buffer, offset + file_offset_, buffer_size);
-		if (crypto_ && crypto_->IsPasswordOK())
+		uint32_t plain_length = 0;
+		size_t length = ReadRawData(source_offset, source, sizeof(source));
+		if (length > 0)
 		{
-			crypto_->Decrypt(buffer, (uint32_t)buffer_size, GetObjectNumber(), GetGenerateNumber());
+			source_offset += length;
+			plain_length = context.Update(source, (uint32_t)length, plain);
+		}else{
+			plain_length = context.Final(plain);
+			b_final = true;
 		}
-		return size_return;
-	}else{
-		if (offset + buffer_size > size_)
- 		{
-			size_return = size_ - offset;
- 		}
-		memcpy(buffer, data_ + offset, size_return);
-		if (crypto_ && crypto_->IsPasswordOK())
-		{
-			crypto_->Decrypt(buffer, (uint32_t)buffer_size, GetObjectNumber(), GetGenerateNumber());
+		if (plain_length > buffer_size - size_return)
+		{
+			plain_length = (uint32_t)(buffer_size - size_return);
 		}
- 		return size_return;
+		memcpy(buffer + size_return, plain, plain_length);
+		size_return += plain_length;
 	}
+	return size_return;
 }
 
 PdfStreamAccess::PdfStreamAccess(Allocator * allocator) : BaseObject(allocator), data_(nullptr), size_(0) {}
@@ -1501,13 +2697,12 @@ bool PdfStreamAccess::Attach(const PdfStreamPointer & stream, PDF_STREAM_DECODE_
 	{
 		uint32_t filter_count = 0;
 		size_t size = stream->GetRawSize();
-		PdfObjectPointer filter = dictionary->GetElement("Filter");
-		PdfObjectPointer params = dictionary->GetElement("DecodeParms");
+		PdfObjectPointer filter = dictionary->GetElement(NAME_Filter);
+		PdfObjectPointer params = dictionary->GetElement(NAME_DecodeParms);
 		if (!filter)
 		{
-			size_ = size;
-			data_ = GetAllocator()->NewArray<uint8_t>(size_);
-			stream->GetRawData(0, data_, size_);
+			data_ = GetAllocator()->NewArray<uint8_t>(size);
+			size_ = stream->GetRawData(0, data_, size);
 			return true;
 		}
 		if (filter->GetType() == OBJ_TYPE_ARRAY)
@@ -1541,125 +2736,164 @@ bool PdfStreamAccess::Attach(const PdfStreamPointer & stream, PDF_STREAM_DECODE_
 		}else if (params && params->GetType() == OBJ_TYPE_ARRAY)
 		{
 			uint32_t param_count = params->GetPdfArray()->GetSize();
+			if (param_count > filter_count)
+			{
+				param_count = filter_count;
+			}
 			for (uint32_t index = 0; index < param_count; ++index)
 			{
 				param_dictionary_array[index] = params->GetPdfArray()->GetElement(index)->GetPdfDictionary();
 			}
 		}
 
-		/*size_t bufSize = (size == 0) ? 1024 : size;
-		ByteString str(GetAllocator());
-		CDynBuffer buffer( bufSize * 2, bufSize, GetAllocator() );
-		size_t lSize = stmPointer->GetRawSize();
-		PBYTE pTmp = nullptr;
-		pTmp = GetAllocator()->NewArray<BYTE>( lSize );
-		stmPointer->GetRawData( 0, pTmp, lSize );
-		
-		for ( size_t i = 0; i < lFilterCount; i++ )
-		{
-			if ( mode == STREAM_DECODE_NOTLASTFILTER )
+		Buffer buffer((size == 0) ? 1024 : size * 2, (size == 0) ? 1024 : size, GetAllocator());
+		uint8_t * data = GetAllocator()->NewArray<uint8_t>(size + 1);
+		size = stream->GetRawData(0, data, size);
+		for (uint32_t index = 0; index < filter_count; ++index)
+		{
+			if (mode == STREAM_DECODE_NOTLASTFILTER && index + 1 == filter_count)
+			{
+				break;
+			}
+			uint32_t name = filter_name_array[index] ? filter_name_array[index]->GetAtom() : (uint32_t)NAME_ATOM_NONE;
+			if (name != NAME_ATOM_NONE && name >= NAME_ATOM_PREDEFINED_COUNT)
 			{
-				if ( i + 1 == lFilterCount )
+				//abbreviations of inline images, some writers use them for streams as well
+				ByteString abbreviation = PdfNameTable::GetName(name);
+				if (abbreviation == "AHx")
 				{
-					break;
+					name = NAME_ASCIIHexDecode;
+				}else if (abbreviation == "A85")
+				{
+					name = NAME_ASCII85Decode;
+				}else if (abbreviation == "LZW")
+				{
+					name = NAME_LZWDecode;
+				}else if (abbreviation == "Fl")
+				{
+					name = NAME_FlateDecode;
+				}else if (abbreviation == "RL")
+				{
+					name = NAME_RunLengthDecode;
+				}else if (abbreviation == "CCF")
+				{
+					name = NAME_CCITTFaxDecode;
+				}else if (abbreviation == "DCT")
+				{
+					name = NAME_DCTDecode;
 				}
 			}
-
-			str = pFilterNameArr[i]->GetNamePointer()->GetString();
-			if ( str == "ASCIIHexDecode" || str == "AHx" )
+			buffer.Clear();
+			switch (name)
 			{
-				CPDF_HexFilter filter( GetAllocator() );
-				filter.Decode( pTmp, lSize, buffer );
-			}else if ( str == "ASCII85Decode" || str == "A85" )
-			{
-				CPDF_ASCII85Filter filter( GetAllocator() );
-				filter.Decode( pTmp, lSize, buffer );
-			}else if ( str == "LZWDecode" || str == "LZW" )
-			{
-				PdfDictionaryPointer pDecodeParams = pParamDictArr[i];
-				if ( ! pDecodeParams )
+			case NAME_ASCIIHexDecode:
 				{
-					CPDF_LZWFilter filter( GetAllocator() );
-					filter.Decode( pTmp, lSize, buffer );
-				}else{
-					CPDF_Predictor pPredictor( pDecodeParams, GetAllocator() );
-					CPDF_LZWFilter filter( GetAllocator() );
-					filter.Decode( pTmp, lSize, buffer );
-					lSize = buffer.GetSize();
-					GetAllocator()->DeleteArray<BYTE>( pTmp );
-					pTmp = GetAllocator()->NewArray<BYTE>( lSize );
-					buffer.Read( pTmp, lSize );
-					buffer.Clear();
-					pPredictor.Decode( pTmp, lSize, buffer );
+					PdfHexFilter filter(GetAllocator());
+					filter.Decode(data, size, buffer);
+					break;
 				}
-			}else if ( str == "FlateDecode" || str == "Fl" )
-			{
-				PdfDictionaryPointer pDecodeParams = pParamDictArr[i];
-				if ( !pDecodeParams )
+			case NAME_ASCII85Decode:
 				{
-					CPDF_FlateFilter filter( GetAllocator() );
-					filter.Decode( pTmp, lSize, buffer );
-				}else{
-					CPDF_Predictor pPredictor( pDecodeParams, GetAllocator() );
-					CPDF_FlateFilter filter( GetAllocator() );
-					filter.Decode( pTmp, lSize, buffer );
-					lSize = buffer.GetSize();
-					GetAllocator()->DeleteArray<BYTE>( pTmp );
-					pTmp = GetAllocator()->NewArray<BYTE>( lSize );
-					buffer.Read( pTmp, lSize );
-					buffer.Clear();
-					pPredictor.Decode( pTmp, lSize, buffer );
+					PdfASCII85Filter filter(GetAllocator());
+					filter.Decode(data, size, buffer);
+					break;
 				}
-			}else if ( str == "RunLengthDecode" || str == "RL" )
-			{
-				CPDF_RLEFileter filter( GetAllocator() );
-				filter.Decode( pTmp, lSize, buffer );
-			}else if ( str == "CCITTFaxDecode" || str == "CCF" )
-			{
-				PdfDictionaryPointer pDecodeParams = pParamDictArr[i];
-				CPDF_FaxDecodeParams params( pDecodeParams );
-				CPDF_FaxFilter filter( &params, GetAllocator() );
-				filter.Decode( pTmp, lSize, buffer );
-			}else if ( str == "JBIG2Decode" )
-			{
-				CPDF_JBig2Filter filter( GetAllocator() );
-				filter.Decode( pTmp, lSize, buffer );
-			}else if ( str == "DCTDecode" || str == "DCT" )
-			{
-				CPDF_DCTDFilter filter( GetAllocator() );
-				filter.Decode( pTmp, lSize, buffer );
-			}else if ( str == "JPXDecode" )
-			{
-                CPDF_JPXFilter fileter( GetAllocator() );
-                fileter.Decode( pTmp, lSize, buffer );
-			}else if ( str == "Crypt" )
-			{
-				retValue = false;
+			case NAME_RunLengthDecode:
+				{
+					PdfRLEFileter filter(GetAllocator());
+					filter.Decode(data, size, buffer);
+					break;
+				}
+			case NAME_LZWDecode:
+			case NAME_FlateDecode:
+				{
+					if (name == NAME_LZWDecode)
+					{
+						PdfLZWFilter filter(GetAllocator());
+						filter.Decode(data, size, buffer);
+					}else{
+						PdfFlateFilter filter(GetAllocator());
+						filter.Decode(data, size, buffer);
+					}
+					PdfObjectPointer predictor;
+					if (param_dictionary_array[index])
+					{
+						predictor = param_dictionary_array[index]->GetElement(NAME_Predictor, OBJ_TYPE_NUMBER);
+					}
+					if (predictor && predictor->GetPdfNumber()->GetInteger() > 1)
+					{
+						GetAllocator()->DeleteArray<uint8_t>(data);
+						size = buffer.GetSize();
+						data = GetAllocator()->NewArray<uint8_t>(size + 1);
+						buffer.Read(data, size);
+						buffer.Clear();
+						PdfFilterPredictor filter(param_dictionary_array[index], GetAllocator());
+						filter.Decode(data, size, buffer);
+					}
+					break;
+				}
+			case NAME_CCITTFaxDecode:
+				{
+					PdfFaxDecodeParams params(param_dictionary_array[index]);
+					PdfFaxFilter filter(&params, GetAllocator());
+					filter.Decode(data, size, buffer);
+					break;
+				}
+			case NAME_JBIG2Decode:
+				{
+					PdfStreamAccess globals(GetAllocator());
+					PdfJBig2Filter filter(GetAllocator());
+					if (param_dictionary_array[index])
+					{
+						PdfObjectPointer object = param_dictionary_array[index]->GetElement(NAME_JBIG2Globals, OBJ_TYPE_STREAM);
+						if (object && globals.Attach(object->GetPdfStream()))
+						{
+							filter.SetGlobals(globals.GetData(), globals.GetSize());
+						}
+					}
+					filter.Decode(data, size, buffer);
+					break;
+				}
+			case NAME_DCTDecode:
+				{
+					PdfDCTDFilter filter(GetAllocator());
+					filter.Decode(data, size, buffer);
+					break;
+				}
+			case NAME_JPXDecode:
+				{
+					PdfJPXFilter filter(GetAllocator());
+					filter.Decode(data, size, buffer);
+					break;
+				}
+			default:
+				//Crypt and unknown filters
+				result = false;
+				break;
 			}
-
-			if ( retValue == false )
+			if (!result)
 			{
-				GetAllocator()->DeleteArray<BYTE>( pTmp );
-				GetAllocator()->DeleteArray<PdfNamePointer>( pFilterNameArr );
-				GetAllocator()->DeleteArray<PdfDictionaryPointer>( pParamDictArr );
-				return false;
-			}else{
-				lSize = buffer.GetSize();
-				GetAllocator()->DeleteArray<BYTE>( pTmp );
-				pTmp = GetAllocator()->NewArray<BYTE>( lSize );
-				buffer.Read( pTmp, lSize );
+				break;
 			}
-		}
-        m_pDataBuf = pTmp;
-        m_dwSize = lSize;
-        */
+			GetAllocator()->DeleteArray<uint8_t>(data);
+			size = buffer.GetSize();
+			data = GetAllocator()->NewArray<uint8_t>(size + 1);
+			buffer.Read(data, size);
+		}
+		if (result)
+		{
+			data_ = data;
+			size_ = size;
+		}else{
+			GetAllocator()->DeleteArray<uint8_t>(data);
+		}
 		GetAllocator()->DeleteArray<PdfNamePointer>(filter_name_array);
 		GetAllocator()->DeleteArray<PdfDictionaryPointer>(param_dictionary_array);
         return result;
 	}else{
-		size_ = stream_->GetRawSize();
-		data_ = GetAllocator()->NewArray<uint8_t>(size_);
-		stream_->GetRawData(0, data_, size_);
+		size_t size = stream_->GetRawSize();
+		data_ = GetAllocator()->NewArray<uint8_t>(size);
+		size_ = stream_->GetRawData(0, data_, size);
 		return true;
 	}
 	return false;
@@ -0,0 +1,1071 @@
+#include "../include/che_pdf_parser.h"
+#include "../include/che_pdf_crypto.h"
+
+#ifdef _CHE_SSE2_
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace chepdf {
+
+#define PDF_CHAR_WHITE_SPACE	0x01
+#define PDF_CHAR_DELIMITER		0x02
+#define PDF_CHAR_NUMBER			0x04
+#define PDF_CHAR_HEX			0x08
+
+//character classes of PDF 32000-1 7.2.2, digits, signs and '.' start a number
+static const uint8_t gPdfCharClass[256] =
+{
+	/*0x00*/ 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x01, 0x00, 0x01, 0x01, 0x00, 0x00,
+	/*0x10*/ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	/*0x20*/ 0x01, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x02, 0x02, 0x00, 0x04, 0x00, 0x04, 0x04, 0x02,
+	/*0x30*/ 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x00, 0x00, 0x02, 0x00, 0x02, 0x00,
+	/*0x40*/ 0x00, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	/*0x50*/ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x02, 0x00, 0x00,
+	/*0x60*/ 0x00, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	/*0x70*/ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x02, 0x00, 0x00,
+	/*0x80*/ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	/*0x90*/ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	/*0xA0*/ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	/*0xB0*/ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	/*0xC0*/ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	/*0xD0*/ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	/*0xE0*/ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	/*0xF0*/ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static inline bool is_white_space(uint8_t ch)
+{
+	return (gPdfCharClass[ch] & PDF_CHAR_WHITE_SPACE) != 0;
+}
+
+static inline bool is_regular(uint8_t ch)
+{
+	return (gPdfCharClass[ch] & (PDF_CHAR_WHITE_SPACE | PDF_CHAR_DELIMITER)) == 0;
+}
+
+static inline uint8_t hex_value(uint8_t ch)
+{
+	return (ch & 0x0F) + (ch >> 6) * 9;
+}
+
+#ifdef _CHE_SSE2_
+static inline uint32_t lowest_bit(uint32_t mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+#endif
+
+//first byte at or after p that is not white space
+static inline const uint8_t * skip_white_space(const uint8_t * p, const uint8_t * end)
+{
+	while (p < end && is_white_space(*p))
+	{
+		++p;
+#ifdef _CHE_SSE2_
+		//a single separator is the common case, longer runs such as indentation go 16 bytes at a time
+		if (end - p >= 16 && is_white_space(*p))
+		{
+			const __m128i space = _mm_set1_epi8(0x20);
+			const __m128i tab = _mm_set1_epi8(0x09);
+			const __m128i lf = _mm_set1_epi8(0x0A);
+			const __m128i ff = _mm_set1_epi8(0x0C);
+			const __m128i cr = _mm_set1_epi8(0x0D);
+			const __m128i zero = _mm_setzero_si128();
+			do
+			{
+				__m128i v = _mm_loadu_si128((const __m128i *)p);
+				__m128i white = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, lf)),
+				                             _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, tab)));
+				white = _mm_or_si128(white, _mm_or_si128(_mm_cmpeq_epi8(v, ff), _mm_cmpeq_epi8(v, zero)));
+				uint32_t mask = ~(uint32_t)_mm_movemask_epi8(white) & 0xFFFF;
+				if (mask)
+				{
+					return p + lowest_bit(mask);
+				}
+				p += 16;
+			} while (end - p >= 16);
+		}
+#endif
+	}
+	return p;
+}
+
+//the line end closing a comment, or end
+static inline const uint8_t * find_line_end(const uint8_t * p, const uint8_t * end)
+{
+#ifdef _CHE_SSE2_
+	const __m128i lf = _mm_set1_epi8(0x0A);
+	const __m128i cr = _mm_set1_epi8(0x0D);
+	while (end - p >= 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)));
+		if (mask)
+		{
+			return p + lowest_bit(mask);
+		}
+		p += 16;
+	}
+#endif
+	while (p < end && *p != 0x0A && *p != 0x0D)
+	{
+		++p;
+	}
+	return p;
+}
+
+//the ')' closing a literal string whose content starts at p, or end. bEscaped is set when the
+//content holds escapes or carriage returns, which the parser then has to rewrite.
+static inline const uint8_t * find_string_end(const uint8_t * p, const uint8_t * end, bool & bEscaped)
+{
+	uint32_t depth = 1;
+#ifdef _CHE_SSE2_
+	const __m128i open = _mm_set1_epi8('(');
+	const __m128i close = _mm_set1_epi8(')');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i cr = _mm_set1_epi8(0x0D);
+#endif
+	while (p < end)
+	{
+#ifdef _CHE_SSE2_
+		while (end - p >= 16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i *)p);
+			__m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, open), _mm_cmpeq_epi8(v, close)),
+			                               _mm_or_si128(_mm_cmpeq_epi8(v, backslash), _mm_cmpeq_epi8(v, cr)));
+			uint32_t mask = (uint32_t)_mm_movemask_epi8(special);
+			if (mask)
+			{
+				p += lowest_bit(mask);
+				break;
+			}
+			p += 16;
+		}
+		if (p >= end)
+		{
+			break;
+		}
+#endif
+		switch (*p)
+		{
+		case '\\':
+			bEscaped = true;
+			if (++p == end)
+			{
+				return end;
+			}
+			break;
+		case 0x0D:
+			bEscaped = true;
+			break;
+		case '(':
+			depth++;
+			break;
+		case ')':
+			if (--depth == 0)
+			{
+				return p;
+			}
+			break;
+		default:
+			break;
+		}
+		++p;
+	}
+	return end;
+}
+
+PdfLexer::PdfLexer(IRead * iread, Allocator * allocator/*= nullptr*/)
+	: BaseObject(allocator), iread_(iread), size_(0), position_(0), data_(nullptr), data_offset_(0),
+	data_size_(0), window_(nullptr), window_capacity_(0)
+{
+	if (iread_ != nullptr)
+	{
+		size_ = iread_->GetSize();
+		data_ = iread_->GetData();
+		if (data_ != nullptr)
+		{
+			data_size_ = size_;
+		}
+	}
+}
+
+PdfLexer::~PdfLexer()
+{
+	if (window_)
+	{
+		GetAllocator()->Free(window_);
+		window_ = nullptr;
+	}
+}
+
+bool PdfLexer::Fill(size_t offset, size_t size)
+{
+	if (offset >= size_)
+	{
+		return false;
+	}
+	if (size > size_ - offset)
+	{
+		size = size_ - offset;
+	}
+	if (offset >= data_offset_ && offset + size <= data_offset_ + data_size_)
+	{
+		return true;
+	}
+	if (data_ != nullptr && window_ == nullptr)
+	{
+		return false;
+	}
+	//read whole windows, so the following tokens are usually there already
+	if (size < PDF_LEXER_WINDOW_SIZE)
+	{
+		size = (size_ - offset < PDF_LEXER_WINDOW_SIZE) ? size_ - offset : PDF_LEXER_WINDOW_SIZE;
+	}
+	//bytes from offset that are in the window already move to the front
+	size_t keep = 0;
+	if (offset >= data_offset_ && offset < data_offset_ + data_size_)
+	{
+		keep = data_offset_ + data_size_ - offset;
+	}
+	if (size > window_capacity_)
+	{
+		uint8_t * window = (uint8_t *)GetAllocator()->Alloc(size);
+		if (window == nullptr)
+		{
+			return false;
+		}
+		if (keep)
+		{
+			memcpy(window, window_ + (offset - data_offset_), keep);
+		}
+		if (window_)
+		{
+			GetAllocator()->Free(window_);
+		}
+		window_ = window;
+		window_capacity_ = size;
+	}else if (keep)
+	{
+		memmove(window_, window_ + (offset - data_offset_), keep);
+	}
+	size_t read = iread_->ReadBlock(window_ + keep, offset + keep, size - keep);
+	data_ = window_;
+	data_offset_ = offset;
+	data_size_ = keep + read;
+	if (keep + read < size)
+	{
+		//a short read ends the data, so the scan never waits for bytes that will not come
+		size_ = offset + keep + read;
+	}
+	return data_size_ != 0;
+}
+
+const uint8_t * PdfLexer::GetSpan(size_t offset, size_t & size)
+{
+	if (!Fill(offset, size))
+	{
+		size = 0;
+		return nullptr;
+	}
+	size_t available = data_offset_ + data_size_ - offset;
+	if (size > available)
+	{
+		size = available;
+	}
+	return data_ + (offset - data_offset_);
+}
+
+bool PdfLexer::SkipWhiteSpace()
+{
+	//a comment cut by the end of the window goes on in the next one
+	bool bComment = false;
+	while (Fill(position_, 1))
+	{
+		const uint8_t * p = data_ + (position_ - data_offset_);
+		const uint8_t * end = data_ + data_size_;
+		if (bComment)
+		{
+			p = find_line_end(p, end);
+			bComment = (p == end);
+		}
+		p = skip_white_space(p, end);
+		if (p < end && *p == '%')
+		{
+			p = find_line_end(p, end);
+			bComment = (p == end);
+		}else if (p < end)
+		{
+			position_ = data_offset_ + (p - data_);
+			return true;
+		}
+		position_ = data_offset_ + (p - data_);
+	}
+	position_ = size_;
+	return false;
+}
+
+bool PdfLexer::NextToken(PdfToken & token)
+{
+	token.type = TOKEN_TYPE_END;
+	token.b_escaped = false;
+	token.length = 0;
+	token.data = nullptr;
+	token.integer = 0;
+	token.number = 0;
+	if (!SkipWhiteSpace())
+	{
+		token.offset = size_;
+		return false;
+	}
+	size_t need = 0;
+	while (true)
+	{
+		if (need != 0 && !Fill(position_, need))
+		{
+			return false;
+		}
+		const uint8_t * p = data_ + (position_ - data_offset_);
+		const uint8_t * end = data_ + data_size_;
+		//a token running into the end of the window is read again from a larger window
+		bool bLast = (data_offset_ + data_size_ >= size_);
+		const uint8_t * next = nullptr;
+		token.offset = position_;
+		token.data = p;
+		token.b_escaped = false;
+		switch (*p)
+		{
+		case '(':
+			next = find_string_end(p + 1, end, token.b_escaped);
+			if (next < end)
+			{
+				token.type = TOKEN_TYPE_STRING;
+				token.data = p + 1;
+				token.length = (uint32_t)(next - p - 1);
+				next++;
+			}else if (bLast)
+			{
+				token.type = TOKEN_TYPE_STRING;
+				token.data = p + 1;
+				token.length = (uint32_t)(end - p - 1);
+			}else{
+				next = nullptr;
+			}
+			break;
+		case '<':
+			if (p + 1 < end && p[1] == '<')
+			{
+				token.type = TOKEN_TYPE_DICTIONARY_BEGIN;
+				token.length = 2;
+				next = p + 2;
+			}else if (p + 1 < end || bLast)
+			{
+				next = (const uint8_t *)memchr(p + 1, '>', end - p - 1);
+				if (next != nullptr)
+				{
+					token.type = TOKEN_TYPE_HEX_STRING;
+					token.data = p + 1;
+					token.length = (uint32_t)(next - p - 1);
+					next++;
+				}else if (bLast)
+				{
+					token.type = TOKEN_TYPE_HEX_STRING;
+					token.data = p + 1;
+					token.length = (uint32_t)(end - p - 1);
+					next = end;
+				}
+			}
+			break;
+		case '>':
+			if (p + 1 < end && p[1] == '>')
+			{
+				token.type = TOKEN_TYPE_DICTIONARY_END;
+				token.length = 2;
+				next = p + 2;
+			}else if (p + 1 < end || bLast)
+			{
+				token.type = TOKEN_TYPE_INVALID;
+				token.length = 1;
+				next = p + 1;
+			}
+			break;
+		case '[':
+			token.type = TOKEN_TYPE_ARRAY_BEGIN;
+			token.length = 1;
+			next = p + 1;
+			break;
+		case ']':
+			token.type = TOKEN_TYPE_ARRAY_END;
+			token.length = 1;
+			next = p + 1;
+			break;
+		case '/':
+			next = p + 1;
+			while (next < end && is_regular(*next))
+			{
+				if (*next == '#')
+				{
+					token.b_escaped = true;
+				}
+				++next;
+			}
+			if (next < end || bLast)
+			{
+				token.type = TOKEN_TYPE_NAME;
+				token.data = p + 1;
+				token.length = (uint32_t)(next - p - 1);
+			}else{
+				next = nullptr;
+			}
+			break;
+		default:
+			if (!is_regular(*p))
+			{
+				//')', '{' and '}' have no meaning outside strings and PostScript functions
+				token.type = TOKEN_TYPE_INVALID;
+				token.length = 1;
+				next = p + 1;
+				break;
+			}
+			next = p + 1;
+			while (next < end && is_regular(*next))
+			{
+				++next;
+			}
+			if (next == end && !bLast)
+			{
+				next = nullptr;
+				break;
+			}
+			token.length = (uint32_t)(next - p);
+			token.type = TOKEN_TYPE_KEYWORD;
+			if (gPdfCharClass[*p] & PDF_CHAR_NUMBER)
+			{
+				bool bInteger = false;
+				ParsePdfNumber((const char *)p, token.length, token.integer, token.number, bInteger);
+				token.type = bInteger ? TOKEN_TYPE_INTEGER : TOKEN_TYPE_FLOAT;
+			}
+			break;
+		}
+		if (next != nullptr)
+		{
+			position_ = data_offset_ + (next - data_);
+			return true;
+		}
+		need = (data_offset_ + data_size_ - position_) * 2;
+	}
+	return false;
+}
+
+bool PdfLexer::Find(const char * pattern, uint32_t length, size_t limit, size_t & offsetRet)
+{
+	if (pattern == nullptr || length == 0)
+	{
+		return false;
+	}
+	if (limit > size_)
+	{
+		limit = size_;
+	}
+	size_t offset = position_;
+	while (offset + length <= limit)
+	{
+		//data read through the window is searched a window at a time
+		size_t size = limit - offset;
+		if (window_ != nullptr || data_ == nullptr)
+		{
+			size_t capacity = (window_capacity_ > PDF_LEXER_WINDOW_SIZE) ? window_capacity_ : PDF_LEXER_WINDOW_SIZE;
+			if (capacity < (size_t)length * 2)
+			{
+				capacity = (size_t)length * 2;
+			}
+			if (size > capacity)
+			{
+				size = capacity;
+			}
+		}
+		const uint8_t * p = GetSpan(offset, size);
+		if (p == nullptr || size < length)
+		{
+			break;
+		}
+		const uint8_t * last = p + size - length;
+		while (p <= last)
+		{
+			p = (const uint8_t *)memchr(p, pattern[0], last - p + 1);
+			if (p == nullptr)
+			{
+				break;
+			}
+			if (memcmp(p, pattern, length) == 0)
+			{
+				offsetRet = data_offset_ + (p - data_);
+				return true;
+			}
+			++p;
+		}
+		//the next span starts early enough to hold a match cut by this one
+		offset += size - length + 1;
+	}
+	return false;
+}
+
+
+PdfParser::PdfParser(IRead * iread, PdfFile * file/*= nullptr*/, Allocator * allocator/*= nullptr*/)
+	: BaseObject(allocator), lexer_(iread, GetAllocator()), file_(file), crypto_(nullptr), b_crypt_(false),
+	object_number_(0), generate_number_(0), pending_count_(0) {}
+
+bool PdfParser::NextToken(PdfToken & token)
+{
+	if (pending_count_ != 0)
+	{
+		token = pending_[0];
+		pending_[0] = pending_[1];
+		pending_count_--;
+		return true;
+	}
+	return lexer_.NextToken(token);
+}
+
+void PdfParser::PushBack(const PdfToken & token)
+{
+	//integers carry their value, other tokens point into the window and are read again
+	if (token.type == TOKEN_TYPE_INTEGER && pending_count_ < 2)
+	{
+		pending_[1] = pending_[0];
+		pending_[0] = token;
+		pending_count_++;
+	}else{
+		pending_count_ = 0;
+		lexer_.SetPosition(token.offset);
+	}
+}
+
+uint32_t PdfParser::ParseName(const PdfToken & token)
+{
+	if (!token.b_escaped)
+	{
+		return PdfNameTable::GetAtom((const char *)token.data, token.length);
+	}
+	char buffer[256];
+	char * name = buffer;
+	if (token.length > sizeof(buffer))
+	{
+		name = (char *)GetAllocator()->Alloc(token.length);
+		if (name == nullptr)
+		{
+			return NAME_ATOM_NONE;
+		}
+	}
+	uint32_t length = 0;
+	for (uint32_t i = 0; i < token.length; i++)
+	{
+		uint8_t ch = token.data[i];
+		if (ch == '#' && i + 2 < token.length &&
+		    (gPdfCharClass[token.data[i + 1]] & PDF_CHAR_HEX) && (gPdfCharClass[token.data[i + 2]] & PDF_CHAR_HEX))
+		{
+			ch = (hex_value(token.data[i + 1]) << 4) | hex_value(token.data[i + 2]);
+			i += 2;
+		}
+		name[length++] = (char)ch;
+	}
+	uint32_t atom = PdfNameTable::GetAtom(name, length);
+	if (name != buffer)
+	{
+		GetAllocator()->Free(name);
+	}
+	return atom;
+}
+
+PdfStringPointer PdfParser::ParseString(const PdfToken & token)
+{
+	ByteString str(GetAllocator());
+	if (token.length != 0)
+	{
+		const uint8_t * p = token.data;
+		const uint8_t * end = token.data + token.length;
+		uint32_t length = 0;
+		if (token.type == TOKEN_TYPE_HEX_STRING)
+		{
+			uint8_t * dst = str.GetBuffer(token.length / 2 + 1);
+			uint8_t high = 0;
+			bool bHigh = false;
+			for (; p < end; ++p)
+			{
+				if ((gPdfCharClass[*p] & PDF_CHAR_HEX) == 0)
+				{
+					continue;
+				}
+				if (bHigh)
+				{
+					dst[length++] = (high << 4) | hex_value(*p);
+				}else{
+					high = hex_value(*p);
+				}
+				bHigh = !bHigh;
+			}
+			//a missing last digit is 0
+			if (bHigh)
+			{
+				dst[length++] = high << 4;
+			}
+		}else if (!token.b_escaped)
+		{
+			uint8_t * dst = str.GetBuffer(token.length);
+			memcpy(dst, p, token.length);
+			length = token.length;
+		}else{
+			uint8_t * dst = str.GetBuffer(token.length);
+			while (p < end)
+			{
+				uint8_t ch = *p++;
+				if (ch == 0x0D)
+				{
+					//end of line markers read as a single line feed
+					if (p < end && *p == 0x0A)
+					{
+						++p;
+					}
+					ch = 0x0A;
+				}else if (ch == '\\')
+				{
+					if (p == end)
+					{
+						break;
+					}
+					ch = *p++;
+					switch (ch)
+					{
+					case 'n': ch = 0x0A; break;
+					case 'r': ch = 0x0D; break;
+					case 't': ch = 0x09; break;
+					case 'b': ch = 0x08; break;
+					case 'f': ch = 0x0C; break;
+					case 0x0D:
+						//a backslash before a line end continues the string on the next line
+						if (p < end && *p == 0x0A)
+						{
+							++p;
+						}
+						continue;
+					case 0x0A:
+						continue;
+					default:
+						if (ch >= '0' && ch <= '7')
+						{
+							uint32_t value = ch - '0';
+							for (uint32_t i = 0; i < 2 && p < end && *p >= '0' && *p <= '7'; i++)
+							{
+								value = (value << 3) | (*p++ - '0');
+							}
+							ch = (uint8_t)value;
+						}
+						//other escaped characters stand for themselves
+						break;
+					}
+				}
+				dst[length++] = ch;
+			}
+		}
+		str.ReleaseBuffer(length);
+	}
+	if (b_crypt_ && crypto_ != nullptr && str.GetLength() != 0)
+	{
+		crypto_->Decrypt(str, object_number_, generate_number_);
+	}
+	return PdfString::Create(str, GetAllocator());
+}
+
+bool PdfParser::ParseValue(PdfToken & token, PdfValue & valueRet, uint32_t depth)
+{
+	switch (token.type)
+	{
+	case TOKEN_TYPE_INTEGER:
+		//"n g R" is a reference, everything read ahead otherwise goes back
+		if (token.integer >= 0)
+		{
+			PdfToken generate;
+			if (NextToken(generate))
+			{
+				if (generate.type == TOKEN_TYPE_INTEGER && generate.integer >= 0 && generate.integer <= 0xFFFF)
+				{
+					PdfToken keyword;
+					if (NextToken(keyword))
+					{
+						if (keyword.IsKeyword("R", 1))
+						{
+							valueRet = PdfValue::Reference(token.integer, generate.integer, file_);
+							return true;
+						}
+						PushBack(keyword);
+					}
+				}
+				PushBack(generate);
+			}
+		}
+		valueRet = PdfValue::Integer(token.integer);
+		return true;
+	case TOKEN_TYPE_FLOAT:
+		valueRet = PdfValue::Float(token.number);
+		return true;
+	case TOKEN_TYPE_STRING:
+	case TOKEN_TYPE_HEX_STRING:
+		valueRet = PdfValue(ParseString(token));
+		return true;
+	case TOKEN_TYPE_NAME:
+		{
+			uint32_t atom = ParseName(token);
+			if (atom == NAME_ATOM_NONE)
+			{
+				return false;
+			}
+			valueRet = PdfValue::Name(atom);
+			PdfNameTable::Release(atom);
+			return true;
+		}
+	case TOKEN_TYPE_ARRAY_BEGIN:
+		return ParseArray(valueRet, depth + 1);
+	case TOKEN_TYPE_DICTIONARY_BEGIN:
+		return ParseDictionary(valueRet, depth + 1);
+	case TOKEN_TYPE_KEYWORD:
+		if (token.IsKeyword("true", 4))
+		{
+			valueRet = PdfValue::Boolean(true);
+			return true;
+		}
+		if (token.IsKeyword("false", 5))
+		{
+			valueRet = PdfValue::Boolean(false);
+			return true;
+		}
+		if (token.IsKeyword("null", 4))
+		{
+			valueRet = PdfValue::Null();
+			return true;
+		}
+		return false;
+	default:
+		return false;
+	}
+}
+
+bool PdfParser::ParseArray(PdfValue & valueRet, uint32_t depth)
+{
+	if (depth > PDF_PARSER_MAX_DEPTH)
+	{
+		return false;
+	}
+	PdfArrayPointer array = PdfArray::Create(GetAllocator());
+	PdfToken token;
+	PdfValue value;
+	while (NextToken(token))
+	{
+		if (token.type == TOKEN_TYPE_ARRAY_END)
+		{
+			break;
+		}
+		if (ParseValue(token, value, depth))
+		{
+			if (!array->AppendValue(value))
+			{
+				return false;
+			}
+			continue;
+		}
+		//a name fails only when it can't be interned
+		if (token.type == TOKEN_TYPE_ARRAY_BEGIN || token.type == TOKEN_TYPE_DICTIONARY_BEGIN || token.type == TOKEN_TYPE_NAME)
+		{
+			return false;
+		}
+		//a keyword or '>>' means the ']' is missing, the array ends before it
+		if (token.type == TOKEN_TYPE_KEYWORD || token.type == TOKEN_TYPE_DICTIONARY_END)
+		{
+			PushBack(token);
+			break;
+		}
+	}
+	valueRet = PdfValue(std::move(array));
+	return true;
+}
+
+bool PdfParser::ParseDictionary(PdfValue & valueRet, uint32_t depth)
+{
+	if (depth > PDF_PARSER_MAX_DEPTH)
+	{
+		return false;
+	}
+	PdfDictionaryPointer dictionary = PdfDictionary::Create(GetAllocator());
+	PdfToken token;
+	PdfValue value;
+	while (NextToken(token))
+	{
+		if (token.type == TOKEN_TYPE_DICTIONARY_END)
+		{
+			break;
+		}
+		if (token.type == TOKEN_TYPE_NAME)
+		{
+			uint32_t atom = ParseName(token);
+			if (atom == NAME_ATOM_NONE)
+			{
+				return false;
+			}
+			if (!NextToken(token))
+			{
+				PdfNameTable::Release(atom);
+				break;
+			}
+			if (ParseValue(token, value, depth))
+			{
+				//a null value is the same as no entry
+				bool bSet = value.GetType() == OBJ_TYPE_NULL || dictionary->SetValue(atom, value);
+				PdfNameTable::Release(atom);
+				if (!bSet)
+				{
+					return false;
+				}
+				continue;
+			}
+			PdfNameTable::Release(atom);
+			if (token.type == TOKEN_TYPE_ARRAY_BEGIN || token.type == TOKEN_TYPE_DICTIONARY_BEGIN || token.type == TOKEN_TYPE_NAME)
+			{
+				return false;
+			}
+			//the key has no value, what follows is read again
+			PushBack(token);
+			if (token.type != TOKEN_TYPE_KEYWORD)
+			{
+				continue;
+			}
+			break;
+		}
+		if (token.type == TOKEN_TYPE_KEYWORD)
+		{
+			PushBack(token);
+			break;
+		}
+		//values without a key are dropped
+		if (token.type == TOKEN_TYPE_ARRAY_BEGIN || token.type == TOKEN_TYPE_DICTIONARY_BEGIN)
+		{
+			if (!ParseValue(token, value, depth))
+			{
+				return false;
+			}
+		}
+	}
+	valueRet = PdfValue(std::move(dictionary));
+	return true;
+}
+
+bool PdfParser::GetValue(PdfValue & valueRet)
+{
+	PdfToken token;
+	bool bRet = false;
+	pending_count_ = 0;
+	if (lexer_.NextToken(token))
+	{
+		bRet = ParseValue(token, valueRet, 0);
+		if (!bRet)
+		{
+			pending_count_ = 0;
+			lexer_.SetPosition(token.offset);
+		}
+	}
+	//integers read ahead are left in the data, so the position is right for the caller
+	if (pending_count_ != 0)
+	{
+		lexer_.SetPosition(pending_[0].offset);
+		pending_count_ = 0;
+	}
+	if (bRet && !valueRet.IsInline())
+	{
+		valueRet.GetObject()->SetModified(false);
+	}
+	return bRet;
+}
+
+PdfObjectPointer PdfParser::GetObject()
+{
+	PdfValue value;
+	if (!GetValue(value))
+	{
+		return PdfObjectPointer();
+	}
+	return value.GetObject(GetAllocator());
+}
+
+bool PdfParser::GetStreamSize(const PdfDictionaryPointer & dictionary, size_t offset, size_t & sizeRet)
+{
+	PdfValue length = dictionary->GetValue(NAME_Length);
+	int64_t size = -1;
+	if (length.GetType() == OBJ_TYPE_NUMBER)
+	{
+		size = length.GetInteger();
+	}else if (length.GetType() == OBJ_TYPE_REFERENCE && file_ != nullptr)
+	{
+		//the file may parse the length with this parser, so the state is put back afterwards
+		bool bCrypt = b_crypt_;
+		uint32_t objNum = object_number_;
+		uint32_t genNum = generate_number_;
+		PdfObjectPointer object = length.GetObject(GetAllocator());
+		object = object->GetPdfReference()->GetPdfObject(OBJ_TYPE_NUMBER);
+		b_crypt_ = bCrypt;
+		object_number_ = objNum;
+		generate_number_ = genNum;
+		pending_count_ = 0;
+		if (object)
+		{
+			size = object->GetPdfNumber()->GetInteger();
+		}
+	}
+	//a length is only trusted when endstream follows it
+	if (size >= 0 && (size_t)size <= lexer_.GetSize() - offset)
+	{
+		lexer_.SetPosition(offset + (size_t)size);
+		if (lexer_.SkipWhiteSpace())
+		{
+			size_t span = 9;
+			const uint8_t * p = lexer_.GetSpan(lexer_.GetPosition(), span);
+			if (span == 9 && memcmp(p, "endstream", 9) == 0)
+			{
+				sizeRet = (size_t)size;
+				return true;
+			}
+		}
+	}
+	size_t end = 0;
+	lexer_.SetPosition(offset);
+	if (!lexer_.Find("endstream", 9, lexer_.GetSize(), end))
+	{
+		return false;
+	}
+	//the line end before endstream is not data
+	size_t span = 2;
+	if (end - offset >= 2)
+	{
+		const uint8_t * p = lexer_.GetSpan(end - 2, span);
+		if (span == 2)
+		{
+			if (p[0] == 0x0D && p[1] == 0x0A)
+			{
+				end -= 2;
+			}else if (p[1] == 0x0A || p[1] == 0x0D)
+			{
+				end -= 1;
+			}
+		}
+	}else if (end - offset == 1)
+	{
+		span = 1;
+		const uint8_t * p = lexer_.GetSpan(end - 1, span);
+		if (span == 1 && (p[0] == 0x0A || p[0] == 0x0D))
+		{
+			end -= 1;
+		}
+	}
+	sizeRet = end - offset;
+	return true;
+}
+
+PdfObjectPointer PdfParser::GetIndirectObject(size_t offset, uint32_t & objNumRet, uint32_t & genNumRet)
+{
+	PdfObjectPointer object;
+	PdfToken token;
+	pending_count_ = 0;
+	lexer_.SetPosition(offset);
+	if (!lexer_.NextToken(token) || token.type != TOKEN_TYPE_INTEGER || token.integer < 0)
+	{
+		return object;
+	}
+	uint32_t objNum = (uint32_t)token.integer;
+	if (!lexer_.NextToken(token) || token.type != TOKEN_TYPE_INTEGER || token.integer < 0 || token.integer > 0xFFFF)
+	{
+		return object;
+	}
+	uint32_t genNum = (uint32_t)token.integer;
+	if (!lexer_.NextToken(token) || !token.IsKeyword("obj", 3))
+	{
+		return object;
+	}
+	objNumRet = objNum;
+	genNumRet = genNum;
+
+	size_t valueOffset = lexer_.GetPosition();
+	b_crypt_ = (crypto_ != nullptr);
+	object_number_ = objNum;
+	generate_number_ = genNum;
+	PdfValue value;
+	if (!GetValue(value))
+	{
+		b_crypt_ = false;
+		return object;
+	}
+	if (value.GetType() == OBJ_TYPE_DICTIONARY)
+	{
+		PdfDictionaryPointer dictionary = value.GetObject()->GetPdfDictionary();
+		//cross-reference streams are never encrypted, strings in their dictionary neither
+		bool bXRef = (dictionary->GetValue(NAME_Type).GetNameAtom() == NAME_XRef);
+		if (bXRef && b_crypt_)
+		{
+			b_crypt_ = false;
+			lexer_.SetPosition(valueOffset);
+			if (GetValue(value) && value.GetType() == OBJ_TYPE_DICTIONARY)
+			{
+				dictionary = value.GetObject()->GetPdfDictionary();
+			}
+		}
+		size_t position = lexer_.GetPosition();
+		if (lexer_.NextToken(token) && token.IsKeyword("stream", 6))
+		{
+			//the keyword ends with CR LF or LF, a lone CR is taken as well
+			size_t dataOffset = lexer_.GetPosition();
+			size_t span = 2;
+			const uint8_t * p = lexer_.GetSpan(dataOffset, span);
+			if (span == 2 && p[0] == 0x0D && p[1] == 0x0A)
+			{
+				dataOffset += 2;
+			}else if (span >= 1 && (p[0] == 0x0A || p[0] == 0x0D))
+			{
+				dataOffset += 1;
+			}
+			size_t size = 0;
+			if (GetStreamSize(dictionary, dataOffset, size))
+			{
+				PdfStreamPointer stream = PdfStream::Create(lexer_.GetIRead(), dataOffset, size, dictionary, objNum, genNum,
+				                                            bXRef ? nullptr : crypto_, GetAllocator());
+				lexer_.SetPosition(dataOffset + size);
+				if (lexer_.NextToken(token) && !token.IsKeyword("endstream", 9))
+				{
+					lexer_.SetPosition(token.offset);
+				}
+				stream->SetModified(false);
+				object = stream;
+			}else{
+				lexer_.SetPosition(position);
+			}
+		}else{
+			lexer_.SetPosition(position);
+		}
+	}
+	if (!object)
+	{
+		object = value.GetObject(GetAllocator());
+	}
+	if (lexer_.NextToken(token) && !token.IsKeyword("endobj", 6))
+	{
+		lexer_.SetPosition(token.offset);
+	}
+	b_crypt_ = false;
+	return object;
+}
+
+}//namespace